@@ -0,0 +1,187 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _BENCH_CHANNEL_TABLE_CPP
+#include "../network/network.hpp"
+#include <sys/resource.h>
+using namespace net;
+
+// Logging is stubbed out so that both registries pay for building their log
+// strings but not for the file I/O behind them.
+namespace
+{
+    size_t logged_bytes = 0;
+}
+
+void log_write_error_information(const string &err) { logged_bytes += err.size(); }
+void log_write_error_information(string &&err) { logged_bytes += err.size(); }
+void log_write_regular_information(const string &info) { logged_bytes += info.size(); }
+void log_write_regular_information(string &&info) { logged_bytes += info.size(); }
+void log_write_warning_information(const string &info) { logged_bytes += info.size(); }
+void log_write_warning_information(string &&info) { logged_bytes += info.size(); }
+void logging::write(LogLevel, string &&message) { logged_bytes += message.size(); }
+void logging::write_record(string_view record) { logged_bytes += record.size(); }
+uint32_t logging::register_site(LogLevel, const char *, const char *, int) { return 0; }
+logging::Stats logging::stats() { return {}; }
+
+namespace
+{
+    class LegacyEpollRegistry
+    {
+    public:
+        LegacyEpollRegistry() : epoll_fd_{::epoll_create1(EPOLL_CLOEXEC)} {}
+
+        void update_channel(Channel *channel)
+        {
+            const int fd = channel->fd();
+            log_write_regular_information("update_channel fd = " + to_string(fd) + " events = " + to_string(channel->events()));
+
+            struct epoll_event ev{};
+            ev.events = channel->events() | (channel->is_edge_triggered() ? EPOLLET : 0u);
+            ev.data.ptr = channel;
+
+            if (channels_.count(fd))
+            {
+                if (channel->is_none_event())
+                {
+                    if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
+                        log_write_error_information("epoll_ctl op=DEL fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
+                }
+                else
+                {
+                    if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_MOD, fd, &ev) == -1)
+                        log_write_error_information("epoll_ctl op=MOD fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
+                    log_write_regular_information("MOD fd = " + to_string(fd) + " events = " + to_string(channel->events()));
+                }
+            }
+            else
+            {
+                channels_[fd] = channel;
+                if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &ev) == -1)
+                {
+                    log_write_error_information("epoll_ctl op=ADD fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
+                    channels_.erase(fd);
+                }
+                else
+                    log_write_regular_information("ADD fd = " + to_string(fd) + " events = " + to_string(channel->events()));
+            }
+        }
+
+        void remove_channel(Channel *channel)
+        {
+            int fd = channel->fd();
+            log_write_regular_information("remove_channel fd = " + to_string(fd));
+            channels_.erase(fd);
+            if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
+                if (errno != ENOENT)
+                    log_write_error_information("epoll_ctl op=DEL fd=" + to_string(fd) + " failed during remove_channel: " + errno_to_string(errno));
+        }
+
+        bool has_channel(Channel *channel)
+        {
+            auto it = channels_.find(channel->fd());
+            return it != channels_.end() and it->second == channel;
+        }
+
+    private:
+        Socket epoll_fd_;
+        unordered_map<int, Channel *> channels_;
+    };
+
+    double nanoseconds_per_op(chrono::steady_clock::time_point start, size_t ops)
+    {
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / static_cast<double>(ops);
+    }
+
+    template <typename Registry>
+    void run(const char *name, Registry &registry, vector<unique_ptr<Channel>> &channels, size_t rounds)
+    {
+        auto start = chrono::steady_clock::now();
+        for (unique_ptr<Channel> &channel : channels)
+        {
+            channel->set_events(EPOLLIN | EPOLLPRI);
+            registry.update_channel(channel.get());
+        }
+        double add_ns = nanoseconds_per_op(start, channels.size());
+
+        start = chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; ++round)
+            for (unique_ptr<Channel> &channel : channels)
+            {
+                channel->set_events(EPOLLIN | EPOLLPRI | EPOLLOUT);
+                registry.update_channel(channel.get());
+                channel->set_events(EPOLLIN | EPOLLPRI);
+                registry.update_channel(channel.get());
+            }
+        double mod_ns = nanoseconds_per_op(start, rounds * channels.size() * 2);
+
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds * 16; ++round)
+            for (unique_ptr<Channel> &channel : channels)
+                found += registry.has_channel(channel.get());
+        double lookup_ns = nanoseconds_per_op(start, rounds * 16 * channels.size());
+
+        start = chrono::steady_clock::now();
+        for (unique_ptr<Channel> &channel : channels)
+        {
+            channel->set_events(0);
+            registry.remove_channel(channel.get());
+        }
+        double remove_ns = nanoseconds_per_op(start, channels.size());
+
+        printf("%-22s add %8.1f ns  mod %8.1f ns  has_channel %6.1f ns  remove %8.1f ns  (found %zu)\n",
+               name, add_ns, mod_ns, lookup_ns, remove_ns, found);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_fds = argc > 1 ? stoul(argv[1]) : 10000;
+    size_t rounds = argc > 2 ? stoul(argv[2]) : 20;
+
+    struct rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 and limit.rlim_cur < num_fds + 64)
+    {
+        limit.rlim_cur = min<rlim_t>(limit.rlim_max, num_fds + 64);
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    EventLoop loop;
+    vector<Socket> fds;
+    vector<unique_ptr<Channel>> channels;
+    for (size_t i = 0; i < num_fds; ++i)
+    {
+        int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1)
+        {
+            fprintf(stderr, "eventfd failed after %zu descriptors: %s\n", i, strerror(errno));
+            break;
+        }
+        fds.emplace_back(fd);
+        channels.push_back(make_unique<Channel>(&loop, fd));
+    }
+
+    printf("%zu channels, %zu modify rounds\n", channels.size(), rounds);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        LegacyEpollRegistry legacy;
+        run("unordered_map (before)", legacy, channels, rounds);
+        EpollPoller poller(&loop);
+        run("flat table (after)", poller, channels, rounds);
+    }
+    return logged_bytes == 0;
+}
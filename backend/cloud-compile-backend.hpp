@@ -19,6 +19,7 @@
 
 #include <iostream>
 #include <list>
+#include <unordered_set>
 #include <fstream>
 #include <filesystem>
 #include <sys/wait.h>
@@ -30,6 +31,7 @@ using namespace std;
 
 string compile_files(const vector<string> &instructions);
 tuple<bool, string, string> execute_executable(const vector<string> &command_line, const string &input_filename);
+size_t kill_child_processes(int signo);
 
 void make_sure_log_file(void) throws(runtime_error);
 void close_log_file(void) throws(runtime_error);
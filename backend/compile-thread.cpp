@@ -17,6 +17,62 @@
 #define _COMPILE_THREAD_CPP
 #include "cloud-compile-backend.hpp"
 
+namespace
+{
+    const MetricsRegistry::Id compile_seconds = MetricsRegistry::histogram("simplek_compile_duration_seconds", "Wall time of compiler invocations.");
+    const MetricsRegistry::Id compile_failures = MetricsRegistry::counter("simplek_compile_failures_total", "Compiler invocations that failed to run or exited non-zero.");
+    const MetricsRegistry::Id exec_seconds = MetricsRegistry::histogram("simplek_exec_duration_seconds", "Wall time of user program executions.");
+    const MetricsRegistry::Id exec_failures = MetricsRegistry::counter("simplek_exec_failures_total", "User programs that failed to start or did not exit with status 0.");
+
+    mutex children_mutex;
+    unordered_set<pid_t> children;
+
+    // Each child leads its own process group, so signalling the group also reaches whatever
+    // the compiler spawns. The parent calls setpgid() too, closing the race with exec.
+    class ChildRegistration
+    {
+    public:
+        explicit ChildRegistration(pid_t pid) : pid_{pid}
+        {
+            ::setpgid(pid_, pid_);
+            lock_guard lk{children_mutex};
+            children.insert(pid_);
+        }
+        ~ChildRegistration()
+        {
+            lock_guard lk{children_mutex};
+            children.erase(pid_);
+        }
+
+        ChildRegistration(const ChildRegistration &) = delete;
+        ChildRegistration &operator=(const ChildRegistration &) = delete;
+
+    private:
+        pid_t pid_;
+    };
+
+    // Runs in the forked child, so only async-signal-safe calls. The mask is inherited across
+    // exec and the server blocks the signals it reads from a signalfd.
+    void prepare_child_process()
+    {
+        ::setpgid(0, 0);
+        sigset_t none;
+        sigemptyset(&none);
+        ::sigprocmask(SIG_SETMASK, &none, nullptr);
+    }
+}
+
+size_t kill_child_processes(int signo)
+{
+    lock_guard lk{children_mutex};
+    for (pid_t pid : children)
+        if (::kill(-pid, signo) == -1 and errno != ESRCH)
+            SK_LOG_ERROR("Failed to send signal {} to process group {}: {}", signo, pid, strerror(errno));
+    if (!children.empty())
+        SK_LOG_WARNING("Sent signal {} to {} child process group(s).", signo, children.size());
+    return children.size();
+}
+
 class FdGuard
 {
     int fd_ = -1;
@@ -27,7 +83,7 @@ public:
     {
         if (fd_ != -1)
             if (close(fd_) == -1)
-                log_write_error_information("Failed to close fd " + to_string(fd_) + ": " + strerror(errno));
+                SK_LOG_ERROR("Failed to close fd {}: {}", fd_, strerror(errno));
     }
 
     FdGuard(FdGuard &&other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
@@ -38,7 +94,7 @@ public:
         {
             if (fd_ != -1)
                 if (close(fd_) == -1)
-                    log_write_error_information("Failed to close fd " + to_string(fd_) + " in move assignment: " + strerror(errno));
+                    SK_LOG_ERROR("Failed to close fd {} in move assignment: {}", fd_, strerror(errno));
             fd_ = other.fd_;
             other.fd_ = -1;
         }
@@ -54,7 +110,7 @@ public:
     {
         if (fd_ != -1)
             if (close(fd_) == -1)
-                log_write_error_information("Failed to close fd " + to_string(fd_) + " in reset: " + strerror(errno));
+                SK_LOG_ERROR("Failed to close fd {} in reset: {}", fd_, strerror(errno));
         fd_ = fd;
     }
 
@@ -68,9 +124,11 @@ public:
 
 string compile_files(const vector<string> &instructions)
 {
+    MetricsRegistry::ScopedTimer timer(compile_seconds);
     if (instructions.empty())
     {
-        log_write_error_information("compile_files received empty instruction list.");
+        MetricsRegistry::add(compile_failures);
+        SK_LOG_ERROR("compile_files received empty instruction list.");
         return "Error: Empty instruction list provided.";
     }
 
@@ -81,15 +139,17 @@ string compile_files(const vector<string> &instructions)
         {
             if (pipe(stderr_pipe_fds) < 0)
             {
+                MetricsRegistry::add(compile_failures);
                 string error_msg = "Failed to create pipe: " + string(strerror(errno));
-                log_write_error_information(error_msg);
+                SK_LOG_ERROR("{}", error_msg);
                 return "Error: " + error_msg;
             }
             if (fcntl(stderr_pipe_fds[0], F_SETFD, FD_CLOEXEC) == -1 ||
                 fcntl(stderr_pipe_fds[1], F_SETFD, FD_CLOEXEC) == -1)
             {
+                MetricsRegistry::add(compile_failures);
                 string error_msg = "Failed to set FD_CLOEXEC on pipe: " + string(strerror(errno));
-                log_write_error_information(error_msg);
+                SK_LOG_ERROR("{}", error_msg);
                 close(stderr_pipe_fds[0]);
                 close(stderr_pipe_fds[1]);
                 return "Error: " + error_msg;
@@ -97,8 +157,9 @@ string compile_files(const vector<string> &instructions)
         }
         else
         {
+            MetricsRegistry::add(compile_failures);
             string error_msg = "Failed to create pipe with pipe2: " + string(strerror(errno));
-            log_write_error_information(error_msg);
+            SK_LOG_ERROR("{}", error_msg);
             return "Error: " + error_msg;
         }
     }
@@ -110,6 +171,7 @@ string compile_files(const vector<string> &instructions)
 
     if (pid == 0)
     {
+        prepare_child_process();
         pipe_read_end.reset();
 
         if (dup2(pipe_write_end.get(), STDERR_FILENO) < 0)
@@ -126,6 +188,7 @@ string compile_files(const vector<string> &instructions)
     }
     else if (pid > 0)
     {
+        ChildRegistration registration(pid);
         pipe_write_end.reset();
 
         stringstream error_output_stream;
@@ -139,20 +202,21 @@ string compile_files(const vector<string> &instructions)
         }
 
         if (bytes_read < 0)
-            log_write_error_information("Error reading from pipe: " + string(strerror(errno)));
+            SK_LOG_ERROR("Error reading from pipe: {}", strerror(errno));
 
         string error_output = error_output_stream.str();
         if (!error_output.empty())
         {
             // replace(error_output.begin(), error_output.end(), '\n', ' ');
-            log_write_warning_information("Compiler stderr output captured");
+            SK_LOG_WARNING("Compiler stderr output captured");
         }
 
         int child_status;
         if (waitpid(pid, &child_status, 0) == -1)
         {
+            MetricsRegistry::add(compile_failures);
             string error_msg = "waitpid failed for PID " + to_string(pid) + ": " + string(strerror(errno));
-            log_write_error_information(error_msg);
+            SK_LOG_ERROR("{}", error_msg);
             return "Error: " + error_msg + "\n" + error_output;
         }
 
@@ -161,12 +225,13 @@ string compile_files(const vector<string> &instructions)
             int exit_code = WEXITSTATUS(child_status);
             if (exit_code == 0)
             {
-                log_write_regular_information("Compilation successful for PID " + to_string(pid));
+                SK_LOG_INFO("Compilation successful for PID {}", pid);
                 return error_output;
             }
             else
             {
-                log_write_warning_information("Compilation failed or child exec failed (PID " + to_string(pid) + ") with exit code: " + to_string(exit_code));
+                MetricsRegistry::add(compile_failures);
+                SK_LOG_WARNING("Compilation failed or child exec failed (PID {}) with exit code: {}", pid, exit_code);
                 return error_output;
             }
         }
@@ -174,43 +239,51 @@ string compile_files(const vector<string> &instructions)
         {
             int term_signal = WTERMSIG(child_status);
             string signal_str = strsignal(term_signal) ? strsignal(term_signal) : "Unknown signal";
-            log_write_error_information("Compiler process (PID " + to_string(pid) + ") terminated by signal: " + to_string(term_signal) + " (" + signal_str + ")");
+            MetricsRegistry::add(compile_failures);
+            SK_LOG_ERROR("Compiler process (PID {}) terminated by signal: {} ({})", pid, term_signal, signal_str);
             return error_output + "\nError: Process terminated by signal " + to_string(term_signal);
         }
         else
         {
-            log_write_error_information("Compiler process (PID " + to_string(pid) + ") terminated abnormally.");
+            MetricsRegistry::add(compile_failures);
+            SK_LOG_ERROR("Compiler process (PID {}) terminated abnormally.", pid);
             return error_output + "\nError: Process terminated abnormally.";
         }
     }
     else
     {
+        MetricsRegistry::add(compile_failures);
         string error_msg = "Failed to fork process: " + string(strerror(errno));
-        log_write_error_information(error_msg);
+        SK_LOG_ERROR("{}", error_msg);
         return "Error: " + error_msg;
     }
 }
 
 tuple<bool, string, string> execute_executable(const vector<string> &command_line, const string &input_filename)
 {
+    MetricsRegistry::ScopedTimer timer(exec_seconds);
     string out_filename = "";
     string err_filename = "";
 
     if (command_line.empty())
     {
-        log_write_error_information("execute_executable received empty command line: even no executable given");
+        MetricsRegistry::add(exec_failures);
+        SK_LOG_ERROR("execute_executable received empty command line: even no executable given");
         return {true, "execute_executable received empty command line: even no executable given", ""};
     }
 
+    static atomic<unsigned long> execution_seq{0};
+
     auto now = chrono::system_clock::now();
     auto now_c = chrono::system_clock::to_time_t(now);
     long timestamp = static_cast<long>(now_c);
+    unsigned long seq = execution_seq.fetch_add(1, memory_order_relaxed);
 
     char out_filename_buf[FILENAME_BUFFER_SIZE];
     char err_filename_buf[FILENAME_BUFFER_SIZE];
 
-    snprintf(out_filename_buf, FILENAME_BUFFER_SIZE, "%s/%ld.output", OUT_DIRECTORY, timestamp);
-    snprintf(err_filename_buf, FILENAME_BUFFER_SIZE, "%s/%ld.err", OUT_DIRECTORY, timestamp);
+    snprintf(out_filename_buf, FILENAME_BUFFER_SIZE, "%s/%ld-%lu.output", OUT_DIRECTORY, timestamp, seq);
+    snprintf(err_filename_buf, FILENAME_BUFFER_SIZE, "%s/%ld-%lu.err", OUT_DIRECTORY, timestamp, seq);
 
     out_filename = out_filename_buf;
     err_filename = err_filename_buf;
@@ -224,8 +297,9 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
         int in_fd = open(input_filename.c_str(), O_RDONLY | O_CLOEXEC);
         if (in_fd < 0)
         {
+            MetricsRegistry::add(exec_failures);
             string error_info = "Failed to open input file '" + input_filename + "': " + strerror(errno);
-            log_write_error_information(error_info);
+            SK_LOG_ERROR("{}", error_info);
             return {true, move(error_info), ""};
         }
         input_fd_guard.reset(in_fd);
@@ -234,8 +308,9 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
     int out_fd = open(out_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
     if (out_fd < 0)
     {
+        MetricsRegistry::add(exec_failures);
         string error_info = "Failed to open output file '" + out_filename + "': " + strerror(errno);
-        log_write_error_information(error_info);
+        SK_LOG_ERROR("{}", error_info);
         return {true, move(error_info), ""};
     }
     output_fd_guard.reset(out_fd);
@@ -243,8 +318,9 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
     int err_fd = open(err_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
     if (err_fd < 0)
     {
+        MetricsRegistry::add(exec_failures);
         string error_info = "Failed to open error file '" + err_filename + "': " + strerror(errno);
-        log_write_error_information(error_info);
+        SK_LOG_ERROR("{}", error_info);
         return {true, move(error_info), ""};
     }
     error_fd_guard.reset(err_fd);
@@ -253,6 +329,7 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
 
     if (pid == 0)
     {
+        prepare_child_process();
         if (input_fd_guard.get() != -1)
         {
             if (dup2(input_fd_guard.get(), STDIN_FILENO) < 0)
@@ -278,11 +355,13 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
     }
     else if (pid > 0)
     {
+        ChildRegistration registration(pid);
         int child_status;
         if (waitpid(pid, &child_status, 0) == -1)
         {
+            MetricsRegistry::add(exec_failures);
             string errno_information = string(strerror(errno));
-            log_write_error_information("waitpid failed for PID " + to_string(pid) + ": " + errno_information);
+            SK_LOG_ERROR("waitpid failed for PID {}: {}", pid, errno_information);
             if (out_filename.length() or err_filename.length())
                 return {true,
                         "waitpid failed for PID " + to_string(pid) + ": " + errno_information + "\nfile(s) created:" + out_filename + ',' + err_filename,
@@ -295,25 +374,33 @@ tuple<bool, string, string> execute_executable(const vector<string> &command_lin
         {
             int exit_code = WEXITSTATUS(child_status);
             if (exit_code == 0)
-                log_write_regular_information("Executable process (PID " + to_string(pid) + ") completed successfully.");
+                SK_LOG_INFO("Executable process (PID {}) completed successfully.", pid);
             else
-                log_write_error_information("Executable process (PID " + to_string(pid) + ") failed with exit code: " + to_string(exit_code));
+            {
+                MetricsRegistry::add(exec_failures);
+                SK_LOG_ERROR("Executable process (PID {}) failed with exit code: {}", pid, exit_code);
+            }
         }
         else if (WIFSIGNALED(child_status))
         {
+            MetricsRegistry::add(exec_failures);
             int term_signal = WTERMSIG(child_status);
             string signal_str = strsignal(term_signal) ? strsignal(term_signal) : "Unknown signal";
-            log_write_error_information("Executable process (PID " + to_string(pid) + ") terminated by signal: " + to_string(term_signal) + " (" + signal_str + ")");
+            SK_LOG_ERROR("Executable process (PID {}) terminated by signal: {} ({})", pid, term_signal, signal_str);
         }
         else
-            log_write_error_information("Executable process (PID " + to_string(pid) + ") terminated abnormally.");
+        {
+            MetricsRegistry::add(exec_failures);
+            SK_LOG_ERROR("Executable process (PID {}) terminated abnormally.", pid);
+        }
 
         return {false, out_filename, err_filename};
     }
     else
     {
+        MetricsRegistry::add(exec_failures);
         string info = "Failed to fork process: " + string(strerror(errno));
-        log_write_error_information(info);
+        SK_LOG_ERROR("{}", info);
         return {true, move(info), ""};
     }
 }
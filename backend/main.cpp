@@ -18,348 +18,391 @@
 #include "cloud-compile-backend.hpp"
 using namespace net;
 
-static string readFileContentToString(const filesystem::path &filePath)
+struct CompileUpload
 {
-    ifstream file_stream(filePath, ios::binary);
-    if (!file_stream.is_open())
-    {
-        string error_msg = "Error: Could not open file for reading: " + filePath.string();
-        log_write_error_information("readFileContentToString: " + error_msg);
-        return error_msg;
-    }
-
-    file_stream.unsetf(ios::skipws);
-
-    file_stream.seekg(0, ios::end);
-    streampos file_size_pos = file_stream.tellg();
-    file_stream.seekg(0, ios::beg);
+    string original_filename;
+    string source_stem;
+    filesystem::path source_filepath;
+    filesystem::path out_dir_path;
+    ofstream source_file;
+    string error;
+};
+
+static constexpr size_t kMaxUploadFilenameLength = 4096;
+static constexpr chrono::seconds kDefaultDrainGrace{30};
+static constexpr chrono::seconds kWorkerShutdownTimeout{10};
+
+static void open_compile_upload(CompileUpload &upload)
+{
+    const string SRC_DIR_STR = "src";
+    const string OUT_DIR_STR = OUT_DIRECTORY;
 
-    if (file_size_pos == static_cast<streampos>(-1) || file_size_pos < 0)
+    if (upload.original_filename.empty())
     {
-        string error_msg = "Error: Could not determine size of file (or file is invalid): " + filePath.string();
-        log_write_error_information("readFileContentToString: " + error_msg);
-        return error_msg;
-    }
-
-    string content;
-    if (file_size_pos > 0)
-    {
-        try
-        {
-            content.reserve(static_cast<string::size_type>(file_size_pos));
-        }
-        catch (const length_error &le)
-        {
-            string error_msg = "Error: File too large to reserve memory for reading: " + filePath.string() + " (" + le.what() + ")";
-            log_write_error_information("readFileContentToString: " + error_msg);
-            return error_msg;
-        }
+        upload.error = "Invalid payload: Original filename is empty.";
+        return;
     }
 
     try
     {
-        content.assign((istreambuf_iterator<char>(file_stream)),
-                       istreambuf_iterator<char>());
+        filesystem::path original_fs_path(upload.original_filename);
+        string original_basename = original_fs_path.stem().string();
+        string original_extension = original_fs_path.extension().string();
+
+        static atomic<unsigned long> request_seq{0};
+        auto now_timepoint = chrono::system_clock::now();
+        auto now_epoch_ms = chrono::duration_cast<chrono::milliseconds>(now_timepoint.time_since_epoch()).count();
+        string timestamp_str = to_string(now_epoch_ms) + "-" + to_string(request_seq.fetch_add(1, memory_order_relaxed));
+
+        upload.source_stem = original_basename + "-" + timestamp_str;
+        string new_source_filename = upload.source_stem + original_extension;
+
+        filesystem::path src_dir_path(SRC_DIR_STR);
+        upload.out_dir_path = OUT_DIR_STR;
+
+        if (!filesystem::exists(src_dir_path))
+            filesystem::create_directories(src_dir_path);
+        if (!filesystem::exists(upload.out_dir_path))
+            filesystem::create_directories(upload.out_dir_path);
+
+        upload.source_filepath = src_dir_path / new_source_filename;
+        upload.source_file.open(upload.source_filepath, ios::binary | ios::trunc);
+        if (!upload.source_file.is_open())
+            upload.error = "Failed to create/open source file for writing: " + upload.source_filepath.string();
     }
-    catch (const exception &e)
+    catch (const filesystem::filesystem_error &e)
     {
-        string error_msg = "Error: Exception during assigning file content to string for file: " + filePath.string() + " (" + e.what() + ")";
-        log_write_error_information("readFileContentToString: " + error_msg);
-        return error_msg;
+        upload.error = "Filesystem error in compile-execute handler: " + string(e.what());
     }
+}
 
-    if (file_stream.bad())
+static void discard_compile_upload(CompileUpload &upload)
+{
+    if (upload.source_file.is_open())
+        upload.source_file.close();
+    if (!upload.source_filepath.empty())
     {
-        string error_msg = "Error: Failed while reading file content (badbit set) from: " + filePath.string();
-        log_write_error_information("readFileContentToString: " + error_msg);
-        return error_msg;
+        error_code ec;
+        filesystem::remove(upload.source_filepath, ec);
     }
-
-    return content;
 }
 
-int main(int argc, char *argv[])
+static TcpServer::ProtocolHandlerPair compile_and_execute(const TcpConnectionPtr &conn, const string &incoming_tag, CompileUpload &upload)
 {
-    EventLoop loop;
-    TcpServer server(&loop, DEFAULT_PORT, "k-SI");
-
-    server.set_connection_callback([](const TcpConnectionPtr &conn)
-                                   {
-        if (conn->connected()) 
-        {
-            char peer_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &conn->peer_address().sin_addr, peer_ip, sizeof(peer_ip));
-            uint16_t peer_port = ntohs(conn->peer_address().sin_port);
-            log_write_regular_information("Client connected: " + conn->name() + " from " +
-                                           string(peer_ip) + ":" + to_string(peer_port));
-        } 
-        else 
-            log_write_regular_information("Client disconnected: " + conn->name()); });
-
-    server.register_protocol_handler(
-        "compile-execute",
-        [&](const TcpConnectionPtr &conn, const string &incoming_tag, string_view payload) -> TcpServer::ProtocolHandlerPair
+    try
+    {
+        string output_executable_name = upload.source_stem + ".out";
+        filesystem::path output_executable_path = upload.out_dir_path / output_executable_name;
+
+        vector<string> compile_instructions = {
+            "g++", "-Wall", "-Wextra", "-pedantic",
+            upload.source_filepath.string(),
+            "-o", output_executable_path.string()};
+        string compile_command;
+        for (string &str : compile_instructions)
+            compile_command += str;
+        SK_LOG_INFO("{}", move(compile_command));
+        string compile_stderr_output = compile_files(compile_instructions);
+
+        bool compilation_produced_executable = filesystem::exists(output_executable_path) &&
+                                               !filesystem::is_empty(output_executable_path);
+
+        if (!compilation_produced_executable)
         {
-            const string SRC_DIR_STR = "src";
-            const string OUT_DIR_STR = OUT_DIRECTORY;
-
-            size_t null_pos = payload.find('\0');
-            if (null_pos == string_view::npos)
+            string errinfo_filename = upload.source_stem + ".errinfo";
+            filesystem::path errinfo_filepath = upload.out_dir_path / errinfo_filename;
             {
-                string err_msg_content = "Invalid payload: Missing null terminator.";
-                log_write_error_information("compile-execute handler: " + err_msg_content);
-
-                string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                if (!packaged_error_info.empty())
-                    conn->send(packaged_error_info);
+                ofstream err_info_file(errinfo_filepath, ios::binary | ios::ate);
+                if (err_info_file.is_open())
+                {
+                    err_info_file << "--- compilation error information ---" << endl
+                                  << compile_stderr_output;
+                    err_info_file.close();
+                    SK_LOG_INFO("Compilation error info saved to: {}", errinfo_filepath.string());
+                }
                 else
-                    log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                return {incoming_tag, string(payload)};
+                    SK_LOG_ERROR("Failed to write compilation error info to: {}. Stderr was:\n{}", errinfo_filepath.string(), compile_stderr_output);
             }
 
-            string original_filename_str(payload.substr(0, null_pos));
-            string_view file_content_sv = payload.substr(null_pos + 1);
+            string error_for_client = compile_stderr_output;
+            if (error_for_client.empty())
+                error_for_client = "Compilation failed to produce an executable, and no specific error message was captured from compiler stderr.";
+            SK_LOG_WARNING("compile-execute handler: Compilation failed for {}; errinfo dumped: {}", upload.source_filepath.string(), errinfo_filepath.string());
 
-            if (original_filename_str.empty())
-            {
-                string err_msg_content = "Invalid payload: Original filename is empty.";
-                log_write_error_information("compile-execute handler: " + err_msg_content);
+            conn->send_frame("error-information", "compile-execute handler: Compilation failed for " + upload.original_filename);
+            return {incoming_tag, upload.original_filename + '\0' + "--- compilation error information ---\n" + string(error_for_client)};
+        }
 
-                string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                if (!packaged_error_info.empty())
-                    conn->send(packaged_error_info);
+        if (!compile_stderr_output.empty())
+        {
+            string errinfo_filename = upload.source_stem + ".errinfo";
+            filesystem::path errinfo_filepath = upload.out_dir_path / errinfo_filename;
+            {
+                ofstream err_info_file(errinfo_filepath, ios::binary | ios::ate);
+                if (err_info_file.is_open())
+                {
+                    err_info_file << "--- compilation error information ---" << endl
+                                  << compile_stderr_output;
+                    err_info_file.close();
+                    SK_LOG_INFO("Compilation error info saved to: {}", errinfo_filepath.string());
+                }
                 else
-                    log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                return {incoming_tag, string(payload)};
+                    SK_LOG_ERROR("Failed to write compilation error info to: {}", errinfo_filepath.string());
             }
+            SK_LOG_INFO("Compilation for {} succeeded but produced stderr (e.g., warnings)", upload.source_filepath.string());
+        }
+        SK_LOG_INFO("Compilation successful for {} with executable: {}", upload.source_filepath.string(), output_executable_path.string());
 
-            log_write_regular_information("compile-execute: Received request for file: " + original_filename_str + " with content length: " + to_string(file_content_sv.length()));
-
-            try
-            {
-
-                filesystem::path original_fs_path(original_filename_str);
-                string original_basename = original_fs_path.stem().string();
-                string original_extension = original_fs_path.extension().string();
-
-                auto now_timepoint = chrono::system_clock::now();
-                auto now_epoch_ms = chrono::duration_cast<chrono::milliseconds>(now_timepoint.time_since_epoch()).count();
-                string timestamp_str = to_string(now_epoch_ms);
+        vector<string> exec_command = {output_executable_path.string()};
+        SK_LOG_INFO("Executing: {}", output_executable_path.string());
+        auto [exec_has_error, result_file1_str, result_file2_str] = execute_executable(exec_command, "" /* no stdin file */);
 
-                string new_source_filename_stem = original_basename + "-" + timestamp_str;
-                string new_source_filename = new_source_filename_stem + original_extension;
+        string exec_response_content_for_client;
+        if (exec_has_error)
+        {
+            exec_response_content_for_client = result_file1_str;
+            SK_LOG_ERROR("compile-execute handler: Execution failed for {}; error: {}", output_executable_path.string(), exec_response_content_for_client);
 
-                filesystem::path src_dir_path(SRC_DIR_STR);
-                filesystem::path out_dir_path(OUT_DIR_STR);
+            conn->send_frame("error-information", exec_response_content_for_client);
 
-                if (!filesystem::exists(src_dir_path))
-                    filesystem::create_directories(src_dir_path);
-                if (!filesystem::exists(out_dir_path))
-                    filesystem::create_directories(out_dir_path);
+            stringstream combined_content_ss;
+            if (!compile_stderr_output.empty())
+            {
+                combined_content_ss << "--- compiler returned ---\n";
+                combined_content_ss << compile_stderr_output << endl;
+            }
+            combined_content_ss << "--- execution error ---\n";
+            combined_content_ss << exec_response_content_for_client;
+            return {incoming_tag, upload.original_filename + '\0' + combined_content_ss.str()};
+        }
+        else
+        {
+            SK_LOG_INFO("Receive .output & .err file for executable:{}, {}", result_file1_str, result_file2_str);
+            filesystem::path exec_output_filepath(result_file1_str);
+            filesystem::path exec_error_filepath(result_file2_str);
 
-                filesystem::path source_filepath = src_dir_path / new_source_filename;
-                string output_executable_name = new_source_filename_stem + ".out";
-                filesystem::path output_executable_path = out_dir_path / output_executable_name;
+            string response_prefix = upload.original_filename + '\0';
+            if (!compile_stderr_output.empty())
+                response_prefix += "--- compiler returned ---\n" + compile_stderr_output + "\n";
+            response_prefix += "--- stdout ---\n";
 
-                {
-                    ofstream src_file(source_filepath, ios::binary | ios::trunc);
-                    if (!src_file.is_open())
-                    {
-                        string err_msg_content = "Failed to create/open source file for writing: " + source_filepath.string();
-                        log_write_error_information("compile-execute handler: " + err_msg_content);
-                        string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                        if (!packaged_error_info.empty())
-                            conn->send(packaged_error_info);
-                        else
-                            log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                        return {incoming_tag, move(packaged_error_info)};
-                    }
-                    src_file.write(file_content_sv.data(), file_content_sv.length());
-                    if (src_file.fail())
-                    {
-                        string err_msg_content = "Failed to write content to source file: " + source_filepath.string();
-                        log_write_error_information("compile-execute handler: " + err_msg_content);
-                        src_file.close();
-                        filesystem::remove(source_filepath);
-                        string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                        if (!packaged_error_info.empty())
-                            conn->send(packaged_error_info);
-                        else
-                            log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                        return {incoming_tag, move(packaged_error_info)};
-                    }
-                    src_file.close();
-                    log_write_regular_information("Source file saved successfully: " + source_filepath.string());
-                }
+            auto file_or_notice = [](const filesystem::path &path) -> OutputSegment
+            {
+                if (optional<FileSegment> file = FileSegment::open(path.string()))
+                    return move(*file);
+                SK_LOG_ERROR("Failed to open execution result file: {}", path.string());
+                return "Failed to read " + path.string() + ". See server logs for details.\n";
+            };
+
+            vector<OutputSegment> response_segments;
+            response_segments.emplace_back(move(response_prefix));
+            response_segments.push_back(file_or_notice(exec_output_filepath));
+            response_segments.emplace_back(string("\n--- stderr ---\n"));
+            response_segments.push_back(file_or_notice(exec_error_filepath));
+            TcpServer::respond(conn, incoming_tag, move(response_segments));
+
+            SK_LOG_INFO("Execution of {} completed. Output/Err captured.", output_executable_path.string());
+        }
 
-                vector<string> compile_instructions = {
-                    "g++", "-Wall", "-Wextra", "-pedantic",
-                    source_filepath.string(),
-                    "-o", output_executable_path.string()};
-                string compile_command;
-                for (string &str : compile_instructions)
-                    compile_command += str;
-                log_write_regular_information(move(compile_command));
-                string compile_stderr_output = compile_files(compile_instructions);
+        return {incoming_tag, ""};
+    }
+    catch (const filesystem::filesystem_error &e)
+    {
+        string err_msg_content = "Filesystem error in compile-execute handler: " + string(e.what());
+        SK_LOG_ERROR("compile-execute handler: {}", err_msg_content);
+        conn->send_frame("error-information", err_msg_content);
+        return {incoming_tag, err_msg_content};
+    }
+    catch (const exception &e)
+    {
+        string err_msg_content = "Standard exception in compile-execute handler: " + string(e.what());
+        SK_LOG_ERROR("compile-execute handler: {}", err_msg_content);
+        conn->send_frame("error-information", err_msg_content);
+        return {incoming_tag, err_msg_content};
+    }
+    catch (...)
+    {
+        string err_msg_content = "Unknown error occurred in compile-execute handler.";
+        SK_LOG_ERROR("compile-execute handler: {}", err_msg_content);
+        conn->send_frame("error-information", err_msg_content);
+        return {incoming_tag, err_msg_content};
+    }
+}
 
-                bool compilation_produced_executable = filesystem::exists(output_executable_path) &&
-                                                       !filesystem::is_empty(output_executable_path);
+int main(int argc, char *argv[])
+{
+    // Resolved now: an upgrade usually replaces the binary on disk while this process runs.
+    vector<string> self_argv(argv, argv + argc);
+    error_code ec;
+    if (filesystem::path self = filesystem::read_symlink("/proc/self/exe", ec); !ec)
+        self_argv[0] = self.string();
+    unique_ptr<ListenerHandoff> predecessor = ListenerHandoff::inherit();
+    Socket inherited_listener = predecessor ? predecessor->take_listener("k-SI") : Socket{};
 
-                if (!compilation_produced_executable)
+    EventLoop loop;
+    TcpServer server = inherited_listener.fd() != -1 ? TcpServer(&loop, move(inherited_listener), "k-SI")
+                                                     : TcpServer(&loop, DEFAULT_PORT, "k-SI");
+
+    chrono::seconds drain_grace = kDefaultDrainGrace;
+    if (const char *seconds = getenv("SIMPLE_K_DRAIN_SECONDS"))
+        drain_grace = chrono::seconds(max(0L, strtol(seconds, nullptr, 10)));
+    bool drained = true;
+    auto drain_and_quit = [&loop, &server, &drained, drain_grace]
+    {
+        server.drain(drain_grace, [&loop, &drained](bool completed)
+                     {
+            drained = completed;
+            loop.quit(); });
+    };
+    unique_ptr<MetricsHttpServer> metrics_http;
+    shared_ptr<ListenerHandoff> upgrade;
+    // SIGTERM/SIGINT drain; a second one kills the compilers and programs the drain waits for.
+    // SIGUSR2 starts the binary at self_argv[0] on our listening sockets; this process drains once
+    // the successor is accepting, and keeps serving if it fails to start.
+    loop.watch_signals({SIGTERM, SIGINT, SIGUSR2}, [&loop, &server, &metrics_http, &upgrade, &self_argv, &drain_and_quit, drain_grace](int signo)
+                       {
+        if (signo == SIGUSR2)
+        {
+            if (server.draining() or upgrade)
+            {
+                SK_LOG_WARNING("Received SIGUSR2 while {}, ignoring it.", upgrade ? "an upgrade is in progress" : "draining");
+                return;
+            }
+            vector<ListenerHandoff::Listener> listeners = {{server.name(), server.listener_fd()}};
+            if (metrics_http)
+                listeners.emplace_back("metrics", metrics_http->listener_fd());
+            upgrade = ListenerHandoff::spawn(&loop, self_argv, listeners, [&upgrade, &drain_and_quit](bool ready)
+                                             {
+                if (!ready)
                 {
-                    string errinfo_filename = new_source_filename_stem + ".errinfo";
-                    filesystem::path errinfo_filepath = out_dir_path / errinfo_filename;
-                    {
-                        ofstream err_info_file(errinfo_filepath, ios::binary | ios::ate);
-                        if (err_info_file.is_open())
-                        {
-                            err_info_file << "--- compilation error information ---" << endl
-                                          << compile_stderr_output;
-                            err_info_file.close();
-                            log_write_regular_information("Compilation error info saved to: " + errinfo_filepath.string());
-                        }
-                        else
-                            log_write_error_information("Failed to write compilation error info to: " + errinfo_filepath.string() + ". Stderr was:\n" + compile_stderr_output);
-                    }
-
-                    string error_for_client = compile_stderr_output;
-                    if (error_for_client.empty())
-                        error_for_client = "Compilation failed to produce an executable, and no specific error message was captured from compiler stderr.";
-                    log_write_warning_information("compile-execute handler: Compilation failed for " + source_filepath.string() + "; errinfo dumped: " + errinfo_filepath.string());
-
-                    string packaged_error_info = TcpServer::package_message("error-information", "compile-execute handler: Compilation failed for " + original_filename_str);
-                    if (!packaged_error_info.empty())
-                        conn->send(packaged_error_info);
-                    else
-                        log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                    return {incoming_tag, original_filename_str + '\0' + "--- compilation error information ---\n" + string(error_for_client)};
+                    SK_LOG_ERROR("Upgrade failed, still serving from this process.");
+                    upgrade.reset();
+                    return;
                 }
+                SK_LOG_INFO("Upgrade handed over, draining.");
+                drain_and_quit(); });
+            if (!upgrade)
+                SK_LOG_ERROR("Could not start the upgrade, still serving from this process.");
+            return;
+        }
+        if (server.draining())
+        {
+            SK_LOG_WARNING("Received {} while draining, killing running jobs.", strsignal(signo));
+            kill_child_processes(SIGKILL);
+            return;
+        }
+        SK_LOG_INFO("Received {}, draining for up to {} s. Send it again to kill running jobs.", strsignal(signo), drain_grace.count());
+        drain_and_quit(); });
 
-                if (!compile_stderr_output.empty())
-                {
-                    string errinfo_filename = new_source_filename_stem + ".errinfo";
-                    filesystem::path errinfo_filepath = out_dir_path / errinfo_filename;
-                    {
-                        ofstream err_info_file(errinfo_filepath, ios::binary | ios::ate);
-                        if (err_info_file.is_open())
-                        {
-                            err_info_file << "--- compilation error information ---" << endl
-                                          << compile_stderr_output;
-                            err_info_file.close();
-                            log_write_regular_information("Compilation error info saved to: " + errinfo_filepath.string());
-                        }
-                        else
-                            log_write_error_information("Failed to write compilation error info to: " + errinfo_filepath.string());
-                    }
-                    log_write_regular_information("Compilation for " + source_filepath.string() + " succeeded but produced stderr (e.g., warnings)");
-                }
-                log_write_regular_information("Compilation successful for " + source_filepath.string() + " with executable: " + output_executable_path.string());
+    server.set_edge_triggered(true);
+    server.set_zerocopy_threshold(256 * 1024);
 
-                vector<string> exec_command = {output_executable_path.string()};
-                log_write_regular_information("Executing: " + output_executable_path.string());
-                auto [exec_has_error, result_file1_str, result_file2_str] = execute_executable(exec_command, "" /* no stdin file */);
+    server.set_connection_callback([](const TcpConnectionPtr &conn)
+                                   {
+        if (conn->connected()) 
+        {
+            char peer_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &conn->peer_address().sin_addr, peer_ip, sizeof(peer_ip));
+            uint16_t peer_port = ntohs(conn->peer_address().sin_port);
+            SK_LOG_INFO("Client connected: {} from {}:{}", conn->name(), peer_ip, peer_port);
+        } 
+        else 
+            SK_LOG_INFO("Client disconnected: {}", conn->name()); });
 
-                string exec_response_content_for_client;
-                if (exec_has_error)
-                {
-                    exec_response_content_for_client = result_file1_str;
-                    log_write_error_information("compile-execute handler: Execution failed for " + output_executable_path.string() + "; error: " + exec_response_content_for_client);
-
-                    string packaged_error_info = TcpServer::package_message("error-information", exec_response_content_for_client);
-                    if (!packaged_error_info.empty())
-                        conn->send(packaged_error_info);
-                    else
-                        log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-
-                    stringstream combined_content_ss;
-                    if (!compile_stderr_output.empty())
-                    {
-                        combined_content_ss << "--- compiler returned ---\n";
-                        combined_content_ss << compile_stderr_output << endl;
-                    }
-                    combined_content_ss << "--- execution error ---\n";
-                    combined_content_ss << exec_response_content_for_client;
-                    return {incoming_tag, original_filename_str + '\0' + combined_content_ss.str()};
-                }
-                else
-                {
-                    log_write_regular_information("Receive .output & .err file for executable:" + result_file1_str + ", " + "result_file2_str");
-                    filesystem::path exec_output_filepath(result_file1_str);
-                    filesystem::path exec_error_filepath(result_file2_str);
-
-                    string output_content = readFileContentToString(exec_output_filepath);
-                    string error_content = readFileContentToString(exec_error_filepath);
-
-                    bool output_read_error = output_content.rfind("Error: Could not open file", 0) == 0 || output_content.rfind("Error: Failed while reading file", 0) == 0 || output_content.rfind("Error: Could not determine size", 0) == 0 || output_content.rfind("Error: File too large", 0) == 0 || output_content.rfind("Error: Exception during assigning", 0) == 0;
-                    bool error_read_error = error_content.rfind("Error: Could not open file", 0) == 0 || error_content.rfind("Error: Failed while reading file", 0) == 0 || error_content.rfind("Error: Could not determine size", 0) == 0 || error_content.rfind("Error: File too large", 0) == 0 || error_content.rfind("Error: Exception during assigning", 0) == 0;
-
-                    if (output_read_error)
-                        log_write_error_information("Failed to read execution output file: " + exec_output_filepath.string() + ". Content/Error: " + output_content);
-                    if (error_read_error)
-                        log_write_error_information("Failed to read execution error file: " + exec_error_filepath.string() + ". Content/Error: " + error_content);
-
-                    stringstream combined_content_ss;
-                    if (!compile_stderr_output.empty())
-                    {
-                        combined_content_ss << "--- compiler returned ---\n";
-                        combined_content_ss << compile_stderr_output << endl;
-                    }
-                    combined_content_ss << "--- stdout ---\n";
-                    combined_content_ss << (output_read_error ? ("Failed to read " + exec_output_filepath.string() + ". See server logs for details.\n") : output_content);
-                    combined_content_ss << "\n--- stderr ---\n";
-                    combined_content_ss << (error_read_error ? ("Failed to read " + exec_error_filepath.string() + ". See server logs for details.\n") : error_content);
-                    exec_response_content_for_client = combined_content_ss.str();
-
-                    log_write_regular_information("Execution of " + output_executable_path.string() + " completed. Output/Err captured.");
-                }
+    TcpServer::StreamingProtocolHandler compile_execute_handler;
+    compile_execute_handler.on_frame_begin = [](const TcpConnectionPtr &conn, const string &/*tag*/, size_t payload_len) -> any
+    {
+        SK_LOG_INFO("compile-execute: Receiving upload of {} bytes from {}", payload_len, conn->name());
+        return make_shared<CompileUpload>();
+    };
+    compile_execute_handler.on_frame_chunk = [](const TcpConnectionPtr &/*conn*/, any &context, string_view chunk)
+    {
+        CompileUpload &upload = *any_cast<shared_ptr<CompileUpload> &>(context);
+        if (!upload.error.empty())
+            return;
 
-                return {incoming_tag, original_filename_str + '\0' + exec_response_content_for_client};
-            }
-            catch (const filesystem::filesystem_error &e)
-            {
-                string err_msg_content = "Filesystem error in compile-execute handler: " + string(e.what());
-                log_write_error_information("compile-execute handler: " + err_msg_content);
-                string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                if (!packaged_error_info.empty())
-                    conn->send(packaged_error_info);
-                else
-                    log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                return {incoming_tag, string(payload)};
-            }
-            catch (const exception &e)
-            {
-                string err_msg_content = "Standard exception in compile-execute handler: " + string(e.what());
-                log_write_error_information("compile-execute handler: " + err_msg_content);
-                string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                if (!packaged_error_info.empty())
-                    conn->send(packaged_error_info);
-                else
-                    log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                return {incoming_tag, string(payload)};
-            }
-            catch (...)
+        if (!upload.source_file.is_open())
+        {
+            size_t null_pos = chunk.find('\0');
+            upload.original_filename.append(chunk.substr(0, null_pos));
+            if (upload.original_filename.length() > kMaxUploadFilenameLength)
             {
-                string err_msg_content = "Unknown error occurred in compile-execute handler.";
-                log_write_error_information("compile-execute handler: " + err_msg_content);
-                string packaged_error_info = TcpServer::package_message("error-information", err_msg_content);
-                if (!packaged_error_info.empty())
-                    conn->send(packaged_error_info);
-                else
-                    log_write_error_information("compile-execute handler: Failed to package 'error-information' for client " + conn->name());
-                return {incoming_tag, string(payload)};
+                upload.error = "Invalid payload: Original filename is too long.";
+                return;
             }
-        });
+            if (null_pos == string_view::npos)
+                return;
+            open_compile_upload(upload);
+            if (!upload.error.empty())
+                return;
+            chunk.remove_prefix(null_pos + 1);
+        }
+
+        upload.source_file.write(chunk.data(), chunk.length());
+        if (upload.source_file.fail())
+            upload.error = "Failed to write content to source file: " + upload.source_filepath.string();
+    };
+    compile_execute_handler.on_frame_end = [](const TcpConnectionPtr &conn, const string &incoming_tag, any &context) -> TcpServer::ProtocolHandlerPair
+    {
+        CompileUpload &upload = *any_cast<shared_ptr<CompileUpload> &>(context);
+        if (upload.error.empty() and !upload.source_file.is_open())
+            upload.error = upload.original_filename.empty() ? "Invalid payload: Original filename is empty." : "Invalid payload: Missing null terminator.";
+        if (upload.error.empty())
+        {
+            upload.source_file.close();
+            if (upload.source_file.fail())
+                upload.error = "Failed to write content to source file: " + upload.source_filepath.string();
+        }
+        if (!upload.error.empty())
+        {
+            SK_LOG_ERROR("compile-execute handler: {}", upload.error);
+            discard_compile_upload(upload);
+            conn->send_frame("error-information", upload.error);
+            return {incoming_tag, upload.error};
+        }
+
+        SK_LOG_INFO("Source file saved successfully: {}", upload.source_filepath.string());
+        return compile_and_execute(conn, incoming_tag, upload);
+    };
+    compile_execute_handler.on_frame_abort = [](const TcpConnectionPtr &conn, any &context)
+    {
+        CompileUpload &upload = *any_cast<shared_ptr<CompileUpload> &>(context);
+        SK_LOG_WARNING("compile-execute: Upload from {} aborted, discarding {}", conn->name(), upload.source_filepath.string());
+        discard_compile_upload(upload);
+    };
+    server.register_streaming_handler("compile-execute", move(compile_execute_handler));
+    server.set_admission_controller("compile-execute", AdmissionController::create("compile-execute", AdmissionController::Options{}));
 
     server.register_protocol_handler(
         "Hello",
         [](const TcpConnectionPtr &conn, const string &tag, string_view payload) -> TcpServer::ProtocolHandlerPair
         {
-            log_write_regular_information("Hello protocol handled for " + conn->name());
-            return {"Hello", "Hello. Communication link established with server."};
+            SK_LOG_DEBUG("Hello protocol handled for {}", conn->name());
+            return {"Hello", "Hello. Communication link established with server." + TcpServer::negotiate_protocol(payload)};
         });
 
+    server.enable_stats();
+
+    if (Socket listener = predecessor ? predecessor->take_listener("metrics") : Socket{}; listener.fd() != -1)
+        metrics_http = make_unique<MetricsHttpServer>(&loop, move(listener));
+    else if (const char *metrics_port = getenv("SIMPLE_K_METRICS_PORT"))
+        metrics_http = make_unique<MetricsHttpServer>(&loop, static_cast<uint16_t>(atoi(metrics_port)));
+    if (metrics_http)
+        metrics_http->start();
+
     server.start();
+    if (predecessor)
+    {
+        predecessor->notify_ready();
+        predecessor.reset();
+    }
     loop.loop();
+
+    // Handlers left running after an incomplete drain still refer to the server.
+    if (!drained)
+        kill_child_processes(SIGKILL);
+    if (!ThreadPool::instance().wait_idle(kWorkerShutdownTimeout))
+        SK_LOG_ERROR("Thread pool still busy {} s after the server stopped.", kWorkerShutdownTimeout.count());
 }
 
 struct global
@@ -377,7 +420,7 @@ struct global
             if (!exists(OUT_DIRECTORY))
                 create_directory(OUT_DIRECTORY);
             make_sure_log_file();
-            log_write_regular_information("Program Starts. Directories checked/created. Logger initialized.");
+            SK_LOG_INFO("Program Starts. Directories checked/created. Logger initialized.");
         }
         catch (const runtime_error &e)
         {
@@ -397,7 +440,7 @@ struct global
 
     ~global(void)
     {
-        log_write_regular_information("Program Exiting. Closing log file.");
+        SK_LOG_INFO("Program Exiting. Closing log file.");
         try
         {
             close_log_file();
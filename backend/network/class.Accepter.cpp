@@ -20,6 +20,12 @@ using namespace net;
 
 #include <iostream>
 
+namespace
+{
+    const MetricsRegistry::Id connections_accepted = MetricsRegistry::counter("simplek_connections_accepted_total", "TCP connections accepted by all listeners.");
+    const MetricsRegistry::Id accept_errors = MetricsRegistry::counter("simplek_accept_errors_total", "accept4() failures other than EAGAIN.");
+}
+
 Acceptor::Acceptor(EventLoop *loop, uint16_t port, bool reuse_port)
     : loop_{loop},
       accept_socket_{::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)},
@@ -47,14 +53,40 @@ Acceptor::Acceptor(EventLoop *loop, uint16_t port, bool reuse_port)
 
     accept_channel_.on_read([this]
                             { handle_read(); });
-    log_write_regular_information("Acceptor created for port " + to_string(port) + ", fd=" + to_string(accept_socket_.fd()));
+    SK_LOG_INFO("Acceptor created for port {}, fd={}", port, accept_socket_.fd());
+}
+
+Acceptor::Acceptor(EventLoop *loop, Socket listen_socket)
+    : loop_{loop},
+      accept_socket_{move(listen_socket)},
+      accept_channel_{loop, accept_socket_.fd()},
+      listening_{false},
+      idle_fd_{::open("/dev/null", O_RDONLY | O_CLOEXEC)}
+{
+    if (accept_socket_.fd() < 0)
+        util::fatal_perror("Acceptor::Acceptor adopted an invalid socket");
+    if (idle_fd_ < 0)
+        util::fatal_perror("Acceptor::Acceptor open /dev/null failed");
+
+    // The socket was bound by another process; O_NONBLOCK lives in the shared file description,
+    // but set it anyway in case the sender created it blocking.
+    int flags = ::fcntl(accept_socket_.fd(), F_GETFL);
+    if (flags == -1 or ::fcntl(accept_socket_.fd(), F_SETFL, flags | O_NONBLOCK) == -1)
+        util::fatal_perror("Acceptor::Acceptor fcntl O_NONBLOCK failed");
+
+    accept_channel_.on_read([this]
+                            { handle_read(); });
+    SK_LOG_INFO("Acceptor adopted listening socket fd={}", accept_socket_.fd());
 }
 
 Acceptor::~Acceptor()
 {
-    log_write_regular_information("Acceptor destroyed with fd=" + to_string(idle_fd_));
-    accept_channel_.disable_all();
-    accept_channel_.remove();
+    SK_LOG_INFO("Acceptor destroyed with fd={}", idle_fd_);
+    if (accept_socket_.fd() != -1)
+    {
+        accept_channel_.disable_all();
+        accept_channel_.remove();
+    }
     ::close(idle_fd_);
 }
 
@@ -65,7 +97,22 @@ void Acceptor::listen()
     if (::listen(accept_socket_.fd(), SOMAXCONN) < 0)
         util::fatal_perror("Acceptor::listen failed");
     accept_channel_.enable_reading();
-    log_write_regular_information("Acceptor starts listening on fd " + to_string(accept_socket_.fd()));
+    SK_LOG_INFO("Acceptor starts listening on fd {}", accept_socket_.fd());
+}
+
+void Acceptor::stop()
+{
+    loop_->assert_in_loop_thread();
+    if (accept_socket_.fd() == -1)
+        return;
+    listening_ = false;
+    accept_channel_.disable_all();
+    accept_channel_.remove();
+    // Closing rather than just ignoring the socket makes the kernel refuse the backlog, so
+    // clients fail over instead of hanging in a queue nobody accepts from. A successor that
+    // was handed the socket keeps it, and the backlog, open.
+    accept_socket_.close();
+    SK_LOG_INFO("Acceptor stopped listening");
 }
 
 void Acceptor::handle_read()
@@ -80,12 +127,13 @@ void Acceptor::handle_read()
                                &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd >= 0)
         {
-            log_write_regular_information("Accepted new connection sockfd=" + to_string(connfd));
+            SK_LOG_DEBUG("Accepted new connection sockfd={}", connfd);
+            MetricsRegistry::add(connections_accepted);
             if (new_connection_cb_)
                 new_connection_cb_(connfd, peer_addr);
             else
             {
-                log_write_warning_information("No NewConnectionCallback set, closing accepted fd " + to_string(connfd));
+                SK_LOG_WARNING("No NewConnectionCallback set, closing accepted fd {}", connfd);
                 ::close(connfd);
             }
         }
@@ -94,20 +142,21 @@ void Acceptor::handle_read()
             int saved_errno = errno;
             if (saved_errno == EAGAIN or saved_errno == EWOULDBLOCK)
                 break;
-            else if (saved_errno == EMFILE or saved_errno == ENFILE)
+            MetricsRegistry::add(accept_errors);
+            if (saved_errno == EMFILE or saved_errno == ENFILE)
             {
                 ::close(idle_fd_);
                 idle_fd_ = ::accept(accept_socket_.fd(), nullptr, nullptr);
                 ::close(idle_fd_);
                 idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
-                log_write_error_information("Acceptor::handle_read - Reached fd limit (EMFILE/ENFILE), closed one incoming connection.");
+                SK_LOG_ERROR("Acceptor::handle_read - Reached fd limit (EMFILE/ENFILE), closed one incoming connection.");
                 break;
             }
             else if (saved_errno == ECONNABORTED or saved_errno == EINTR or saved_errno == EPROTO)
-                log_write_warning_information("Acceptor::handle_read - Ignorable accept error: " + errno_to_string(saved_errno));
+                SK_LOG_WARNING("Acceptor::handle_read - Ignorable accept error: {}", errno_to_string(saved_errno));
             else
             {
-                log_write_error_information("FATAL: Acceptor::handle_read accept failed: " + errno_to_string(saved_errno));
+                SK_LOG_ERROR("FATAL: Acceptor::handle_read accept failed: {}", errno_to_string(saved_errno));
                 break;
             }
         }
@@ -0,0 +1,124 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_ADMISSIONCONTROLLER_CPP
+#include "network.hpp"
+
+AdmissionController::Ticket::~Ticket()
+{
+    if (in_service_)
+    {
+        chrono::steady_clock::duration service_time = chrono::steady_clock::now() - service_started_;
+        owner_->release(&service_time);
+    }
+    else
+        owner_->release(nullptr);
+}
+
+void AdmissionController::Ticket::begin_service() noexcept
+{
+    in_service_ = true;
+    service_started_ = chrono::steady_clock::now();
+}
+
+/* static */ shared_ptr<AdmissionController> AdmissionController::create(const string &name, const Options &options)
+{
+    return shared_ptr<AdmissionController>(new AdmissionController(name, options));
+}
+
+AdmissionController::AdmissionController(const string &name, const Options &options)
+    : options_{max<size_t>(options.concurrency, 1),
+               max<size_t>(options.max_outstanding, 1),
+               options.max_queue_wait,
+               options.initial_service_time,
+               options.min_retry_after},
+      metrics_{MetricsRegistry::counter("simplek_admission_admitted_total", "Jobs accepted by admission control.", MetricsRegistry::label("pipeline", name)),
+               MetricsRegistry::counter("simplek_admission_rejected_total", "Jobs turned away by admission control.", MetricsRegistry::label("pipeline", name) + "," + MetricsRegistry::label("reason", "full")),
+               MetricsRegistry::counter("simplek_admission_rejected_total", "Jobs turned away by admission control.", MetricsRegistry::label("pipeline", name) + "," + MetricsRegistry::label("reason", "wait")),
+               MetricsRegistry::gauge("simplek_admission_outstanding", "Admitted jobs that have not finished yet.", MetricsRegistry::label("pipeline", name)),
+               MetricsRegistry::gauge("simplek_admission_service_time_estimate_ms", "Moving average of job service time used to estimate queue wait.", MetricsRegistry::label("pipeline", name)),
+               MetricsRegistry::histogram("simplek_admission_service_seconds", "Service time of admitted jobs.", MetricsRegistry::label("pipeline", name))},
+      outstanding_{0},
+      service_us_{static_cast<double>(chrono::duration_cast<chrono::microseconds>(options.initial_service_time).count())},
+      published_estimate_ms_{options.initial_service_time.count()}
+{
+    MetricsRegistry::add(metrics_.service_time_estimate, published_estimate_ms_);
+}
+
+AdmissionController::Decision AdmissionController::try_admit()
+{
+    lock_guard lock(mutex_);
+    chrono::microseconds wait = wait_for_locked(outstanding_);
+    bool full = outstanding_ >= options_.max_outstanding;
+    if (!full and wait <= options_.max_queue_wait)
+    {
+        ++outstanding_;
+        MetricsRegistry::add(metrics_.admitted);
+        MetricsRegistry::add(metrics_.outstanding);
+        return Decision{shared_ptr<Ticket>(new Ticket(shared_from_this())), chrono::duration_cast<chrono::milliseconds>(wait), chrono::milliseconds{0}};
+    }
+
+    // Every completion moves the queue forward by roughly one service time spread over the slots;
+    // hint at the time it takes for enough of them to bring this job back under both limits.
+    double per_slot_us = service_us_ / static_cast<double>(options_.concurrency);
+    size_t completions = full ? outstanding_ - options_.max_outstanding + 1 : 0;
+    if (wait > options_.max_queue_wait and per_slot_us > 0)
+    {
+        double excess_us = static_cast<double>((wait - chrono::duration_cast<chrono::microseconds>(options_.max_queue_wait)).count());
+        completions = max(completions, static_cast<size_t>(ceil(excess_us / per_slot_us)));
+    }
+    auto retry_after = chrono::duration_cast<chrono::milliseconds>(chrono::microseconds{static_cast<int64_t>(per_slot_us * static_cast<double>(completions))});
+    MetricsRegistry::add(full ? metrics_.rejected_full : metrics_.rejected_wait);
+    return Decision{nullptr, chrono::duration_cast<chrono::milliseconds>(wait), max(retry_after, options_.min_retry_after)};
+}
+
+size_t AdmissionController::outstanding()
+{
+    lock_guard lock(mutex_);
+    return outstanding_;
+}
+
+chrono::microseconds AdmissionController::service_time_estimate()
+{
+    lock_guard lock(mutex_);
+    return chrono::microseconds{static_cast<int64_t>(service_us_)};
+}
+
+chrono::microseconds AdmissionController::wait_for_locked(size_t outstanding) const
+{
+    if (outstanding < options_.concurrency)
+        return chrono::microseconds{0};
+    size_t ahead = outstanding - options_.concurrency + 1;
+    return chrono::microseconds{static_cast<int64_t>(service_us_ * static_cast<double>(ahead) / static_cast<double>(options_.concurrency))};
+}
+
+void AdmissionController::release(const chrono::steady_clock::duration *service_time)
+{
+    if (service_time != nullptr)
+        MetricsRegistry::observe(metrics_.service_seconds, *service_time);
+
+    lock_guard lock(mutex_);
+    --outstanding_;
+    MetricsRegistry::add(metrics_.outstanding, -1);
+    if (service_time == nullptr)
+        return;
+
+    double sample_us = static_cast<double>(chrono::duration_cast<chrono::microseconds>(*service_time).count());
+    service_us_ += kServiceTimeWeight * (sample_us - service_us_);
+    int64_t estimate_ms = static_cast<int64_t>(service_us_ / 1000.0);
+    MetricsRegistry::add(metrics_.service_time_estimate, estimate_ms - published_estimate_ms_);
+    published_estimate_ms_ = estimate_ms;
+}
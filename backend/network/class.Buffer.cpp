@@ -18,53 +18,275 @@
 #include "network.hpp"
 using namespace net;
 
-void Buffer::make_space(size_t len)
+Buffer::Buffer(size_t initial_size)
+    : write_block_{0},
+      readable_{0},
+      reserve_hint_{0},
+      retain_limit_{kMaxReadAhead}
 {
-    if (writable_bytes() + prependable_bytes() < len + kCheapPrepend)
-        buffer_.resize(writer_index_ + len);
-    else
+    if (initial_size > kBlockSize)
+        add_block(BufferBlockPool::size_class(initial_size));
+}
+
+Buffer::~Buffer()
+{
+    for (Block &block : blocks_)
+        release_block(block);
+}
+
+Buffer::Buffer(Buffer &&other) noexcept
+    : blocks_{move(other.blocks_)},
+      write_block_{other.write_block_},
+      readable_{other.readable_},
+      reserve_hint_{other.reserve_hint_},
+      retain_limit_{other.retain_limit_}
+{
+    other.blocks_.clear();
+    other.write_block_ = 0;
+    other.readable_ = 0;
+    other.reserve_hint_ = 0;
+}
+
+Buffer &Buffer::operator=(Buffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        blocks_.swap(other.blocks_);
+        swap(write_block_, other.write_block_);
+        swap(readable_, other.readable_);
+        swap(reserve_hint_, other.reserve_hint_);
+        swap(retain_limit_, other.retain_limit_);
+        other.retrieve_all();
+    }
+    return *this;
+}
+
+size_t Buffer::writable_bytes() const noexcept
+{
+    size_t writable = 0;
+    for (size_t i = write_block_; i < blocks_.size(); ++i)
+        writable += blocks_[i].capacity - blocks_[i].write;
+    return writable;
+}
+
+size_t Buffer::capacity() const noexcept
+{
+    size_t total = 0;
+    for (const Block &block : blocks_)
+        total += block.capacity;
+    return total;
+}
+
+char Buffer::peek_byte(size_t offset) const noexcept
+{
+    char byte = 0;
+    copy_out(offset, &byte, 1);
+    return byte;
+}
+
+void Buffer::copy_out(size_t offset, void *dst, size_t len) const noexcept
+{
+    assert(offset + len <= readable_);
+    char *out = static_cast<char *>(dst);
+    for (const Block &block : blocks_)
+    {
+        if (len == 0)
+            break;
+        size_t available = block.write - block.read;
+        if (offset >= available)
+        {
+            offset -= available;
+            continue;
+        }
+        size_t n = min(len, available - offset);
+        memcpy(out, block.data + block.read + offset, n);
+        out += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+vector<string_view> Buffer::views(size_t len) const
+{
+    assert(len <= readable_);
+    vector<string_view> result;
+    for (const Block &block : blocks_)
+    {
+        if (len == 0)
+            break;
+        size_t n = min(len, block.write - block.read);
+        result.emplace_back(block.data + block.read, n);
+        len -= n;
+    }
+    return result;
+}
+
+size_t Buffer::fill_iovecs(struct iovec *vec, size_t max_vecs, size_t max_bytes) const noexcept
+{
+    size_t count = 0;
+    for (const Block &block : blocks_)
+    {
+        if (count == max_vecs or max_bytes == 0 or block.write == block.read)
+            break;
+        size_t n = min(max_bytes, block.write - block.read);
+        vec[count].iov_base = block.data + block.read;
+        vec[count].iov_len = n;
+        ++count;
+        max_bytes -= n;
+    }
+    return count;
+}
+
+void Buffer::retrieve(size_t len) noexcept
+{
+    assert(len <= readable_);
+    if (len >= readable_)
+    {
+        retrieve_all();
+        return;
+    }
+
+    readable_ -= len;
+    while (len > 0)
+    {
+        Block &block = blocks_.front();
+        size_t n = min(len, block.write - block.read);
+        block.read += n;
+        len -= n;
+        if (block.read == block.write and write_block_ > 0)
+        {
+            release_block(block);
+            blocks_.pop_front();
+            --write_block_;
+        }
+    }
+}
+
+void Buffer::retrieve_all() noexcept
+{
+    for (Block &block : blocks_)
+        release_block(block);
+    blocks_.clear();
+    write_block_ = 0;
+    readable_ = 0;
+}
+
+string Buffer::retrieve_as_string(size_t len)
+{
+    assert(len <= readable_);
+    string result(len, '\0');
+    copy_out(0, result.data(), len);
+    retrieve(len);
+    return result;
+}
+
+void Buffer::append(const char *data, size_t len)
+{
+    while (len > 0)
     {
-        size_t readable = readable_bytes();
-        memmove(begin() + kCheapPrepend, peek(), readable);
-        reader_index_ = kCheapPrepend;
-        writer_index_ = reader_index_ + readable;
+        if (blocks_.empty())
+            add_block(kBlockSize);
+        Block &block = blocks_[write_block_];
+        size_t space = block.capacity - block.write;
+        if (space == 0)
+        {
+            if (write_block_ + 1 == blocks_.size())
+                add_block(kBlockSize);
+            ++write_block_;
+            continue;
+        }
+        size_t n = min(space, len);
+        memcpy(block.data + block.write, data, n);
+        block.write += n;
+        readable_ += n;
+        data += n;
+        len -= n;
     }
-    assert(writable_bytes() >= len);
+}
+
+void Buffer::ensure_writable_bytes(size_t len)
+{
+    for (size_t writable = writable_bytes(); writable < len; writable += blocks_.back().capacity)
+        add_block(block_capacity_for(len - writable));
+}
+
+void Buffer::shrink() noexcept
+{
+    reserve_hint_ = 0;
+    trim_spare_blocks();
 }
 
 ssize_t Buffer::read_fd(int fd, int *saved_errno)
 {
-    char extrabuf[65536];
-    struct iovec vec[2];
-    const size_t writable = writable_bytes();
-    vec[0].iov_base = begin_write();
-    vec[0].iov_len = writable;
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof(extrabuf);
-    const int iovcnt = 2;
+    ensure_writable_bytes(clamp(reserve_hint_, kMinReadAhead, max(kMinReadAhead, min(retain_limit_, kMaxReadAhead))));
 
-    const ssize_t n = ::readv(fd, vec, iovcnt);
+    struct iovec vec[kMaxReadAhead / kBlockSize + 2];
+    size_t count = 0;
+    for (size_t i = write_block_; i < blocks_.size() and count < size(vec); ++i)
+    {
+        vec[count].iov_base = blocks_[i].data + blocks_[i].write;
+        vec[count].iov_len = blocks_[i].capacity - blocks_[i].write;
+        ++count;
+    }
 
+    const ssize_t n = ::readv(fd, vec, static_cast<int>(count));
     if (n < 0)
-    {
         *saved_errno = errno;
-        return -1;
-    }
-    else if (n == 0)
-        return 0;
-    else if (static_cast<size_t>(n) <= writable)
-        has_written(n);
     else
     {
-        if (static_cast<size_t>(n) > writable + sizeof(extrabuf))
+        size_t left = static_cast<size_t>(n);
+        readable_ += left;
+        reserve_hint_ = reserve_hint_ > left ? reserve_hint_ - left : 0;
+        while (left > 0)
         {
-            log_write_error_information("Buffer::read_fd read more data than buffers could hold!");
-            *saved_errno = EOVERFLOW;
-            return -1;
+            Block &block = blocks_[write_block_];
+            size_t m = min(left, block.capacity - block.write);
+            block.write += m;
+            left -= m;
+            if (block.write == block.capacity and write_block_ + 1 < blocks_.size())
+                ++write_block_;
         }
-        size_t must_write_from_extrabuf = static_cast<size_t>(n) - writable;
-        writer_index_ = buffer_.size();
-        append(extrabuf, must_write_from_extrabuf);
     }
+    trim_spare_blocks();
     return n;
 }
+
+size_t Buffer::block_capacity_for(size_t missing) noexcept
+{
+    size_t capacity = kBlockSize;
+    for (size_t size_class : BufferBlockPool::kSizeClasses)
+        if (size_class <= missing)
+            capacity = size_class;
+    return capacity;
+}
+
+void Buffer::add_block(size_t capacity)
+{
+    blocks_.push_back(Block{BufferBlockPool::acquire(capacity), capacity, 0, 0});
+}
+
+void Buffer::release_block(Block &block) noexcept
+{
+    BufferBlockPool::release(block.data, block.capacity);
+    block.data = nullptr;
+}
+
+void Buffer::trim_spare_blocks() noexcept
+{
+    if (readable_ == 0 and reserve_hint_ == 0)
+    {
+        retrieve_all();
+        return;
+    }
+
+    size_t keep = min({reserve_hint_, retain_limit_, kMaxReadAhead});
+    size_t spare = 0;
+    for (size_t i = write_block_ + 1; i < blocks_.size(); ++i)
+        spare += blocks_[i].capacity;
+    while (blocks_.size() > write_block_ + 1 and spare - blocks_.back().capacity >= keep)
+    {
+        spare -= blocks_.back().capacity;
+        release_block(blocks_.back());
+        blocks_.pop_back();
+    }
+}
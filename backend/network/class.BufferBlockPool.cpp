@@ -0,0 +1,163 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_BUFFERBLOCKPOOL_CPP
+#include "network.hpp"
+
+namespace
+{
+    thread_local bool local_pool_destroyed = false;
+}
+
+BufferBlockPool::~BufferBlockPool()
+{
+    local_pool_destroyed = true;
+    for (size_t i = 0; i < kSizeClasses.size(); ++i)
+    {
+        for (char *block : free_blocks_[i])
+            free(block);
+        bytes_cached_ -= free_blocks_[i].size() * kSizeClasses[i];
+    }
+}
+
+BufferBlockPool *BufferBlockPool::local() noexcept
+{
+    if (local_pool_destroyed)
+        return nullptr;
+    thread_local BufferBlockPool pool;
+    return &pool;
+}
+
+size_t BufferBlockPool::class_index(size_t capacity) noexcept
+{
+    for (size_t i = 0; i < kSizeClasses.size(); ++i)
+        if (kSizeClasses[i] == capacity)
+            return i;
+    return kNoSizeClass;
+}
+
+size_t BufferBlockPool::size_class(size_t len) noexcept
+{
+    for (size_t capacity : kSizeClasses)
+        if (len <= capacity)
+            return capacity;
+    return (len + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+char *BufferBlockPool::acquire(size_t capacity)
+{
+    assert(capacity % kPageSize == 0);
+    ++acquires_;
+    BufferBlockPool *pool = local();
+    size_t index = class_index(capacity);
+    char *block = nullptr;
+    if (pool != nullptr)
+    {
+        ++pool->acquires_since_trim_;
+        if (index != kNoSizeClass and !pool->free_blocks_[index].empty())
+        {
+            block = pool->free_blocks_[index].back();
+            pool->free_blocks_[index].pop_back();
+            pool->cached_bytes_ -= capacity;
+            bytes_cached_ -= capacity;
+            ++cache_hits_;
+            if (index == 0)
+                pool->advised_blocks_ = min(pool->advised_blocks_, pool->free_blocks_[0].size());
+        }
+    }
+    if (block == nullptr)
+    {
+        block = static_cast<char *>(aligned_alloc(kPageSize, capacity));
+        if (block == nullptr)
+            throw bad_alloc();
+    }
+
+    size_t in_use = bytes_in_use_ += capacity;
+    size_t peak = peak_bytes_in_use_.load(memory_order_relaxed);
+    while (in_use > peak and !peak_bytes_in_use_.compare_exchange_weak(peak, in_use, memory_order_relaxed))
+    {
+    }
+    return block;
+}
+
+void BufferBlockPool::release(char *block, size_t capacity) noexcept
+{
+    bytes_in_use_ -= capacity;
+    BufferBlockPool *pool = local();
+    size_t index = class_index(capacity);
+    if (pool != nullptr and index != kNoSizeClass and pool->cached_bytes_ + capacity <= kMaxCachedBytes)
+    {
+        try
+        {
+            pool->free_blocks_[index].push_back(block);
+            pool->cached_bytes_ += capacity;
+            bytes_cached_ += capacity;
+            return;
+        }
+        catch (...)
+        {
+        }
+    }
+    free(block);
+}
+
+void BufferBlockPool::return_to_os(char *block, size_t capacity) noexcept
+{
+    bytes_returned_to_os_ += capacity;
+    free(block);
+}
+
+void BufferBlockPool::trim_idle() noexcept
+{
+    BufferBlockPool *pool = local();
+    if (pool == nullptr)
+        return;
+    bool idle = pool->acquires_since_trim_ == 0;
+    pool->acquires_since_trim_ = 0;
+    if (!idle or pool->cached_bytes_ == pool->advised_blocks_ * kBlockSize)
+        return;
+    uint64_t returned_before = bytes_returned_to_os_.load(memory_order_relaxed);
+
+    for (size_t i = 1; i < kSizeClasses.size(); ++i)
+    {
+        for (char *block : pool->free_blocks_[i])
+            return_to_os(block, kSizeClasses[i]);
+        pool->cached_bytes_ -= pool->free_blocks_[i].size() * kSizeClasses[i];
+        bytes_cached_ -= pool->free_blocks_[i].size() * kSizeClasses[i];
+        pool->free_blocks_[i].clear();
+    }
+
+    vector<char *> &small = pool->free_blocks_[0];
+    for (size_t i = pool->advised_blocks_; i < small.size(); ++i)
+    {
+        if (::madvise(small[i], kBlockSize, MADV_DONTNEED) == 0)
+            bytes_returned_to_os_ += kBlockSize;
+    }
+    pool->advised_blocks_ = small.size();
+
+    Stats current = stats();
+    SK_LOG_INFO("BufferBlockPool - idle trim returned {} bytes to the OS (in use: {}, peak: {}, cached: {}, hit rate: {}/{}).", current.bytes_returned_to_os - returned_before, current.bytes_in_use, current.peak_bytes_in_use, current.bytes_cached, current.cache_hits, current.acquires);
+}
+
+BufferBlockPool::Stats BufferBlockPool::stats() noexcept
+{
+    return Stats{bytes_in_use_.load(memory_order_relaxed),
+                 peak_bytes_in_use_.load(memory_order_relaxed),
+                 bytes_cached_.load(memory_order_relaxed),
+                 acquires_.load(memory_order_relaxed),
+                 cache_hits_.load(memory_order_relaxed),
+                 bytes_returned_to_os_.load(memory_order_relaxed)};
+}
@@ -26,17 +26,17 @@ void Channel::handle_event()
         guard = tie_.lock();
         if (!guard)
         {
-            log_write_warning_information("Channel::handle_event() - Tied object expired, fd = " + to_string(fd_));
+            SK_LOG_WARNING("Channel::handle_event() - Tied object expired, fd = {}", fd_);
             return;
         }
     }
 
-    log_write_regular_information("handle_event revents=" + to_string(revents_) + " for fd=" + to_string(fd_));
+    SK_LOG_DEBUG("handle_event revents={} for fd={}", revents_, fd_);
 
     if (revents_ & (EPOLLERR | EPOLLHUP))
     {
         if (!(revents_ & EPOLLIN))
-            log_write_warning_information("Channel::handle_event() EPOLLHUP without EPOLLIN fd = " + to_string(fd_));
+            SK_LOG_WARNING("Channel::handle_event() EPOLLHUP without EPOLLIN fd = {}", fd_);
 
         if (error_cb_)
             error_cb_();
@@ -0,0 +1,149 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _CLASS_CONNECTIONREAPER_CPP
+#include "network.hpp"
+using namespace net;
+
+ConnectionReaper::ConnectionReaper(EventLoop *loop, const Options &options)
+    : loop_{loop},
+      options_{options},
+      wheel_(kWheelSize),
+      cursor_{0}
+{
+}
+
+void ConnectionReaper::start()
+{
+    weak_ptr<ConnectionReaper> weak_self = weak_from_this();
+    loop_->run_every(kTick, [weak_self]()
+                     {
+        if (auto self = weak_self.lock())
+            self->on_tick(); });
+}
+
+void ConnectionReaper::track(const TcpConnectionPtr &conn)
+{
+    loop_->assert_in_loop_thread();
+    TimerClock::time_point now = TimerClock::now();
+    TimerClock::time_point next_check = now + kTick;
+    if (inspect(*conn, now, next_check) == nullptr)
+        schedule(conn, next_check, now);
+}
+
+void ConnectionReaper::schedule(const TcpConnectionPtr &conn, TimerClock::time_point deadline, TimerClock::time_point now)
+{
+    size_t ticks = 1;
+    if (deadline > now)
+    {
+        auto remaining = deadline - now;
+        ticks = static_cast<size_t>((remaining + kTick - TimerClock::duration{1}) / kTick);
+        ticks = clamp<size_t>(ticks, 1, kWheelSize - 1);
+    }
+    wheel_[(cursor_ + ticks) % kWheelSize].emplace_back(conn);
+}
+
+void ConnectionReaper::on_tick()
+{
+    cursor_ = (cursor_ + 1) % kWheelSize;
+    vector<weak_ptr<TcpConnection>> bucket;
+    bucket.swap(wheel_[cursor_]);
+    if (bucket.empty())
+        return;
+
+    TimerClock::time_point now = TimerClock::now();
+    for (weak_ptr<TcpConnection> &weak_conn : bucket)
+    {
+        TcpConnectionPtr conn = weak_conn.lock();
+        if (!conn or !conn->connected())
+            continue;
+
+        TimerClock::time_point next_check = now + kTick;
+        const char *reason = inspect(*conn, now, next_check);
+        if (reason != nullptr)
+        {
+            SK_LOG_WARNING("ConnectionReaper - closing [{}]: {}", conn->name(), reason);
+            conn->force_close();
+            continue;
+        }
+        if (!conn->inbound_progress().frame_pending)
+            conn->shrink_buffers();
+        schedule(conn, next_check, now);
+    }
+}
+
+const char *ConnectionReaper::inspect(TcpConnection &conn, TimerClock::time_point now, TimerClock::time_point &next_check) const
+{
+    TimerClock::time_point earliest = TimerClock::time_point::max();
+    const TcpConnection::InboundProgress &progress = conn.inbound_progress();
+
+    if (options_.idle_timeout.count() > 0)
+    {
+        TimerClock::time_point idle_deadline = conn.last_activity() + options_.idle_timeout;
+        if (now >= idle_deadline)
+        {
+            if (conn.jobs_in_flight() > 0 or conn.strand()->busy())
+                idle_deadline = now + options_.idle_timeout;
+            else
+                return "idle timeout";
+        }
+        earliest = min(earliest, idle_deadline);
+    }
+
+    // A paused connection is waiting on us; its progress clock restarts when reading resumes.
+    if (conn.reading_paused())
+    {
+        next_check = min(earliest, now + kTick);
+        return nullptr;
+    }
+
+    if (progress.frame_pending and !progress.header_complete and options_.header_timeout.count() > 0)
+    {
+        TimerClock::time_point header_deadline = progress.frame_started + options_.header_timeout;
+        if (now >= header_deadline)
+            return "frame header not completed in time";
+        earliest = min(earliest, header_deadline);
+    }
+
+    if (progress.frame_pending and progress.header_complete and options_.min_bytes_per_second > 0)
+    {
+        TimerClock::time_point grace_deadline = progress.frame_started + options_.throughput_grace;
+        if (now >= grace_deadline)
+        {
+            double elapsed = chrono::duration<double>(now - progress.frame_started).count();
+            double rate = static_cast<double>(conn.bytes_received() - progress.bytes_at_frame_start) / elapsed;
+            if (rate < static_cast<double>(options_.min_bytes_per_second))
+                return "inbound frame below minimum throughput";
+            grace_deadline = now + kTick;
+        }
+        earliest = min(earliest, grace_deadline);
+    }
+
+    if (!progress.frame_pending)
+    {
+        if (options_.header_timeout.count() > 0)
+            earliest = min(earliest, now + options_.header_timeout);
+        if (options_.min_bytes_per_second > 0)
+            earliest = min(earliest, now + options_.throughput_grace);
+    }
+
+    if (earliest != TimerClock::time_point::max())
+        next_check = earliest;
+    else
+        next_check = now + kTick * (kWheelSize - 1);
+    return nullptr;
+}
@@ -0,0 +1,100 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_EPOLLPOLLER_CPP
+#include "network.hpp"
+using namespace net;
+
+EpollPoller::EpollPoller(EventLoop *loop)
+    : Poller{loop},
+      epoll_fd_{::epoll_create1(EPOLL_CLOEXEC)},
+      active_events_(kInitEventListSize)
+{
+    if (epoll_fd_.fd() == -1)
+        util::fatal_perror("EpollPoller::EpollPoller epoll_create1 failed");
+}
+
+void EpollPoller::poll(int timeout_ms, ChannelList *active_channels)
+{
+    int num_events = ::epoll_wait(epoll_fd_.fd(), active_events_.data(), static_cast<int>(active_events_.size()), timeout_ms);
+    int saved_errno = errno;
+
+    if (num_events > 0)
+    {
+        for (size_t i = 0; i < static_cast<size_t>(num_events); ++i)
+        {
+            int fd = token_fd(active_events_[i].data.u64);
+            uint32_t generation = token_generation(active_events_[i].data.u64);
+            Channel *channel = find_channel(fd, generation);
+            if (channel == nullptr)
+                continue;
+            channel->set_revents(active_events_[i].events);
+            active_channels->push_back(ReadyChannel{channel, fd, generation});
+        }
+
+        if (static_cast<size_t>(num_events) == active_events_.size() and active_events_.size() < kMaxEventListSize)
+            active_events_.resize(active_events_.size() * 2);
+    }
+    else if (num_events < 0 and saved_errno != EINTR)
+    {
+        errno = saved_errno;
+        SK_LOG_ERROR("EpollPoller::poll() epoll_wait() error: {}", errno_to_string(errno));
+    }
+}
+
+void EpollPoller::update_channel(Channel *channel)
+{
+    const int fd = channel->fd();
+    struct epoll_event ev{};
+    ev.events = channel->events() | (channel->is_edge_triggered() ? EPOLLET : 0u);
+
+    if (find_channel(fd) == channel)
+    {
+        ev.data.u64 = make_token(fd, generation_of(fd));
+        if (channel->is_none_event())
+        {
+            if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1 and errno != ENOENT)
+                SK_LOG_ERROR("epoll_ctl op=DEL fd={} failed: {}", fd, errno_to_string(errno));
+        }
+        else if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_MOD, fd, &ev) == -1)
+        {
+            if (errno != ENOENT or ::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &ev) == -1)
+                SK_LOG_ERROR("epoll_ctl op=MOD fd={} failed: {}", fd, errno_to_string(errno));
+        }
+        return;
+    }
+
+    ev.data.u64 = make_token(fd, insert_channel(channel));
+    if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        SK_LOG_ERROR("epoll_ctl op=ADD fd={} failed: {}", fd, errno_to_string(errno));
+        erase_channel(fd);
+    }
+}
+
+void EpollPoller::remove_channel(Channel *channel)
+{
+    int fd = channel->fd();
+    assert(find_channel(fd) == channel);
+    assert(channel->is_none_event());
+
+    SK_LOG_DEBUG("remove_channel fd = {}", fd);
+    erase_channel(fd);
+
+    if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
+        if (errno != ENOENT)
+            SK_LOG_ERROR("epoll_ctl op=DEL fd={} failed during remove_channel: {}", fd, errno_to_string(errno));
+}
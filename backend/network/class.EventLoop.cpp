@@ -24,28 +24,25 @@ EventLoop::EventLoop()
       event_handling_{false},
       calling_pending_functors_{false},
       thread_id_{this_thread::get_id()},
-      epoll_fd_{::epoll_create1(EPOLL_CLOEXEC)},
+      poller_{Poller::new_default_poller(this)},
       wakeup_fd_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
-      active_events_(kMaxEvents)
+      wakeup_pending_{false}
 {
-    if (epoll_fd_.fd() == -1)
-        util::fatal_perror("EventLoop::EventLoop epoll_create1 failed");
-
     if (wakeup_fd_.fd() == -1)
         util::fatal_perror("EventLoop::EventLoop eventfd failed");
-    log_write_regular_information("EventLoop created in thread " + to_string(hash<thread::id>{}(thread_id_)) +
-                                  ", epollfd=" + to_string(epoll_fd_.fd()) +
-                                  ", wakeupfd=" + to_string(wakeup_fd_.fd()));
+    SK_LOG_INFO("EventLoop created in thread {}, poller={}, wakeupfd={}", hash<thread::id>{}(thread_id_), poller_->backend_name(), wakeup_fd_.fd());
 
     wakeup_channel_ = make_unique<Channel>(this, wakeup_fd_.fd());
     wakeup_channel_->on_read([this]
                              { handle_read(); });
     wakeup_channel_->enable_reading();
+
+    timer_queue_ = make_unique<TimerQueue>(this);
 }
 
 EventLoop::~EventLoop()
 {
-    log_write_regular_information("EventLoop destroyed in thread " + to_string(hash<thread::id>{}(this_thread::get_id())));
+    SK_LOG_INFO("EventLoop destroyed in thread {}", hash<thread::id>{}(this_thread::get_id()));
     assert(!looping_);
 }
 
@@ -55,40 +52,24 @@ void EventLoop::loop()
     assert_in_loop_thread();
     looping_ = true;
     quit_ = false;
-    log_write_regular_information("EventLoop " + to_string(reinterpret_cast<uintptr_t>(this)) + " start looping in thread " + to_string(hash<thread::id>{}(thread_id_)));
+    SK_LOG_INFO("EventLoop {} start looping in thread {}", reinterpret_cast<uintptr_t>(this), hash<thread::id>{}(thread_id_));
 
     while (!quit_)
     {
-        active_events_.clear();
-        int num_events = ::epoll_wait(epoll_fd_.fd(), active_events_.data(), kMaxEvents, -1);
-        int saved_errno = errno;
-
-        if (num_events > 0)
-        {
-            log_write_regular_information(to_string(num_events) + " events happened");
-            event_handling_ = true;
-            for (int i = 0; i < num_events; ++i)
-            {
-                Channel *channel = static_cast<Channel *>(active_events_[i].data.ptr);
-                channel->set_revents(active_events_[i].events);
-                channel->handle_event();
-            }
-            event_handling_ = false;
-        }
-        else if (num_events == 0)
-            ;
-        else
-        {
-            if (saved_errno != EINTR)
-            {
-                errno = saved_errno;
-                log_write_error_information("EventLoop::loop() epoll_wait() error: " + errno_to_string(errno));
-            }
-        }
+        active_channels_.clear();
+        poller_->poll(-1, &active_channels_);
+
+        event_handling_ = true;
+        for (const Poller::ReadyChannel &ready : active_channels_)
+            if (poller_->is_current(ready))
+                ready.channel->handle_event();
+        event_handling_ = false;
         do_pending_functors();
     }
+    // A capped pass may have left functors behind; everything queued before quit() still runs.
+    do_pending_functors();
 
-    log_write_regular_information("EventLoop " + to_string(reinterpret_cast<uintptr_t>(this)) + " stop looping.");
+    SK_LOG_INFO("EventLoop {} stop looping.", reinterpret_cast<uintptr_t>(this));
     looping_ = false;
 }
 
@@ -109,76 +90,77 @@ void EventLoop::run_in_loop(Functor f)
 
 void EventLoop::queue_in_loop(Functor f)
 {
-    {
-        lock_guard lock(mutex_);
-        pending_functors_.push_back(move(f));
-    }
-    if (!is_in_loop_thread() || calling_pending_functors_)
+    pending_functors_.push(move(f));
+    // Only the first poster after the loop last drained the queue pays for the eventfd write.
+    if ((!is_in_loop_thread() or calling_pending_functors_) and !wakeup_pending_.exchange(true, memory_order_acq_rel))
         wakeup();
 }
 
-void EventLoop::update_channel(Channel *channel)
+TimerId EventLoop::run_at(TimerClock::time_point when, TimerCallback cb)
 {
-    assert(channel->owner_loop() == this);
-    assert_in_loop_thread();
-    const int fd = channel->fd();
-    log_write_regular_information("update_channel fd = " + to_string(fd) + " events = " + to_string(channel->events()));
+    return timer_queue_->add_timer(move(cb), when, TimerClock::duration::zero());
+}
 
-    struct epoll_event ev{};
-    ev.events = channel->events();
-    ev.data.ptr = channel;
+TimerId EventLoop::run_after(TimerClock::duration delay, TimerCallback cb)
+{
+    return run_at(TimerClock::now() + delay, move(cb));
+}
 
-    if (channels_.count(fd))
-    {
-        if (channel->is_none_event())
-        {
-            if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
-                log_write_error_information("epoll_ctl op=DEL fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
-        }
-        else
-        {
-            if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_MOD, fd, &ev) == -1)
-                log_write_error_information("epoll_ctl op=MOD fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
-            log_write_regular_information("MOD fd = " + to_string(fd) + " events = " + to_string(channel->events()));
-        }
-    }
-    else
+TimerId EventLoop::run_every(TimerClock::duration interval, TimerCallback cb)
+{
+    return timer_queue_->add_timer(move(cb), TimerClock::now() + interval, interval);
+}
+
+void EventLoop::cancel(TimerId timer_id)
+{
+    timer_queue_->cancel(timer_id);
+}
+
+void EventLoop::watch_signals(initializer_list<int> signals, SignalCallback cb)
+{
+    assert_in_loop_thread();
+    assert(!signal_channel_);
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signo : signals)
+        sigaddset(&mask, signo);
+    // A signalfd only sees signals that no thread is willing to take directly.
+    if (int err = ::pthread_sigmask(SIG_BLOCK, &mask, nullptr); err != 0)
     {
-        channels_[fd] = channel;
-        if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &ev) == -1)
-        {
-            log_write_error_information("epoll_ctl op=ADD fd=" + to_string(fd) + " failed: " + errno_to_string(errno));
-            channels_.erase(fd);
-        }
-        else
-            log_write_regular_information("ADD fd = " + to_string(fd) + " events = " + to_string(channel->events()));
+        errno = err;
+        util::fatal_perror("EventLoop::watch_signals pthread_sigmask failed");
     }
+    signal_fd_ = Socket(::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+    if (signal_fd_.fd() == -1)
+        util::fatal_perror("EventLoop::watch_signals signalfd failed");
+
+    signal_cb_ = move(cb);
+    signal_channel_ = make_unique<Channel>(this, signal_fd_.fd());
+    signal_channel_->on_read([this]
+                             { handle_signals(); });
+    signal_channel_->enable_reading();
+    SK_LOG_INFO("EventLoop {} watching {} signal(s) on signalfd {}", reinterpret_cast<uintptr_t>(this), signals.size(), signal_fd_.fd());
 }
 
-void EventLoop::remove_channel(Channel *channel)
+void EventLoop::update_channel(Channel *channel)
 {
     assert(channel->owner_loop() == this);
     assert_in_loop_thread();
-    int fd = channel->fd();
-    assert(channels_.count(fd));
-    assert(channels_[fd] == channel);
-    assert(channel->is_none_event());
-
-    log_write_regular_information("remove_channel fd = " + to_string(fd));
-    size_t n = channels_.erase(fd);
-    assert(n == 1);
+    poller_->update_channel(channel);
+}
 
-    if (::epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
-        if (errno != ENOENT)
-            log_write_error_information("epoll_ctl op=DEL fd=" + to_string(fd) + " failed during remove_channel: " + errno_to_string(errno));
+void EventLoop::remove_channel(Channel *channel)
+{
+    assert(channel->owner_loop() == this);
+    assert_in_loop_thread();
+    poller_->remove_channel(channel);
 }
 
 bool EventLoop::has_channel(Channel *channel)
 {
     assert(channel->owner_loop() == this);
     assert_in_loop_thread();
-    auto it = channels_.find(channel->fd());
-    return it != channels_.end() and it->second == channel;
+    return poller_->has_channel(channel);
 }
 
 void EventLoop::handle_read()
@@ -187,34 +169,52 @@ void EventLoop::handle_read()
     uint64_t one = 1;
     ssize_t n = ::read(wakeup_fd_.fd(), &one, sizeof one);
     if (n != sizeof one)
-        log_write_error_information("EventLoop::handle_read() reads " + to_string(n) + " bytes instead of 8 from wakeup fd " + to_string(wakeup_fd_.fd()));
-    log_write_regular_information("EventLoop woken up");
+        SK_LOG_ERROR("EventLoop::handle_read() reads {} bytes instead of 8 from wakeup fd {}", n, wakeup_fd_.fd());
 }
 
-void EventLoop::do_pending_functors()
+void EventLoop::handle_signals()
 {
-    vector<Functor> functors;
-    calling_pending_functors_ = true;
+    assert_in_loop_thread();
+    signalfd_siginfo info;
+    ssize_t n;
+    while ((n = ::read(signal_fd_.fd(), &info, sizeof info)) == sizeof info)
     {
-        lock_guard lock(mutex_);
-        functors.swap(pending_functors_);
+        int signo = static_cast<int>(info.ssi_signo);
+        SK_LOG_INFO("EventLoop {} received signal {} ({}) from pid {}", reinterpret_cast<uintptr_t>(this), signo, ::strsignal(signo), info.ssi_pid);
+        signal_cb_(signo);
     }
+    if (n < 0 and errno != EAGAIN)
+        SK_LOG_ERROR("EventLoop::handle_signals read error on signalfd {}: {}", signal_fd_.fd(), errno_to_string(errno));
+}
 
-    log_write_regular_information("Executing " + to_string(functors.size()) + " pending functors");
-    for (const Functor &functor : functors)
+void EventLoop::do_pending_functors()
+{
+    calling_pending_functors_ = true;
+    // Clearing the flag before draining means a post that races with the drain either
+    // lands in this pass or wakes the loop again, never neither.
+    wakeup_pending_.exchange(false, memory_order_acq_rel);
+
+    Functor functor;
+    size_t executed = 0;
+    for (; (executed < kMaxFunctorsPerPass or quit_) and pending_functors_.pop(functor); ++executed)
         try
         {
             functor();
         }
         catch (const exception &e)
         {
-            log_write_error_information("Pending functor exception: " + string(e.what()));
+            SK_LOG_ERROR("Pending functor exception: {}", e.what());
         }
         catch (...)
         {
-            log_write_error_information("Pending functor unknown exception.");
+            SK_LOG_ERROR("Pending functor unknown exception.");
         }
+    functor = nullptr;
     calling_pending_functors_ = false;
+
+    // Leave the rest for the next iteration so a flood of posts cannot starve I/O.
+    if (executed >= kMaxFunctorsPerPass and !quit_ and !wakeup_pending_.exchange(true, memory_order_acq_rel))
+        wakeup();
 }
 
 void EventLoop::abort_not_in_loop_thread()
@@ -223,7 +223,7 @@ void EventLoop::abort_not_in_loop_thread()
                        to_string(reinterpret_cast<uintptr_t>(this)) +
                        " was created in threadId_ = " + to_string(hash<thread::id>{}(thread_id_)) +
                        ", current thread id = " + to_string(hash<thread::id>{}(this_thread::get_id()));
-    log_write_error_information("FATAL ERROR: " + error_msg);
+    SK_LOG_ERROR("FATAL ERROR: {}", error_msg);
     abort();
 }
 
@@ -232,6 +232,5 @@ void EventLoop::wakeup()
     uint64_t one = 1;
     ssize_t n = ::write(wakeup_fd_.fd(), &one, sizeof one);
     if (n != sizeof(one))
-        log_write_error_information("EventLoop::wakeup() writes " + to_string(n) + " bytes instead of 8 to wakeup fd " + to_string(wakeup_fd_.fd()) + ": " + errno_to_string(errno));
-    log_write_regular_information("Waking up loop thread");
+        SK_LOG_ERROR("EventLoop::wakeup() writes {} bytes instead of 8 to wakeup fd {}: {}", n, wakeup_fd_.fd(), errno_to_string(errno));
 }
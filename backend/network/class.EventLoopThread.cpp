@@ -0,0 +1,65 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_EVENTLOOPTHREAD_CPP
+#include "network.hpp"
+using namespace net;
+
+EventLoopThread::EventLoopThread(string name)
+    : loop_{nullptr},
+      name_{move(name)}
+{
+}
+
+EventLoopThread::~EventLoopThread()
+{
+    {
+        lock_guard lock(mutex_);
+        if (loop_ != nullptr)
+            loop_->quit();
+    }
+    if (thread_.joinable())
+        thread_.join();
+    SK_LOG_INFO("EventLoopThread [{}] joined.", name_);
+}
+
+EventLoop *EventLoopThread::start_loop()
+{
+    assert(!thread_.joinable());
+    thread_ = thread([this]
+                     { thread_func(); });
+
+    unique_lock lock(mutex_);
+    cv_.wait(lock, [this]
+             { return loop_ != nullptr; });
+    return loop_;
+}
+
+void EventLoopThread::thread_func()
+{
+    EventLoop loop;
+    {
+        lock_guard lock(mutex_);
+        loop_ = &loop;
+    }
+    cv_.notify_one();
+    SK_LOG_INFO("EventLoopThread [{}] running loop {}", name_, reinterpret_cast<uintptr_t>(&loop));
+
+    loop.loop();
+
+    lock_guard lock(mutex_);
+    loop_ = nullptr;
+}
@@ -0,0 +1,94 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_EVENTLOOPTHREADPOOL_CPP
+#include "network.hpp"
+using namespace net;
+
+EventLoopThreadPool::EventLoopThreadPool(EventLoop *base_loop, string name)
+    : base_loop_{base_loop},
+      name_{move(name)},
+      started_{false},
+      num_threads_{thread::hardware_concurrency()},
+      next_{0},
+      strategy_{Strategy::kRoundRobin}
+{
+}
+
+EventLoopThreadPool::~EventLoopThreadPool()
+{
+    SK_LOG_INFO("EventLoopThreadPool [{}] stopping {} loop thread(s).", name_, threads_.size());
+}
+
+void EventLoopThreadPool::start()
+{
+    assert(!started_);
+    base_loop_->assert_in_loop_thread();
+    started_ = true;
+
+    for (size_t i = 0; i < num_threads_; ++i)
+    {
+        threads_.push_back(make_unique<EventLoopThread>(name_ + "-io" + to_string(i)));
+        loops_.push_back(threads_.back()->start_loop());
+    }
+    loads_.assign(loops_.size(), 0);
+    SK_LOG_INFO("EventLoopThreadPool [{}] started with {} I/O loop(s).", name_, loops_.size());
+}
+
+EventLoop *EventLoopThreadPool::get_next_loop()
+{
+    base_loop_->assert_in_loop_thread();
+    assert(started_);
+    if (loops_.empty())
+        return base_loop_;
+
+    size_t index = 0;
+    if (strategy_ == Strategy::kLeastConnections)
+    {
+        for (size_t i = 1; i < loads_.size(); ++i)
+            if (loads_[i] < loads_[index])
+                index = i;
+    }
+    else
+    {
+        index = next_;
+        next_ = (next_ + 1) % loops_.size();
+    }
+
+    ++loads_[index];
+    return loops_[index];
+}
+
+void EventLoopThreadPool::release_loop(EventLoop *loop)
+{
+    base_loop_->assert_in_loop_thread();
+    for (size_t i = 0; i < loops_.size(); ++i)
+        if (loops_[i] == loop)
+        {
+            if (loads_[i] > 0)
+                --loads_[i];
+            return;
+        }
+}
+
+vector<EventLoop *> EventLoopThreadPool::get_all_loops()
+{
+    base_loop_->assert_in_loop_thread();
+    assert(started_);
+    if (loops_.empty())
+        return vector<EventLoop *>(1, base_loop_);
+    return loops_;
+}
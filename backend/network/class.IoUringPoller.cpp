@@ -0,0 +1,321 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_IOURINGPOLLER_CPP
+#include "network.hpp"
+using namespace net;
+
+namespace
+{
+    int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t arg_size)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size));
+    }
+
+    void unmap_ring(void *ring, size_t size)
+    {
+        if (ring != nullptr)
+            ::munmap(ring, size);
+    }
+}
+
+IoUringPoller::IoUringPoller(EventLoop *loop, int ring_fd)
+    : Poller{loop},
+      ring_fd_{ring_fd},
+      sq_ring_{nullptr},
+      sq_ring_size_{0},
+      cq_ring_{nullptr},
+      cq_ring_size_{0},
+      sqes_{nullptr},
+      sqes_size_{0},
+      sq_head_{nullptr},
+      sq_tail_{nullptr},
+      sq_array_{nullptr},
+      sq_mask_{0},
+      sq_entries_{0},
+      cq_head_{nullptr},
+      cq_tail_{nullptr},
+      cqes_{nullptr},
+      cq_mask_{0},
+      to_submit_{0},
+      next_generation_{1},
+      multishot_supported_{true},
+      ext_arg_supported_{false}
+{
+}
+
+IoUringPoller::~IoUringPoller()
+{
+    unmap_ring(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_)
+        unmap_ring(cq_ring_, cq_ring_size_);
+    unmap_ring(sq_ring_, sq_ring_size_);
+}
+
+unique_ptr<IoUringPoller> IoUringPoller::create(EventLoop *loop)
+{
+    struct io_uring_params params{};
+    int ring_fd = sys_io_uring_setup(kRingEntries, &params);
+    if (ring_fd == -1)
+    {
+        SK_LOG_WARNING("IoUringPoller::create - io_uring_setup failed: {}", errno_to_string(errno));
+        return nullptr;
+    }
+
+    unique_ptr<IoUringPoller> poller(new IoUringPoller(loop, ring_fd));
+    if (!poller->map_rings(params))
+        return nullptr;
+    poller->ext_arg_supported_ = params.features & IORING_FEAT_EXT_ARG;
+    SK_LOG_INFO("IoUringPoller created, ringfd={}, sq_entries={}, cq_entries={}", ring_fd, params.sq_entries, params.cq_entries);
+    return poller;
+}
+
+bool IoUringPoller::map_rings(const struct io_uring_params &params)
+{
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size_ = cq_ring_size_ = max(sq_ring_size_, cq_ring_size_);
+
+    void *sq_ring = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_.fd(), IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        SK_LOG_ERROR("IoUringPoller::map_rings - mmap of SQ ring failed: {}", errno_to_string(errno));
+        return false;
+    }
+    sq_ring_ = sq_ring;
+
+    if (single_mmap)
+        cq_ring_ = sq_ring_;
+    else
+    {
+        void *cq_ring = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_.fd(), IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            SK_LOG_ERROR("IoUringPoller::map_rings - mmap of CQ ring failed: {}", errno_to_string(errno));
+            return false;
+        }
+        cq_ring_ = cq_ring;
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_.fd(), IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        SK_LOG_ERROR("IoUringPoller::map_rings - mmap of SQE array failed: {}", errno_to_string(errno));
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+
+    char *cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    return true;
+}
+
+// Without SQPOLL the kernel only reads the SQ during io_uring_enter(), so the tail
+// may be published before the caller fills the entry in.
+struct io_uring_sqe *IoUringPoller::next_sqe()
+{
+    unsigned tail = *sq_tail_;
+    if (tail - atomic_ref<unsigned>(*sq_head_).load(memory_order_acquire) >= sq_entries_)
+    {
+        submit_and_wait(0, 0);
+        if (tail - atomic_ref<unsigned>(*sq_head_).load(memory_order_acquire) >= sq_entries_)
+            return nullptr;
+    }
+
+    unsigned index = tail & sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    atomic_ref<unsigned>(*sq_tail_).store(tail + 1, memory_order_release);
+    ++to_submit_;
+    return sqe;
+}
+
+int IoUringPoller::submit_and_wait(unsigned wait_nr, int timeout_ms)
+{
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    if (wait_nr > 0 and timeout_ms >= 0 and ext_arg_supported_)
+    {
+        struct __kernel_timespec ts{};
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        struct io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        ret = sys_io_uring_enter(ring_fd_.fd(), to_submit_, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    else
+        ret = sys_io_uring_enter(ring_fd_.fd(), to_submit_, timeout_ms == 0 ? 0 : wait_nr, flags, nullptr, 0);
+
+    if (ret >= 0)
+        to_submit_ -= min(to_submit_, static_cast<unsigned>(ret));
+    return ret;
+}
+
+void IoUringPoller::poll(int timeout_ms, ChannelList *active_channels)
+{
+    if (submit_and_wait(1, timeout_ms) == -1 and errno != EINTR and errno != ETIME)
+        SK_LOG_ERROR("IoUringPoller::poll() io_uring_enter() error: {}", errno_to_string(errno));
+    reap_completions(active_channels);
+}
+
+void IoUringPoller::reap_completions(ChannelList *active_channels)
+{
+    unsigned head = *cq_head_;
+    unsigned tail = atomic_ref<unsigned>(*cq_tail_).load(memory_order_acquire);
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe &cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == kRemoveUserData)
+            continue;
+
+        int fd = token_fd(cqe.user_data);
+        size_t index = static_cast<size_t>(fd);
+        if (fd < 0 or index >= registrations_.size())
+            continue;
+        Registration &reg = registrations_[index];
+        if (reg.channel == nullptr or reg.user_data != cqe.user_data)
+            continue;
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            reg.armed = false;
+        if (!reg.touched)
+        {
+            reg.touched = true;
+            touched_fds_.push_back(fd);
+        }
+
+        if (cqe.res >= 0)
+            reg.pending_revents |= static_cast<uint32_t>(cqe.res);
+        else if (cqe.res == -EINVAL and reg.armed_multishot)
+        {
+            SK_LOG_WARNING("IoUringPoller - multishot poll rejected by the kernel, re-arming one-shot polls instead.");
+            multishot_supported_ = false;
+        }
+        else if (cqe.res != -ECANCELED)
+            SK_LOG_ERROR("IoUringPoller - poll on fd {} failed: {}", fd, errno_to_string(-cqe.res));
+    }
+    atomic_ref<unsigned>(*cq_head_).store(head, memory_order_release);
+
+    for (int fd : touched_fds_)
+    {
+        Registration &reg = registrations_[static_cast<size_t>(fd)];
+        reg.touched = false;
+        if (reg.pending_revents != 0)
+        {
+            reg.channel->set_revents(reg.pending_revents);
+            reg.pending_revents = 0;
+            active_channels->push_back(ReadyChannel{reg.channel, fd, generation_of(fd)});
+        }
+        if (!reg.armed and !reg.channel->is_none_event())
+            arm(reg);
+    }
+    touched_fds_.clear();
+}
+
+void IoUringPoller::arm(Registration &reg)
+{
+    struct io_uring_sqe *sqe = next_sqe();
+    if (sqe == nullptr)
+    {
+        SK_LOG_ERROR("IoUringPoller::arm - submission queue full, fd {} not armed.", reg.channel->fd());
+        return;
+    }
+
+    if (next_generation_ == 0)
+        ++next_generation_;
+    reg.user_data = make_token(reg.channel->fd(), next_generation_++);
+    reg.armed_events = reg.channel->events();
+    reg.armed_multishot = multishot_supported_ and reg.channel->is_edge_triggered();
+    reg.armed = true;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = reg.channel->fd();
+    sqe->poll32_events = reg.armed_events;
+    sqe->len = reg.armed_multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = reg.user_data;
+}
+
+void IoUringPoller::disarm(Registration &reg)
+{
+    if (!reg.armed)
+        return;
+
+    struct io_uring_sqe *sqe = next_sqe();
+    if (sqe == nullptr)
+        SK_LOG_ERROR("IoUringPoller::disarm - submission queue full, stale poll on fd {} left armed.", reg.channel->fd());
+    else
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = reg.user_data;
+        sqe->user_data = kRemoveUserData;
+    }
+    reg.armed = false;
+    reg.user_data = 0;
+}
+
+void IoUringPoller::update_channel(Channel *channel)
+{
+    const int fd = channel->fd();
+    assert(fd >= 0);
+    const size_t index = static_cast<size_t>(fd);
+    if (find_channel(fd) != channel)
+    {
+        insert_channel(channel);
+        if (index >= registrations_.size())
+            registrations_.resize(max(index + 1, registrations_.size() * 2), Registration{nullptr, 0, 0, false, false, 0, false});
+        registrations_[index] = Registration{channel, 0, 0, false, false, 0, false};
+    }
+    Registration &reg = registrations_[index];
+
+    bool multishot = multishot_supported_ and channel->is_edge_triggered();
+    if (reg.armed and reg.armed_events == channel->events() and reg.armed_multishot == multishot)
+        return;
+    disarm(reg);
+    if (!channel->is_none_event())
+        arm(reg);
+}
+
+void IoUringPoller::remove_channel(Channel *channel)
+{
+    int fd = channel->fd();
+    assert(find_channel(fd) == channel);
+    assert(channel->is_none_event());
+
+    SK_LOG_DEBUG("remove_channel fd = {}", fd);
+    erase_channel(fd);
+    Registration &reg = registrations_[static_cast<size_t>(fd)];
+    disarm(reg);
+    reg.channel = nullptr;
+}
@@ -0,0 +1,294 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _CLASS_LISTENERHANDOFF_CPP
+#include "network.hpp"
+using namespace net;
+
+namespace
+{
+    constexpr string_view kReadyMessage = "ready";
+    constexpr size_t kMaxNamesLength = 4096;
+}
+
+ListenerHandoff::ListenerHandoff(EventLoop *loop, Socket channel, pid_t successor)
+    : loop_{loop},
+      channel_{move(channel)},
+      successor_{successor}
+{
+}
+
+ListenerHandoff::~ListenerHandoff()
+{
+    if (channel_watch_ and channel_.fd() != -1)
+    {
+        loop_->cancel(timeout_);
+        channel_watch_->disable_all();
+        channel_watch_->remove();
+        // Abandoned before the successor confirmed, e.g. the server was stopped meanwhile.
+        ::kill(successor_, SIGKILL);
+        int status;
+        ::waitpid(successor_, &status, 0);
+    }
+}
+
+/* static */ shared_ptr<ListenerHandoff> ListenerHandoff::spawn(EventLoop *loop, const vector<string> &argv, const vector<Listener> &listeners, DoneCallback on_done)
+{
+    loop->assert_in_loop_thread();
+    assert(!argv.empty());
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+        SK_LOG_ERROR("ListenerHandoff::spawn socketpair failed: {}", errno_to_string(errno));
+        return nullptr;
+    }
+    Socket ours{fds[0]};
+    Socket theirs{fds[1]};
+    // dup2() onto the same number would leave FD_CLOEXEC set and the channel would not survive exec.
+    if (theirs.fd() == kChannelFd)
+        theirs = Socket(::fcntl(theirs.fd(), F_DUPFD_CLOEXEC, kChannelFd + 1));
+
+    // The message waits in the socket buffer until the successor reads it during startup.
+    if (!send_listeners(ours.fd(), listeners))
+        return nullptr;
+    pid_t pid = spawn_successor(argv, theirs.fd());
+    if (pid < 0)
+        return nullptr;
+    theirs.close();
+
+    int flags = ::fcntl(ours.fd(), F_GETFL);
+    if (flags == -1 or ::fcntl(ours.fd(), F_SETFL, flags | O_NONBLOCK) == -1)
+        SK_LOG_WARNING("ListenerHandoff::spawn - could not make the channel non-blocking: {}", errno_to_string(errno));
+
+    shared_ptr<ListenerHandoff> handoff(new ListenerHandoff(loop, move(ours), pid));
+    handoff->on_done_ = move(on_done);
+    handoff->channel_watch_ = make_unique<Channel>(loop, handoff->channel_.fd());
+    handoff->channel_watch_->tie(handoff);
+    handoff->channel_watch_->on_read([raw = handoff.get()]
+                                     { raw->handle_read(); });
+    handoff->channel_watch_->enable_reading();
+    handoff->timeout_ = loop->run_after(kReadyTimeout, [weak_self = weak_ptr<ListenerHandoff>(handoff)]()
+                                        {
+        if (shared_ptr<ListenerHandoff> self = weak_self.lock())
+        {
+            SK_LOG_ERROR("ListenerHandoff - successor {} not ready after {} s.", self->successor_, kReadyTimeout.count());
+            self->finish(false);
+        } });
+    SK_LOG_INFO("ListenerHandoff - spawned successor {} ({}) with {} listener(s).", pid, argv[0], listeners.size());
+    return handoff;
+}
+
+/* static */ bool ListenerHandoff::send_listeners(int channel_fd, const vector<Listener> &listeners)
+{
+    if (listeners.empty() or listeners.size() > kMaxListeners)
+    {
+        SK_LOG_ERROR("ListenerHandoff - cannot hand over {} listeners (1 to {} supported).", listeners.size(), kMaxListeners);
+        return false;
+    }
+
+    string names;
+    vector<int> fds;
+    for (const auto &[name, fd] : listeners)
+    {
+        if (fd < 0 or name.empty() or name.find('\n') != string::npos)
+        {
+            SK_LOG_ERROR("ListenerHandoff - invalid listener '{}' (fd {}).", name, fd);
+            return false;
+        }
+        names.append(name).push_back('\n');
+        fds.push_back(fd);
+    }
+
+    iovec iov{names.data(), names.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxListeners)]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    if (::sendmsg(channel_fd, &msg, MSG_NOSIGNAL) < 0)
+    {
+        SK_LOG_ERROR("ListenerHandoff - sendmsg failed: {}", errno_to_string(errno));
+        return false;
+    }
+    return true;
+}
+
+/* static */ pid_t ListenerHandoff::spawn_successor(const vector<string> &argv, int channel_fd)
+{
+    vector<char *> args;
+    for (const string &arg : argv)
+        args.push_back(const_cast<char *>(arg.c_str()));
+    args.push_back(nullptr);
+
+    string channel_prefix = string(kChannelEnv) + "=";
+    string channel_entry = channel_prefix + to_string(kChannelFd);
+    vector<char *> env;
+    for (char **entry = environ; *entry != nullptr; ++entry)
+        if (!string_view(*entry).starts_with(channel_prefix))
+            env.push_back(*entry);
+    env.push_back(channel_entry.data());
+    env.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, channel_fd, kChannelFd);
+    // This process blocks the signals it reads from a signalfd, and the mask survives exec.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid = -1;
+    int err = ::posix_spawn(&pid, args[0], &actions, &attr, args.data(), env.data());
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0)
+    {
+        SK_LOG_ERROR("ListenerHandoff - posix_spawn {} failed: {}", argv[0], errno_to_string(err));
+        return -1;
+    }
+    return pid;
+}
+
+void ListenerHandoff::handle_read()
+{
+    loop_->assert_in_loop_thread();
+    char message[16];
+    ssize_t n = ::recv(channel_.fd(), message, sizeof message, 0);
+    if (n < 0 and (errno == EAGAIN or errno == EINTR))
+        return;
+
+    bool ready = n >= 0 and string_view(message, static_cast<size_t>(n)) == kReadyMessage;
+    if (ready)
+        SK_LOG_INFO("ListenerHandoff - successor {} is accepting.", successor_);
+    else if (n == 0)
+        SK_LOG_ERROR("ListenerHandoff - successor {} closed the channel before it was ready.", successor_);
+    else if (n < 0)
+        SK_LOG_ERROR("ListenerHandoff - recv from successor {} failed: {}", successor_, errno_to_string(errno));
+    else
+        SK_LOG_ERROR("ListenerHandoff - unexpected message from successor {}.", successor_);
+    finish(ready);
+}
+
+void ListenerHandoff::finish(bool ready)
+{
+    if (channel_.fd() == -1)
+        return;
+    loop_->cancel(timeout_);
+    channel_watch_->disable_all();
+    channel_watch_->remove();
+    channel_.close();
+
+    if (!ready)
+    {
+        // A successor that never confirmed may still have started accepting on the shared
+        // sockets; it must not keep competing with this process for connections.
+        ::kill(successor_, SIGKILL);
+        int status;
+        ::waitpid(successor_, &status, 0);
+    }
+
+    DoneCallback cb = move(on_done_);
+    on_done_ = nullptr;
+    if (cb)
+        cb(ready);
+}
+
+/* static */ unique_ptr<ListenerHandoff> ListenerHandoff::inherit()
+{
+    const char *channel_env = getenv(kChannelEnv);
+    if (channel_env == nullptr)
+        return nullptr;
+    int fd = atoi(channel_env);
+    // Neither the compilers nor the programs this process runs should see the channel.
+    ::unsetenv(kChannelEnv);
+    if (fd < 0 or ::fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+    {
+        SK_LOG_ERROR("ListenerHandoff::inherit - handoff channel fd {} is not open.", fd);
+        return nullptr;
+    }
+    unique_ptr<ListenerHandoff> handoff(new ListenerHandoff(nullptr, Socket(fd), -1));
+
+    char names[kMaxNamesLength];
+    iovec iov{names, sizeof names};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxListeners)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+    {
+        SK_LOG_ERROR("ListenerHandoff::inherit - no listeners received: {}", n < 0 ? errno_to_string(errno) : string("channel closed"));
+        return handoff;
+    }
+
+    vector<Socket> fds;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_RIGHTS)
+            for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); ++i)
+            {
+                int received;
+                memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fds.emplace_back(received);
+            }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        SK_LOG_ERROR("ListenerHandoff::inherit - handoff message truncated, some listeners are lost.");
+
+    string_view remaining(names, static_cast<size_t>(n));
+    for (Socket &listener : fds)
+    {
+        size_t end = remaining.find('\n');
+        if (end == string_view::npos)
+            break;
+        handoff->inherited_.emplace(string(remaining.substr(0, end)), move(listener));
+        remaining.remove_prefix(end + 1);
+    }
+    SK_LOG_INFO("ListenerHandoff::inherit - received {} listener(s) from the predecessor.", handoff->inherited_.size());
+    return handoff;
+}
+
+Socket ListenerHandoff::take_listener(const string &name)
+{
+    auto it = inherited_.find(name);
+    if (it == inherited_.end())
+        return Socket{};
+    Socket listener = move(it->second);
+    inherited_.erase(it);
+    return listener;
+}
+
+void ListenerHandoff::notify_ready()
+{
+    if (::send(channel_.fd(), kReadyMessage.data(), kReadyMessage.size(), MSG_NOSIGNAL) < 0)
+        SK_LOG_ERROR("ListenerHandoff::notify_ready - send failed: {}", errno_to_string(errno));
+    channel_.close();
+    if (!inherited_.empty())
+        SK_LOG_WARNING("ListenerHandoff::notify_ready - {} inherited listener(s) were not used.", inherited_.size());
+    inherited_.clear();
+}
@@ -0,0 +1,149 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _CLASS_METRICSHTTPSERVER_CPP
+#include "network.hpp"
+using namespace net;
+
+MetricsHttpServer::MetricsHttpServer(EventLoop *loop, uint16_t port)
+    : loop_{loop},
+      acceptor_{loop, port, false},
+      next_conn_id_{1}
+{
+    install_accept_callback();
+    SK_LOG_INFO("MetricsHttpServer created on port {}", port);
+}
+
+MetricsHttpServer::MetricsHttpServer(EventLoop *loop, Socket listen_socket)
+    : loop_{loop},
+      acceptor_{loop, move(listen_socket)},
+      next_conn_id_{1}
+{
+    install_accept_callback();
+    SK_LOG_INFO("MetricsHttpServer created on an inherited socket");
+}
+
+void MetricsHttpServer::install_accept_callback()
+{
+    acceptor_.set_new_connection_callback(
+        [this](int sockfd, const sockaddr_in &peer_addr)
+        {
+            new_connection(sockfd, peer_addr);
+        });
+}
+
+MetricsHttpServer::~MetricsHttpServer()
+{
+    loop_->assert_in_loop_thread();
+    for (auto &[conn_name, conn] : connections_)
+        conn->connect_destroyed();
+    connections_.clear();
+}
+
+void MetricsHttpServer::start()
+{
+    loop_->run_in_loop([this]()
+                       { acceptor_.listen(); });
+}
+
+void MetricsHttpServer::new_connection(int sockfd, const sockaddr_in &peer_addr)
+{
+    loop_->assert_in_loop_thread();
+    sockaddr_in local_addr{};
+    socklen_t addrlen = sizeof(local_addr);
+    if (::getsockname(sockfd, reinterpret_cast<sockaddr *>(&local_addr), &addrlen) < 0)
+    {
+        SK_LOG_ERROR("MetricsHttpServer::new_connection - Failed to get local address for fd {}: {}", sockfd, errno_to_string(errno));
+        ::close(sockfd);
+        return;
+    }
+
+    string conn_name = "metrics-http#" + to_string(next_conn_id_++);
+    TcpConnectionPtr conn = make_shared<TcpConnection>(loop_, conn_name, sockfd, local_addr, peer_addr);
+    connections_[conn_name] = conn;
+    conn->set_message_callback(
+        [this](const TcpConnectionPtr &c, Buffer *b)
+        {
+            return on_message(c, b);
+        });
+    conn->set_close_callback(
+        [this](const TcpConnectionPtr &c)
+        {
+            remove_connection(c);
+        });
+    conn->connect_established();
+
+    loop_->run_after(kRequestTimeout, [weak_conn = weak_ptr<TcpConnection>(conn)]()
+                     {
+        if (TcpConnectionPtr c = weak_conn.lock())
+            c->force_close(); });
+}
+
+tuple<unique_ptr<char[]>, size_t> MetricsHttpServer::on_message(const TcpConnectionPtr &conn, Buffer *buf)
+{
+    size_t readable = buf->readable_bytes();
+    if (readable > kMaxRequestSize)
+    {
+        buf->retrieve_all();
+        conn->send("HTTP/1.0 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        conn->shutdown();
+        return {nullptr, 0};
+    }
+
+    string request(readable, '\0');
+    buf->copy_out(0, request.data(), readable);
+    if (request.find("\r\n\r\n") == string::npos and request.find("\n\n") == string::npos)
+        return {nullptr, 0};
+
+    buf->retrieve_all();
+    string_view request_line(request);
+    request_line = request_line.substr(0, request_line.find_first_of("\r\n"));
+    conn->send(response_for(request_line));
+    conn->shutdown();
+    return {nullptr, 0};
+}
+
+/* static */ string MetricsHttpServer::response_for(string_view request_line)
+{
+    string_view method = request_line.substr(0, request_line.find(' '));
+    string_view target = request_line.substr(min(request_line.size(), method.size() + 1));
+    target = target.substr(0, target.find(' '));
+
+    string status = "200 OK";
+    string body;
+    if (method != "GET")
+        status = "405 Method Not Allowed";
+    else if (target != "/metrics" and target != "/")
+        status = "404 Not Found";
+    else
+        body = MetricsRegistry::render();
+
+    string response = "HTTP/1.0 " + status + "\r\n";
+    response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    response += "Content-Length: " + to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    return response;
+}
+
+void MetricsHttpServer::remove_connection(const TcpConnectionPtr &conn)
+{
+    loop_->assert_in_loop_thread();
+    connections_.erase(conn->name());
+    loop_->queue_in_loop([conn]()
+                         { conn->connect_destroyed(); });
+}
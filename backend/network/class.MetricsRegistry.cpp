@@ -0,0 +1,273 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _CLASS_METRICSREGISTRY_CPP
+#include "network.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace
+{
+    thread_local bool local_shard_destroyed = false;
+
+    void append_sample(string &out, string_view name, string_view suffix, string_view labels, string_view extra_label, string_view value)
+    {
+        out.append(name).append(suffix);
+        if (!labels.empty() or !extra_label.empty())
+        {
+            out.push_back('{');
+            out.append(labels);
+            if (!labels.empty() and !extra_label.empty())
+                out.push_back(',');
+            out.append(extra_label);
+            out.push_back('}');
+        }
+        out.push_back(' ');
+        out.append(value);
+        out.push_back('\n');
+    }
+
+    string seconds_from_micros(uint64_t micros)
+    {
+        char buf[32];
+        snprintf(buf, sizeof buf, "%.6f", static_cast<double>(micros) / 1e6);
+        return buf;
+    }
+}
+
+struct MetricsRegistry::State
+{
+    mutex lock;
+    vector<Family> families;
+    unordered_map<string, Id> index;
+    size_t next_cell = 1; // cell 0 absorbs updates to metrics that did not fit
+    vector<Shard *> shards;
+    array<int64_t, kMaxCells> retired{};
+};
+
+MetricsRegistry::State &MetricsRegistry::state()
+{
+    // Leaked on purpose: thread-local shards fold into it during thread exit, which may
+    // happen after static destructors have run.
+    static State *registry_state = new State;
+    return *registry_state;
+}
+
+MetricsRegistry::Shard::Shard()
+{
+    State &registry = state();
+    lock_guard lk{registry.lock};
+    registry.shards.push_back(this);
+}
+
+MetricsRegistry::Shard::~Shard()
+{
+    local_shard_destroyed = true;
+    State &registry = state();
+    lock_guard lk{registry.lock};
+    for (size_t i = 0; i < kMaxCells; ++i)
+        registry.retired[i] += cells[i].load(memory_order_relaxed);
+    erase(registry.shards, this);
+}
+
+MetricsRegistry::Shard *MetricsRegistry::local() noexcept
+{
+    if (local_shard_destroyed)
+        return nullptr;
+    thread_local Shard shard;
+    return &shard;
+}
+
+MetricsRegistry::Id MetricsRegistry::register_family(Kind kind, string_view name, string_view help, string_view labels)
+{
+    State &registry = state();
+    string key = string(name) + '{' + string(labels) + '}';
+    lock_guard lk{registry.lock};
+    if (auto it = registry.index.find(key); it != registry.index.end())
+        return it->second;
+
+    size_t cells = kind == Kind::kHistogram ? kHistogramBuckets + 1 : 1;
+    if (registry.next_cell + cells > kMaxCells)
+    {
+        SK_LOG_ERROR("MetricsRegistry - no room left for metric {}, updates to it are dropped.", key);
+        return 0;
+    }
+
+    Id id = static_cast<Id>(registry.next_cell);
+    registry.next_cell += cells;
+    registry.families.push_back(Family{string(name), string(help), string(labels), kind, id});
+    registry.index.emplace(move(key), id);
+    return id;
+}
+
+MetricsRegistry::Id MetricsRegistry::counter(string_view name, string_view help, string_view labels)
+{
+    return register_family(Kind::kCounter, name, help, labels);
+}
+
+MetricsRegistry::Id MetricsRegistry::gauge(string_view name, string_view help, string_view labels)
+{
+    return register_family(Kind::kGauge, name, help, labels);
+}
+
+MetricsRegistry::Id MetricsRegistry::histogram(string_view name, string_view help, string_view labels)
+{
+    return register_family(Kind::kHistogram, name, help, labels);
+}
+
+string MetricsRegistry::label(string_view key, string_view value)
+{
+    string out(key);
+    out.append("=\"");
+    for (char c : value)
+    {
+        if (c == '\\' or c == '"')
+            out.push_back('\\');
+        if (c == '\n')
+        {
+            out.append("\\n");
+            continue;
+        }
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
+
+void MetricsRegistry::add(Id id, int64_t delta) noexcept
+{
+    Shard *shard = local();
+    if (shard == nullptr)
+        return;
+    atomic<int64_t> &cell = shard->cells[id];
+    cell.store(cell.load(memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+void MetricsRegistry::observe(Id histogram, uint64_t micros) noexcept
+{
+    Shard *shard = local();
+    if (shard == nullptr or histogram == 0)
+        return;
+    atomic<int64_t> &bucket = shard->cells[histogram + bucket_index(micros)];
+    bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic<int64_t> &sum = shard->cells[histogram + kHistogramBuckets];
+    sum.store(sum.load(memory_order_relaxed) + static_cast<int64_t>(micros), memory_order_relaxed);
+}
+
+// Log-linear buckets: values below kSubBuckets get one bucket each, every power of two
+// above that is split into kSubBuckets equal slices.
+size_t MetricsRegistry::bucket_index(uint64_t value) noexcept
+{
+    if (value < kSubBuckets)
+        return static_cast<size_t>(value);
+    unsigned msb = 63 - static_cast<unsigned>(countl_zero(value));
+    if (msb > kMaxExponent)
+        return kHistogramBuckets - 1;
+    unsigned shift = msb - kSubBucketBits;
+    return (msb - kSubBucketBits + 1) * kSubBuckets + static_cast<size_t>((value >> shift) & (kSubBuckets - 1));
+}
+
+uint64_t MetricsRegistry::bucket_lower_bound(size_t index) noexcept
+{
+    if (index < kSubBuckets)
+        return index;
+    size_t group = index / kSubBuckets;
+    return static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << (group - 1);
+}
+
+vector<int64_t> MetricsRegistry::collect()
+{
+    State &registry = state();
+    lock_guard lk{registry.lock};
+    vector<int64_t> totals(registry.retired.begin(), registry.retired.end());
+    for (Shard *shard : registry.shards)
+        for (size_t i = 0; i < kMaxCells; ++i)
+            totals[i] += shard->cells[i].load(memory_order_relaxed);
+    return totals;
+}
+
+string MetricsRegistry::render()
+{
+    vector<Family> families;
+    {
+        State &registry = state();
+        lock_guard lk{registry.lock};
+        families = registry.families;
+    }
+    vector<int64_t> totals = collect();
+    stable_sort(families.begin(), families.end(), [](const Family &a, const Family &b)
+                { return a.name < b.name; });
+
+    string out;
+    out.reserve(families.size() * 128);
+    string_view previous_name;
+    for (const Family &family : families)
+    {
+        if (family.name != previous_name)
+        {
+            static constexpr const char *kTypeNames[] = {"counter", "gauge", "histogram"};
+            out.append("# HELP ").append(family.name).append(" ").append(family.help).append("\n");
+            out.append("# TYPE ").append(family.name).append(" ").append(kTypeNames[static_cast<int>(family.kind)]).append("\n");
+            previous_name = family.name;
+        }
+
+        if (family.kind != Kind::kHistogram)
+        {
+            append_sample(out, family.name, "", family.labels, "", to_string(totals[family.id]));
+            continue;
+        }
+
+        size_t last_used = 0;
+        for (size_t i = 0; i < kHistogramBuckets - 1; ++i)
+            if (totals[family.id + i] != 0)
+                last_used = i + 1;
+
+        int64_t cumulative = 0;
+        for (size_t i = 0; i < last_used; ++i)
+        {
+            cumulative += totals[family.id + i];
+            append_sample(out, family.name, "_bucket", family.labels, label("le", seconds_from_micros(bucket_lower_bound(i + 1) - 1)), to_string(cumulative));
+        }
+        for (size_t i = last_used; i < kHistogramBuckets; ++i)
+            cumulative += totals[family.id + i];
+        append_sample(out, family.name, "_bucket", family.labels, "le=\"+Inf\"", to_string(cumulative));
+        append_sample(out, family.name, "_sum", family.labels, "", seconds_from_micros(static_cast<uint64_t>(totals[family.id + kHistogramBuckets])));
+        append_sample(out, family.name, "_count", family.labels, "", to_string(cumulative));
+    }
+
+    BufferBlockPool::Stats pool = BufferBlockPool::stats();
+    out.append("# TYPE simplek_buffer_pool_bytes gauge\n");
+    append_sample(out, "simplek_buffer_pool_bytes", "", "state=\"in_use\"", "", to_string(pool.bytes_in_use));
+    append_sample(out, "simplek_buffer_pool_bytes", "", "state=\"peak\"", "", to_string(pool.peak_bytes_in_use));
+    append_sample(out, "simplek_buffer_pool_bytes", "", "state=\"cached\"", "", to_string(pool.bytes_cached));
+    out.append("# TYPE simplek_buffer_pool_acquires_total counter\n");
+    append_sample(out, "simplek_buffer_pool_acquires_total", "", "", "", to_string(pool.acquires));
+    out.append("# TYPE simplek_buffer_pool_cache_hits_total counter\n");
+    append_sample(out, "simplek_buffer_pool_cache_hits_total", "", "", "", to_string(pool.cache_hits));
+
+    logging::Stats log = logging::stats();
+    out.append("# TYPE simplek_log_queued_bytes gauge\n");
+    append_sample(out, "simplek_log_queued_bytes", "", "", "", to_string(log.queued_bytes));
+    out.append("# TYPE simplek_log_written_bytes_total counter\n");
+    append_sample(out, "simplek_log_written_bytes_total", "", "", "", to_string(log.bytes_written));
+    out.append("# TYPE simplek_log_producer_stalls_total counter\n");
+    append_sample(out, "simplek_log_producer_stalls_total", "", "", "", to_string(log.producer_stalls));
+    out.append("# TYPE simplek_log_rotations_total counter\n");
+    append_sample(out, "simplek_log_rotations_total", "", "", "", to_string(log.rotations));
+    return out;
+}
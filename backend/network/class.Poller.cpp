@@ -0,0 +1,47 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_POLLER_CPP
+#include "network.hpp"
+using namespace net;
+
+bool Poller::has_channel(Channel *channel) const noexcept
+{
+    return find_channel(channel->fd()) == channel;
+}
+
+uint32_t Poller::insert_channel(Channel *channel)
+{
+    size_t fd = static_cast<size_t>(channel->fd());
+    if (fd >= slots_.size())
+        slots_.resize(max(fd + 1, slots_.size() * 2), ChannelSlot{nullptr, 0});
+    ChannelSlot &slot = slots_[fd];
+    assert(slot.channel == nullptr);
+    slot.channel = channel;
+    return ++slot.generation;
+}
+
+unique_ptr<Poller> Poller::new_default_poller(EventLoop *loop)
+{
+    const char *backend = ::getenv("SIMPLE_K_POLLER");
+    if (backend != nullptr and string_view(backend) == "io_uring")
+    {
+        if (unique_ptr<IoUringPoller> poller = IoUringPoller::create(loop))
+            return poller;
+        SK_LOG_WARNING("Poller::new_default_poller - io_uring is not available, falling back to epoll.");
+    }
+    return make_unique<EpollPoller>(loop);
+}
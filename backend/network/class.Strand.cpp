@@ -0,0 +1,90 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_STRAND_CPP
+#include "network.hpp"
+
+void Strand::post(Task task)
+{
+    bool need_schedule = false;
+    {
+        lock_guard lock(mutex_);
+        tasks_.push(move(task));
+        if (!running_)
+        {
+            running_ = true;
+            need_schedule = true;
+        }
+    }
+
+    if (need_schedule)
+        pool_.enqueue([self = shared_from_this()]()
+                      { self->run(); });
+}
+
+size_t Strand::pending()
+{
+    lock_guard lock(mutex_);
+    return tasks_.size();
+}
+
+bool Strand::busy()
+{
+    lock_guard lock(mutex_);
+    return running_ or !tasks_.empty();
+}
+
+void Strand::run()
+{
+    for (size_t executed = 0; executed < kMaxTasksPerRun; ++executed)
+    {
+        Task task;
+        {
+            lock_guard lock(mutex_);
+            if (tasks_.empty())
+            {
+                running_ = false;
+                return;
+            }
+            task = move(tasks_.front());
+            tasks_.pop();
+        }
+
+        try
+        {
+            task();
+        }
+        catch (const exception &e)
+        {
+            SK_LOG_ERROR("Strand: task threw an exception: {}", e.what());
+        }
+        catch (...)
+        {
+            SK_LOG_ERROR("Strand: task threw an unknown exception.");
+        }
+    }
+
+    {
+        lock_guard lock(mutex_);
+        if (tasks_.empty())
+        {
+            running_ = false;
+            return;
+        }
+    }
+    pool_.enqueue([self = shared_from_this()]()
+                  { self->run(); });
+}
@@ -0,0 +1,216 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_TASKQUEUE_CPP
+#include "network.hpp"
+using namespace net;
+
+// Nodes are cached per producer thread. The consumer hands a finished node back to the
+// cache it came from through a lock-free return stack, which the owner drains in one
+// exchange when its local list runs dry. refs counts the owning thread plus every node
+// that is currently out of the local list, so the cache outlives its thread until the
+// last node comes home.
+struct TaskQueue::NodeCache
+{
+    Node *free_nodes = nullptr;
+    size_t free_count = 0;
+    atomic<Node *> returned{nullptr};
+    atomic<size_t> refs{1};
+
+    static NodeCache *local() noexcept;
+
+    Node *take();
+    void give_back(Node *node) noexcept;
+    void orphan() noexcept;
+    void delete_nodes(Node *node) noexcept;
+};
+
+namespace
+{
+    thread_local bool local_cache_destroyed = false;
+}
+
+TaskQueue::NodeCache *TaskQueue::NodeCache::local() noexcept
+{
+    struct Holder
+    {
+        NodeCache *cache = new NodeCache;
+        ~Holder()
+        {
+            local_cache_destroyed = true;
+            cache->orphan();
+        }
+    };
+
+    if (local_cache_destroyed)
+        return nullptr;
+    thread_local Holder holder;
+    return holder.cache;
+}
+
+TaskQueue::Node *TaskQueue::NodeCache::take()
+{
+    if (free_nodes == nullptr)
+    {
+        Node *node = returned.exchange(nullptr, memory_order_acquire);
+        while (node != nullptr)
+        {
+            Node *next = node->next.load(memory_order_relaxed);
+            if (free_count < kMaxCachedNodes)
+            {
+                node->next.store(free_nodes, memory_order_relaxed);
+                free_nodes = node;
+                ++free_count;
+            }
+            else
+                delete node;
+            node = next;
+        }
+    }
+
+    Node *node = free_nodes;
+    if (node != nullptr)
+    {
+        free_nodes = node->next.load(memory_order_relaxed);
+        --free_count;
+    }
+    else
+        node = new Node;
+    node->home = this;
+    refs.fetch_add(1, memory_order_relaxed);
+    return node;
+}
+
+void TaskQueue::NodeCache::give_back(Node *node) noexcept
+{
+    Node *head = returned.load(memory_order_relaxed);
+    do
+        node->next.store(head, memory_order_relaxed);
+    while (!returned.compare_exchange_weak(head, node, memory_order_release, memory_order_relaxed));
+
+    if (refs.fetch_sub(1, memory_order_acq_rel) == 1)
+    {
+        delete_nodes(returned.exchange(nullptr, memory_order_acquire));
+        delete this;
+    }
+}
+
+void TaskQueue::NodeCache::orphan() noexcept
+{
+    delete_nodes(free_nodes);
+    free_nodes = nullptr;
+    free_count = 0;
+    delete_nodes(returned.exchange(nullptr, memory_order_acquire));
+    if (refs.fetch_sub(1, memory_order_acq_rel) == 1)
+    {
+        delete_nodes(returned.exchange(nullptr, memory_order_acquire));
+        delete this;
+    }
+}
+
+void TaskQueue::NodeCache::delete_nodes(Node *node) noexcept
+{
+    while (node != nullptr)
+    {
+        Node *next = node->next.load(memory_order_relaxed);
+        delete node;
+        node = next;
+    }
+}
+
+TaskQueue::~TaskQueue()
+{
+    Task task;
+    while (pop(task))
+        task = nullptr;
+}
+
+TaskQueue::Node *TaskQueue::acquire_node()
+{
+    NodeCache *cache = NodeCache::local();
+    return cache != nullptr ? cache->take() : new Node;
+}
+
+void TaskQueue::release_node(Node *node) noexcept
+{
+    NodeCache *home = node->home;
+    if (home == nullptr)
+    {
+        delete node;
+        return;
+    }
+
+    node->task = nullptr;
+    if (home == NodeCache::local())
+    {
+        if (home->free_count < kMaxCachedNodes)
+        {
+            node->next.store(home->free_nodes, memory_order_relaxed);
+            home->free_nodes = node;
+            ++home->free_count;
+        }
+        else
+            delete node;
+        home->refs.fetch_sub(1, memory_order_relaxed);
+    }
+    else
+        home->give_back(node);
+}
+
+void TaskQueue::push(Task task)
+{
+    Node *node = acquire_node();
+    node->task = move(task);
+    push_node(node);
+}
+
+void TaskQueue::push_node(Node *node) noexcept
+{
+    node->next.store(nullptr, memory_order_relaxed);
+    Node *prev = head_.exchange(node, memory_order_acq_rel);
+    prev->next.store(node, memory_order_release);
+}
+
+bool TaskQueue::pop(Task &task)
+{
+    Node *tail = tail_;
+    Node *next = tail->next.load(memory_order_acquire);
+    if (tail == &stub_)
+    {
+        if (next == nullptr)
+            return false;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(memory_order_acquire);
+    }
+
+    if (next == nullptr)
+    {
+        // Either the queue holds exactly one node, or a producer has swapped head_ but
+        // not linked its node yet; in the latter case that producer will wake us again.
+        if (tail != head_.load(memory_order_acquire))
+            return false;
+        push_node(&stub_);
+        next = tail->next.load(memory_order_acquire);
+        if (next == nullptr)
+            return false;
+    }
+
+    tail_ = next;
+    task = move(tail->task);
+    release_node(tail);
+    return true;
+}
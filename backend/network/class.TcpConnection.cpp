@@ -18,6 +18,19 @@
 #include "network.hpp"
 using namespace net;
 
+namespace
+{
+    const MetricsRegistry::Id connections_open = MetricsRegistry::gauge("simplek_connections_open", "TCP connections currently established.");
+    const MetricsRegistry::Id connections_closed = MetricsRegistry::counter("simplek_connections_closed_total", "TCP connections that have been closed.");
+    const MetricsRegistry::Id bytes_received_total = MetricsRegistry::counter("simplek_bytes_received_total", "Bytes read from client sockets.");
+    const MetricsRegistry::Id bytes_sent_total = MetricsRegistry::counter("simplek_bytes_sent_total", "Bytes written to client sockets.");
+    const MetricsRegistry::Id requests_in_flight = MetricsRegistry::gauge("simplek_jobs_in_flight", "Requests dispatched to handlers and not yet finished.");
+    const MetricsRegistry::Id connections_read_paused = MetricsRegistry::gauge("simplek_connections_read_paused", "Connections whose reads are paused by flow control.");
+    const MetricsRegistry::Id read_pauses_output = MetricsRegistry::counter("simplek_read_pauses_total", "Times a connection stopped reading because of flow control.", MetricsRegistry::label("reason", "output"));
+    const MetricsRegistry::Id read_pauses_jobs = MetricsRegistry::counter("simplek_read_pauses_total", "Times a connection stopped reading because of flow control.", MetricsRegistry::label("reason", "jobs"));
+    const MetricsRegistry::Id read_pauses_upload = MetricsRegistry::counter("simplek_read_pauses_total", "Times a connection stopped reading because of flow control.", MetricsRegistry::label("reason", "upload"));
+}
+
 TcpConnection::TcpConnection(EventLoop *loop,
                              string name,
                              int sockfd,
@@ -27,41 +40,52 @@ TcpConnection::TcpConnection(EventLoop *loop,
       name_{move(name)},
       state_{State::kConnecting},
       reading_{true},
+      strand_{make_shared<Strand>()},
       socket_{sockfd},
       channel_{make_unique<Channel>(loop, sockfd)},
       local_addr_{local_addr},
       peer_addr_{peer_addr},
-      high_water_mark_{64 * 1024 * 1024}
+      high_water_mark_{64 * 1024 * 1024},
+      deferred_bytes_{0},
+      zerocopy_threshold_{0},
+      zerocopy_next_seq_{0},
+      edge_triggered_{false},
+      io_budget_{kDefaultIoBudget},
+      read_resume_pending_{false},
+      write_resume_pending_{false},
+      jobs_in_flight_{0},
+      upload_backlog_{0},
+      reading_paused_{false},
+      write_side_closed_{false},
+      last_activity_{TimerClock::now()},
+      bytes_received_{0},
+      inbound_progress_{TimerClock::time_point{}, 0, false, false}
 {
     channel_->on_read([this]
                       { handle_read(); });
     channel_->on_write([this]
                        { handle_write(); });
     channel_->on_error([this]
-                       { handle_error(); });
+                       { handle_error_event(); });
 
-    log_write_regular_information("TcpConnection::ctor[" + name_ + "] at " +
-                                  to_string(reinterpret_cast<uintptr_t>(this)) +
-                                  " fd=" + to_string(sockfd));
+    SK_LOG_DEBUG("TcpConnection::ctor[{}] at {} fd={}", name_, reinterpret_cast<uintptr_t>(this), sockfd);
     if (util::set_non_blocking(sockfd) == -1)
-        log_write_error_information("Failed to set non-blocking for fd " + to_string(sockfd) + " in TcpConnection ctor.");
+        SK_LOG_ERROR("Failed to set non-blocking for fd {} in TcpConnection ctor.", sockfd);
 }
 
 TcpConnection::~TcpConnection()
 {
-    log_write_regular_information("TcpConnection::dtor[" + name_ + "] at " +
-                                  to_string(reinterpret_cast<uintptr_t>(this)) +
-                                  " fd=" + (channel_ ? to_string(channel_->fd()) : "n/a") +
-                                  " state=" + to_string(static_cast<int>(state_)));
+    SK_LOG_DEBUG("TcpConnection::dtor[{}] at {} fd={} state={}", name_, reinterpret_cast<uintptr_t>(this), (channel_ ? to_string(channel_->fd()) : "n/a"), static_cast<int>(state_.load()));
     assert(state_ == State::kDisconnected);
 }
 
 void TcpConnection::connect_established()
 {
-    log_write_regular_information("TcpConnection::connect_established at " + this->name_);
+    SK_LOG_DEBUG("TcpConnection::connect_established at {}", this->name_);
     loop_->assert_in_loop_thread();
     assert(state_ == State::kConnecting);
     set_state(State::kConnected);
+    MetricsRegistry::add(connections_open);
     channel_->tie(shared_from_this());
     channel_->enable_reading();
     if (connection_cb_)
@@ -72,7 +96,13 @@ void TcpConnection::connect_destroyed()
 {
     loop_->assert_in_loop_thread();
     bool was_connected = (state_ == State::kConnected);
+    if (was_connected or state_ == State::kDisconnecting)
+    {
+        MetricsRegistry::add(connections_open, -1);
+        MetricsRegistry::add(connections_closed);
+    }
     set_state(State::kDisconnected);
+    clear_read_pause();
 
     if (channel_)
     {
@@ -83,7 +113,158 @@ void TcpConnection::connect_destroyed()
 
     if (was_connected and connection_cb_)
         connection_cb_(shared_from_this());
-    log_write_regular_information("TcpConnection::connect_destroyed [" + name_ + "] fd=" + (channel_ ? to_string(channel_->fd()) : "n/a"));
+    SK_LOG_DEBUG("TcpConnection::connect_destroyed [{}] fd={}", name_, (channel_ ? to_string(channel_->fd()) : "n/a"));
+}
+
+void TcpConnection::set_edge_triggered(bool on)
+{
+    assert(state_ == State::kConnecting);
+    edge_triggered_ = on;
+    channel_->set_edge_triggered(on);
+}
+
+void TcpConnection::set_zerocopy_threshold(size_t bytes)
+{
+    assert(state_ == State::kConnecting);
+    if (bytes > 0)
+    {
+        int one = 1;
+        if (::setsockopt(socket_.fd(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == -1)
+        {
+            SK_LOG_WARNING("TcpConnection::set_zerocopy_threshold [{}] - SO_ZEROCOPY unavailable: {}", name_, errno_to_string(errno));
+            bytes = 0;
+        }
+    }
+    zerocopy_threshold_ = bytes;
+}
+
+void TcpConnection::set_retained_buffer_limit(size_t bytes)
+{
+    input_buffer_.set_retain_limit(bytes);
+    output_buffer_.set_retain_limit(bytes);
+}
+
+void TcpConnection::set_flow_control(const FlowControl &options)
+{
+    assert(state_ == State::kConnecting);
+    flow_control_ = options;
+    if (flow_control_.output_high_mark > 0)
+        flow_control_.output_low_mark = min(flow_control_.output_low_mark, flow_control_.output_high_mark - 1);
+    if (flow_control_.jobs_high_mark > 0)
+        flow_control_.jobs_low_mark = min(flow_control_.jobs_low_mark, flow_control_.jobs_high_mark - 1);
+    if (flow_control_.upload_high_mark > 0)
+        flow_control_.upload_low_mark = min(flow_control_.upload_low_mark, flow_control_.upload_high_mark - 1);
+}
+
+void TcpConnection::job_started()
+{
+    loop_->assert_in_loop_thread();
+    MetricsRegistry::add(requests_in_flight);
+    size_t jobs = jobs_in_flight_.fetch_add(1, memory_order_acq_rel) + 1;
+    if (flow_control_.jobs_high_mark > 0 and jobs >= flow_control_.jobs_high_mark)
+        pause_reading(PauseReason::kJobs);
+}
+
+void TcpConnection::job_finished()
+{
+    MetricsRegistry::add(requests_in_flight, -1);
+    size_t jobs = jobs_in_flight_.fetch_sub(1, memory_order_acq_rel) - 1;
+    // Only the job that brings the count down to the low mark needs to wake the loop.
+    if (flow_control_.jobs_high_mark > 0 and jobs == flow_control_.jobs_low_mark)
+        loop_->run_in_loop([weak_self = weak_from_this()]()
+                           {
+            if (TcpConnectionPtr self = weak_self.lock())
+                self->maybe_resume_reading(); });
+}
+
+void TcpConnection::upload_queued(size_t bytes)
+{
+    loop_->assert_in_loop_thread();
+    size_t backlog = upload_backlog_.fetch_add(bytes, memory_order_acq_rel) + bytes;
+    if (flow_control_.upload_high_mark > 0 and backlog >= flow_control_.upload_high_mark)
+        pause_reading(PauseReason::kUpload);
+}
+
+void TcpConnection::upload_consumed(size_t bytes)
+{
+    size_t backlog = upload_backlog_.fetch_sub(bytes, memory_order_acq_rel) - bytes;
+    // Chunks vary in size, so wake the loop on the chunk that crosses the low mark.
+    if (flow_control_.upload_high_mark > 0 and backlog <= flow_control_.upload_low_mark and backlog + bytes > flow_control_.upload_low_mark)
+        loop_->run_in_loop([weak_self = weak_from_this()]()
+                           {
+            if (TcpConnectionPtr self = weak_self.lock())
+                self->maybe_resume_reading(); });
+}
+
+void TcpConnection::pause_reading(PauseReason reason)
+{
+    loop_->assert_in_loop_thread();
+    if (reading_paused_ or state_ != State::kConnected)
+        return;
+    reading_paused_ = true;
+    channel_->disable_reading();
+    MetricsRegistry::add(connections_read_paused);
+    MetricsRegistry::add(reason == PauseReason::kOutput ? read_pauses_output : reason == PauseReason::kJobs ? read_pauses_jobs : read_pauses_upload);
+    SK_LOG_DEBUG("TcpConnection::pause_reading [{}] - output={} jobs={} upload={}", name_, output_pending_bytes(), jobs_in_flight(), upload_backlog());
+}
+
+void TcpConnection::maybe_resume_reading()
+{
+    loop_->assert_in_loop_thread();
+    if (!reading_paused_ or state_ != State::kConnected)
+        return;
+    if (flow_control_.output_high_mark > 0 and output_pending_bytes() > flow_control_.output_low_mark)
+        return;
+    if (flow_control_.jobs_high_mark > 0 and jobs_in_flight() > flow_control_.jobs_low_mark)
+        return;
+    if (flow_control_.upload_high_mark > 0 and upload_backlog() > flow_control_.upload_low_mark)
+        return;
+
+    clear_read_pause();
+    // The time spent paused was ours, not the peer's; restart the reaper's throughput window.
+    if (inbound_progress_.frame_pending)
+    {
+        inbound_progress_.frame_started = TimerClock::now();
+        inbound_progress_.bytes_at_frame_start = bytes_received_;
+    }
+    channel_->enable_reading();
+    SK_LOG_DEBUG("TcpConnection::maybe_resume_reading [{}] - output={} jobs={}", name_, output_pending_bytes(), jobs_in_flight());
+    if (edge_triggered_)
+        resume_io_later(true);
+}
+
+void TcpConnection::clear_read_pause()
+{
+    if (!reading_paused_)
+        return;
+    reading_paused_ = false;
+    MetricsRegistry::add(connections_read_paused, -1);
+}
+
+void TcpConnection::shrink_buffers()
+{
+    loop_->assert_in_loop_thread();
+    input_buffer_.shrink();
+    output_buffer_.shrink();
+}
+
+void TcpConnection::update_inbound_progress(bool frame_pending, bool header_complete, bool frame_completed)
+{
+    loop_->assert_in_loop_thread();
+    if (!frame_pending)
+    {
+        inbound_progress_.frame_pending = false;
+        inbound_progress_.header_complete = false;
+        return;
+    }
+
+    if (!inbound_progress_.frame_pending or frame_completed)
+    {
+        inbound_progress_.frame_started = last_activity_;
+        inbound_progress_.bytes_at_frame_start = bytes_received_ - input_buffer_.readable_bytes();
+        inbound_progress_.frame_pending = true;
+    }
+    inbound_progress_.header_complete = header_complete;
 }
 
 void TcpConnection::send(string_view message)
@@ -100,7 +281,7 @@ void TcpConnection::send(string_view message)
         }
     }
     else
-        log_write_warning_information("TcpConnection::send [" + name_ + "] - Connection disconnected, cannot send.");
+        SK_LOG_WARNING("TcpConnection::send [{}] - Connection disconnected, cannot send.", name_);
 }
 
 void TcpConnection::send(unique_ptr<char[]> message, size_t buflen)
@@ -117,7 +298,7 @@ void TcpConnection::send(unique_ptr<char[]> message, size_t buflen)
         }
     }
     else
-        log_write_warning_information("TcpConnection::send [" + name_ + "] - Connection disconnected, cannot send.");
+        SK_LOG_WARNING("TcpConnection::send [{}] - Connection disconnected, cannot send.", name_);
 }
 
 void TcpConnection::send(Buffer *buf)
@@ -126,7 +307,11 @@ void TcpConnection::send(Buffer *buf)
     {
         if (loop_->is_in_loop_thread())
         {
-            send_in_loop(buf->peek(), buf->readable_bytes());
+            vector<string_view> views = buf->views(buf->readable_bytes());
+            vector<struct iovec> vec(views.size());
+            for (size_t i = 0; i < views.size(); ++i)
+                vec[i] = {const_cast<char *>(views[i].data()), views[i].size()};
+            send_in_loop(vec.data(), vec.size());
             buf->retrieve_all();
         }
         else
@@ -137,31 +322,201 @@ void TcpConnection::send(Buffer *buf)
         }
     }
     else
-        log_write_warning_information("TcpConnection::send(Buffer*) [" + name_ + "] - Connection disconnected, cannot send.");
+        SK_LOG_WARNING("TcpConnection::send(Buffer*) [{}] - Connection disconnected, cannot send.", name_);
+}
+
+void TcpConnection::send_frame(const string &tag, string payload)
+{
+    vector<OutputSegment> segments;
+    segments.emplace_back(move(payload));
+    send_frame(tag, move(segments));
+}
+
+void TcpConnection::send_frame(const string &tag, vector<OutputSegment> payload)
+{
+    size_t payload_len = 0;
+    for (const OutputSegment &segment : payload)
+        payload_len += holds_alternative<string>(segment) ? get<string>(segment).size() : get<FileSegment>(segment).remaining();
+
+    string header = TcpServer::frame_header(tag, payload_len);
+    if (header.empty())
+    {
+        SK_LOG_ERROR("TcpConnection::send_frame [{}] - cannot frame tag '{}', dropping {} bytes.", name_, tag, payload_len);
+        return;
+    }
+
+    vector<OutputSegment> segments;
+    segments.reserve(payload.size() + 1);
+    segments.emplace_back(move(header));
+    for (OutputSegment &segment : payload)
+        segments.push_back(move(segment));
+    send_segments(move(segments));
+}
+
+void TcpConnection::send_segments(vector<OutputSegment> segments)
+{
+    if (state_ == State::kConnected)
+    {
+        if (loop_->is_in_loop_thread())
+            send_segments_in_loop(segments);
+        else
+            loop_->run_in_loop([ptr = shared_from_this(), segments = make_shared<vector<OutputSegment>>(move(segments))]()
+                               { ptr->send_segments_in_loop(*segments); });
+    }
+    else
+        SK_LOG_WARNING("TcpConnection::send_segments [{}] - Connection disconnected, cannot send.", name_);
+}
+
+void TcpConnection::send_response(uint64_t request_id, const string &tag, string payload, uint8_t flags)
+{
+    vector<OutputSegment> segments;
+    segments.emplace_back(move(payload));
+    send_response(request_id, tag, move(segments), flags);
+}
+
+void TcpConnection::send_response(uint64_t request_id, const string &tag, vector<OutputSegment> payload, uint8_t flags)
+{
+    if (tag.length() > numeric_limits<uint8_t>::max())
+    {
+        SK_LOG_ERROR("TcpConnection::send_response [{}] - tag '{}' is too long, dropping response to request {}.", name_, tag, request_id);
+        return;
+    }
+    if (state_ == State::kDisconnected)
+    {
+        SK_LOG_WARNING("TcpConnection::send_response [{}] - Connection disconnected, cannot answer request {}.", name_, request_id);
+        return;
+    }
+
+    ResponseStream stream{request_id, tag, flags, deque<OutputSegment>(make_move_iterator(payload.begin()), make_move_iterator(payload.end())), 0};
+    if (loop_->is_in_loop_thread())
+        queue_response_in_loop(move(stream));
+    else
+        loop_->run_in_loop([ptr = shared_from_this(), stream = make_shared<ResponseStream>(move(stream))]()
+                           { ptr->queue_response_in_loop(move(*stream)); });
+}
+
+void TcpConnection::queue_response_in_loop(ResponseStream stream)
+{
+    loop_->assert_in_loop_thread();
+    response_streams_.push_back(move(stream));
+    pump_responses();
+    if (state_ == State::kDisconnecting)
+        shutdown_in_loop();
+}
+
+void TcpConnection::pump_responses()
+{
+    while (!response_streams_.empty() and output_pending_bytes() < kResponseFragmentSize)
+    {
+        if (state_ == State::kDisconnected)
+        {
+            response_streams_.clear();
+            return;
+        }
+
+        ResponseStream stream = move(response_streams_.front());
+        response_streams_.pop_front();
+
+        vector<OutputSegment> fragment;
+        fragment.emplace_back(string());
+        size_t len = 0;
+        while (len < kResponseFragmentSize and !stream.payload.empty())
+        {
+            size_t want = kResponseFragmentSize - len;
+            if (string *bytes = get_if<string>(&stream.payload.front()))
+            {
+                size_t n = min(want, bytes->size() - stream.offset);
+                bool whole = stream.offset == 0 and n == bytes->size();
+                fragment.emplace_back(whole ? move(*bytes) : bytes->substr(stream.offset, n));
+                stream.offset += n;
+                len += n;
+                if (whole or stream.offset == bytes->size())
+                {
+                    stream.payload.pop_front();
+                    stream.offset = 0;
+                }
+            }
+            else
+            {
+                FileSegment &file = get<FileSegment>(stream.payload.front());
+                size_t n = min(want, file.remaining());
+                fragment.emplace_back(file.take_front(n));
+                len += n;
+                if (file.remaining() == 0)
+                    stream.payload.pop_front();
+            }
+        }
+
+        bool last = stream.payload.empty();
+        uint8_t flags = last ? stream.flags : stream.flags | TcpServer::kFlagMoreFragments;
+        fragment.front() = TcpServer::frame_header(stream.tag, stream.request_id, flags, len);
+        send_segments_in_loop(fragment);
+        if (!last)
+            response_streams_.push_back(move(stream));
+    }
+}
+
+void TcpConnection::send_segments_in_loop(vector<OutputSegment> &segments)
+{
+    vector<struct iovec> vec;
+    vec.reserve(segments.size());
+    for (OutputSegment &segment : segments)
+    {
+        string *bytes = get_if<string>(&segment);
+        bool zerocopy = bytes != nullptr and zerocopy_threshold_ > 0 and bytes->size() >= zerocopy_threshold_;
+        if (bytes != nullptr and !zerocopy)
+        {
+            if (!bytes->empty())
+                vec.push_back({bytes->data(), bytes->size()});
+            continue;
+        }
+        if (!vec.empty())
+        {
+            send_in_loop(vec.data(), vec.size());
+            vec.clear();
+        }
+        if (zerocopy)
+            send_zerocopy_in_loop(make_shared<string>(move(*bytes)));
+        else
+            send_file_in_loop(move(get<FileSegment>(segment)));
+    }
+    if (!vec.empty())
+        send_in_loop(vec.data(), vec.size());
 }
 
 void TcpConnection::send_in_loop(const void *data, size_t len)
+{
+    struct iovec vec;
+    vec.iov_base = const_cast<void *>(data);
+    vec.iov_len = len;
+    send_in_loop(&vec, 1);
+}
+
+void TcpConnection::send_in_loop(const struct iovec *vec, size_t count)
 {
     loop_->assert_in_loop_thread();
-    if (state_ == State::kDisconnected or state_ == State::kDisconnecting)
+    if (state_ == State::kDisconnected or write_side_closed())
     {
-        log_write_warning_information("TcpConnection::send_in_loop [" + name_ + "] - disconnected or disconnecting, give up writing.");
+        SK_LOG_WARNING("TcpConnection::send_in_loop [{}] - disconnected or write side closed, give up writing.", name_);
         return;
     }
 
-    ssize_t nwrote = 0;
-    size_t remaining = len;
-    bool fault_error = false;
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i)
+        len += vec[i].iov_len;
 
-    const char *char_data = static_cast<const char *>(data);
+    size_t nwrote = 0;
+    bool fault_error = false;
 
-    if (!channel_->is_writing() and output_buffer_.readable_bytes() == 0)
+    if (!channel_->is_writing() and output_pending_bytes() == 0)
     {
-        nwrote = ::write(channel_->fd(), char_data, len);
-        if (nwrote >= 0)
+        ssize_t n = ::writev(channel_->fd(), vec, static_cast<int>(min<size_t>(count, IOV_MAX)));
+        if (n >= 0)
         {
-            remaining = len - nwrote;
-            if (remaining == 0 and write_complete_cb_)
+            last_activity_ = TimerClock::now();
+            nwrote = static_cast<size_t>(n);
+            MetricsRegistry::add(bytes_sent_total, n);
+            if (nwrote == len and write_complete_cb_)
             {
                 loop_->queue_in_loop([ptr = shared_from_this()]()
                                      {
@@ -169,32 +524,45 @@ void TcpConnection::send_in_loop(const void *data, size_t len)
                                         ptr->write_complete_cb_(ptr); });
             }
         }
-        else
+        else if (errno != EWOULDBLOCK and errno != EAGAIN)
         {
-            nwrote = 0;
-            if (errno != EWOULDBLOCK and errno != EAGAIN)
-            {
-                log_write_error_information("TcpConnection::send_in_loop [" + name_ + "] write error: " + errno_to_string(errno));
-                if (errno == EPIPE or errno == ECONNRESET)
-                    fault_error = true;
-            }
+            SK_LOG_ERROR("TcpConnection::send_in_loop [{}] write error: {}", name_, errno_to_string(errno));
+            if (errno == EPIPE or errno == ECONNRESET)
+                fault_error = true;
         }
     }
 
-    assert(remaining <= len);
-
+    size_t remaining = len - nwrote;
     if (!fault_error and remaining > 0)
     {
-        size_t old_len = output_buffer_.readable_bytes();
-        if (old_len + remaining >= high_water_mark_ and
-            old_len < high_water_mark_ and
-            high_water_mark_cb_)
+        notify_output_growth(output_pending_bytes(), remaining);
+        string spilled;
+        bool defer = !deferred_output_.empty();
+        if (defer)
+            spilled.reserve(remaining);
+        else
+            output_buffer_.ensure_writable_bytes(remaining);
+
+        size_t skip = nwrote;
+        for (size_t i = 0; i < count; ++i)
         {
-            loop_->queue_in_loop([ptr = shared_from_this(), current_len = old_len + remaining]()
-                                 {
-if(ptr->high_water_mark_cb_) ptr->high_water_mark_cb_(ptr, current_len); });
+            if (skip >= vec[i].iov_len)
+            {
+                skip -= vec[i].iov_len;
+                continue;
+            }
+            const char *begin = static_cast<const char *>(vec[i].iov_base) + skip;
+            if (defer)
+                spilled.append(begin, vec[i].iov_len - skip);
+            else
+                output_buffer_.append(begin, vec[i].iov_len - skip);
+            skip = 0;
+        }
+        if (defer)
+        {
+            deferred_bytes_ += spilled.size();
+            deferred_output_.emplace_back(move(spilled));
         }
-        output_buffer_.append(char_data + nwrote, remaining);
         if (!channel_->is_writing())
         {
             channel_->enable_writing();
@@ -204,6 +572,225 @@ if(ptr->high_water_mark_cb_) ptr->high_water_mark_cb_(ptr, current_len); });
         handle_error();
 }
 
+void TcpConnection::send_file_in_loop(FileSegment file)
+{
+    loop_->assert_in_loop_thread();
+    if (state_ == State::kDisconnected or write_side_closed())
+    {
+        SK_LOG_WARNING("TcpConnection::send_file_in_loop [{}] - disconnected or write side closed, give up writing.", name_);
+        return;
+    }
+    if (file.remaining() == 0)
+        return;
+
+    if (!channel_->is_writing() and output_pending_bytes() == 0)
+    {
+        ssize_t n = file.send_to(channel_->fd(), file.remaining());
+        if (n > 0)
+        {
+            last_activity_ = TimerClock::now();
+            MetricsRegistry::add(bytes_sent_total, n);
+        }
+        else if (n == 0 or (errno != EWOULDBLOCK and errno != EAGAIN))
+        {
+            SK_LOG_ERROR("TcpConnection::send_file_in_loop [{}] sendfile error: {}", name_, (n == 0 ? string("file shorter than announced") : errno_to_string(errno)));
+            handle_error();
+            return;
+        }
+
+        if (file.remaining() == 0)
+        {
+            if (write_complete_cb_)
+                loop_->queue_in_loop([ptr = shared_from_this()]()
+                                     {
+                                        if(ptr->write_complete_cb_) 
+                                        ptr->write_complete_cb_(ptr); });
+            return;
+        }
+    }
+
+    notify_output_growth(output_pending_bytes(), file.remaining());
+    deferred_bytes_ += file.remaining();
+    deferred_output_.emplace_back(move(file));
+    if (!channel_->is_writing())
+        channel_->enable_writing();
+}
+
+void TcpConnection::send_zerocopy_in_loop(shared_ptr<string> data)
+{
+    loop_->assert_in_loop_thread();
+    if (state_ == State::kDisconnected or write_side_closed())
+    {
+        SK_LOG_WARNING("TcpConnection::send_zerocopy_in_loop [{}] - disconnected or write side closed, give up writing.", name_);
+        return;
+    }
+
+    size_t offset = 0;
+    if (!channel_->is_writing() and output_pending_bytes() == 0)
+    {
+        ssize_t n = send_zerocopy(data, 0, data->size());
+        if (n > 0)
+        {
+            last_activity_ = TimerClock::now();
+            offset = static_cast<size_t>(n);
+            MetricsRegistry::add(bytes_sent_total, n);
+        }
+        else if (errno != EWOULDBLOCK and errno != EAGAIN)
+        {
+            SK_LOG_ERROR("TcpConnection::send_zerocopy_in_loop [{}] send error: {}", name_, errno_to_string(errno));
+            if (errno == EPIPE or errno == ECONNRESET)
+                handle_error();
+            return;
+        }
+
+        if (offset == data->size())
+        {
+            if (write_complete_cb_)
+                loop_->queue_in_loop([ptr = shared_from_this()]()
+                                     {
+                                        if(ptr->write_complete_cb_) 
+                                        ptr->write_complete_cb_(ptr); });
+            return;
+        }
+    }
+
+    size_t remaining = data->size() - offset;
+    notify_output_growth(output_pending_bytes(), remaining);
+    deferred_bytes_ += remaining;
+    deferred_output_.emplace_back(ZeroCopySegment{move(data), offset});
+    if (!channel_->is_writing())
+        channel_->enable_writing();
+}
+
+ssize_t TcpConnection::send_zerocopy(const shared_ptr<string> &data, size_t offset, size_t max_bytes)
+{
+    size_t len = min(data->size() - offset, max_bytes);
+    int flags = MSG_NOSIGNAL;
+    if (zerocopy_threshold_ > 0)
+        flags |= MSG_ZEROCOPY;
+
+    ssize_t n = ::send(channel_->fd(), data->data() + offset, len, flags);
+    if (n < 0 and errno == ENOBUFS and (flags & MSG_ZEROCOPY))
+    {
+        flags &= ~MSG_ZEROCOPY;
+        n = ::send(channel_->fd(), data->data() + offset, len, flags);
+    }
+
+    if (n >= 0 and (flags & MSG_ZEROCOPY))
+    {
+        uint32_t seq = zerocopy_next_seq_++;
+        if (!zerocopy_inflight_.empty() and zerocopy_inflight_.back().second == data)
+            zerocopy_inflight_.back().first = seq;
+        else
+            zerocopy_inflight_.emplace_back(seq, data);
+    }
+    return n;
+}
+
+bool TcpConnection::reap_zerocopy_completions()
+{
+    bool reaped = false;
+    for (;;)
+    {
+        char control[128];
+        struct msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        if (::recvmsg(channel_->fd(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP and cm->cmsg_type == IP_RECVERR) or
+                  (cm->cmsg_level == SOL_IPV6 and cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            const struct sock_extended_err *serr = reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 or serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            reaped = true;
+            uint32_t hi = serr->ee_data;
+            while (!zerocopy_inflight_.empty() and static_cast<int32_t>(zerocopy_inflight_.front().first - hi) <= 0)
+                zerocopy_inflight_.pop_front();
+
+            if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) and zerocopy_threshold_ > 0)
+            {
+                SK_LOG_INFO("TcpConnection::reap_zerocopy_completions [{}] - kernel copied the data, falling back to regular sends.", name_);
+                zerocopy_threshold_ = 0;
+            }
+        }
+    }
+    return reaped;
+}
+
+void TcpConnection::notify_output_growth(size_t old_len, size_t added)
+{
+    if (old_len + added >= high_water_mark_ and
+        old_len < high_water_mark_ and
+        high_water_mark_cb_)
+    {
+        loop_->queue_in_loop([ptr = shared_from_this(), current_len = old_len + added]()
+                             {
+if(ptr->high_water_mark_cb_) ptr->high_water_mark_cb_(ptr, current_len); });
+    }
+    if (flow_control_.output_high_mark > 0 and old_len + added >= flow_control_.output_high_mark)
+        pause_reading(PauseReason::kOutput);
+}
+
+ssize_t TcpConnection::write_output(size_t max_bytes)
+{
+    while (output_buffer_.readable_bytes() == 0 and !deferred_output_.empty() and holds_alternative<string>(deferred_output_.front()))
+    {
+        string &bytes = get<string>(deferred_output_.front());
+        output_buffer_.append(bytes);
+        deferred_bytes_ -= bytes.size();
+        deferred_output_.pop_front();
+    }
+
+    if (output_buffer_.readable_bytes() > 0)
+    {
+        struct iovec vec[kMaxWriteIovecs];
+        size_t count = output_buffer_.fill_iovecs(vec, kMaxWriteIovecs, max_bytes);
+        ssize_t n = ::writev(channel_->fd(), vec, static_cast<int>(count));
+        if (n > 0)
+            output_buffer_.retrieve(n);
+        return n;
+    }
+
+    if (deferred_output_.empty())
+        return 0;
+
+    if (ZeroCopySegment *zc = get_if<ZeroCopySegment>(&deferred_output_.front()))
+    {
+        ssize_t n = send_zerocopy(zc->data, zc->offset, max_bytes);
+        if (n > 0)
+        {
+            zc->offset += static_cast<size_t>(n);
+            deferred_bytes_ -= static_cast<size_t>(n);
+            if (zc->offset == zc->data->size())
+                deferred_output_.pop_front();
+        }
+        return n;
+    }
+
+    FileSegment &file = get<FileSegment>(deferred_output_.front());
+    ssize_t n = file.send_to(channel_->fd(), max_bytes);
+    if (n > 0)
+    {
+        deferred_bytes_ -= static_cast<size_t>(n);
+        if (file.remaining() == 0)
+            deferred_output_.pop_front();
+    }
+    else if (n == 0)
+    {
+        SK_LOG_ERROR("TcpConnection::write_output [{}] - file segment fd={} is shorter than announced.", name_, file.fd());
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
 void TcpConnection::send_in_loop(string_view message)
 {
     send_in_loop(message.data(), message.size());
@@ -222,15 +809,20 @@ void TcpConnection::shutdown()
 void TcpConnection::shutdown_in_loop()
 {
     loop_->assert_in_loop_thread();
-    if (!channel_->is_writing())
+    if (write_side_closed())
+        return;
+    if (!channel_->is_writing() and response_streams_.empty() and output_pending_bytes() == 0)
     {
         if (::shutdown(socket_.fd(), SHUT_WR) < 0)
-            log_write_error_information("TcpConnection::shutdown_in_loop [" + name_ + "] SHUT_WR error: " + errno_to_string(errno));
+            SK_LOG_ERROR("TcpConnection::shutdown_in_loop [{}] SHUT_WR error: {}", name_, errno_to_string(errno));
         else
-            log_write_regular_information("TcpConnection::shutdown_in_loop [" + name_ + "] - SHUT_WR successful.");
+        {
+            write_side_closed_.store(true, memory_order_release);
+            SK_LOG_DEBUG("TcpConnection::shutdown_in_loop [{}] - SHUT_WR successful.", name_);
+        }
     }
     else
-        log_write_regular_information("TcpConnection::shutdown_in_loop [" + name_ + "] - Waiting for writes to complete before shutdown.");
+        SK_LOG_DEBUG("TcpConnection::shutdown_in_loop [{}] - Waiting for writes to complete before shutdown.", name_);
 }
 
 void TcpConnection::force_close()
@@ -246,112 +838,164 @@ void TcpConnection::force_close()
 void TcpConnection::force_close_in_loop()
 {
     loop_->assert_in_loop_thread();
-    log_write_regular_information("TcpConnection::force_close_in_loop [" + name_ + "] fd=" + to_string(channel_->fd()));
+    SK_LOG_DEBUG("TcpConnection::force_close_in_loop [{}] fd={}", name_, channel_->fd());
     handle_close();
 }
 
 void TcpConnection::handle_read()
 {
     loop_->assert_in_loop_thread();
+    read_resume_pending_ = false;
     int saved_errno = 0;
-    ssize_t n = input_buffer_.read_fd(channel_->fd(), &saved_errno);
+    size_t total = 0;
+    ssize_t n = 0;
+    do
+    {
+        n = input_buffer_.read_fd(channel_->fd(), &saved_errno);
+        if (n <= 0)
+            break;
+        total += static_cast<size_t>(n);
+    } while (edge_triggered_ and total < io_budget_);
+
+    if (total > 0)
+    {
+        last_activity_ = TimerClock::now();
+        bytes_received_ += total;
+        MetricsRegistry::add(bytes_received_total, static_cast<int64_t>(total));
+        dispatch_input();
+    }
 
     if (n > 0)
     {
-        if (message_cb_)
+        if (edge_triggered_)
+            resume_io_later(true);
+    }
+    else if (n == 0)
+        handle_close();
+    else if (saved_errno != EAGAIN and saved_errno != EWOULDBLOCK)
+    {
+        errno = saved_errno;
+        SK_LOG_ERROR("TcpConnection::handle_read [{}] read error: {}", name_, errno_to_string(errno));
+        handle_error();
+    }
+}
+
+void TcpConnection::dispatch_input()
+{
+    if (message_cb_)
+    {
+        TcpConnectionPtr self = shared_from_this();
+        try
         {
-            auto self = shared_from_this();
-            ThreadPool::instance().enqueue(
-                [this, self, buf_ptr = &input_buffer_]() -> void
-                {
-                    auto ret = message_cb_(self, buf_ptr);
-                    try
-                    {
-                        if (auto &[response, rlen] = ret; response != nullptr)
-                            send(move(response), rlen);
-                    }
-                    catch (const future_error &e)
-                    {
-                        log_write_error_information("Future error getting result for connection [" + name_ + "]: " + string(e.what()) + " code: " + to_string(e.code().value()));
-                        send("Error processing request (future).\r\n");
-                    }
-                    catch (const exception &e)
-                    {
-                        log_write_error_information("MessageCallback exception for connection [" + name_ + "]: " + string(e.what()));
-                        send("Error processing request.\r\n");
-                    }
-                    catch (...)
-                    {
-                        log_write_error_information("Unknown exception during MessageCallback for connection [" + name_ + "]");
-                        send("Unknown error processing request.\r\n");
-                    }
-                });
+            if (auto [response, rlen] = message_cb_(self, &input_buffer_); response != nullptr)
+                send(move(response), rlen);
         }
-        else
+        catch (const exception &e)
         {
-            log_write_warning_information("No message callback set for connection [" + name_ + "], discarding " + to_string(n) + " bytes.");
-            input_buffer_.retrieve_all();
+            SK_LOG_ERROR("MessageCallback exception for connection [{}]: {}", name_, e.what());
+            send("Error processing request.\r\n");
+        }
+        catch (...)
+        {
+            SK_LOG_ERROR("Unknown exception during MessageCallback for connection [{}]", name_);
+            send("Unknown error processing request.\r\n");
         }
     }
-    else if (n == 0)
-        handle_close();
     else
     {
-        errno = saved_errno;
-        log_write_error_information("TcpConnection::handle_read [" + name_ + "] read error: " + errno_to_string(errno));
-        handle_error();
+        SK_LOG_WARNING("No message callback set for connection [{}], discarding {} bytes.", name_, input_buffer_.readable_bytes());
+        input_buffer_.retrieve_all();
     }
 }
 
+void TcpConnection::resume_io_later(bool reading)
+{
+    bool &pending = reading ? read_resume_pending_ : write_resume_pending_;
+    if (pending)
+        return;
+    pending = true;
+    loop_->queue_in_loop([weak_self = weak_from_this(), reading]()
+                         {
+        TcpConnectionPtr self = weak_self.lock();
+        if (!self or self->disconnected())
+            return;
+        if (reading and self->read_resume_pending_ and self->channel_->is_reading())
+            self->handle_read();
+        else if (!reading and self->write_resume_pending_ and self->channel_->is_writing())
+            self->handle_write();
+        else
+            (reading ? self->read_resume_pending_ : self->write_resume_pending_) = false; });
+}
+
 void TcpConnection::handle_write()
 {
     loop_->assert_in_loop_thread();
+    write_resume_pending_ = false;
     if (channel_->is_writing())
     {
-        ssize_t n = ::write(channel_->fd(),
-                            output_buffer_.peek(),
-                            output_buffer_.readable_bytes());
-        if (n > 0)
+        size_t total = 0;
+        ssize_t n = 0;
+        do
         {
-            output_buffer_.retrieve(n);
-            if (output_buffer_.readable_bytes() == 0)
+            n = write_output(io_budget_ - total);
+            if (n <= 0)
+                break;
+            total += static_cast<size_t>(n);
+        } while (edge_triggered_ and output_pending_bytes() > 0 and total < io_budget_);
+
+        if (total > 0)
+        {
+            last_activity_ = TimerClock::now();
+            MetricsRegistry::add(bytes_sent_total, static_cast<int64_t>(total));
+        }
+
+        if (n < 0 and errno != EWOULDBLOCK and errno != EAGAIN)
+        {
+            SK_LOG_ERROR("TcpConnection::handle_write [{}] write error: {}", name_, errno_to_string(errno));
+            handle_error();
+            return;
+        }
+
+        if (!response_streams_.empty() and output_pending_bytes() < kResponseFragmentSize)
+            pump_responses();
+        if (reading_paused_)
+            maybe_resume_reading();
+        if (output_pending_bytes() == 0)
+        {
+            channel_->disable_writing();
+            if (write_complete_cb_)
             {
-                channel_->disable_writing();
-                if (write_complete_cb_)
-                {
-                    loop_->queue_in_loop([ptr = shared_from_this()]()
-                                         {
-                                            if(ptr->write_complete_cb_) 
-                                                ptr->write_complete_cb_(ptr); });
-                }
-                if (state_ == State::kDisconnecting)
-                    shutdown_in_loop();
+                loop_->queue_in_loop([ptr = shared_from_this()]()
+                                     {
+                                        if(ptr->write_complete_cb_) 
+                                            ptr->write_complete_cb_(ptr); });
             }
-            else
-                log_write_regular_information("TcpConnection::handle_write [" + name_ + "] - more data to write: " + to_string(output_buffer_.readable_bytes()));
+            if (state_ == State::kDisconnecting)
+                shutdown_in_loop();
         }
+        else if (edge_triggered_ and n > 0)
+            resume_io_later(false);
         else
-        {
-            log_write_error_information("TcpConnection::handle_write [" + name_ + "] write error: " + errno_to_string(errno));
-            if (errno != EWOULDBLOCK and errno != EAGAIN)
-                handle_error();
-        }
+            SK_LOG_DEBUG("TcpConnection::handle_write [{}] - more data to write: {}", name_, output_pending_bytes());
     }
     else
-        log_write_warning_information("TcpConnection::handle_write [" + name_ + "] - channel is not writing, fd = " + to_string(channel_->fd()));
+        SK_LOG_WARNING("TcpConnection::handle_write [{}] - channel is not writing, fd = {}", name_, channel_->fd());
 }
 
 void TcpConnection::handle_close()
 {
     loop_->assert_in_loop_thread();
-    log_write_regular_information("TcpConnection::handle_close [" + name_ + "] fd = " + to_string(channel_->fd()) +
-                                  " state = " + to_string(static_cast<int>(state_)));
+    SK_LOG_DEBUG("TcpConnection::handle_close [{}] fd = {} state = {}", name_, channel_->fd(), static_cast<int>(state_.load()));
     if (state_ == State::kDisconnected)
         return;
     assert(state_ == State::kConnected or state_ == State::kDisconnecting);
 
     set_state(State::kDisconnected);
+    MetricsRegistry::add(connections_open, -1);
+    MetricsRegistry::add(connections_closed);
     channel_->disable_all();
+    response_streams_.clear();
+    clear_read_pause();
 
     TcpConnectionPtr guard_this(shared_from_this());
     if (connection_cb_)
@@ -360,6 +1004,22 @@ void TcpConnection::handle_close()
         close_cb_(guard_this);
 }
 
+void TcpConnection::handle_error_event()
+{
+    loop_->assert_in_loop_thread();
+    if (!zerocopy_inflight_.empty() and reap_zerocopy_completions())
+    {
+        int optval = 0;
+        socklen_t optlen = sizeof optval;
+        if (::getsockopt(channel_->fd(), SOL_SOCKET, SO_ERROR, &optval, &optlen) == 0 and optval == 0)
+            return;
+        SK_LOG_ERROR("TcpConnection::handle_error_event [{}] - SO_ERROR = {} ({})", name_, optval, errno_to_string(optval));
+        handle_close();
+        return;
+    }
+    handle_error();
+}
+
 void TcpConnection::handle_error()
 {
     loop_->assert_in_loop_thread();
@@ -370,6 +1030,6 @@ void TcpConnection::handle_error()
         err = errno;
     else
         err = optval;
-    log_write_error_information("TcpConnection::handle_error [" + name_ + "] - SO_ERROR = " + to_string(err) + " (" + errno_to_string(err) + ")");
+    SK_LOG_ERROR("TcpConnection::handle_error [{}] - SO_ERROR = {} ({})", name_, err, errno_to_string(err));
     handle_close();
 }
\ No newline at end of file
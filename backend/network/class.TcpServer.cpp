@@ -18,83 +18,203 @@
 #include "network.hpp"
 using namespace net;
 
+namespace
+{
+    thread_local uint64_t active_request_id = 0;
+
+    // Publishes the request a handler is serving to TcpServer::respond() on this thread.
+    class RequestScope
+    {
+    public:
+        explicit RequestScope(uint64_t request_id) noexcept : saved_{active_request_id} { active_request_id = request_id; }
+        ~RequestScope() { active_request_id = saved_; }
+
+        RequestScope(const RequestScope &) = delete;
+        RequestScope &operator=(const RequestScope &) = delete;
+
+    private:
+        uint64_t saved_;
+    };
+
+    // Balances TcpConnection::job_started() even when the job throws.
+    class JobScope
+    {
+    public:
+        explicit JobScope(const TcpConnectionPtr &conn) noexcept : conn_{conn} {}
+        ~JobScope() { conn_->job_finished(); }
+
+        JobScope(const JobScope &) = delete;
+        JobScope &operator=(const JobScope &) = delete;
+
+    private:
+        const TcpConnectionPtr &conn_;
+    };
+
+    const MetricsRegistry::Id output_high_mark_bytes = MetricsRegistry::gauge("simplek_flow_control_output_high_mark_bytes", "Pending output at which a connection stops reading (0 = disabled).");
+    const MetricsRegistry::Id output_low_mark_bytes = MetricsRegistry::gauge("simplek_flow_control_output_low_mark_bytes", "Pending output at which a paused connection resumes reading.");
+    const MetricsRegistry::Id jobs_high_mark = MetricsRegistry::gauge("simplek_flow_control_jobs_high_mark", "In-flight requests at which a connection stops reading (0 = disabled).");
+    const MetricsRegistry::Id jobs_low_mark = MetricsRegistry::gauge("simplek_flow_control_jobs_low_mark", "In-flight requests at which a paused connection resumes reading.");
+    const MetricsRegistry::Id upload_high_mark_bytes = MetricsRegistry::gauge("simplek_flow_control_upload_high_mark_bytes", "Queued upload bytes at which a connection stops reading (0 = disabled).");
+    const MetricsRegistry::Id upload_low_mark_bytes = MetricsRegistry::gauge("simplek_flow_control_upload_low_mark_bytes", "Queued upload bytes at which a paused connection resumes reading.");
+
+    const MetricsRegistry::Id servers_draining = MetricsRegistry::gauge("simplek_servers_draining", "Servers that stopped accepting and are waiting for in-flight requests.");
+    const MetricsRegistry::Id drain_rejected = MetricsRegistry::counter("simplek_drain_rejected_total", "Requests answered with busy because the server was draining.");
+
+    void publish_flow_control(const TcpConnection::FlowControl &from, const TcpConnection::FlowControl &to)
+    {
+        auto delta = [](size_t before, size_t after)
+        { return static_cast<int64_t>(after) - static_cast<int64_t>(before); };
+        MetricsRegistry::add(output_high_mark_bytes, delta(from.output_high_mark, to.output_high_mark));
+        MetricsRegistry::add(output_low_mark_bytes, delta(from.output_low_mark, to.output_low_mark));
+        MetricsRegistry::add(jobs_high_mark, delta(from.jobs_high_mark, to.jobs_high_mark));
+        MetricsRegistry::add(jobs_low_mark, delta(from.jobs_low_mark, to.jobs_low_mark));
+        MetricsRegistry::add(upload_high_mark_bytes, delta(from.upload_high_mark, to.upload_high_mark));
+        MetricsRegistry::add(upload_low_mark_bytes, delta(from.upload_low_mark, to.upload_low_mark));
+    }
+}
+
 TcpServer::TcpServer(EventLoop *loop, uint16_t port, string name, bool reuse_port)
+    : TcpServer(loop, make_unique<Acceptor>(loop, port, reuse_port), move(name))
+{
+    SK_LOG_INFO("TcpServer [{}] bound to port {}", name_, port);
+}
+
+TcpServer::TcpServer(EventLoop *loop, Socket listen_socket, string name)
+    : TcpServer(loop, make_unique<Acceptor>(loop, move(listen_socket)), move(name))
+{
+    SK_LOG_INFO("TcpServer [{}] adopted an inherited listening socket", name_);
+}
+
+TcpServer::TcpServer(EventLoop *loop, unique_ptr<Acceptor> acceptor, string name)
     : loop_{loop},
       name_{move(name)},
-      acceptor_{make_unique<Acceptor>(loop, port, reuse_port)},
+      acceptor_{move(acceptor)},
+      edge_triggered_{false},
+      io_budget_{TcpConnection::kDefaultIoBudget},
+      zerocopy_threshold_{0},
+      retained_buffer_limit_{TcpConnection::kDefaultRetainedBufferLimit},
+      loop_pool_{make_unique<EventLoopThreadPool>(loop, name_)},
       started_{false},
       next_conn_id_{1},
       connection_cb_{[](const TcpConnectionPtr &) { /* Default no-op */ }},
       write_complete_cb_{[](const TcpConnectionPtr &) { /* Default no-op */ }},
+      max_streaming_payload_size_{kDefaultMaxStreamingPayloadSize},
       default_protocol_handler_{[](const TcpConnectionPtr &conn, const string &tag, string_view /*payload*/) -> ProtocolHandlerPair
                                 {
-                                    log_write_warning_information("Using default protocol handler for unknown tag: " + tag + " on connection " + conn->name());
+                                    SK_LOG_WARNING("Using default protocol handler for unknown tag: {} on connection {}", tag, conn->name());
                                     return ProtocolHandlerPair("ERROR", "Error: Unknown protocol command '" + tag + "'");
                                 }},
       default_handler_{[](const TcpConnectionPtr &conn, Buffer *buf) -> string
                        {
-                           log_write_warning_information("Using legacy default handler for connection " + conn->name() + ". Buffer size: " + to_string(buf->readable_bytes()));
+                           SK_LOG_WARNING("Using legacy default handler for connection {}. Buffer size: {}", conn->name(), buf->readable_bytes());
                            string received = buf->retrieve_all_as_string();
                            return "Error: Unrecognized command or data format: '" + received.substr(0, 50) + (received.length() > 50 ? "..." : "") + "'\r\n";
-                       }}
+                       }},
+      draining_{false},
+      unregistered_tag_metrics_{make_tag_metrics("<unregistered>")},
+      oversized_frames_{MetricsRegistry::counter("simplek_protocol_errors_total", "Frames rejected or failed by the protocol layer.", MetricsRegistry::label("reason", "oversized"))},
+      malformed_input_{MetricsRegistry::counter("simplek_protocol_errors_total", "Frames rejected or failed by the protocol layer.", MetricsRegistry::label("reason", "malformed"))},
+      handler_errors_{MetricsRegistry::counter("simplek_protocol_errors_total", "Frames rejected or failed by the protocol layer.", MetricsRegistry::label("reason", "handler_exception"))}
 {
-    log_write_regular_information("Starting server on port " + to_string(port) + "...");
+    publish_flow_control(TcpConnection::FlowControl{0, 0, 0, 0, 0, 0}, flow_control_);
     acceptor_->set_new_connection_callback(
         [this](int sockfd, const sockaddr_in &peer_addr)
         {
             new_connection(sockfd, peer_addr);
         });
-    log_write_regular_information("TcpServer created [" + name_ + "] on loop " + to_string(reinterpret_cast<uintptr_t>(loop_)));
+    SK_LOG_INFO("TcpServer created [{}] on loop {}", name_, reinterpret_cast<uintptr_t>(loop_));
 }
 
 TcpServer::~TcpServer()
 {
-    log_write_regular_information("TcpServer::~TcpServer [" + name_ + "] destructing");
+    loop_->assert_in_loop_thread();
+    SK_LOG_INFO("TcpServer::~TcpServer [{}] destructing", name_);
     for (auto &[conn_name, conn] : connections_)
     {
         TcpConnectionPtr conn_copy(conn);
         conn.reset();
         if (conn_copy)
-        {
-            /* Default no-op */
-        }
+            conn_copy->get_loop()->run_in_loop([conn_copy]()
+                                               { conn_copy->connect_destroyed(); });
     }
     connections_.clear();
-    log_write_regular_information("Server exited.");
+    publish_flow_control(flow_control_, TcpConnection::FlowControl{0, 0, 0, 0, 0, 0});
+    SK_LOG_INFO("Server exited.");
+}
+
+TcpServer::TagRoute *TcpServer::route_for_registration(const string &tag, const char *kind)
+{
+    assert(!started_);
+    if (tag.empty() or tag.length() > kMaxTagLength)
+    {
+        SK_LOG_ERROR("Cannot register {}: Tag length must be between 1 and {} bytes. Tag: {}", kind, kMaxTagLength, tag);
+        return nullptr;
+    }
+    TagTable::TagId id = tags_.intern(tag);
+    if (id == TagTable::kUnknownTag)
+        return nullptr;
+    if (id == routes_.size())
+        routes_.push_back(TagRoute{nullptr, nullptr, nullptr, nullptr, make_tag_metrics(tag)});
+    return &routes_[id];
 }
 
 void TcpServer::register_protocol_handler(const string &tag, ProtocolHandler cb)
 {
-    if (tag.length() > numeric_limits<uint8_t>::max())
+    TagRoute *route = route_for_registration(tag, "protocol handler");
+    if (route == nullptr)
+        return;
+    route->protocol = move(cb);
+    SK_LOG_INFO("Registered protocol handler for tag: {}", tag);
+}
+
+void TcpServer::register_streaming_handler(const string &tag, StreamingProtocolHandler handler)
+{
+    if (!handler.on_frame_begin or !handler.on_frame_chunk or !handler.on_frame_end)
     {
-        log_write_error_information("Cannot register protocol handler: Tag length exceeds 255 bytes. Tag: " + tag);
+        SK_LOG_ERROR("Cannot register streaming handler for tag: {} - on_frame_begin, on_frame_chunk and on_frame_end are required.", tag);
         return;
     }
-    protocol_handlers_.insert_or_assign(tag, cb);
-    log_write_regular_information("Registered protocol handler for tag: " + tag);
+    TagRoute *route = route_for_registration(tag, "streaming handler");
+    if (route == nullptr)
+        return;
+    route->streaming = make_shared<const StreamingProtocolHandler>(move(handler));
+    SK_LOG_INFO("Registered streaming handler for tag: {}", tag);
+}
+
+void TcpServer::set_max_streaming_payload_size(size_t bytes)
+{
+    assert(!started_);
+    max_streaming_payload_size_ = min<size_t>(bytes, numeric_limits<uint32_t>::max());
+}
+
+void TcpServer::set_admission_controller(const string &tag, shared_ptr<AdmissionController> controller)
+{
+    TagRoute *route = route_for_registration(tag, "admission controller");
+    if (route == nullptr)
+        return;
+    route->admission = move(controller);
+    SK_LOG_INFO("Admission control enabled for tag: {}", tag);
 }
 
 void TcpServer::set_default_protocol_handler(ProtocolHandler cb)
 {
     default_protocol_handler_ = move(cb);
-    log_write_regular_information("Default protocol handler set.");
+    SK_LOG_INFO("Default protocol handler set.");
 }
 
 void TcpServer::register_handler(HandlerTag tag, Handler cb)
 {
-    if (tag.length() > numeric_limits<uint8_t>::max())
-    {
-        log_write_error_information("Cannot register legacy handler: Tag length exceeds 255 bytes. Tag: " + tag);
+    TagRoute *route = route_for_registration(tag, "legacy handler");
+    if (route == nullptr)
         return;
-    }
-    handlers_.insert_or_assign(tag, cb);
-    log_write_regular_information("Registered legacy handler for tag: " + tag);
+    route->legacy = move(cb);
+    SK_LOG_INFO("Registered legacy handler for tag: {}", tag);
 }
 
 void TcpServer::set_default_handler(Handler cb)
 {
     default_handler_ = move(cb);
-    log_write_regular_information("Legacy default handler set.");
+    SK_LOG_INFO("Legacy default handler set.");
 }
 
 void TcpServer::set_connection_callback(const TcpConnection::ConnectionCallback &cb)
@@ -107,6 +227,83 @@ void TcpServer::set_write_complete_callback(const TcpConnection::WriteCompleteCa
     write_complete_cb_ = cb;
 }
 
+void TcpServer::set_thread_num(size_t num_threads)
+{
+    assert(!started_);
+    loop_pool_->set_thread_num(num_threads);
+}
+
+void TcpServer::set_loop_strategy(EventLoopThreadPool::Strategy strategy)
+{
+    loop_pool_->set_strategy(strategy);
+}
+
+void TcpServer::set_reaper_options(const ConnectionReaper::Options &options)
+{
+    assert(!started_);
+    reaper_options_ = options;
+}
+
+void TcpServer::set_edge_triggered(bool on)
+{
+    assert(!started_);
+    edge_triggered_ = on;
+}
+
+void TcpServer::set_io_budget(size_t bytes)
+{
+    assert(!started_);
+    io_budget_ = bytes;
+}
+
+void TcpServer::set_zerocopy_threshold(size_t bytes)
+{
+    assert(!started_);
+    zerocopy_threshold_ = bytes;
+}
+
+void TcpServer::set_retained_buffer_limit(size_t bytes)
+{
+    assert(!started_);
+    retained_buffer_limit_ = bytes;
+}
+
+void TcpServer::set_flow_control(const TcpConnection::FlowControl &options)
+{
+    assert(!started_);
+    publish_flow_control(flow_control_, options);
+    flow_control_ = options;
+}
+
+void TcpServer::enable_stats(const string &tag)
+{
+    register_protocol_handler(tag, [](const TcpConnectionPtr &conn, const string &incoming_tag, string_view /*payload*/) -> ProtocolHandlerPair
+                              {
+                                  SK_LOG_DEBUG("stats requested by {}", conn->name());
+                                  return {incoming_tag, MetricsRegistry::render()};
+                              });
+}
+
+/* static */ TcpServer::TagMetrics TcpServer::make_tag_metrics(const string &tag)
+{
+    string labels = MetricsRegistry::label("tag", tag);
+    return TagMetrics{MetricsRegistry::counter("simplek_frames_received_total", "Protocol frames received, by tag.", labels),
+                      MetricsRegistry::counter("simplek_frame_payload_bytes_total", "Protocol frame payload bytes received, by tag.", labels),
+                      MetricsRegistry::histogram("simplek_handler_duration_seconds", "Time spent in protocol handlers, by tag.", labels)};
+}
+
+const TcpServer::TagMetrics &TcpServer::metrics_for(TagTable::TagId tag) const
+{
+    return tag == TagTable::kUnknownTag ? unregistered_tag_metrics_ : routes_[tag].metrics;
+}
+
+void TcpServer::count_frame(TagTable::TagId tag, size_t payload_len) const
+{
+    const TagMetrics &metrics = metrics_for(tag);
+    MetricsRegistry::add(metrics.frames);
+    MetricsRegistry::add(metrics.payload_bytes, static_cast<int64_t>(payload_len));
+}
+
 void TcpServer::start()
 {
     if (!started_)
@@ -115,270 +312,640 @@ void TcpServer::start()
         loop_->run_in_loop([this]()
                            {
              loop_->assert_in_loop_thread();
+             loop_pool_->start();
+             for (EventLoop *io_loop : loop_pool_->get_all_loops())
+             {
+                 auto reaper = make_shared<ConnectionReaper>(io_loop, reaper_options_);
+                 reaper->start();
+                 reapers_.emplace(io_loop, move(reaper));
+                 io_loop->run_every(BufferBlockPool::kIdleTrimInterval, []()
+                                    { BufferBlockPool::trim_idle(); });
+             }
              acceptor_->listen();
-             log_write_regular_information("TcpServer [" + name_ + "] started listening."); });
-        log_write_regular_information("TcpServer [" + name_ + "] start requested."); // 模拟启动
+             SK_LOG_INFO("TcpServer [{}] started listening.", name_); });
+        SK_LOG_INFO("TcpServer [{}] start requested.", name_); // 模拟启动
     }
 }
 
-/* static */ string TcpServer::package_message(const string &tag, string_view payload)
+void TcpServer::drain(TimerClock::duration grace, DrainCallback on_drained)
+{
+    loop_->run_in_loop([this, grace, on_drained = move(on_drained)]() mutable
+                       {
+        loop_->assert_in_loop_thread();
+        if (draining_.exchange(true, memory_order_acq_rel))
+        {
+            SK_LOG_WARNING("TcpServer [{}] is already draining.", name_);
+            return;
+        }
+        MetricsRegistry::add(servers_draining, 1);
+        drained_cb_ = move(on_drained);
+        drain_deadline_ = TimerClock::now() + grace;
+        acceptor_->stop();
+        SK_LOG_INFO("TcpServer [{}] draining {} connection(s), grace period {} ms.", name_, connections_.size(), chrono::duration_cast<chrono::milliseconds>(grace).count());
+        drain_timer_ = loop_->run_every(kDrainPollInterval, [this]()
+                                        { check_drain(); });
+        check_drain(); });
+}
+
+void TcpServer::check_drain()
+{
+    loop_->assert_in_loop_thread();
+    if (!drained_cb_)
+        return;
+
+    size_t jobs = 0;
+    size_t busy_connections = 0;
+    for (auto &[conn_name, conn] : connections_)
+    {
+        size_t conn_jobs = conn->jobs_in_flight();
+        // A handler's reply reaches the I/O loop as a queued functor before its job count drops,
+        // so the count is checked again there. shutdown_in_loop() holds SHUT_WR back until every
+        // queued response and output byte is written; only a sent FIN counts as drained.
+        if (conn_jobs == 0 and conn->connected())
+            conn->get_loop()->run_in_loop([conn]()
+                                          {
+                if (conn->jobs_in_flight() == 0)
+                    conn->shutdown(); });
+        if (conn_jobs > 0 or !conn->write_side_closed())
+            ++busy_connections;
+        jobs += conn_jobs;
+    }
+
+    if (busy_connections == 0)
+        finish_drain(true);
+    else if (TimerClock::now() >= drain_deadline_)
+    {
+        SK_LOG_WARNING("TcpServer [{}] drain deadline passed with {} connection(s) and {} request(s) in flight; closing them.", name_, busy_connections, jobs);
+        for (auto &[conn_name, conn] : connections_)
+            conn->force_close();
+        finish_drain(jobs == 0);
+    }
+}
+
+void TcpServer::finish_drain(bool completed)
+{
+    loop_->cancel(drain_timer_);
+    MetricsRegistry::add(servers_draining, -1);
+    SK_LOG_INFO("TcpServer [{}] drained{}.", name_, completed ? "" : " with requests abandoned");
+    DrainCallback cb = move(drained_cb_);
+    drained_cb_ = nullptr;
+    cb(completed);
+}
+
+/* static */ string TcpServer::frame_header(const string &tag, size_t payload_len)
 {
     if (tag.length() > numeric_limits<uint8_t>::max())
     {
-        log_write_error_information("package_message error: Tag length (" + to_string(tag.length()) + ") exceeds limit (255). Tag: " + tag);
+        SK_LOG_ERROR("frame_header error: Tag length ({}) exceeds limit (255). Tag: {}", tag.length(), tag);
         return "";
     }
-    if (payload.length() > numeric_limits<uint32_t>::max())
+    if (payload_len > numeric_limits<uint32_t>::max())
     {
-        log_write_error_information("package_message error: Payload length (" + to_string(payload.length()) + ") exceeds limit (UINT32_MAX).");
+        SK_LOG_ERROR("frame_header error: Payload length ({}) exceeds limit (UINT32_MAX).", payload_len);
         return "";
     }
 
     uint8_t tag_len = static_cast<uint8_t>(tag.length());
-    uint32_t payload_len_host = static_cast<uint32_t>(payload.length());
-    uint32_t payload_len_net = htonl(payload_len_host);
+    uint32_t payload_len_net = htonl(static_cast<uint32_t>(payload_len));
 
-    string message;
-    size_t total_len = sizeof(tag_len) + tag.length() + sizeof(payload_len_net) + payload.length();
-    message.reserve(total_len);
+    string header;
+    header.reserve(sizeof(tag_len) + tag.length() + sizeof(payload_len_net));
+    header.push_back(static_cast<char>(tag_len));
+    header.append(tag);
+    header.append(reinterpret_cast<const char *>(&payload_len_net), sizeof(payload_len_net));
+    return header;
+}
 
-    message.push_back(static_cast<char>(tag_len));
-    message.append(tag);
-    message.append(reinterpret_cast<const char *>(&payload_len_net), sizeof(payload_len_net));
-    message.append(payload.data(), payload.length());
+/* static */ string TcpServer::frame_header(const string &tag, uint64_t request_id, uint8_t flags, size_t payload_len)
+{
+    if (tag.length() > numeric_limits<uint8_t>::max())
+    {
+        SK_LOG_ERROR("frame_header error: Tag length ({}) exceeds limit (255). Tag: {}", tag.length(), tag);
+        return "";
+    }
+    if (payload_len > numeric_limits<uint32_t>::max())
+    {
+        SK_LOG_ERROR("frame_header error: Payload length ({}) exceeds limit (UINT32_MAX).", payload_len);
+        return "";
+    }
+
+    uint64_t request_id_net = htobe64(request_id);
+    uint32_t payload_len_net = htonl(static_cast<uint32_t>(payload_len));
+
+    string header;
+    header.reserve(4 * sizeof(uint8_t) + tag.length() + sizeof(request_id_net) + sizeof(payload_len_net));
+    header.push_back(static_cast<char>(kFrameV2Marker));
+    header.push_back(static_cast<char>(kProtocolVersion));
+    header.push_back(static_cast<char>(flags));
+    header.push_back(static_cast<char>(tag.length()));
+    header.append(tag);
+    header.append(reinterpret_cast<const char *>(&request_id_net), sizeof(request_id_net));
+    header.append(reinterpret_cast<const char *>(&payload_len_net), sizeof(payload_len_net));
+    return header;
+}
+
+/* static */ string TcpServer::negotiate_protocol(string_view hello_payload)
+{
+    constexpr string_view key = "protocol=";
+    for (size_t begin = 0; begin < hello_payload.size();)
+    {
+        size_t end = hello_payload.find('\n', begin);
+        string_view line = hello_payload.substr(begin, end == string_view::npos ? string_view::npos : end - begin);
+        if (line.starts_with(key))
+        {
+            unsigned offered = 0;
+            from_chars(line.data() + key.size(), line.data() + line.size(), offered);
+            if (offered >= kProtocolVersion)
+                return "\n" + string(key) + to_string(kProtocolVersion);
+        }
+        if (end == string_view::npos)
+            break;
+        begin = end + 1;
+    }
+    return "";
+}
+
+/* static */ uint64_t TcpServer::current_request_id()
+{
+    return active_request_id;
+}
+
+/* static */ void TcpServer::respond(const TcpConnectionPtr &conn, const string &tag, vector<OutputSegment> payload)
+{
+    if (uint64_t request_id = current_request_id(); request_id != 0)
+        conn->send_response(request_id, tag, move(payload));
+    else
+        conn->send_frame(tag, move(payload));
+}
+
+/* static */ void TcpServer::send_handler_response(const TcpConnectionPtr &conn, uint64_t request_id, ProtocolHandlerPair response, bool failed)
+{
+    if (response.second.empty())
+        return;
+    if (request_id == 0)
+        conn->send_frame(response.first, move(response.second));
+    else
+        conn->send_response(request_id, response.first, move(response.second), failed ? kFlagError : 0);
+}
+
+/* static */ shared_ptr<Strand> TcpServer::strand_for(const TcpConnectionPtr &conn, uint64_t request_id)
+{
+    // v1 frames share the connection strand and are answered in order; every v2 request
+    // gets a strand of its own so a slow handler only holds up its own response.
+    return request_id == 0 ? conn->strand() : make_shared<Strand>();
+}
+
+/* static */ void TcpServer::post_job(const TcpConnectionPtr &conn, const shared_ptr<Strand> &strand, Strand::Task job)
+{
+    conn->job_started();
+    strand->post([conn, job = move(job)]()
+                 {
+        JobScope scope(conn);
+        job(); });
+}
 
+/* static */ string TcpServer::package_message(const string &tag, string_view payload)
+{
+    string message = frame_header(tag, payload.length());
+    if (message.empty())
+        return "";
+    message.reserve(message.size() + payload.length());
+    message.append(payload.data(), payload.length());
     return message;
 }
 
-tuple<unique_ptr<char[]>, size_t> TcpServer::on_message(const TcpConnectionPtr &conn, Buffer *buf)
+bool TcpServer::admit(const TcpConnectionPtr &conn, const TagRoute &route, TagTable::TagId tag, uint64_t request_id, shared_ptr<AdmissionController::Ticket> &ticket)
 {
-    while (buf->readable_bytes() > 0)
+    AdmissionController::Decision decision{nullptr, chrono::milliseconds::zero(), kDrainRetryAfter};
+    string_view reason = "Server is shutting down, please retry later.";
+    if (draining())
+        MetricsRegistry::add(drain_rejected);
+    else if (!route.admission)
+        return true;
+    else
+    {
+        decision = route.admission->try_admit();
+        if (decision.ticket)
+        {
+            ticket = move(decision.ticket);
+            return true;
+        }
+        reason = "Server is busy, please retry later.";
+    }
+
+    SK_LOG_WARNING("TcpServer::admit [{}] - rejecting '{}' (estimated wait {} ms), retry after {} ms.", conn->name(), tags_.name(tag), decision.estimated_wait.count(), decision.retry_after.count());
+    string payload = "retry_after_ms=" + to_string(decision.retry_after.count()) +
+                     "\nestimated_wait_ms=" + to_string(decision.estimated_wait.count()) +
+                     "\n" + string(reason);
+    // v1 answers must stay in request order, so the rejection queues behind earlier work; it
+    // counts as a job so that a draining server does not shut the connection down under it.
+    if (request_id == 0)
+        post_job(conn, conn->strand(), [conn, payload = move(payload)]() mutable
+                 { conn->send_frame(kBusyTag, move(payload)); });
+    else
+        conn->send_response(request_id, kBusyTag, move(payload), kFlagError);
+    return false;
+}
+
+TcpServer::FrameStatus TcpServer::begin_inbound_stream(const TcpConnectionPtr &conn, Buffer *buf, shared_ptr<const StreamingProtocolHandler> handler, TagTable::TagId tag, uint64_t request_id, size_t payload_len, shared_ptr<AdmissionController::Ticket> ticket)
+{
+    // A stream without a handler was turned away by admission control; its payload is only drained.
+    auto stream = make_shared<InboundStream>(InboundStream{move(handler), nullptr, tag, request_id, payload_len, payload_len, any{}, false, move(ticket)});
+    conn->inbound_stream() = stream;
+    if (!stream->handler)
+        return continue_inbound_stream(conn, buf, stream);
+
+    stream->strand = strand_for(conn, request_id);
+    conn->job_started();
+    stream->strand->post([this, conn, stream]()
+                         { invoke_stream_callback(conn, *stream, [&]()
+                                                  { stream->context = stream->handler->on_frame_begin(conn, tags_.name(stream->tag), stream->payload_len); }); });
+    return continue_inbound_stream(conn, buf, stream);
+}
+
+TcpServer::FrameStatus TcpServer::continue_inbound_stream(const TcpConnectionPtr &conn, Buffer *buf, const shared_ptr<InboundStream> &stream)
+{
+    size_t available = min(buf->readable_bytes(), stream->remaining);
+    bool finished = available == stream->remaining;
+    if (!stream->handler)
     {
-        size_t initial_readable = buf->readable_bytes();
+        buf->retrieve(available);
+        stream->remaining -= available;
+        if (!finished)
+            return FrameStatus::kIncomplete;
+        conn->inbound_stream().reset();
+        return FrameStatus::kComplete;
+    }
+    if (!finished and available < kStreamChunkSize)
+    {
+        buf->reserve(min(stream->remaining, kStreamChunkSize) - available);
+        return FrameStatus::kIncomplete;
+    }
+
+    string chunk = buf->retrieve_as_string(available);
+    stream->remaining -= available;
+    if (finished)
+        conn->inbound_stream().reset();
+    // The strand may be stuck behind another job; stop reading rather than queueing the whole upload.
+    conn->upload_queued(available);
+    stream->strand->post([this, conn, stream, chunk = move(chunk), finished]()
+                         {
+        feed_inbound_stream(conn, *stream, chunk, finished);
+        conn->upload_consumed(chunk.size());
+        if (finished)
+            conn->job_finished(); });
+    return finished ? FrameStatus::kComplete : FrameStatus::kIncomplete;
+}
+
+void TcpServer::feed_inbound_stream(const TcpConnectionPtr &conn, InboundStream &stream, string_view chunk, bool finished)
+{
+    if (!chunk.empty())
+        invoke_stream_callback(conn, stream, [&]()
+                               { stream.handler->on_frame_chunk(conn, stream.context, chunk); });
+    if (!finished)
+        return;
+
+    ProtocolHandlerPair response;
+    if (stream.failed)
+        response.second = "Internal server error (protocol handler exception).";
+    else
+    {
+        if (stream.ticket)
+            stream.ticket->begin_service();
+        MetricsRegistry::ScopedTimer timer(metrics_for(stream.tag).handler_seconds);
+        if (!invoke_stream_callback(conn, stream, [&]()
+                                    { response = stream.handler->on_frame_end(conn, tags_.name(stream.tag), stream.context); }))
+            response.second = "Internal server error (protocol handler exception).";
+    }
+    stream.context.reset();
+    stream.ticket.reset();
+
+    send_handler_response(conn, stream.request_id, move(response), stream.failed);
+}
+
+void TcpServer::abort_inbound_stream(const TcpConnectionPtr &conn)
+{
+    conn->get_loop()->assert_in_loop_thread();
+    auto *active = any_cast<shared_ptr<InboundStream>>(&conn->inbound_stream());
+    if (active == nullptr)
+        return;
 
-        bool processed_by_protocol_attempt = attempt_protocol_processing(conn, buf);
+    shared_ptr<InboundStream> stream = *active;
+    conn->inbound_stream().reset();
+    if (!stream->handler)
+        return;
+    SK_LOG_WARNING("TcpServer::abort_inbound_stream [{}] - connection closed with {} bytes of '{}' frame outstanding.", conn->name(), stream->remaining, tags_.name(stream->tag));
+    stream->strand->post([this, conn, stream]()
+                         {
+        JobScope scope(conn);
+        if (stream->handler->on_frame_abort)
+            invoke_stream_callback(conn, *stream, [&]()
+                                   { stream->handler->on_frame_abort(conn, stream->context); });
+        stream->context.reset();
+        stream->ticket.reset(); });
+}
 
-        if (processed_by_protocol_attempt)
+bool TcpServer::invoke_stream_callback(const TcpConnectionPtr &conn, InboundStream &stream, const function<void()> &callback)
+{
+    if (stream.failed)
+        return false;
+    try
+    {
+        RequestScope scope(stream.request_id);
+        callback();
+        return true;
+    }
+    catch (const exception &e)
+    {
+        SK_LOG_ERROR("StreamingProtocolHandler exception for tag [{}] on connection [{}]: {}", tags_.name(stream.tag), conn->name(), e.what());
+    }
+    catch (...)
+    {
+        SK_LOG_ERROR("Unknown StreamingProtocolHandler exception for tag [{}] on connection [{}].", tags_.name(stream.tag), conn->name());
+    }
+    MetricsRegistry::add(handler_errors_);
+    stream.failed = true;
+    return false;
+}
+
+tuple<unique_ptr<char[]>, size_t> TcpServer::on_message(const TcpConnectionPtr &conn, Buffer *buf)
+{
+    conn->get_loop()->assert_in_loop_thread();
+    bool frame_completed = false;
+    while (buf->readable_bytes() > 0)
+    {
+        FrameStatus status = attempt_protocol_processing(conn, buf);
+        if (status == FrameStatus::kComplete)
         {
+            frame_completed = true;
             continue;
         }
-        else
+        if (status == FrameStatus::kMalformed)
         {
-            bool processed_by_legacy = process_legacy_fallback(conn, buf, initial_readable);
-            break;
+            MetricsRegistry::add(malformed_input_);
+            process_legacy_fallback(conn, buf);
         }
+        break;
+    }
+
+    size_t pending = buf->readable_bytes();
+    if (conn->inbound_stream().has_value())
+        conn->update_inbound_progress(true, true, frame_completed);
+    else
+    {
+        FrameHeader header;
+        bool header_complete = pending > 0 and peek_frame_header(buf, header) == FrameStatus::kComplete;
+        conn->update_inbound_progress(pending > 0, header_complete, frame_completed);
     }
     return {nullptr, 0};
 }
 
-bool TcpServer::attempt_protocol_processing(const TcpConnectionPtr &conn, Buffer *buf)
+/* static */ TcpServer::FrameStatus TcpServer::peek_frame_header(const Buffer *buf, FrameHeader &header)
 {
-    uint8_t tag_len = 0;
-    size_t header_len = 0;
-    uint32_t payload_len = 0;
-    size_t total_message_len = 0;
-    string tag = "";
-    size_t initial_readable = buf->readable_bytes();
+    size_t readable = buf->readable_bytes();
+    if (readable < sizeof(uint8_t))
+        return FrameStatus::kIncomplete;
 
-    if (initial_readable < sizeof(uint8_t))
-        return false;
+    bool v2 = static_cast<uint8_t>(buf->peek_byte(0)) == kFrameV2Marker;
+    size_t prefix_len = v2 ? 4 * sizeof(uint8_t) : sizeof(uint8_t);
+    if (readable < prefix_len)
+        return FrameStatus::kIncomplete;
+    // Requests never carry flags; fragmentation is only used for responses.
+    if (v2 and (static_cast<uint8_t>(buf->peek_byte(1)) != kProtocolVersion or buf->peek_byte(2) != 0))
+        return FrameStatus::kMalformed;
 
-    tag_len = static_cast<uint8_t>(*buf->peek());
-    if (tag_len == 0 || tag_len >= 64)
-        return false;
+    header.tag_len = static_cast<uint8_t>(buf->peek_byte(prefix_len - 1));
+    if (header.tag_len == 0 || header.tag_len > kMaxTagLength)
+        return FrameStatus::kMalformed;
 
-    header_len = sizeof(uint8_t) + tag_len + sizeof(uint32_t);
-    if (initial_readable < header_len)
-        return false;
+    size_t request_id_len = v2 ? sizeof(uint64_t) : 0;
+    header.length = prefix_len + header.tag_len + request_id_len + sizeof(uint32_t);
+    if (readable < header.length)
+        return FrameStatus::kIncomplete;
+
+    buf->copy_out(prefix_len, header.tag_bytes, header.tag_len);
+    header.request_id = 0;
+    if (v2)
+    {
+        uint64_t request_id_net;
+        buf->copy_out(prefix_len + header.tag_len, &request_id_net, sizeof(request_id_net));
+        header.request_id = be64toh(request_id_net);
+        if (header.request_id == 0)
+            return FrameStatus::kMalformed;
+    }
 
     uint32_t payload_len_net;
-    memcpy(&payload_len_net, buf->peek() + sizeof(uint8_t) + tag_len, sizeof(payload_len_net));
-    payload_len = ntohl(payload_len_net);
+    buf->copy_out(prefix_len + header.tag_len + request_id_len, &payload_len_net, sizeof(payload_len_net));
+    header.payload_len = ntohl(payload_len_net);
+    return FrameStatus::kComplete;
+}
+
+TcpServer::FrameStatus TcpServer::attempt_protocol_processing(const TcpConnectionPtr &conn, Buffer *buf)
+{
+    if (auto *active = any_cast<shared_ptr<InboundStream>>(&conn->inbound_stream()))
+    {
+        shared_ptr<InboundStream> stream = *active;
+        return continue_inbound_stream(conn, buf, stream);
+    }
+
+    FrameHeader header;
+    FrameStatus header_status = peek_frame_header(buf, header);
+    if (header_status != FrameStatus::kComplete)
+        return header_status;
+
+    size_t initial_readable = buf->readable_bytes();
+    size_t header_len = header.length;
+    uint32_t payload_len = header.payload_len;
+    string_view tag = header.tag();
+    TagTable::TagId tag_id = tags_.find(tag);
+    const TagRoute *route = tag_id == TagTable::kUnknownTag ? nullptr : &routes_[tag_id];
+
+    if (route != nullptr and route->streaming)
+    {
+        if (payload_len > max_streaming_payload_size_)
+        {
+            SK_LOG_ERROR("TcpServer::attempt_protocol_processing [{}] - Protocol Error: Streaming payload length ({}) exceeds limit. Closing connection.", conn->name(), payload_len);
+            MetricsRegistry::add(oversized_frames_);
+            conn->force_close();
+            buf->retrieve_all();
+            return FrameStatus::kRejected;
+        }
+        count_frame(tag_id, payload_len);
+        buf->retrieve(header_len);
+        shared_ptr<AdmissionController::Ticket> ticket;
+        if (!admit(conn, *route, tag_id, header.request_id, ticket))
+            return begin_inbound_stream(conn, buf, nullptr, tag_id, header.request_id, payload_len, nullptr);
+        return begin_inbound_stream(conn, buf, route->streaming, tag_id, header.request_id, payload_len, move(ticket));
+    }
+
     if (payload_len > kMaxPayloadSize)
     {
-        log_write_error_information("TcpServer::attempt_protocol_processing [" + conn->name() + "] - Protocol Error: Payload length (" + to_string(payload_len) + ") exceeds limit. Closing connection.");
+        SK_LOG_ERROR("TcpServer::attempt_protocol_processing [{}] - Protocol Error: Payload length ({}) exceeds limit. Closing connection.", conn->name(), payload_len);
+        MetricsRegistry::add(oversized_frames_);
         conn->force_close();
         buf->retrieve_all();
-        return true;
+        return FrameStatus::kRejected;
     }
 
-    total_message_len = header_len + payload_len;
+    size_t total_message_len = header_len + payload_len;
     if (initial_readable < total_message_len)
-        return false;
-
-    tag.assign(buf->peek() + sizeof(uint8_t), tag_len);
-
-    auto it_proto = protocol_handlers_.find(tag);
-    if (it_proto != protocol_handlers_.end())
     {
-        execute_protocol_handler(it_proto->second, conn, buf, tag, header_len, payload_len);
-        return true;
+        buf->reserve(total_message_len - initial_readable);
+        return FrameStatus::kIncomplete;
     }
 
-    if (execute_legacy_handler_for_tag(tag, conn, buf))
+    count_frame(tag_id, payload_len);
+    if (route != nullptr and route->protocol)
     {
-        if (buf->readable_bytes() < initial_readable)
-            return true;
-        else
+        shared_ptr<AdmissionController::Ticket> ticket;
+        if (!admit(conn, *route, tag_id, header.request_id, ticket))
         {
-            log_write_warning_information("TcpServer::attempt_protocol_processing [" + conn->name() + "] - Legacy handler for tag '" + tag + "' was called but consumed no data.");
-            return false;
+            buf->retrieve(total_message_len);
+            return FrameStatus::kComplete;
         }
+        buf->retrieve(header_len);
+        InboundFrame frame{tag_id, header.request_id, buf->retrieve_as_string(payload_len), move(ticket)};
+        post_job(conn, strand_for(conn, header.request_id), [this, conn, frame = move(frame)]()
+                 { execute_protocol_handler(conn, frame); });
+        return FrameStatus::kComplete;
+    }
+
+    // Legacy handlers parse v1 frames themselves and answer without a request id.
+    if (route != nullptr and route->legacy and header.request_id == 0)
+    {
+        auto frame_buf = make_shared<Buffer>(total_message_len);
+        for (string_view view : buf->views(total_message_len))
+            frame_buf->append(view);
+        buf->retrieve(total_message_len);
+        post_job(conn, conn->strand(), [this, conn, tag_id, frame_buf]()
+                 { execute_legacy_handler_for_tag(routes_[tag_id].legacy, conn, tags_.name(tag_id), frame_buf.get()); });
+        return FrameStatus::kComplete;
     }
 
     if (default_protocol_handler_)
     {
-        execute_default_protocol_handler(default_protocol_handler_, conn, buf, tag, header_len, payload_len);
-        return true;
+        buf->retrieve(header_len);
+        post_job(conn, strand_for(conn, header.request_id), [this, conn, handler = default_protocol_handler_, tag = string(tag), request_id = header.request_id, payload = buf->retrieve_as_string(payload_len)]()
+                 { execute_default_protocol_handler(handler, conn, tag, request_id, payload); });
+        return FrameStatus::kComplete;
     }
 
-    log_write_warning_information("TcpServer::attempt_protocol_processing [" + conn->name() + "] - Valid protocol frame for tag '" + tag + "' but no handler found. Discarding frame.");
+    SK_LOG_WARNING("TcpServer::attempt_protocol_processing [{}] - Valid protocol frame for tag '{}' but no handler found. Discarding frame.", conn->name(), tag);
     buf->retrieve(total_message_len);
-    return true;
+    return FrameStatus::kComplete;
 }
 
-void TcpServer::execute_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, Buffer *buf, const string &tag, size_t header_len, uint32_t payload_len)
+void TcpServer::execute_protocol_handler(const TcpConnectionPtr &conn, const InboundFrame &frame)
 {
+    const TagRoute &route = routes_[frame.tag];
+    const string &tag = tags_.name(frame.tag);
     ProtocolHandlerPair response;
+    bool failed = false;
+    if (frame.ticket)
+        frame.ticket->begin_service();
     try
     {
-        buf->retrieve(header_len);
-        string_view payload_sv(buf->peek(), payload_len);
-        size_t payload_to_consume = payload_len;
-        response = handler(conn, tag, payload_sv);
-        buf->retrieve(payload_to_consume);
+        RequestScope scope(frame.request_id);
+        MetricsRegistry::ScopedTimer timer(route.metrics.handler_seconds);
+        response = route.protocol(conn, tag, frame.payload);
     }
     catch (const exception &e)
     {
-        log_write_error_information("ProtocolHandler exception for tag [" + tag + "] on connection [" + conn->name() + "]: " + string(e.what()));
+        MetricsRegistry::add(handler_errors_);
+        SK_LOG_ERROR("ProtocolHandler exception for tag [{}] on connection [{}]: {}", tag, conn->name(), e.what());
         response.second = "Internal server error (protocol handler exception).";
-        if (buf->readable_bytes() >= payload_len)
-            buf->retrieve(payload_len);
+        failed = true;
     }
     catch (...)
     {
-        log_write_error_information("Unknown ProtocolHandler exception for tag [" + tag + "] on connection [" + conn->name() + "].");
+        MetricsRegistry::add(handler_errors_);
+        SK_LOG_ERROR("Unknown ProtocolHandler exception for tag [{}] on connection [{}].", tag, conn->name());
         response.second = "Unknown internal server error (protocol handler exception).";
-        if (buf->readable_bytes() >= payload_len)
-        {
-            buf->retrieve(payload_len);
-        }
+        failed = true;
     }
 
-    if (!response.second.empty())
-    {
-        string packaged_response = TcpServer::package_message(response.first, response.second);
-        if (!packaged_response.empty())
-            conn->send(packaged_response);
-    }
+    send_handler_response(conn, frame.request_id, move(response), failed);
 }
 
-bool TcpServer::execute_legacy_handler_for_tag(const string &tag, const TcpConnectionPtr &conn, Buffer *buf)
+void TcpServer::execute_legacy_handler_for_tag(const Handler &handler, const TcpConnectionPtr &conn, const string &tag, Buffer *frame_buf)
 {
-    auto it_legacy = handlers_.find(tag);
-    if (it_legacy != handlers_.end())
+    SK_LOG_WARNING("TcpServer::execute_legacy_handler_for_tag [{}] - No ProtocolHandler for tag '{}', falling back to OLD legacy Handler.", conn->name(), tag);
+    try
     {
-        log_write_warning_information("TcpServer::execute_legacy_handler_for_tag [" + conn->name() + "] - No ProtocolHandler for tag '" + tag + "', falling back to OLD legacy Handler.");
-        Handler legacy_handler = it_legacy->second;
-        try
-        {
-            string response = legacy_handler(conn, buf);
-            if (!response.empty())
-                conn->send(response);
-            return true;
-        }
-        catch (const exception &e)
-        {
-            log_write_error_information("Legacy handler (for tag '" + tag + "') exception on connection [" + conn->name() + "]: " + string(e.what()));
-            conn->send("Internal server error (legacy handler exception).\r\n");
-            return true;
-        }
-        catch (...)
-        {
-            log_write_error_information("Unknown legacy handler (for tag '" + tag + "') exception on connection [" + conn->name() + "].");
-            conn->send("Unknown internal server error (legacy handler exception).\r\n");
-            return true;
-        }
+        string response = handler(conn, frame_buf);
+        if (!response.empty())
+            conn->send(response);
+    }
+    catch (const exception &e)
+    {
+        SK_LOG_ERROR("Legacy handler (for tag '{}') exception on connection [{}]: {}", tag, conn->name(), e.what());
+        conn->send("Internal server error (legacy handler exception).\r\n");
+    }
+    catch (...)
+    {
+        SK_LOG_ERROR("Unknown legacy handler (for tag '{}') exception on connection [{}].", tag, conn->name());
+        conn->send("Unknown internal server error (legacy handler exception).\r\n");
     }
-    return false;
 }
 
-void TcpServer::execute_default_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, Buffer *buf, const string &tag, size_t header_len, uint32_t payload_len)
+void TcpServer::execute_default_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, const string &tag, uint64_t request_id, string_view payload)
 {
-    log_write_warning_information("TcpServer::execute_default_protocol_handler [" + conn->name() + "] - Using NEW default_protocol_handler for tag '" + tag + "'.");
+    SK_LOG_WARNING("TcpServer::execute_default_protocol_handler [{}] - Using NEW default_protocol_handler for tag '{}'.", conn->name(), tag);
     ProtocolHandlerPair response;
+    bool failed = false;
     try
     {
-        buf->retrieve(header_len);
-        string_view payload_sv(buf->peek(), payload_len);
-        size_t payload_to_consume = payload_len;
-        response = handler(conn, tag, payload_sv);
-        buf->retrieve(payload_to_consume);
+        RequestScope scope(request_id);
+        response = handler(conn, tag, payload);
     }
     catch (const exception &e)
     {
-        log_write_error_information("Default ProtocolHandler exception for tag [" + tag + "] on connection [" + conn->name() + "]: " + string(e.what()));
+        SK_LOG_ERROR("Default ProtocolHandler exception for tag [{}] on connection [{}]: {}", tag, conn->name(), e.what());
         response.second = "Internal server error (default protocol handler exception).";
-        if (buf->readable_bytes() >= payload_len)
-        {
-            buf->retrieve(payload_len);
-        }
+        failed = true;
     }
     catch (...)
     {
-        log_write_error_information("Unknown Default ProtocolHandler exception for tag [" + tag + "] on connection [" + conn->name() + "].");
+        SK_LOG_ERROR("Unknown Default ProtocolHandler exception for tag [{}] on connection [{}].", tag, conn->name());
         response.second = "Unknown internal server error (default protocol handler exception).";
-        if (buf->readable_bytes() >= payload_len)
-            buf->retrieve(payload_len);
-    }
-    if (!response.second.empty())
-    {
-        string packaged_response = TcpServer::package_message(response.first, response.second);
-        if (!packaged_response.empty())
-            conn->send(packaged_response);
+        failed = true;
     }
+    send_handler_response(conn, request_id, move(response), failed);
 }
 
-bool TcpServer::process_legacy_fallback(const TcpConnectionPtr &conn, Buffer *buf, size_t initial_readable)
+void TcpServer::process_legacy_fallback(const TcpConnectionPtr &conn, Buffer *buf)
 {
-    if (default_handler_)
+    if (!default_handler_)
     {
+        SK_LOG_WARNING("TcpServer::process_legacy_fallback [{}] - No legacy default handler and data is not protocol format. Discarding {} bytes.", conn->name(), buf->readable_bytes());
+        buf->retrieve_all();
+        return;
+    }
+
+    auto data_buf = make_shared<Buffer>(buf->readable_bytes());
+    for (string_view view : buf->views(buf->readable_bytes()))
+        data_buf->append(view);
+    buf->retrieve_all();
+    post_job(conn, conn->strand(), [this, conn, data_buf]()
+             {
         try
         {
-            string response = default_handler_(conn, buf);
+            string response = default_handler_(conn, data_buf.get());
             if (!response.empty())
                 conn->send(response);
-            if (buf->readable_bytes() < initial_readable)
-                return true;
-            else
-            {
-                if (initial_readable > 0)
-                    log_write_warning_information("TcpServer::process_legacy_fallback [" + conn->name() + "] - OLD Legacy default handler did not consume any data.");
-                return false;
-            }
+            if (data_buf->readable_bytes() > 0)
+                SK_LOG_WARNING("TcpServer::process_legacy_fallback [{}] - OLD Legacy default handler left {} bytes unconsumed.", conn->name(), data_buf->readable_bytes());
         }
         catch (const exception &e)
         {
-            log_write_error_information("OLD Legacy default handler exception on connection [" + conn->name() + "]: " + string(e.what()));
+            SK_LOG_ERROR("OLD Legacy default handler exception on connection [{}]: {}", conn->name(), e.what());
             conn->send("Internal server error (legacy default handler exception).\r\n");
-            return false;
         }
         catch (...)
         {
-            log_write_error_information("Unknown OLD legacy default handler exception on connection [" + conn->name() + "].");
+            SK_LOG_ERROR("Unknown OLD legacy default handler exception on connection [{}].", conn->name());
             conn->send("Unknown internal server error (legacy default handler exception).\r\n");
-            return false;
-        }
-    }
-    else
-    {
-        if (buf->readable_bytes() > 0)
-        {
-            log_write_warning_information("TcpServer::process_legacy_fallback [" + conn->name() + "] - No legacy default handler and data is not protocol format. Discarding " + to_string(buf->readable_bytes()) + " bytes.");
-            buf->retrieve_all();
-        }
-        return false;
-    }
+        } });
 }
 
 void TcpServer::new_connection(int sockfd, const sockaddr_in &peer_addr)
@@ -394,41 +961,47 @@ void TcpServer::new_connection(int sockfd, const sockaddr_in &peer_addr)
     ++next_conn_id_;
     string conn_name = name_ + "-" + buf;
 
-    log_write_regular_information("TcpServer::new_connection [" + name_ +
-                                  "] - new connection [" + conn_name +
-                                  "] from " + peer_ip + ":" + to_string(peer_port) +
-                                  " sockfd=" + to_string(sockfd));
+    SK_LOG_DEBUG("TcpServer::new_connection [{}] - new connection [{}] from {}:{} sockfd={}", name_, conn_name, peer_ip, peer_port, sockfd);
 
     sockaddr_in local_addr{};
     socklen_t addrlen = sizeof(local_addr);
     if (::getsockname(sockfd, reinterpret_cast<sockaddr *>(&local_addr), &addrlen) < 0)
     {
-        log_write_error_information("TcpServer::new_connection - Failed to get local address for fd " + to_string(sockfd) + ": " + errno_to_string(errno));
+        SK_LOG_ERROR("TcpServer::new_connection - Failed to get local address for fd {}: {}", sockfd, errno_to_string(errno));
         ::close(sockfd);
         return;
     }
 
-    TcpConnectionPtr conn = make_shared<TcpConnection>(loop_, conn_name, sockfd, local_addr, peer_addr);
+    EventLoop *io_loop = loop_pool_->get_next_loop();
+    TcpConnectionPtr conn = make_shared<TcpConnection>(io_loop, conn_name, sockfd, local_addr, peer_addr);
     connections_[conn_name] = conn;
 
+    conn->set_edge_triggered(edge_triggered_);
+    conn->set_io_budget(io_budget_);
+    conn->set_zerocopy_threshold(zerocopy_threshold_);
+    conn->set_retained_buffer_limit(retained_buffer_limit_);
+    conn->set_flow_control(flow_control_);
+
     conn->set_connection_callback(connection_cb_);
     conn->set_message_callback(
         [this](const TcpConnectionPtr &c, Buffer *b)
         {
-            log_write_regular_information("message at: " + c->name());
+            SK_LOG_DEBUG("message at: {}", c->name());
             return on_message(c, b);
         });
     conn->set_write_complete_callback(write_complete_cb_);
     conn->set_close_callback(
         [this](const TcpConnectionPtr &c)
         {
-            log_write_regular_information("connection close: " + c->name());
+            SK_LOG_DEBUG("connection close: {}", c->name());
             remove_connection(c);
         });
 
-    loop_->run_in_loop([conn]()
-                       {
-        if (conn) conn->connect_established(); });
+    shared_ptr<ConnectionReaper> reaper = reapers_[io_loop];
+    io_loop->run_in_loop([conn, reaper]()
+                         {
+        if (conn) conn->connect_established();
+        if (conn and reaper) reaper->track(conn); });
 }
 
 void TcpServer::remove_connection(const TcpConnectionPtr &conn)
@@ -443,14 +1016,16 @@ void TcpServer::remove_connection_in_loop(const TcpConnectionPtr &conn)
     if (!conn)
         return;
 
-    log_write_regular_information("TcpServer::remove_connection_in_loop [" + name_ +
-                                  "] - connection " + conn->name());
+    SK_LOG_DEBUG("TcpServer::remove_connection_in_loop [{}] - connection {}", name_, conn->name());
 
     size_t n = connections_.erase(conn->name());
     if (n != 1)
-        log_write_warning_information("TcpServer::remove_connection_in_loop [" + name_ +
-                                      "] - Tried to remove connection " + conn->name() + " but it was not found or removed multiple times.");
+        SK_LOG_WARNING("TcpServer::remove_connection_in_loop [{}] - Tried to remove connection {} but it was not found or removed multiple times.", name_, conn->name());
+    else
+        loop_pool_->release_loop(conn->get_loop());
 
-    loop_->queue_in_loop([conn]()
-                         { conn->connect_destroyed(); });
+    conn->get_loop()->queue_in_loop([this, conn]()
+                                    {
+        abort_inbound_stream(conn);
+        conn->connect_destroyed(); });
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _CLASS_TIMERQUEUE_CPP
+#include "network.hpp"
+using namespace net;
+
+atomic<uint64_t> TimerQueue::next_sequence_{1};
+
+TimerQueue::TimerQueue(EventLoop *loop)
+    : loop_{loop},
+      timerfd_{::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)},
+      timerfd_channel_{make_unique<Channel>(loop, timerfd_.fd())},
+      armed_expiration_{TimerClock::time_point::max()}
+{
+    if (timerfd_.fd() == -1)
+        util::fatal_perror("TimerQueue::TimerQueue timerfd_create failed");
+
+    timerfd_channel_->on_read([this]
+                              { handle_read(); });
+    timerfd_channel_->enable_reading();
+}
+
+TimerQueue::~TimerQueue()
+{
+    timerfd_channel_->disable_all();
+    timerfd_channel_->remove();
+}
+
+TimerId TimerQueue::add_timer(TimerCallback cb, TimerClock::time_point when, TimerClock::duration interval)
+{
+    Timer *timer = new Timer{move(cb), when, interval, next_sequence_.fetch_add(1, memory_order_relaxed), kNotInHeap, false};
+    TimerId timer_id(timer->sequence);
+    loop_->run_in_loop([this, timer]()
+                       { add_timer_in_loop(timer); });
+    return timer_id;
+}
+
+void TimerQueue::cancel(TimerId timer_id)
+{
+    if (!timer_id.valid())
+        return;
+    loop_->run_in_loop([this, sequence = timer_id.sequence()]()
+                       { cancel_in_loop(sequence); });
+}
+
+void TimerQueue::add_timer_in_loop(Timer *timer)
+{
+    loop_->assert_in_loop_thread();
+    timers_.emplace(timer->sequence, unique_ptr<Timer>(timer));
+    heap_push(timer);
+    if (timer->heap_index == 0)
+        reset_timerfd();
+}
+
+void TimerQueue::cancel_in_loop(uint64_t sequence)
+{
+    loop_->assert_in_loop_thread();
+    auto it = timers_.find(sequence);
+    if (it == timers_.end())
+        return;
+
+    Timer *timer = it->second.get();
+    if (timer->heap_index == kNotInHeap)
+    {
+        timer->canceled = true;
+        return;
+    }
+
+    bool was_earliest = timer->heap_index == 0;
+    heap_erase(timer->heap_index);
+    timers_.erase(it);
+    if (was_earliest)
+        reset_timerfd();
+}
+
+void TimerQueue::handle_read()
+{
+    loop_->assert_in_loop_thread();
+    uint64_t expirations = 0;
+    ssize_t n = ::read(timerfd_.fd(), &expirations, sizeof expirations);
+    if (n != sizeof expirations and errno != EAGAIN)
+        SK_LOG_ERROR("TimerQueue::handle_read() reads {} bytes instead of 8 from timerfd {}", n, timerfd_.fd());
+    armed_expiration_ = TimerClock::time_point::max();
+
+    TimerClock::time_point now = TimerClock::now();
+    vector<Timer *> expired;
+    while (!heap_.empty() and heap_.front().expiration <= now)
+    {
+        Timer *timer = heap_.front().timer;
+        heap_erase(0);
+        expired.push_back(timer);
+    }
+
+    for (Timer *timer : expired)
+        if (!timer->canceled)
+            try
+            {
+                timer->callback();
+            }
+            catch (const exception &e)
+            {
+                SK_LOG_ERROR("Timer callback exception: {}", e.what());
+            }
+            catch (...)
+            {
+                SK_LOG_ERROR("Timer callback unknown exception.");
+            }
+
+    for (Timer *timer : expired)
+    {
+        if (timer->canceled or timer->interval <= TimerClock::duration::zero())
+            timers_.erase(timer->sequence);
+        else
+        {
+            timer->expiration = now + timer->interval;
+            heap_push(timer);
+        }
+    }
+
+    reset_timerfd();
+}
+
+void TimerQueue::reset_timerfd()
+{
+    TimerClock::time_point next = heap_.empty() ? TimerClock::time_point::max() : heap_.front().expiration;
+    if (next == armed_expiration_)
+        return;
+    armed_expiration_ = next;
+
+    struct itimerspec new_value{};
+    if (!heap_.empty())
+    {
+        auto delay = chrono::duration_cast<chrono::nanoseconds>(next - TimerClock::now());
+        if (delay < chrono::microseconds(100))
+            delay = chrono::microseconds(100);
+        new_value.it_value.tv_sec = static_cast<time_t>(delay.count() / 1000000000);
+        new_value.it_value.tv_nsec = static_cast<long>(delay.count() % 1000000000);
+    }
+
+    if (::timerfd_settime(timerfd_.fd(), 0, &new_value, nullptr) == -1)
+        SK_LOG_ERROR("TimerQueue::reset_timerfd timerfd_settime failed: {}", errno_to_string(errno));
+}
+
+void TimerQueue::heap_push(Timer *timer)
+{
+    heap_.push_back(HeapEntry{timer->expiration, timer});
+    timer->heap_index = heap_.size() - 1;
+    sift_up(heap_.size() - 1);
+}
+
+void TimerQueue::heap_erase(size_t index)
+{
+    assert(index < heap_.size());
+    heap_[index].timer->heap_index = kNotInHeap;
+    HeapEntry last = heap_.back();
+    heap_.pop_back();
+    if (index == heap_.size())
+        return;
+
+    heap_place(index, last);
+    if (index > 0 and heap_[index].expiration < heap_[(index - 1) / kHeapArity].expiration)
+        sift_up(index);
+    else
+        sift_down(index);
+}
+
+void TimerQueue::heap_place(size_t index, const HeapEntry &entry)
+{
+    heap_[index] = entry;
+    entry.timer->heap_index = index;
+}
+
+void TimerQueue::sift_up(size_t index)
+{
+    HeapEntry entry = heap_[index];
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / kHeapArity;
+        if (!(entry.expiration < heap_[parent].expiration))
+            break;
+        heap_place(index, heap_[parent]);
+        index = parent;
+    }
+    heap_place(index, entry);
+}
+
+void TimerQueue::sift_down(size_t index)
+{
+    HeapEntry entry = heap_[index];
+    const size_t size = heap_.size();
+    while (true)
+    {
+        size_t first_child = index * kHeapArity + 1;
+        if (first_child >= size)
+            break;
+
+        size_t smallest = first_child;
+        size_t last_child = min(first_child + kHeapArity, size);
+        for (size_t child = first_child + 1; child < last_child; ++child)
+            if (heap_[child].expiration < heap_[smallest].expiration)
+                smallest = child;
+
+        if (!(heap_[smallest].expiration < entry.expiration))
+            break;
+        heap_place(index, heap_[smallest]);
+        index = smallest;
+    }
+    heap_place(index, entry);
+}
@@ -19,24 +19,42 @@
 
 #include <iostream>
 #include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <spawn.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
+#include <any>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <concepts>
 #include <condition_variable>
+#include <csignal>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <functional>
 #include <future>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -49,18 +67,15 @@
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <variant>
 #include <vector>
 #include <cstdlib>
 #include <cstdio>
 
+#include "../write-log.hpp"
+
 using namespace std;
 
-void log_write_error_information(const string &err);
-void log_write_error_information(string &&err);
-void log_write_regular_information(const string &info);
-void log_write_regular_information(string &&info);
-void log_write_warning_information(const string &info);
-void log_write_warning_information(string &&info);
 
 inline string errno_to_string(int err_no) { return string(strerror(err_no)); }
 
@@ -71,12 +86,12 @@ namespace util
         int flags = ::fcntl(fd, F_GETFL, 0);
         if (flags == -1)
         {
-            log_write_error_information("fcntl(F_GETFL) failed for fd " + to_string(fd) + ": " + errno_to_string(errno));
+            SK_LOG_ERROR("fcntl(F_GETFL) failed for fd {}: {}", fd, errno_to_string(errno));
             return -1;
         }
         if (::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
         {
-            log_write_error_information("fcntl(F_SETFL, O_NONBLOCK) failed for fd " + to_string(fd) + ": " + errno_to_string(errno));
+            SK_LOG_ERROR("fcntl(F_SETFL, O_NONBLOCK) failed for fd {}: {}", fd, errno_to_string(errno));
             return -1;
         }
         return 0;
@@ -85,11 +100,93 @@ namespace util
     inline void fatal_perror(const string &msg)
     {
         string error_msg = msg + ": " + errno_to_string(errno);
-        log_write_error_information("FATAL ERROR: " + error_msg);
+        SK_LOG_ERROR("FATAL ERROR: {}", error_msg);
         exit(EXIT_FAILURE);
     }
 }
 
+// Process-wide counters, gauges and latency histograms. Every thread updates its own shard
+// of cells without contention; render() sums the shards into Prometheus text format.
+class MetricsRegistry
+{
+public:
+    using Id = uint32_t;
+
+    static constexpr size_t kMaxCells = 4096;
+    static constexpr unsigned kSubBucketBits = 2;
+    static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+    static constexpr unsigned kMaxExponent = 31;
+    static constexpr size_t kHistogramBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Id histogram) noexcept : histogram_{histogram}, start_{chrono::steady_clock::now()} {}
+        ~ScopedTimer() { MetricsRegistry::observe(histogram_, chrono::steady_clock::now() - start_); }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Id histogram_;
+        chrono::steady_clock::time_point start_;
+    };
+
+    // Registering the same name and labels twice returns the same id.
+    static Id counter(string_view name, string_view help, string_view labels = {});
+    static Id gauge(string_view name, string_view help, string_view labels = {});
+    static Id histogram(string_view name, string_view help, string_view labels = {});
+    static string label(string_view key, string_view value);
+
+    static void add(Id id, int64_t delta = 1) noexcept;
+    static void observe(Id histogram, uint64_t micros) noexcept;
+    static void observe(Id histogram, chrono::steady_clock::duration elapsed) noexcept
+    {
+        observe(histogram, static_cast<uint64_t>(max<int64_t>(chrono::duration_cast<chrono::microseconds>(elapsed).count(), 0)));
+    }
+
+    static size_t bucket_index(uint64_t value) noexcept;
+    static uint64_t bucket_lower_bound(size_t index) noexcept;
+    static string render();
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+private:
+    enum class Kind
+    {
+        kCounter,
+        kGauge,
+        kHistogram
+    };
+
+    struct Family
+    {
+        string name;
+        string help;
+        string labels;
+        Kind kind;
+        Id id;
+    };
+
+    struct Shard
+    {
+        Shard();
+        ~Shard();
+
+        array<atomic<int64_t>, kMaxCells> cells{};
+    };
+
+    struct State;
+
+    MetricsRegistry() = default;
+
+    static State &state();
+    static Shard *local() noexcept;
+    static Id register_family(Kind kind, string_view name, string_view help, string_view labels);
+    static vector<int64_t> collect();
+};
+
 class ThreadPool
 {
 public:
@@ -116,7 +213,7 @@ public:
         for (thread &w : workers_)
             if (w.joinable())
                 w.join();
-        log_write_regular_information("thread pool closed");
+        SK_LOG_INFO("thread pool closed");
     }
 
     template <typename F, typename... Args>
@@ -140,10 +237,20 @@ public:
           idle_threads_{0}
     {
 
-        log_write_regular_information("thread pool initialzed with maximum set:" + to_string(max_threads_));
+        SK_LOG_INFO("thread pool initialzed with maximum set:{}", max_threads_);
         workers_.reserve(max_threads_);
     }
 
+    size_t max_threads() const noexcept { return max_threads_; }
+
+    // Waits until nothing is queued or running, so that objects the tasks refer to can be torn down.
+    bool wait_idle(chrono::steady_clock::duration timeout)
+    {
+        unique_lock lk{mtx_};
+        return idle_cv_.wait_for(lk, timeout, [this]
+                                 { return tasks_.empty() and idle_threads_ == workers_.size(); });
+    }
+
 private:
     using Task = function<void()>;
 
@@ -152,11 +259,26 @@ private:
         int priority;
         size_t seq;
         Task func;
+        chrono::steady_clock::time_point enqueued;
 
         TaskWrapper() : priority(0), seq(0), func(nullptr) {}
-        TaskWrapper(int p, size_t s, Task f) : priority(p), seq(s), func(move(f)) {} // 使用移动语义接管 Task
+        TaskWrapper(int p, size_t s, Task f) : priority(p), seq(s), func(move(f)), enqueued(chrono::steady_clock::now()) {} // 使用移动语义接管 Task
+    };
+
+    struct Metrics
+    {
+        MetricsRegistry::Id queue_depth = MetricsRegistry::gauge("simplek_threadpool_queue_depth", "Tasks waiting in the thread pool queue.");
+        MetricsRegistry::Id busy_workers = MetricsRegistry::gauge("simplek_threadpool_busy_workers", "Thread pool workers currently running a task.");
+        MetricsRegistry::Id queue_wait = MetricsRegistry::histogram("simplek_threadpool_queue_wait_seconds", "Time tasks spent queued before a worker picked them up.");
+        MetricsRegistry::Id task_errors = MetricsRegistry::counter("simplek_threadpool_task_errors_total", "Thread pool tasks that ended with an exception.");
     };
 
+    static const Metrics &metrics()
+    {
+        static const Metrics thread_pool_metrics;
+        return thread_pool_metrics;
+    }
+
     struct Compare
     {
         bool operator()(const TaskWrapper &a, const TaskWrapper &b) const
@@ -180,15 +302,18 @@ private:
 
             if (stop_)
             {
-                log_write_error_information("task pushed to stopped thread pool");
+                SK_LOG_ERROR("task pushed to stopped thread pool");
                 return std::future<R>();
             }
 
             tasks_.emplace(TaskWrapper{priority, seq_++, [taskPtr]()
                                        { (*taskPtr)(); }});
-            log_write_regular_information("task pushed, priority:" + to_string(priority) + ", sequence code:" + to_string(seq_.load() - 1));
+            MetricsRegistry::add(metrics().queue_depth);
+            SK_LOG_DEBUG("task pushed, priority:{}, sequence code:{}", priority, seq_.load() - 1);
 
-            if (idle_threads_ == 0 and workers_.size() < max_threads_)
+            // Idle workers that were notified but have not woken yet still count as idle, so
+            // compare against the backlog rather than waiting for the idle count to hit zero.
+            if (tasks_.size() > idle_threads_ and workers_.size() < max_threads_)
                 workers_.emplace_back([this]
                                       { worker_thread(); });
         }
@@ -199,7 +324,7 @@ private:
 
     void worker_thread(void)
     {
-        log_write_regular_information("thread pool: worker start");
+        SK_LOG_INFO("thread pool: worker start");
         while (true)
         {
             TaskWrapper task_to_run;
@@ -208,13 +333,15 @@ private:
                 unique_lock lk{mtx_};
 
                 idle_threads_++;
+                if (tasks_.empty() and idle_threads_ == workers_.size())
+                    idle_cv_.notify_all();
                 cv_.wait(lk, [this]
                          { return stop_ || !tasks_.empty(); });
                 idle_threads_--;
 
                 if (stop_ and tasks_.empty())
                 {
-                    log_write_regular_information("thread pool: worker exited");
+                    SK_LOG_INFO("thread pool: worker exited");
                     return;
                 }
 
@@ -222,21 +349,28 @@ private:
                 tasks_.pop();
             }
 
+            const Metrics &m = metrics();
+            MetricsRegistry::add(m.queue_depth, -1);
+            MetricsRegistry::observe(m.queue_wait, chrono::steady_clock::now() - task_to_run.enqueued);
+            MetricsRegistry::add(m.busy_workers);
             try
             {
                 if (task_to_run.func)
                     task_to_run.func();
                 else
-                    log_write_error_information("thread pool: worker: ignored empty task");
+                    SK_LOG_ERROR("thread pool: worker: ignored empty task");
             }
             catch (const exception &e)
             {
-                log_write_error_information("thread pool: worker: error occurred:" + string(e.what()));
+                MetricsRegistry::add(m.task_errors);
+                SK_LOG_ERROR("thread pool: worker: error occurred:{}", e.what());
             }
             catch (...)
             {
-                log_write_error_information("thread pool: worker: unkown exception occurred");
+                MetricsRegistry::add(m.task_errors);
+                SK_LOG_ERROR("thread pool: worker: unkown exception occurred");
             }
+            MetricsRegistry::add(m.busy_workers, -1);
         }
     }
 
@@ -245,6 +379,7 @@ private:
 
     mutex mtx_;
     condition_variable cv_;
+    condition_variable idle_cv_;
 
     atomic<bool> stop_;
     atomic<size_t> seq_;
@@ -253,89 +388,220 @@ private:
     const size_t max_threads_;
 };
 
-class Buffer
+class Strand : public enable_shared_from_this<Strand>
 {
 public:
-    static constexpr size_t kCheapPrepend = 8;
-    static constexpr size_t kInitialSize = 1024;
+    using Task = function<void()>;
 
-    explicit Buffer(size_t initial_size = kInitialSize)
-        : buffer_(kCheapPrepend + initial_size),
-          reader_index_(kCheapPrepend),
-          writer_index_(kCheapPrepend) {}
+    explicit Strand(ThreadPool &pool = ThreadPool::instance()) : pool_{pool}, running_{false} {}
 
-    size_t readable_bytes() const noexcept { return writer_index_ - reader_index_; }
-    size_t writable_bytes() const noexcept { return buffer_.size() - writer_index_; }
-    size_t prependable_bytes() const noexcept { return reader_index_; }
+    Strand(const Strand &) = delete;
+    Strand &operator=(const Strand &) = delete;
 
-    const char *peek() const noexcept { return begin() + reader_index_; }
-    char *begin_write() noexcept { return begin() + writer_index_; }
-    const char *begin_write() const noexcept { return begin() + writer_index_; }
+    void post(Task task);
+    size_t pending();
+    bool busy();
 
-    void retrieve(size_t len) noexcept
-    {
-        assert(len <= readable_bytes());
-        if (len < readable_bytes())
-            reader_index_ += len;
-        else
-            retrieve_all();
-    }
+private:
+    void run();
 
-    void retrieve_all() noexcept
-    {
-        reader_index_ = kCheapPrepend;
-        writer_index_ = kCheapPrepend;
-    }
+    static constexpr size_t kMaxTasksPerRun = 16;
 
-    string retrieve_all_as_string()
-    {
-        return retrieve_as_string(readable_bytes());
-    }
+    ThreadPool &pool_;
+    mutex mutex_;
+    queue<Task> tasks_;
+    bool running_;
+};
 
-    string retrieve_as_string(size_t len)
+// Bounds the work admitted to one expensive pipeline. The expected queue wait of a new job is
+// estimated from the admitted-but-unfinished count and a moving average of recent service times;
+// work that would wait too long is turned away up front with a retry-after hint.
+class AdmissionController : public enable_shared_from_this<AdmissionController>
+{
+public:
+    struct Options
     {
-        assert(len <= readable_bytes());
-        string result(peek(), len);
-        retrieve(len);
-        return result;
-    }
+        size_t concurrency{ThreadPool::instance().max_threads()};
+        size_t max_outstanding{4 * ThreadPool::instance().max_threads()};
+        chrono::milliseconds max_queue_wait{chrono::seconds(30)};
+        chrono::milliseconds initial_service_time{chrono::seconds(1)};
+        chrono::milliseconds min_retry_after{chrono::seconds(1)};
+    };
 
-    void append(const char *data, size_t len)
+    // Held for as long as an admitted job is outstanding; releasing it frees the slot and, if
+    // begin_service() was called, feeds the measured service time back into the estimate.
+    class Ticket
     {
-        ensure_writable_bytes(len);
-        memcpy(begin_write(), data, len);
-        has_written(len);
-    }
+    public:
+        ~Ticket();
+
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+        void begin_service() noexcept;
+
+    private:
+        friend class AdmissionController;
+        explicit Ticket(shared_ptr<AdmissionController> owner) noexcept : owner_{move(owner)}, in_service_{false} {}
+
+        shared_ptr<AdmissionController> owner_;
+        chrono::steady_clock::time_point service_started_;
+        bool in_service_;
+    };
 
-    void append(string_view sv)
+    struct Decision
     {
-        append(sv.data(), sv.size());
-    }
+        shared_ptr<Ticket> ticket; // null when the job was rejected
+        chrono::milliseconds estimated_wait;
+        chrono::milliseconds retry_after;
+    };
+
+    static shared_ptr<AdmissionController> create(const string &name, const Options &options);
+
+    AdmissionController(const AdmissionController &) = delete;
+    AdmissionController &operator=(const AdmissionController &) = delete;
+
+    Decision try_admit();
+    size_t outstanding();
+    chrono::microseconds service_time_estimate();
 
-    void has_written(size_t len) noexcept
+private:
+    struct Metrics
     {
-        assert(len <= writable_bytes());
-        writer_index_ += len;
-    }
+        MetricsRegistry::Id admitted;
+        MetricsRegistry::Id rejected_full;
+        MetricsRegistry::Id rejected_wait;
+        MetricsRegistry::Id outstanding;
+        MetricsRegistry::Id service_time_estimate;
+        MetricsRegistry::Id service_seconds;
+    };
+
+    static constexpr double kServiceTimeWeight = 0.2;
+
+    AdmissionController(const string &name, const Options &options);
+    chrono::microseconds wait_for_locked(size_t outstanding) const;
+    void release(const chrono::steady_clock::duration *service_time);
 
-    void ensure_writable_bytes(size_t len)
+    const Options options_;
+    const Metrics metrics_;
+    mutex mutex_;
+    size_t outstanding_;
+    double service_us_;
+    int64_t published_estimate_ms_;
+};
+
+class BufferBlockPool
+{
+public:
+    static constexpr size_t kPageSize = 4096;
+    static constexpr size_t kBlockSize = 16 * 1024;
+    static constexpr array<size_t, 4> kSizeClasses{kBlockSize, 64 * 1024, 256 * 1024, 1024 * 1024};
+    static constexpr size_t kMaxCachedBytes = 8 * 1024 * 1024;
+    static constexpr chrono::seconds kIdleTrimInterval{10};
+
+    struct Stats
     {
-        if (writable_bytes() < len)
-            make_space(len);
-        assert(writable_bytes() >= len);
-    }
+        size_t bytes_in_use;
+        size_t peak_bytes_in_use;
+        size_t bytes_cached;
+        uint64_t acquires;
+        uint64_t cache_hits;
+        uint64_t bytes_returned_to_os;
+    };
+
+    static size_t size_class(size_t len) noexcept;
+    static char *acquire(size_t capacity);
+    static void release(char *block, size_t capacity) noexcept;
+    static void trim_idle() noexcept;
+    static Stats stats() noexcept;
+
+    BufferBlockPool(const BufferBlockPool &) = delete;
+    BufferBlockPool &operator=(const BufferBlockPool &) = delete;
+
+private:
+    BufferBlockPool() = default;
+    ~BufferBlockPool();
+
+    // Returned by class_index() for capacities that are not one of kSizeClasses.
+    static constexpr size_t kNoSizeClass = kSizeClasses.size();
+
+    static BufferBlockPool *local() noexcept;
+    static size_t class_index(size_t capacity) noexcept;
+    static void return_to_os(char *block, size_t capacity) noexcept;
+
+    array<vector<char *>, kSizeClasses.size()> free_blocks_;
+    size_t cached_bytes_ = 0;
+    size_t advised_blocks_ = 0;
+    uint64_t acquires_since_trim_ = 0;
+
+    static inline atomic<size_t> bytes_in_use_{0};
+    static inline atomic<size_t> peak_bytes_in_use_{0};
+    static inline atomic<size_t> bytes_cached_{0};
+    static inline atomic<uint64_t> acquires_{0};
+    static inline atomic<uint64_t> cache_hits_{0};
+    static inline atomic<uint64_t> bytes_returned_to_os_{0};
+};
+
+class Buffer
+{
+public:
+    static constexpr size_t kBlockSize = BufferBlockPool::kBlockSize;
+    static constexpr size_t kMinReadAhead = 4 * kBlockSize;
+    static constexpr size_t kMaxReadAhead = 1024 * 1024;
+
+    explicit Buffer(size_t initial_size = 0);
+    ~Buffer();
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(Buffer &&other) noexcept;
+
+    size_t readable_bytes() const noexcept { return readable_; }
+    size_t writable_bytes() const noexcept;
+    size_t capacity() const noexcept;
+
+    const char *peek() const noexcept { return readable_ == 0 ? nullptr : blocks_.front().data + blocks_.front().read; }
+    size_t contiguous_bytes() const noexcept { return readable_ == 0 ? 0 : blocks_.front().write - blocks_.front().read; }
+    char peek_byte(size_t offset) const noexcept;
+    void copy_out(size_t offset, void *dst, size_t len) const noexcept;
+    vector<string_view> views(size_t len) const;
+    size_t fill_iovecs(struct iovec *vec, size_t max_vecs, size_t max_bytes) const noexcept;
+
+    void retrieve(size_t len) noexcept;
+    void retrieve_all() noexcept;
+    string retrieve_all_as_string() { return retrieve_as_string(readable_bytes()); }
+    string retrieve_as_string(size_t len);
+
+    void append(const char *data, size_t len);
+    void append(string_view sv) { append(sv.data(), sv.size()); }
+
+    void ensure_writable_bytes(size_t len);
+    void reserve(size_t len) noexcept { reserve_hint_ = len; }
+    void set_retain_limit(size_t bytes) noexcept { retain_limit_ = bytes; }
+    void shrink() noexcept;
 
     ssize_t read_fd(int fd, int *saved_errno);
 
 private:
-    char *begin() noexcept { return buffer_.data(); }
-    const char *begin() const noexcept { return buffer_.data(); }
+    struct Block
+    {
+        char *data;
+        size_t capacity;
+        size_t read;
+        size_t write;
+    };
 
-    void make_space(size_t len);
+    static size_t block_capacity_for(size_t missing) noexcept;
+    void add_block(size_t capacity);
+    void release_block(Block &block) noexcept;
+    void trim_spare_blocks() noexcept;
 
-    vector<char> buffer_;
-    size_t reader_index_;
-    size_t writer_index_;
+    deque<Block> blocks_;
+    size_t write_block_;
+    size_t readable_;
+    size_t reserve_hint_;
+    size_t retain_limit_;
 };
 
 namespace net
@@ -374,9 +640,9 @@ namespace net
         {
             if (fd_ != -1)
             {
-                log_write_regular_information("Closing socket fd: " + to_string(fd_));
+                SK_LOG_DEBUG("Closing socket fd: {}", fd_);
                 if (::close(fd_) == -1)
-                    log_write_error_information("Error closing socket fd " + to_string(fd_) + ": " + errno_to_string(errno));
+                    SK_LOG_ERROR("Error closing socket fd {}: {}", fd_, errno_to_string(errno));
                 fd_ = -1;
             }
         }
@@ -385,15 +651,275 @@ namespace net
         int fd_;
     };
 
+    class FileSegment
+    {
+    public:
+        FileSegment(Socket file, off_t offset, size_t length)
+            : file_{make_shared<const Socket>(move(file))}, offset_{offset}, remaining_{length} {}
+
+        FileSegment(FileSegment &&) noexcept = default;
+        FileSegment &operator=(FileSegment &&) noexcept = default;
+
+        static optional<FileSegment> open(const string &path)
+        {
+            Socket file(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+            if (file.fd() == -1)
+            {
+                SK_LOG_ERROR("FileSegment::open - cannot open {}: {}", path, errno_to_string(errno));
+                return nullopt;
+            }
+            struct stat st{};
+            if (::fstat(file.fd(), &st) == -1)
+            {
+                SK_LOG_ERROR("FileSegment::open - fstat failed for {}: {}", path, errno_to_string(errno));
+                return nullopt;
+            }
+            return FileSegment(move(file), 0, static_cast<size_t>(st.st_size));
+        }
+
+        int fd() const noexcept { return file_->fd(); }
+        off_t offset() const noexcept { return offset_; }
+        size_t remaining() const noexcept { return remaining_; }
+
+        // Splits off the next len bytes as a segment of its own; both halves share the fd.
+        FileSegment take_front(size_t len)
+        {
+            len = min(len, remaining_);
+            FileSegment front(file_, offset_, len);
+            offset_ += static_cast<off_t>(len);
+            remaining_ -= len;
+            return front;
+        }
+
+        ssize_t send_to(int sockfd, size_t max_bytes)
+        {
+            ssize_t n = ::sendfile(sockfd, file_->fd(), &offset_, min(remaining_, max_bytes));
+            if (n > 0)
+                remaining_ -= static_cast<size_t>(n);
+            return n;
+        }
+
+    private:
+        FileSegment(shared_ptr<const Socket> file, off_t offset, size_t length) noexcept
+            : file_{move(file)}, offset_{offset}, remaining_{length} {}
+
+        shared_ptr<const Socket> file_;
+        off_t offset_;
+        size_t remaining_;
+    };
+
+    using OutputSegment = variant<string, FileSegment>;
+
     class Channel;
+    class EventLoop;
+    class TimerQueue;
     class TcpConnection;
     class TcpServer;
     using TcpConnectionPtr = shared_ptr<TcpConnection>;
 
+    using TimerClock = chrono::steady_clock;
+    using TimerCallback = function<void()>;
+
+    class TimerId
+    {
+    public:
+        TimerId() noexcept : sequence_{0} {}
+        explicit TimerId(uint64_t sequence) noexcept : sequence_{sequence} {}
+
+        uint64_t sequence() const noexcept { return sequence_; }
+        bool valid() const noexcept { return sequence_ != 0; }
+
+    private:
+        uint64_t sequence_;
+    };
+
+    class Poller
+    {
+    public:
+        struct ReadyChannel
+        {
+            Channel *channel;
+            int fd;
+            uint32_t generation;
+        };
+        using ChannelList = vector<ReadyChannel>;
+
+        explicit Poller(EventLoop *loop) : owner_loop_{loop} {}
+        virtual ~Poller() = default;
+
+        Poller(const Poller &) = delete;
+        Poller &operator=(const Poller &) = delete;
+
+        virtual void poll(int timeout_ms, ChannelList *active_channels) = 0;
+        virtual void update_channel(Channel *channel) = 0;
+        virtual void remove_channel(Channel *channel) = 0;
+        virtual const char *backend_name() const noexcept = 0;
+        bool has_channel(Channel *channel) const noexcept;
+        bool is_current(const ReadyChannel &ready) const noexcept { return find_channel(ready.fd, ready.generation) == ready.channel; }
+
+        static unique_ptr<Poller> new_default_poller(EventLoop *loop);
+
+    protected:
+        struct ChannelSlot
+        {
+            Channel *channel;
+            uint32_t generation;
+        };
+
+        static uint64_t make_token(int fd, uint32_t generation) noexcept { return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd); }
+        static int token_fd(uint64_t token) noexcept { return static_cast<int>(token & 0xffffffffu); }
+        static uint32_t token_generation(uint64_t token) noexcept { return static_cast<uint32_t>(token >> 32); }
+
+        Channel *find_channel(int fd) const noexcept
+        {
+            if (fd < 0 or static_cast<size_t>(fd) >= slots_.size())
+                return nullptr;
+            return slots_[static_cast<size_t>(fd)].channel;
+        }
+        Channel *find_channel(int fd, uint32_t generation) const noexcept
+        {
+            if (fd < 0 or static_cast<size_t>(fd) >= slots_.size() or slots_[static_cast<size_t>(fd)].generation != generation)
+                return nullptr;
+            return slots_[static_cast<size_t>(fd)].channel;
+        }
+        // Only for fds of registered channels.
+        uint32_t generation_of(int fd) const noexcept
+        {
+            assert(fd >= 0);
+            return slots_[static_cast<size_t>(fd)].generation;
+        }
+        uint32_t insert_channel(Channel *channel);
+        void erase_channel(int fd) noexcept
+        {
+            assert(fd >= 0);
+            slots_[static_cast<size_t>(fd)].channel = nullptr;
+        }
+
+        EventLoop *owner_loop_;
+        vector<ChannelSlot> slots_;
+    };
+
+    class EpollPoller : public Poller
+    {
+    public:
+        explicit EpollPoller(EventLoop *loop);
+
+        void poll(int timeout_ms, ChannelList *active_channels) override;
+        void update_channel(Channel *channel) override;
+        void remove_channel(Channel *channel) override;
+        const char *backend_name() const noexcept override { return "epoll"; }
+
+    private:
+        static constexpr size_t kInitEventListSize = 64;
+        static constexpr size_t kMaxEventListSize = 4096;
+
+        Socket epoll_fd_;
+        vector<struct epoll_event> active_events_;
+    };
+
+    class IoUringPoller : public Poller
+    {
+    public:
+        static constexpr unsigned kRingEntries = 256;
+
+        static unique_ptr<IoUringPoller> create(EventLoop *loop);
+        ~IoUringPoller() override;
+
+        void poll(int timeout_ms, ChannelList *active_channels) override;
+        void update_channel(Channel *channel) override;
+        void remove_channel(Channel *channel) override;
+        const char *backend_name() const noexcept override { return "io_uring"; }
+
+    private:
+        struct Registration
+        {
+            Channel *channel;
+            uint64_t user_data;
+            uint32_t armed_events;
+            bool armed;
+            bool armed_multishot;
+            uint32_t pending_revents;
+            bool touched;
+        };
+
+        static constexpr uint64_t kRemoveUserData = ~uint64_t{0};
+
+        IoUringPoller(EventLoop *loop, int ring_fd);
+        bool map_rings(const struct io_uring_params &params);
+        struct io_uring_sqe *next_sqe();
+        int submit_and_wait(unsigned wait_nr, int timeout_ms);
+        void arm(Registration &reg);
+        void disarm(Registration &reg);
+        void reap_completions(ChannelList *active_channels);
+
+        Socket ring_fd_;
+        void *sq_ring_;
+        size_t sq_ring_size_;
+        void *cq_ring_;
+        size_t cq_ring_size_;
+        struct io_uring_sqe *sqes_;
+        size_t sqes_size_;
+
+        unsigned *sq_head_;
+        unsigned *sq_tail_;
+        unsigned *sq_array_;
+        unsigned sq_mask_;
+        unsigned sq_entries_;
+        unsigned *cq_head_;
+        unsigned *cq_tail_;
+        struct io_uring_cqe *cqes_;
+        unsigned cq_mask_;
+
+        unsigned to_submit_;
+        uint32_t next_generation_;
+        bool multishot_supported_;
+        bool ext_arg_supported_;
+        vector<Registration> registrations_;
+        vector<int> touched_fds_;
+    };
+
+    // Intrusive multi-producer / single-consumer queue (Vyukov). push() is wait-free and
+    // may be called from any thread; pop() is only called by the owning loop thread.
+    class TaskQueue
+    {
+    public:
+        using Task = function<void()>;
+
+        static constexpr size_t kMaxCachedNodes = 1024;
+
+        TaskQueue() : head_{&stub_}, tail_{&stub_} {}
+        ~TaskQueue();
+
+        TaskQueue(const TaskQueue &) = delete;
+        TaskQueue &operator=(const TaskQueue &) = delete;
+
+        void push(Task task);
+        bool pop(Task &task);
+
+    private:
+        struct NodeCache;
+
+        struct Node
+        {
+            atomic<Node *> next{nullptr};
+            NodeCache *home = nullptr;
+            Task task;
+        };
+
+        static Node *acquire_node();
+        static void release_node(Node *node) noexcept;
+        void push_node(Node *node) noexcept;
+
+        alignas(64) atomic<Node *> head_;
+        alignas(64) Node *tail_;
+        Node stub_;
+    };
+
     class EventLoop
     {
     public:
         using Functor = function<void()>;
+        using SignalCallback = function<void(int signo)>;
 
         EventLoop();
         ~EventLoop();
@@ -406,6 +932,15 @@ namespace net
         void run_in_loop(Functor f);
         void queue_in_loop(Functor f);
 
+        TimerId run_at(TimerClock::time_point when, TimerCallback cb);
+        TimerId run_after(TimerClock::duration delay, TimerCallback cb);
+        TimerId run_every(TimerClock::duration interval, TimerCallback cb);
+        void cancel(TimerId timer_id);
+
+        // Blocks the signals in the calling thread and delivers them through a signalfd on this
+        // loop. Call it before any other thread is started so that every thread inherits the mask.
+        void watch_signals(initializer_list<int> signals, SignalCallback cb);
+
         void update_channel(Channel *channel);
         void remove_channel(Channel *channel);
         bool has_channel(Channel *channel);
@@ -418,29 +953,32 @@ namespace net
         bool is_in_loop_thread() const { return thread_id_ == this_thread::get_id(); }
 
     private:
+        static constexpr size_t kMaxFunctorsPerPass = 4096;
+
         void handle_read();
+        void handle_signals();
         void do_pending_functors();
         void abort_not_in_loop_thread();
         void wakeup();
 
-        using ChannelMap = unordered_map<int, Channel *>;
-
         atomic<bool> looping_;
         atomic<bool> quit_;
         atomic<bool> event_handling_;
         atomic<bool> calling_pending_functors_;
 
         const thread::id thread_id_;
-        Socket epoll_fd_;
+        unique_ptr<Poller> poller_;
+        Poller::ChannelList active_channels_;
         Socket wakeup_fd_;
         unique_ptr<Channel> wakeup_channel_;
+        Socket signal_fd_;
+        unique_ptr<Channel> signal_channel_;
+        SignalCallback signal_cb_;
 
-        ChannelMap channels_;
-        static constexpr int kMaxEvents = 64;
-        vector<struct epoll_event> active_events_;
+        unique_ptr<TimerQueue> timer_queue_;
 
-        mutex mutex_;
-        vector<Functor> pending_functors_;
+        alignas(64) atomic<bool> wakeup_pending_;
+        TaskQueue pending_functors_;
     };
 
     class Channel
@@ -504,6 +1042,9 @@ namespace net
             update();
         }
 
+        void set_edge_triggered(bool on) noexcept { edge_triggered_ = on; }
+        bool is_edge_triggered() const noexcept { return edge_triggered_; }
+
         bool is_none_event() const noexcept { return events_ == 0; }
         bool is_writing() const noexcept { return events_ & EPOLLOUT; }
         bool is_reading() const noexcept { return events_ & EPOLLIN; }
@@ -541,6 +1082,60 @@ namespace net
         weak_ptr<void> tie_;
         bool tied_{false};
         bool added_to_loop_{false};
+        bool edge_triggered_{false};
+    };
+
+    class TimerQueue
+    {
+    public:
+        explicit TimerQueue(EventLoop *loop);
+        ~TimerQueue();
+
+        TimerQueue(const TimerQueue &) = delete;
+        TimerQueue &operator=(const TimerQueue &) = delete;
+
+        TimerId add_timer(TimerCallback cb, TimerClock::time_point when, TimerClock::duration interval);
+        void cancel(TimerId timer_id);
+        size_t size() const { return timers_.size(); }
+
+    private:
+        struct Timer
+        {
+            TimerCallback callback;
+            TimerClock::time_point expiration;
+            TimerClock::duration interval;
+            uint64_t sequence;
+            size_t heap_index;
+            bool canceled;
+        };
+
+        struct HeapEntry
+        {
+            TimerClock::time_point expiration;
+            Timer *timer;
+        };
+
+        void add_timer_in_loop(Timer *timer);
+        void cancel_in_loop(uint64_t sequence);
+        void handle_read();
+        void reset_timerfd();
+
+        void heap_push(Timer *timer);
+        void heap_erase(size_t index);
+        void heap_place(size_t index, const HeapEntry &entry);
+        void sift_up(size_t index);
+        void sift_down(size_t index);
+
+        static constexpr size_t kHeapArity = 4;
+        static constexpr size_t kNotInHeap = numeric_limits<size_t>::max();
+        static atomic<uint64_t> next_sequence_;
+
+        EventLoop *loop_;
+        Socket timerfd_;
+        unique_ptr<Channel> timerfd_channel_;
+        vector<HeapEntry> heap_;
+        unordered_map<uint64_t, unique_ptr<Timer>> timers_;
+        TimerClock::time_point armed_expiration_;
     };
 
     class TcpConnection : public enable_shared_from_this<TcpConnection>
@@ -552,6 +1147,24 @@ namespace net
         using HighWaterMarkCallback = function<void(const TcpConnectionPtr &, size_t)>;
         using CloseCallback = function<void(const TcpConnectionPtr &)>;
 
+        static constexpr size_t kDefaultIoBudget = 256 * 1024;
+        static constexpr size_t kDefaultRetainedBufferLimit = 256 * 1024;
+        static constexpr size_t kMaxWriteIovecs = 64;
+        static constexpr size_t kResponseFragmentSize = 64 * 1024;
+
+        // Reading is paused once either high mark is reached and resumed when both counts
+        // are back at or below their low marks. A high mark of 0 disables that check.
+        struct FlowControl
+        {
+            size_t output_high_mark{4 * 1024 * 1024};
+            size_t output_low_mark{1024 * 1024};
+            size_t jobs_high_mark{16};
+            size_t jobs_low_mark{8};
+            // Streamed upload bytes handed to a strand and not yet consumed by the handler.
+            size_t upload_high_mark{1024 * 1024};
+            size_t upload_low_mark{512 * 1024};
+        };
+
         TcpConnection(EventLoop *loop,
                       string name,
                       int sockfd,
@@ -568,15 +1181,55 @@ namespace net
             high_water_mark_ = mark;
         }
         void set_close_callback(CloseCallback cb) { close_cb_ = move(cb); }
+        const shared_ptr<Strand> &strand() const { return strand_; }
+
+        void set_edge_triggered(bool on);
+        void set_io_budget(size_t bytes) { io_budget_ = max<size_t>(bytes, 1); }
+        void set_zerocopy_threshold(size_t bytes);
+        void set_retained_buffer_limit(size_t bytes);
+        void set_flow_control(const FlowControl &options);
+        void shrink_buffers();
+
+        void job_started();
+        void job_finished();
+        size_t jobs_in_flight() const { return jobs_in_flight_.load(memory_order_acquire); }
+        // upload_queued() on the loop thread when a chunk is posted, upload_consumed() from the
+        // strand once the handler has taken it.
+        void upload_queued(size_t bytes);
+        void upload_consumed(size_t bytes);
+        size_t upload_backlog() const { return upload_backlog_.load(memory_order_acquire); }
+        bool reading_paused() const { return reading_paused_; }
 
         void send(unique_ptr<char[]> message, size_t buflen);
         void send(string_view message);
         void send(Buffer *buf);
+        void send_frame(const string &tag, string payload);
+        void send_frame(const string &tag, vector<OutputSegment> payload);
+        void send_segments(vector<OutputSegment> segments);
+        void send_response(uint64_t request_id, const string &tag, string payload, uint8_t flags = 0);
+        void send_response(uint64_t request_id, const string &tag, vector<OutputSegment> payload, uint8_t flags = 0);
+        size_t output_pending_bytes() const { return output_buffer_.readable_bytes() + deferred_bytes_; }
         void shutdown();
         void force_close();
 
         bool connected() const { return state_ == State::kConnected; }
         bool disconnected() const { return state_ == State::kDisconnected; }
+        // True once shutdown() has flushed queued responses and output and sent FIN; safe to read from any thread.
+        bool write_side_closed() const { return write_side_closed_.load(memory_order_acquire); }
+
+        struct InboundProgress
+        {
+            TimerClock::time_point frame_started;
+            uint64_t bytes_at_frame_start;
+            bool frame_pending;
+            bool header_complete;
+        };
+
+        void update_inbound_progress(bool frame_pending, bool header_complete, bool frame_completed);
+        const InboundProgress &inbound_progress() const { return inbound_progress_; }
+        TimerClock::time_point last_activity() const { return last_activity_; }
+        uint64_t bytes_received() const { return bytes_received_; }
+        any &inbound_stream() { return inbound_stream_; }
 
         EventLoop *get_loop() const { return loop_; }
         const string &name() const { return name_; }
@@ -596,21 +1249,56 @@ namespace net
         };
         void set_state(State s) { state_ = s; }
 
+        enum class PauseReason
+        {
+            kOutput,
+            kJobs,
+            kUpload
+        };
+
+        // A protocol v2 response that is cut into kResponseFragmentSize frames; streams
+        // take turns on the socket so a large response cannot starve the others.
+        struct ResponseStream
+        {
+            uint64_t request_id;
+            string tag;
+            uint8_t flags;
+            deque<OutputSegment> payload;
+            size_t offset;
+        };
+
         void handle_read();
         void handle_write();
         void handle_close();
         void handle_error();
+        void handle_error_event();
 
         void send_in_loop(const void *data, size_t len);
         void send_in_loop(string_view message);
+        void send_in_loop(const struct iovec *vec, size_t count);
+        void send_segments_in_loop(vector<OutputSegment> &segments);
+        void send_file_in_loop(FileSegment file);
+        void send_zerocopy_in_loop(shared_ptr<string> data);
+        void queue_response_in_loop(ResponseStream stream);
+        void pump_responses();
+        ssize_t send_zerocopy(const shared_ptr<string> &data, size_t offset, size_t max_bytes);
+        bool reap_zerocopy_completions();
+        void notify_output_growth(size_t old_len, size_t added);
+        void pause_reading(PauseReason reason);
+        void maybe_resume_reading();
+        void clear_read_pause();
+        ssize_t write_output(size_t max_bytes);
+        void dispatch_input();
+        void resume_io_later(bool reading);
 
         void shutdown_in_loop();
         void force_close_in_loop();
 
         EventLoop *loop_;
         string name_;
-        State state_;
+        atomic<State> state_;
         atomic<bool> reading_;
+        shared_ptr<Strand> strand_;
 
         Socket socket_;
         unique_ptr<Channel> channel_;
@@ -627,6 +1315,128 @@ namespace net
         size_t high_water_mark_;
         Buffer input_buffer_;
         Buffer output_buffer_;
+        any inbound_stream_;
+
+        struct ZeroCopySegment
+        {
+            shared_ptr<string> data;
+            size_t offset;
+        };
+        using PendingOutput = variant<string, FileSegment, ZeroCopySegment>;
+        deque<PendingOutput> deferred_output_;
+        size_t deferred_bytes_;
+        deque<ResponseStream> response_streams_;
+
+        size_t zerocopy_threshold_;
+        uint32_t zerocopy_next_seq_;
+        deque<pair<uint32_t, shared_ptr<string>>> zerocopy_inflight_;
+
+        bool edge_triggered_;
+        size_t io_budget_;
+        bool read_resume_pending_;
+        bool write_resume_pending_;
+
+        FlowControl flow_control_;
+        atomic<size_t> jobs_in_flight_;
+        atomic<size_t> upload_backlog_;
+        bool reading_paused_;
+        atomic<bool> write_side_closed_;
+
+        TimerClock::time_point last_activity_;
+        uint64_t bytes_received_;
+        InboundProgress inbound_progress_;
+    };
+
+    class ConnectionReaper : public enable_shared_from_this<ConnectionReaper>
+    {
+    public:
+        struct Options
+        {
+            chrono::seconds idle_timeout{300};
+            chrono::seconds header_timeout{30};
+            size_t min_bytes_per_second{1024};
+            chrono::seconds throughput_grace{10};
+        };
+
+        ConnectionReaper(EventLoop *loop, const Options &options);
+
+        ConnectionReaper(const ConnectionReaper &) = delete;
+        ConnectionReaper &operator=(const ConnectionReaper &) = delete;
+
+        void start();
+        void track(const TcpConnectionPtr &conn);
+
+    private:
+        void on_tick();
+        void schedule(const TcpConnectionPtr &conn, TimerClock::time_point deadline, TimerClock::time_point now);
+        const char *inspect(TcpConnection &conn, TimerClock::time_point now, TimerClock::time_point &next_check) const;
+
+        static constexpr TimerClock::duration kTick = chrono::seconds(1);
+        static constexpr size_t kWheelSize = 64;
+
+        EventLoop *loop_;
+        const Options options_;
+        vector<vector<weak_ptr<TcpConnection>>> wheel_;
+        size_t cursor_;
+    };
+
+    class EventLoopThread
+    {
+    public:
+        explicit EventLoopThread(string name = string());
+        ~EventLoopThread();
+
+        EventLoopThread(const EventLoopThread &) = delete;
+        EventLoopThread &operator=(const EventLoopThread &) = delete;
+
+        EventLoop *start_loop();
+
+    private:
+        void thread_func();
+
+        EventLoop *loop_;
+        string name_;
+        thread thread_;
+        mutex mutex_;
+        condition_variable cv_;
+    };
+
+    class EventLoopThreadPool
+    {
+    public:
+        enum class Strategy
+        {
+            kRoundRobin,
+            kLeastConnections
+        };
+
+        EventLoopThreadPool(EventLoop *base_loop, string name);
+        ~EventLoopThreadPool();
+
+        EventLoopThreadPool(const EventLoopThreadPool &) = delete;
+        EventLoopThreadPool &operator=(const EventLoopThreadPool &) = delete;
+
+        void set_thread_num(size_t num_threads) { num_threads_ = num_threads; }
+        void set_strategy(Strategy strategy) { strategy_ = strategy; }
+        void start();
+
+        EventLoop *get_next_loop();
+        void release_loop(EventLoop *loop);
+        vector<EventLoop *> get_all_loops();
+
+        bool started() const { return started_; }
+        const string &name() const { return name_; }
+
+    private:
+        EventLoop *base_loop_;
+        string name_;
+        bool started_;
+        size_t num_threads_;
+        size_t next_;
+        Strategy strategy_;
+        vector<unique_ptr<EventLoopThread>> threads_;
+        vector<EventLoop *> loops_;
+        vector<size_t> loads_;
     };
 
     class Acceptor
@@ -635,6 +1445,8 @@ namespace net
         using NewConnectionCallback = function<void(int sockfd, const sockaddr_in &peer_addr)>;
 
         Acceptor(EventLoop *loop, uint16_t port, bool reuse_port);
+        // Takes over a socket that is already bound, e.g. one inherited through ListenerHandoff.
+        Acceptor(EventLoop *loop, Socket listen_socket);
         ~Acceptor();
 
         Acceptor(const Acceptor &) = delete;
@@ -646,7 +1458,9 @@ namespace net
         }
 
         void listen();
+        void stop();
         bool listening() const { return listening_; }
+        int fd() const { return accept_socket_.fd(); }
 
     private:
         void handle_read();
@@ -659,6 +1473,33 @@ namespace net
         int idle_fd_;
     };
 
+    // Interns protocol tags into dense ids at registration time. The table is rebuilt with a
+    // seed under which every registered tag hashes to its own slot, so resolving a frame
+    // header costs one hash, one probe and one compare, with no allocation.
+    class TagTable
+    {
+    public:
+        using TagId = uint16_t;
+
+        static constexpr TagId kUnknownTag = numeric_limits<TagId>::max();
+        static constexpr size_t kMinSlots = 8;
+        static constexpr int kSeedAttempts = 64;
+
+        TagId intern(string_view tag);
+        TagId find(string_view tag) const noexcept;
+        const string &name(TagId id) const noexcept { return names_[id]; }
+        size_t size() const noexcept { return names_.size(); }
+
+    private:
+        static uint64_t hash(string_view tag, uint64_t seed) noexcept;
+        void rebuild();
+
+        vector<string> names_;
+        vector<TagId> slots_;
+        uint64_t seed_ = 0;
+        uint64_t mask_ = 0;
+    };
+
     class TcpServer
     {
     public:
@@ -668,8 +1509,31 @@ namespace net
         using ProtocolHandler = function<ProtocolHandlerPair(const TcpConnectionPtr &conn,
                                                                   const string &tag,
                                                                   string_view payload)>;
+        using DrainCallback = function<void(bool completed)>;
+
+        struct StreamingProtocolHandler
+        {
+            function<any(const TcpConnectionPtr &conn, const string &tag, size_t payload_len)> on_frame_begin;
+            function<void(const TcpConnectionPtr &conn, any &context, string_view chunk)> on_frame_chunk;
+            function<ProtocolHandlerPair(const TcpConnectionPtr &conn, const string &tag, any &context)> on_frame_end;
+            function<void(const TcpConnectionPtr &conn, any &context)> on_frame_abort;
+        };
+
+        static constexpr size_t kMaxTagLength = 63;
+        // Protocol v2 frames start with a zero byte where v1 has its (non-zero) tag length:
+        // [0][version][flags][tag_len][tag][u64 request_id][u32 payload_len][payload]
+        static constexpr uint8_t kFrameV2Marker = 0;
+        static constexpr uint8_t kProtocolVersion = 2;
+        static constexpr uint8_t kFlagMoreFragments = 0x01;
+        static constexpr uint8_t kFlagError = 0x02;
+        static constexpr size_t kStreamChunkSize = 256 * 1024;
+        static inline const string kBusyTag = "busy";
+        static constexpr size_t kDefaultMaxStreamingPayloadSize = 1024 * 1024 * 1024; // 1 GiB
+        static constexpr chrono::milliseconds kDrainPollInterval{100};
+        static constexpr chrono::milliseconds kDrainRetryAfter{1000};
 
         TcpServer(EventLoop *loop, uint16_t port, string name = "MyTcpServer", bool reuse_port = true);
+        TcpServer(EventLoop *loop, Socket listen_socket, string name = "MyTcpServer");
         ~TcpServer();
 
         TcpServer(const TcpServer &) = delete;
@@ -678,46 +1542,244 @@ namespace net
         TcpServer &operator=(TcpServer &&) = delete;
 
         void register_protocol_handler(const string &tag, ProtocolHandler cb);
+        void register_streaming_handler(const string &tag, StreamingProtocolHandler handler);
+        void set_max_streaming_payload_size(size_t bytes);
+        void set_admission_controller(const string &tag, shared_ptr<AdmissionController> controller);
         void set_default_protocol_handler(ProtocolHandler cb);
         void register_handler(HandlerTag tag, Handler cb);
         void set_default_handler(Handler cb);
         void set_connection_callback(const TcpConnection::ConnectionCallback &cb);
         void set_write_complete_callback(const TcpConnection::WriteCompleteCallback &cb);
+        void set_thread_num(size_t num_threads);
+        void set_loop_strategy(EventLoopThreadPool::Strategy strategy);
+        void set_reaper_options(const ConnectionReaper::Options &options);
+        void set_edge_triggered(bool on);
+        void set_io_budget(size_t bytes);
+        void set_zerocopy_threshold(size_t bytes);
+        void set_retained_buffer_limit(size_t bytes);
+        void set_flow_control(const TcpConnection::FlowControl &options);
+        void enable_stats(const string &tag = "stats");
         void start();
+        // Stops accepting, answers new requests with kBusyTag and shuts each connection down once
+        // its in-flight requests are done and its output is flushed. Connections still open after
+        // `grace` are closed; on_drained(false) means some requests were abandoned.
+        void drain(TimerClock::duration grace, DrainCallback on_drained);
+        bool draining() const { return draining_.load(memory_order_acquire); }
+        int listener_fd() const { return acceptor_->fd(); }
         EventLoop *get_loop() const { return loop_; }
         const string &name() const { return name_; }
         static string package_message(const string &tag, string_view payload);
+        static string frame_header(const string &tag, size_t payload_len);
+        static string frame_header(const string &tag, uint64_t request_id, uint8_t flags, size_t payload_len);
+        static string negotiate_protocol(string_view hello_payload);
+        static uint64_t current_request_id();
+        static void respond(const TcpConnectionPtr &conn, const string &tag, vector<OutputSegment> payload);
 
     private:
-        bool attempt_protocol_processing(const TcpConnectionPtr &conn, Buffer *buf);
-        void execute_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, Buffer *buf, const string &tag, size_t header_len, uint32_t payload_len);
-        bool execute_legacy_handler_for_tag(const string &tag, const TcpConnectionPtr &conn, Buffer *buf);
-        void execute_default_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, Buffer *buf, const string &tag, size_t header_len, uint32_t payload_len);
-        bool process_legacy_fallback(const TcpConnectionPtr &conn, Buffer *buf, size_t initial_readable);
+        enum class FrameStatus
+        {
+            kComplete,
+            kIncomplete,
+            kMalformed,
+            kRejected
+        };
+
+        struct FrameHeader
+        {
+            size_t length;
+            uint64_t request_id;
+            uint32_t payload_len;
+            uint8_t tag_len;
+            char tag_bytes[kMaxTagLength];
+
+            string_view tag() const { return {tag_bytes, tag_len}; }
+        };
+
+        struct InboundFrame
+        {
+            TagTable::TagId tag;
+            uint64_t request_id;
+            string payload;
+            shared_ptr<AdmissionController::Ticket> ticket;
+        };
+
+        struct InboundStream
+        {
+            shared_ptr<const StreamingProtocolHandler> handler;
+            shared_ptr<Strand> strand;
+            TagTable::TagId tag;
+            uint64_t request_id;
+            size_t payload_len;
+            size_t remaining;
+            any context;
+            bool failed;
+            shared_ptr<AdmissionController::Ticket> ticket;
+        };
+
+        struct TagMetrics
+        {
+            MetricsRegistry::Id frames;
+            MetricsRegistry::Id payload_bytes;
+            MetricsRegistry::Id handler_seconds;
+        };
+
+        // Everything registered for one interned tag; indexed by TagTable::TagId.
+        struct TagRoute
+        {
+            ProtocolHandler protocol;
+            shared_ptr<const StreamingProtocolHandler> streaming;
+            Handler legacy;
+            shared_ptr<AdmissionController> admission;
+            TagMetrics metrics;
+        };
+
+        TcpServer(EventLoop *loop, unique_ptr<Acceptor> acceptor, string name);
+
+        static TagMetrics make_tag_metrics(const string &tag);
+        TagRoute *route_for_registration(const string &tag, const char *kind);
+        const TagMetrics &metrics_for(TagTable::TagId tag) const;
+        void count_frame(TagTable::TagId tag, size_t payload_len) const;
+
+        static FrameStatus peek_frame_header(const Buffer *buf, FrameHeader &header);
+        static shared_ptr<Strand> strand_for(const TcpConnectionPtr &conn, uint64_t request_id);
+        static void post_job(const TcpConnectionPtr &conn, const shared_ptr<Strand> &strand, Strand::Task job);
+        static void send_handler_response(const TcpConnectionPtr &conn, uint64_t request_id, ProtocolHandlerPair response, bool failed);
+        FrameStatus attempt_protocol_processing(const TcpConnectionPtr &conn, Buffer *buf);
+        bool admit(const TcpConnectionPtr &conn, const TagRoute &route, TagTable::TagId tag, uint64_t request_id, shared_ptr<AdmissionController::Ticket> &ticket);
+        FrameStatus begin_inbound_stream(const TcpConnectionPtr &conn, Buffer *buf, shared_ptr<const StreamingProtocolHandler> handler, TagTable::TagId tag, uint64_t request_id, size_t payload_len, shared_ptr<AdmissionController::Ticket> ticket);
+        FrameStatus continue_inbound_stream(const TcpConnectionPtr &conn, Buffer *buf, const shared_ptr<InboundStream> &stream);
+        void feed_inbound_stream(const TcpConnectionPtr &conn, InboundStream &stream, string_view chunk, bool finished);
+        void abort_inbound_stream(const TcpConnectionPtr &conn);
+        bool invoke_stream_callback(const TcpConnectionPtr &conn, InboundStream &stream, const function<void()> &callback);
+        void execute_protocol_handler(const TcpConnectionPtr &conn, const InboundFrame &frame);
+        void execute_legacy_handler_for_tag(const Handler &handler, const TcpConnectionPtr &conn, const string &tag, Buffer *frame_buf);
+        void execute_default_protocol_handler(const ProtocolHandler &handler, const TcpConnectionPtr &conn, const string &tag, uint64_t request_id, string_view payload);
+        void process_legacy_fallback(const TcpConnectionPtr &conn, Buffer *buf);
         tuple<unique_ptr<char[]>, size_t> on_message(const TcpConnectionPtr &conn, Buffer *buf);
         void new_connection(int sockfd, const sockaddr_in &peer_addr);
         void remove_connection(const TcpConnectionPtr &conn);
         void remove_connection_in_loop(const TcpConnectionPtr &conn);
+        void check_drain();
+        void finish_drain(bool completed);
 
         EventLoop *loop_;
         const string name_;
 
         unique_ptr<Acceptor> acceptor_;
+        ConnectionReaper::Options reaper_options_;
+        bool edge_triggered_;
+        size_t io_budget_;
+        size_t zerocopy_threshold_;
+        size_t retained_buffer_limit_;
+        TcpConnection::FlowControl flow_control_;
+        unordered_map<EventLoop *, shared_ptr<ConnectionReaper>> reapers_;
+        unique_ptr<EventLoopThreadPool> loop_pool_;
         bool started_;
         int next_conn_id_;
 
         TcpConnection::ConnectionCallback connection_cb_;
         TcpConnection::WriteCompleteCallback write_complete_cb_;
 
-        unordered_map<string, ProtocolHandler> protocol_handlers_;
+        TagTable tags_;
+        vector<TagRoute> routes_;
+        size_t max_streaming_payload_size_;
         ProtocolHandler default_protocol_handler_;
-        unordered_map<HandlerTag, Handler> handlers_;
         Handler default_handler_;
 
         unordered_map<string, TcpConnectionPtr> connections_;
 
+        atomic<bool> draining_;
+        TimerClock::time_point drain_deadline_;
+        TimerId drain_timer_;
+        DrainCallback drained_cb_;
+
+        const TagMetrics unregistered_tag_metrics_;
+        const MetricsRegistry::Id oversized_frames_;
+        const MetricsRegistry::Id malformed_input_;
+        const MetricsRegistry::Id handler_errors_;
+
         static constexpr size_t kMaxPayloadSize = 64 * 1024 * 1024; // 64 MiB
     };
+
+    // Plain-text HTTP endpoint serving MetricsRegistry::render() to scrapers. It shares the
+    // loop it is given; every request is answered once and the connection is closed.
+    class MetricsHttpServer
+    {
+    public:
+        static constexpr size_t kMaxRequestSize = 8 * 1024;
+        static constexpr chrono::seconds kRequestTimeout{10};
+
+        MetricsHttpServer(EventLoop *loop, uint16_t port);
+        MetricsHttpServer(EventLoop *loop, Socket listen_socket);
+        ~MetricsHttpServer();
+
+        MetricsHttpServer(const MetricsHttpServer &) = delete;
+        MetricsHttpServer &operator=(const MetricsHttpServer &) = delete;
+
+        void start();
+        int listener_fd() const { return acceptor_.fd(); }
+
+    private:
+        static string response_for(string_view request_line);
+
+        void install_accept_callback();
+        void new_connection(int sockfd, const sockaddr_in &peer_addr);
+        tuple<unique_ptr<char[]>, size_t> on_message(const TcpConnectionPtr &conn, Buffer *buf);
+        void remove_connection(const TcpConnectionPtr &conn);
+
+        EventLoop *loop_;
+        Acceptor acceptor_;
+        uint64_t next_conn_id_;
+        unordered_map<string, TcpConnectionPtr> connections_;
+    };
+
+    // Zero-downtime upgrade. The running process spawns its successor and passes it the listening
+    // sockets over a SOCK_SEQPACKET socketpair with SCM_RIGHTS; the successor adopts them, starts
+    // accepting and answers "ready", and only then does the predecessor stop accepting and drain.
+    // The kernel backlog is shared throughout, so no connection attempt is refused.
+    class ListenerHandoff
+    {
+    public:
+        using Listener = pair<string, int>;
+        using DoneCallback = function<void(bool ready)>;
+
+        static constexpr const char *kChannelEnv = "SIMPLE_K_HANDOFF_FD";
+        static constexpr int kChannelFd = 3;
+        static constexpr size_t kMaxListeners = 8;
+        static constexpr chrono::seconds kReadyTimeout{30};
+
+        ~ListenerHandoff();
+
+        ListenerHandoff(const ListenerHandoff &) = delete;
+        ListenerHandoff &operator=(const ListenerHandoff &) = delete;
+
+        // Predecessor side: starts argv with the channel on kChannelFd. on_done runs on `loop` with
+        // true once the successor is accepting, or false if it exits, fails or times out first, in
+        // which case it has been killed and this process should carry on serving.
+        static shared_ptr<ListenerHandoff> spawn(EventLoop *loop, const vector<string> &argv, const vector<Listener> &listeners, DoneCallback on_done);
+
+        // Successor side: null unless this process was started by spawn().
+        static unique_ptr<ListenerHandoff> inherit();
+        // An invalid Socket when the predecessor did not pass a listener under this name.
+        Socket take_listener(const string &name);
+        void notify_ready();
+
+    private:
+        ListenerHandoff(EventLoop *loop, Socket channel, pid_t successor);
+
+        static bool send_listeners(int channel_fd, const vector<Listener> &listeners);
+        static pid_t spawn_successor(const vector<string> &argv, int channel_fd);
+        void handle_read();
+        void finish(bool ready);
+
+        EventLoop *loop_;
+        Socket channel_;
+        unique_ptr<Channel> channel_watch_;
+        pid_t successor_;
+        TimerId timeout_;
+        DoneCallback on_done_;
+        unordered_map<string, Socket> inherited_;
+    };
 }
 
 #endif
@@ -0,0 +1,249 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#define _LOG_DECODE_CPP
+#include "../write-log.hpp"
+#include <ctime>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+// Turns binary backend logs (SIMPLE_K_LOG_FORMAT=binary) back into the text format:
+//   log-decode cpl-log/cpl-back-1700000000.klog [more.klog.gz ...]
+// Compressed (.gz) files are read transparently.
+
+namespace
+{
+    struct Site
+    {
+        LogLevel level;
+        string file;
+        uint32_t line;
+        string fmt;
+    };
+
+    class Reader
+    {
+    public:
+        explicit Reader(gzFile file) : file_{file} {}
+
+        bool read(void *dst, size_t len)
+        {
+            return len == 0 or gzread(file_, dst, static_cast<unsigned>(len)) == static_cast<int>(len);
+        }
+
+    private:
+        gzFile file_;
+    };
+
+    template <typename T>
+    bool take(string_view &payload, T &value)
+    {
+        if (payload.size() < sizeof value)
+            return false;
+        memcpy(&value, payload.data(), sizeof value);
+        payload.remove_prefix(sizeof value);
+        return true;
+    }
+
+    bool take_string(string_view &payload, size_t len, string &out)
+    {
+        if (payload.size() < len)
+            return false;
+        out.assign(payload.data(), len);
+        payload.remove_prefix(len);
+        return true;
+    }
+
+    bool append_decoded_argument(string &out, string_view &payload)
+    {
+        char tag;
+        if (!take(payload, tag))
+            return false;
+        if (tag == logging::binary::kString)
+        {
+            uint32_t len;
+            string text;
+            if (!take(payload, len) or !take_string(payload, len, text))
+                return false;
+            out.append(text);
+            return true;
+        }
+
+        uint64_t raw;
+        if (!take(payload, raw))
+            return false;
+        switch (tag)
+        {
+        case logging::binary::kSigned:
+            logging::append_argument(out, static_cast<int64_t>(raw));
+            return true;
+        case logging::binary::kUnsigned:
+            logging::append_argument(out, raw);
+            return true;
+        case logging::binary::kFloat:
+        {
+            double value;
+            memcpy(&value, &raw, sizeof value);
+            logging::append_argument(out, value);
+            return true;
+        }
+        case logging::binary::kBool:
+            logging::append_argument(out, raw != 0);
+            return true;
+        case logging::binary::kChar:
+            out.push_back(static_cast<char>(raw));
+            return true;
+        case logging::binary::kPointer:
+            logging::append_argument(out, reinterpret_cast<const void *>(static_cast<uintptr_t>(raw)));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void append_timestamp(string &out, int64_t realtime_ns)
+    {
+        time_t second = static_cast<time_t>(realtime_ns / 1000000000);
+        long micros = static_cast<long>(realtime_ns % 1000000000 / 1000);
+        struct tm prepared_time;
+        char text[48];
+        if (localtime_r(&second, &prepared_time) == nullptr)
+        {
+            out.append("[TIME_ERR]");
+            return;
+        }
+        size_t len = strftime(text, sizeof text, "%Y-%m-%d %H:%M:%S", &prepared_time);
+        len += static_cast<size_t>(snprintf(text + len, sizeof text - len, ".%06ld", micros));
+        out.append(text, len);
+    }
+
+    bool decode_site(string_view payload, unordered_map<uint32_t, Site> &sites)
+    {
+        uint32_t id, line, fmt_len;
+        uint8_t level;
+        uint16_t file_len;
+        Site site;
+        if (!take(payload, id) or !take(payload, level) or !take(payload, line) or !take(payload, file_len) or
+            !take_string(payload, file_len, site.file) or !take(payload, fmt_len) or !take_string(payload, fmt_len, site.fmt))
+            return false;
+        site.level = static_cast<LogLevel>(level);
+        site.line = line;
+        sites[id] = move(site);
+        return true;
+    }
+
+    int decode_file(const char *path)
+    {
+        gzFile file = gzopen(path, "rb");
+        if (file == nullptr)
+        {
+            cerr << "log-decode: cannot open " << path << endl;
+            return 1;
+        }
+        Reader reader(file);
+
+        char magic[sizeof logging::binary::kMagic];
+        int64_t realtime_anchor, monotonic_anchor;
+        if (!reader.read(magic, sizeof magic) or memcmp(magic, logging::binary::kMagic, sizeof magic) != 0 or
+            !reader.read(&realtime_anchor, sizeof realtime_anchor) or !reader.read(&monotonic_anchor, sizeof monotonic_anchor))
+        {
+            cerr << "log-decode: " << path << " is not a binary backend log" << endl;
+            gzclose(file);
+            return 1;
+        }
+
+        unordered_map<uint32_t, Site> sites;
+        string payload_storage, line;
+        uint64_t records = 0;
+        int status = 0;
+        while (true)
+        {
+            uint32_t site_id, payload_len;
+            uint64_t monotonic_ns;
+            if (!reader.read(&site_id, sizeof site_id))
+                break;
+            if (!reader.read(&payload_len, sizeof payload_len) or !reader.read(&monotonic_ns, sizeof monotonic_ns))
+            {
+                cerr << "log-decode: " << path << " is truncated after " << records << " records" << endl;
+                status = 1;
+                break;
+            }
+            payload_storage.resize(payload_len);
+            if (!reader.read(payload_storage.data(), payload_len))
+            {
+                cerr << "log-decode: " << path << " is truncated after " << records << " records" << endl;
+                status = 1;
+                break;
+            }
+            ++records;
+            string_view payload(payload_storage);
+
+            if (site_id == logging::binary::kSiteRecord)
+            {
+                if (!decode_site(payload, sites))
+                    cerr << "log-decode: malformed site definition in record " << records << endl;
+                continue;
+            }
+
+            line.clear();
+            append_timestamp(line, realtime_anchor + (static_cast<int64_t>(monotonic_ns) - monotonic_anchor));
+            line.push_back(' ');
+            auto it = sites.find(site_id);
+            if (it == sites.end())
+            {
+                line.append("?     [unknown site ").append(to_string(site_id)).append("]\n");
+                cout << line;
+                continue;
+            }
+
+            const Site &site = it->second;
+            line.append(logging::level_prefix(site.level));
+            size_t pos = 0;
+            while (!payload.empty() and pos != string_view::npos)
+            {
+                pos = logging::append_literal(line, site.fmt, pos);
+                if (pos != string_view::npos and !append_decoded_argument(line, payload))
+                {
+                    line.append("[malformed arguments]");
+                    pos = string_view::npos;
+                    break;
+                }
+            }
+            if (pos != string_view::npos)
+                logging::append_literal(line, site.fmt, pos, false);
+            line.push_back('\n');
+            cout << line;
+        }
+        gzclose(file);
+        return status;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " <binary log file>..." << endl;
+        return 2;
+    }
+    ios::sync_with_stdio(false);
+    int status = 0;
+    for (int i = 1; i < argc; ++i)
+        status |= decode_file(argv[i]);
+    return status;
+}
@@ -16,10 +16,128 @@
 
 #define _WRITE_LOG_CPP
 #include "cloud-compile-backend.hpp"
+#include <sys/resource.h>
+#include <zlib.h>
+
+// Each producing thread owns a single-producer/single-consumer byte ring of
+// already formatted lines; the writer thread drains every ring with writev().
+// Lines from different threads may interleave out of timestamp order, but each
+// line is written whole and lines from one thread keep their order.
+class LogRing
+{
+public:
+    static constexpr size_t kCapacity = 256 * 1024;
+
+    LogRing() : data_{make_unique<char[]>(kCapacity)} {}
+
+    size_t free_bytes() const noexcept { return kCapacity - (head_.load(memory_order_relaxed) - tail_.load(memory_order_acquire)); }
+    size_t used_bytes() const noexcept { return head_.load(memory_order_acquire) - tail_.load(memory_order_relaxed); }
+
+    void push(const char *data, size_t len) noexcept
+    {
+        size_t head = head_.load(memory_order_relaxed);
+        size_t offset = head % kCapacity;
+        size_t first = min(len, kCapacity - offset);
+        memcpy(data_.get() + offset, data, first);
+        memcpy(data_.get(), data + first, len - first);
+        head_.store(head + len, memory_order_release);
+    }
+
+    size_t fill_iovecs(struct iovec *vec) const noexcept
+    {
+        size_t tail = tail_.load(memory_order_relaxed);
+        size_t len = head_.load(memory_order_acquire) - tail;
+        if (len == 0)
+            return 0;
+        size_t offset = tail % kCapacity;
+        size_t first = min(len, kCapacity - offset);
+        vec[0] = {data_.get() + offset, first};
+        if (first == len)
+            return 1;
+        vec[1] = {data_.get(), len - first};
+        return 2;
+    }
+
+    void consume(size_t len) noexcept { tail_.store(tail_.load(memory_order_relaxed) + len, memory_order_release); }
+
+    atomic<bool> abandoned{false};
+
+private:
+    unique_ptr<char[]> data_;
+    alignas(64) atomic<size_t> head_{0};
+    alignas(64) atomic<size_t> tail_{0};
+};
+
+// Call sites registered for binary logging. Ids 0..3 are the generic "{}" sites used
+// for already formatted messages at each level.
+class LogSiteTable
+{
+public:
+    struct Site
+    {
+        LogLevel level;
+        const char *fmt;
+        const char *file;
+        int line;
+    };
+
+    static LogSiteTable &instance()
+    {
+        static LogSiteTable table;
+        return table;
+    }
+
+    uint32_t add(const Site &site)
+    {
+        lock_guard<mutex> lock(mutex_);
+        sites_.push_back(site);
+        return static_cast<uint32_t>(sites_.size() - 1);
+    }
+
+    // Serializes the definitions of sites [first, end) and returns the new end.
+    size_t serialize_from(size_t first, string &out)
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (size_t id = first; id < sites_.size(); ++id)
+        {
+            const Site &site = sites_[id];
+            size_t file_len = min<size_t>(strlen(site.file), UINT16_MAX);
+            uint32_t fmt_len = static_cast<uint32_t>(strlen(site.fmt));
+            uint32_t payload_len = static_cast<uint32_t>(4 + 1 + 4 + 2 + file_len + 4 + fmt_len);
+            logging::binary::put(out, logging::binary::kSiteRecord);
+            logging::binary::put(out, payload_len);
+            logging::binary::put(out, uint64_t{0});
+            logging::binary::put(out, static_cast<uint32_t>(id));
+            logging::binary::put(out, static_cast<uint8_t>(site.level));
+            logging::binary::put(out, static_cast<uint32_t>(site.line));
+            logging::binary::put(out, static_cast<uint16_t>(file_len));
+            out.append(site.file, file_len);
+            logging::binary::put(out, fmt_len);
+            out.append(site.fmt, fmt_len);
+        }
+        return sites_.size();
+    }
+
+private:
+    LogSiteTable()
+    {
+        for (LogLevel level : {LogLevel::debug, LogLevel::info, LogLevel::warning, LogLevel::error})
+            sites_.push_back({level, "{}", "", 0});
+    }
+
+    mutex mutex_;
+    vector<Site> sites_;
+};
 
 class Logger
 {
 public:
+    static constexpr chrono::milliseconds kDefaultFlushInterval{100};
+    static constexpr size_t kDefaultMaxFileBytes = 256 * 1024 * 1024;
+    static constexpr chrono::seconds kDefaultRotateInterval{24 * 60 * 60};
+    static constexpr size_t kDefaultKeepFiles = 10;
+    static constexpr chrono::milliseconds kSlowRotationThreshold{100};
+
     static Logger &getInstance()
     {
         static Logger instance;
@@ -33,173 +151,673 @@ public:
     Logger(Logger &&) = delete;
     Logger &operator=(Logger &&) = delete;
 
-    void enqueueLog(string &&log_entry)
+    void append(const char *level, string_view information)
     {
         if (!is_initialized_ or shutdown_requested_.load(memory_order_relaxed))
             return;
-        {
-            lock_guard<mutex> lock(queue_mutex_);
-            log_queue_.push(move(log_entry));
-        }
-        cv_.notify_one();
+
+        string fallback;
+        Scratch *scratch = local_scratch();
+        string &line = scratch != nullptr ? scratch->line : fallback;
+        line.clear();
+        append_timestamp(line);
+        line.push_back(' ');
+        line.append(level);
+        line.append(information);
+        line.push_back('\n');
+        push(line);
+    }
+
+    void append_record(string_view record)
+    {
+        if (!is_initialized_ or shutdown_requested_.load(memory_order_relaxed))
+            return;
+        push(record);
     }
 
     void flush()
     {
         if (!is_initialized_ or shutdown_requested_.load(memory_order_relaxed))
             return;
-        cv_.notify_one();
+        unique_lock<mutex> lock(flush_mutex_);
+        uint64_t target = ++flush_requested_;
+        wake_writer();
+        flushed_cv_.wait_for(lock, chrono::seconds(1), [this, target]
+                             { return flush_completed_ >= target; });
     }
 
     bool isFileOpen() const { return is_initialized_; }
 
+    logging::Stats stats()
+    {
+        logging::Stats result{};
+        {
+            lock_guard<mutex> lock(rings_mutex_);
+            for (const shared_ptr<LogRing> &ring : rings_)
+            {
+                size_t used = ring->used_bytes();
+                result.queued_bytes += used;
+                result.max_ring_bytes = max(result.max_ring_bytes, used);
+            }
+        }
+        {
+            lock_guard<mutex> lock(compress_mutex_);
+            result.pending_compressions = compress_queue_.size();
+        }
+        result.ring_capacity = LogRing::kCapacity;
+        result.producer_stalls = producer_stalls_.load(memory_order_relaxed);
+        result.bytes_written = bytes_written_.load(memory_order_relaxed);
+        result.rotations = rotations_.load(memory_order_relaxed);
+        result.last_rotation_us = last_rotation_us_.load(memory_order_relaxed);
+        result.compressed_files = compressed_files_.load(memory_order_relaxed);
+        result.compress_failures = compress_failures_.load(memory_order_relaxed);
+        return result;
+    }
+
 private:
-    Logger() : shutdown_requested_(false), is_initialized_(false)
+    Logger() : shutdown_requested_(false), is_initialized_(false), flush_interval_(kDefaultFlushInterval),
+               max_file_bytes_(kDefaultMaxFileBytes), rotate_interval_(kDefaultRotateInterval), keep_files_(kDefaultKeepFiles)
     {
         try
         {
-            char filename[FILENAME_BUFFER_SIZE];
-            time_t now_c = chrono::system_clock::to_time_t(chrono::system_clock::now());
-            int written = snprintf(filename, FILENAME_BUFFER_SIZE, "%s/cpl-back-%ld.log", LOG_DIRECTORY, static_cast<long>(now_c));
-
-            log_file_.open(filename, ios::app | ios::out | ios::binary);
-            if (!log_file_.is_open())
+            if (const char *interval = getenv("SIMPLE_K_LOG_FLUSH_MS"))
+                flush_interval_ = chrono::milliseconds(max(1L, strtol(interval, nullptr, 10)));
+            if (const char *bytes = getenv("SIMPLE_K_LOG_MAX_BYTES"))
+                max_file_bytes_ = max<size_t>(LogRing::kCapacity, strtoull(bytes, nullptr, 10));
+            if (const char *seconds = getenv("SIMPLE_K_LOG_ROTATE_SECONDS"))
+                rotate_interval_ = chrono::seconds(max(1L, strtol(seconds, nullptr, 10)));
+            if (const char *keep = getenv("SIMPLE_K_LOG_KEEP_FILES"))
+                keep_files_ = strtoull(keep, nullptr, 10);
+            if (const char *format = getenv("SIMPLE_K_LOG_FORMAT"))
+                binary_ = string_view(format) == "binary";
+
+            log_fd_ = open_new_file(file_path_);
+            if (log_fd_ == -1)
             {
-                cerr << "Error opening log file: " << filename << endl;
-                throw runtime_error(string("Cannot open log file: ") + filename);
+                cerr << "Error opening log file: " << file_path_ << endl;
+                throw runtime_error("Cannot open log file: " + file_path_);
             }
+            file_opened_at_ = chrono::steady_clock::now();
+            start_file_locked();
+            logging::binary_enabled.store(binary_, memory_order_relaxed);
 
+            compressor_thread_ = thread(&Logger::compressor, this);
             writer_thread_ = thread(&Logger::worker, this);
             is_initialized_ = true;
         }
         catch (const exception &e)
         {
             cerr << "Logger initialization failed: " << e.what() << endl;
-            if (log_file_.is_open())
-                log_file_.close();
+            close_fd();
             shutdown_requested_ = true;
             if (writer_thread_.joinable())
             {
-                cv_.notify_all();
+                wake_writer();
                 writer_thread_.join();
             }
+            stop_compressor();
             is_initialized_ = false;
         }
         catch (...)
         {
             cerr << "Logger initialization failed due to an unknown exception." << endl;
-            if (log_file_.is_open())
-                log_file_.close();
+            close_fd();
             shutdown_requested_ = true;
             if (writer_thread_.joinable())
             {
-                cv_.notify_all();
+                wake_writer();
                 writer_thread_.join();
             }
+            stop_compressor();
             is_initialized_ = false;
         }
     }
 
     ~Logger()
     {
-        if (is_initialized_ and !shutdown_requested_.exchange(true))
+        shutdown_requested_ = true;
+        if (writer_thread_.joinable())
         {
-            cv_.notify_all();
-            if (writer_thread_.joinable())
-                writer_thread_.join();
+            wake_writer();
+            writer_thread_.join();
+        }
+        close_fd();
+        stop_compressor();
+    }
+
+    void close_fd() noexcept
+    {
+        lock_guard<mutex> lock(fd_mutex_);
+        if (log_fd_ != -1)
+            ::close(log_fd_);
+        log_fd_ = -1;
+    }
+
+    void stop_compressor()
+    {
+        {
+            lock_guard<mutex> lock(compress_mutex_);
+            compressor_stop_ = true;
         }
-        else if (writer_thread_.joinable())
+        compress_cv_.notify_all();
+        if (compressor_thread_.joinable())
+            compressor_thread_.join();
+    }
+
+    // cpl-back-<epoch>.log (.klog in binary mode), with a -N suffix if several files
+    // are opened within one second.
+    int open_new_file(string &path) const
+    {
+        char filename[FILENAME_BUFFER_SIZE];
+        const char *extension = binary_ ? "klog" : "log";
+        time_t now_c = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        for (int attempt = 0; attempt < 100; ++attempt)
         {
-            if (!shutdown_requested_.load())
+            if (attempt == 0)
+                snprintf(filename, FILENAME_BUFFER_SIZE, "%s/cpl-back-%ld.%s", LOG_DIRECTORY, static_cast<long>(now_c), extension);
+            else
+                snprintf(filename, FILENAME_BUFFER_SIZE, "%s/cpl-back-%ld-%d.%s", LOG_DIRECTORY, static_cast<long>(now_c), attempt, extension);
+            path = filename;
+            int fd = ::open(filename, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+            if (fd != -1 or errno != EEXIST)
+                return fd;
+        }
+        return -1;
+    }
+
+    bool rotation_due() const
+    {
+        return bytes_in_file_.load(memory_order_relaxed) >= max_file_bytes_ or
+               chrono::steady_clock::now() - file_opened_at_ >= rotate_interval_;
+    }
+
+    // Runs on the writer thread between batches; the finished file is handed to the
+    // compressor thread, so the writer only pays for one open() and one close().
+    void rotate()
+    {
+        auto start = chrono::steady_clock::now();
+        string new_path;
+        int new_fd = open_new_file(new_path);
+        if (new_fd == -1)
+        {
+            cerr << "Log rotation failed to open a new file: " << errno_to_string(errno) << endl;
+            file_opened_at_ = start;
+            bytes_in_file_.store(0, memory_order_relaxed);
+            return;
+        }
+
+        int old_fd;
+        {
+            lock_guard<mutex> lock(fd_mutex_);
+            old_fd = log_fd_;
+            log_fd_ = new_fd;
+            start_file_locked();
+        }
+        ::close(old_fd);
+
+        string old_path = exchange(file_path_, new_path);
+        file_opened_at_ = chrono::steady_clock::now();
+        bytes_in_file_.store(0, memory_order_relaxed);
+        {
+            lock_guard<mutex> lock(compress_mutex_);
+            compress_queue_.push_back(move(old_path));
+        }
+        compress_cv_.notify_one();
+
+        auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+        rotations_.fetch_add(1, memory_order_relaxed);
+        last_rotation_us_.store(static_cast<uint64_t>(elapsed.count()), memory_order_relaxed);
+        if (elapsed >= kSlowRotationThreshold)
+        {
+            logging::Stats current = stats();
+            SK_LOG_WARNING("Logger - rotation to {} took {} us, {} bytes queued in rings (largest ring {} of {}).",
+                           file_path_, elapsed.count(), current.queued_bytes, current.max_ring_bytes, current.ring_capacity);
+        }
+    }
+
+    // The log threads are started before main() runs, so they would otherwise accept the
+    // signals main() later routes to an EventLoop signalfd.
+    static void block_signals()
+    {
+        sigset_t all;
+        sigfillset(&all);
+        ::pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    }
+
+    void compressor()
+    {
+        block_signals();
+        // Compression is background work: lowest CPU priority and idle I/O class for this thread only.
+        ::setpriority(PRIO_PROCESS, static_cast<id_t>(::gettid()), 19);
+        constexpr int kIoprioWhoProcess = 1, kIoprioClassIdle = 3, kIoprioClassShift = 13;
+        ::syscall(SYS_ioprio_set, kIoprioWhoProcess, ::gettid(), kIoprioClassIdle << kIoprioClassShift);
+
+        while (true)
+        {
+            string path;
             {
-                shutdown_requested_ = true;
-                cv_.notify_all();
+                unique_lock<mutex> lock(compress_mutex_);
+                compress_cv_.wait(lock, [this]
+                                  { return !compress_queue_.empty() or compressor_stop_; });
+                if (compress_queue_.empty())
+                    break;
+                path = compress_queue_.front();
             }
-            writer_thread_.join();
+
+            if (compress_file(path))
+                compressed_files_.fetch_add(1, memory_order_relaxed);
+            else
+                compress_failures_.fetch_add(1, memory_order_relaxed);
+            enforce_retention();
+
+            lock_guard<mutex> lock(compress_mutex_);
+            compress_queue_.pop_front();
         }
+    }
+
+    // A binary file starts with the magic and a realtime/monotonic clock pair, and
+    // every site is defined again in each new file.
+    void start_file_locked()
+    {
+        emitted_sites_ = 0;
+        if (!binary_)
+            return;
+        string header(logging::binary::kMagic, sizeof logging::binary::kMagic);
+        logging::binary::put(header, static_cast<int64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count()));
+        logging::binary::put(header, static_cast<int64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count()));
+        write_fully(header);
+    }
 
-        if (log_file_.is_open())
+    void emit_sites_locked()
+    {
+        if (!binary_)
+            return;
+        // write_directly() runs on any thread, including the main thread during exit().
+        string fallback;
+        Scratch *scratch = local_scratch();
+        string &definitions = scratch != nullptr ? scratch->definitions : fallback;
+        definitions.clear();
+        emitted_sites_ = LogSiteTable::instance().serialize_from(emitted_sites_, definitions);
+        if (!definitions.empty())
+            write_fully(definitions);
+    }
+
+    void write_fully(string_view data)
+    {
+        size_t written = 0;
+        while (written < data.size())
         {
-            log_file_.flush();
-            log_file_.close();
+            ssize_t n = ::write(log_fd_, data.data() + written, data.size() - written);
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                cerr << "Error writing to log file. Further logs might be lost." << endl;
+                return;
+            }
+            written += static_cast<size_t>(n);
         }
+        bytes_in_file_.fetch_add(data.size(), memory_order_relaxed);
+        bytes_written_.fetch_add(data.size(), memory_order_relaxed);
     }
 
-    void worker()
+    static bool compress_file(const string &path)
     {
-        queue<string> local_queue;
+        string tmp_path = path + ".gz.tmp";
+        int in_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in_fd == -1)
+            return false;
+        gzFile out = gzopen(tmp_path.c_str(), "wb6");
+        if (out == nullptr)
+        {
+            ::close(in_fd);
+            return false;
+        }
 
+        bool ok = true;
+        vector<char> chunk(256 * 1024);
         while (true)
         {
-            unique_lock<mutex> lock(queue_mutex_);
+            ssize_t n = ::read(in_fd, chunk.data(), chunk.size());
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ok = n == 0;
+                break;
+            }
+            if (gzwrite(out, chunk.data(), static_cast<unsigned>(n)) != n)
+            {
+                ok = false;
+                break;
+            }
+        }
+        ::close(in_fd);
+        ok = gzclose(out) == Z_OK and ok;
+
+        if (ok and ::rename(tmp_path.c_str(), (path + ".gz").c_str()) == 0)
+        {
+            ::unlink(path.c_str());
+            return true;
+        }
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
 
-            cv_.wait(lock, [this]
-                     { return !log_queue_.empty() or shutdown_requested_.load(memory_order_relaxed); });
+    // Keeps the newest keep_files_ compressed logs; the live file and uncompressed
+    // leftovers are never removed here.
+    void enforce_retention()
+    {
+        error_code ec;
+        vector<pair<filesystem::file_time_type, filesystem::path>> rolled;
+        for (const filesystem::directory_entry &entry : filesystem::directory_iterator(LOG_DIRECTORY, ec))
+        {
+            string name = entry.path().filename().string();
+            if (name.starts_with("cpl-back-") and (name.ends_with(".log.gz") or name.ends_with(".klog.gz")))
+                rolled.emplace_back(entry.last_write_time(ec), entry.path());
+        }
+        if (rolled.size() <= keep_files_)
+            return;
+        sort(rolled.begin(), rolled.end());
+        for (size_t i = 0; i + keep_files_ < rolled.size(); ++i)
+            filesystem::remove(rolled[i].second, ec);
+    }
 
-            if (shutdown_requested_.load(memory_order_relaxed) and log_queue_.empty())
+    // The "YYYY-mm-dd HH:MM:SS." part only changes once a second, so each thread
+    // keeps the last one it formatted and only appends the microseconds.
+    static void append_timestamp(string &line)
+    {
+        thread_local time_t cached_second = -1;
+        thread_local char cached_prefix[32];
+        thread_local size_t cached_len = 0;
+
+        using namespace chrono;
+        auto now = system_clock::now();
+        auto us = duration_cast<microseconds>(now.time_since_epoch()).count();
+        time_t second = static_cast<time_t>(us / 1000000);
+        if (second != cached_second)
+        {
+            struct tm prepared_time;
+            if (localtime_r(&second, &prepared_time) == nullptr)
             {
-                lock.unlock();
-                break;
+                line.append("[TIME_ERR]");
+                return;
+            }
+            cached_len = strftime(cached_prefix, sizeof cached_prefix, "%Y-%m-%d %H:%M:%S.", &prepared_time);
+            cached_second = second;
+        }
+        line.append(cached_prefix, cached_len);
+
+        char digits[6];
+        long fraction = static_cast<long>(us % 1000000);
+        for (int i = 5; i >= 0; --i, fraction /= 10)
+            digits[i] = static_cast<char>('0' + fraction % 10);
+        line.append(digits, sizeof digits);
+    }
+
+    void push(string_view line)
+    {
+        // The writer thread must never wait on a ring only it can drain.
+        LogRing *ring = is_writer_thread ? nullptr : local_ring();
+        if (ring == nullptr or line.size() > LogRing::kCapacity / 2)
+        {
+            write_directly(line, ring);
+            return;
+        }
+
+        if (ring->free_bytes() < line.size())
+            producer_stalls_.fetch_add(1, memory_order_relaxed);
+        while (ring->free_bytes() < line.size())
+        {
+            wake_writer();
+            this_thread::yield();
+            if (shutdown_requested_.load(memory_order_relaxed))
+                return;
+        }
+        ring->push(line.data(), line.size());
+
+        if (ring->used_bytes() >= LogRing::kCapacity / 2)
+            wake_writer();
+    }
+
+    struct Scratch
+    {
+        string line;
+        string definitions;
+    };
+
+    // Null once the calling thread's thread_locals are destroyed: for the main thread that
+    // happens in exit() before the static destructors that still log.
+    static Scratch *local_scratch()
+    {
+        struct Holder
+        {
+            Scratch scratch;
+            ~Holder() { scratch_destroyed = true; }
+        };
+
+        if (scratch_destroyed)
+            return nullptr;
+        thread_local Holder holder;
+        return &holder.scratch;
+    }
+
+    LogRing *local_ring()
+    {
+        struct Holder
+        {
+            shared_ptr<LogRing> ring;
+            ~Holder()
+            {
+                ring_destroyed = true;
+                if (ring)
+                    ring->abandoned.store(true, memory_order_release);
             }
+        };
+        thread_local Holder holder;
 
-            if (!log_queue_.empty())
-                local_queue.swap(log_queue_);
+        if (ring_destroyed)
+            return nullptr;
+        if (!holder.ring)
+        {
+            holder.ring = make_shared<LogRing>();
+            lock_guard<mutex> lock(rings_mutex_);
+            rings_.push_back(holder.ring);
+        }
+        return holder.ring.get();
+    }
 
-            lock.unlock();
+    // Used for lines larger than half a ring and for threads whose ring is already
+    // gone; a single write() to an O_APPEND file does not interleave with writev().
+    // The calling thread's ring is flushed first so its earlier lines stay ahead; drain()
+    // only consumes under fd_mutex_, so the ring never has two readers at once.
+    void write_directly(string_view line, LogRing *ring = nullptr)
+    {
+        lock_guard<mutex> lock(fd_mutex_);
+        struct iovec vec[2];
+        size_t count = ring != nullptr ? ring->fill_iovecs(vec) : 0;
+        emit_sites_locked();
+        if (count > 0)
+        {
+            size_t len = vec[0].iov_len + (count == 2 ? vec[1].iov_len : 0);
+            write_all(vec, count);
+            bytes_in_file_.fetch_add(len, memory_order_relaxed);
+            bytes_written_.fetch_add(len, memory_order_relaxed);
+            ring->consume(len);
+        }
+        write_fully(line);
+    }
 
-            while (!local_queue.empty())
+    void wake_writer()
+    {
+        if (!wake_pending_.exchange(true, memory_order_acq_rel))
+        {
+            lock_guard<mutex> lock(wake_mutex_);
+            wake_cv_.notify_one();
+        }
+    }
+
+    // Drains every ring once; returns the number of bytes written.
+    size_t drain()
+    {
+        vector<shared_ptr<LogRing>> rings;
+        {
+            lock_guard<mutex> lock(rings_mutex_);
+            erase_if(rings_, [](const shared_ptr<LogRing> &ring)
+                     { return ring->abandoned.load(memory_order_acquire) and ring->used_bytes() == 0; });
+            rings = rings_;
+        }
+
+        size_t total = 0;
+        for (size_t first = 0; first < rings.size();)
+        {
+            struct iovec vec[IOV_MAX];
+            size_t count = 0;
+            size_t last = first;
+            size_t batch_bytes = 0;
+            vector<size_t> lengths;
+            // Held from filling to consuming: write_directly() may flush a ring concurrently.
+            lock_guard<mutex> lock(fd_mutex_);
+            for (; last < rings.size() and count + 2 <= IOV_MAX; ++last)
             {
-                if (log_file_.good())
-                    log_file_ << local_queue.front() << '\n';
-                else
-                    cerr << "Error writing to log file. Further logs might be lost." << endl;
-                local_queue.pop();
+                size_t n = rings[last]->fill_iovecs(vec + count);
+                size_t len = 0;
+                for (size_t i = count; i < count + n; ++i)
+                    len += vec[i].iov_len;
+                lengths.push_back(len);
+                batch_bytes += len;
+                count += n;
             }
 
-            if (log_file_.good())
-                log_file_.flush();
+            if (batch_bytes > 0)
+            {
+                // Site definitions are read after the rings, so every id in this batch is covered.
+                emit_sites_locked();
+                write_all(vec, count);
+                bytes_in_file_.fetch_add(batch_bytes, memory_order_relaxed);
+                bytes_written_.fetch_add(batch_bytes, memory_order_relaxed);
+            }
+            for (size_t i = first; i < last; ++i)
+                rings[i]->consume(lengths[i - first]);
+            total += batch_bytes;
+            first = last;
+        }
+        return total;
+    }
+
+    void write_all(struct iovec *vec, size_t count)
+    {
+        while (count > 0)
+        {
+            ssize_t n = ::writev(log_fd_, vec, static_cast<int>(count));
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                cerr << "Error writing to log file. Further logs might be lost." << endl;
+                return;
+            }
+            size_t left = static_cast<size_t>(n);
+            while (count > 0 and left >= vec->iov_len)
+            {
+                left -= vec->iov_len;
+                ++vec;
+                --count;
+            }
+            if (count > 0)
+            {
+                vec->iov_base = static_cast<char *>(vec->iov_base) + left;
+                vec->iov_len -= left;
+            }
         }
+    }
 
-        if (log_file_.good())
-            log_file_.flush();
+    void worker()
+    {
+        block_signals();
+        is_writer_thread = true;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(wake_mutex_);
+                wake_cv_.wait_for(lock, flush_interval_, [this]
+                                  { return wake_pending_.load(memory_order_acquire) or shutdown_requested_.load(memory_order_relaxed); });
+            }
+            wake_pending_.store(false, memory_order_release);
+            if (rotation_due())
+                rotate();
+
+            uint64_t flush_target = flush_requested_.load(memory_order_acquire);
+            bool shutting_down = shutdown_requested_.load(memory_order_acquire);
+            while (drain() > 0 and shutting_down)
+                ;
+
+            if (flush_target > flush_completed_.load(memory_order_relaxed))
+            {
+                lock_guard<mutex> lock(flush_mutex_);
+                flush_completed_ = flush_target;
+                flushed_cv_.notify_all();
+            }
+            if (shutting_down)
+                break;
+        }
     }
 
-    ofstream log_file_;
-    queue<string> log_queue_;
-    mutex queue_mutex_;
-    condition_variable cv_;
+    static inline thread_local bool ring_destroyed = false;
+    static inline thread_local bool scratch_destroyed = false;
+    static inline thread_local bool is_writer_thread = false;
+
+    mutex fd_mutex_;
+    int log_fd_ = -1;
+    bool binary_ = false;
+    size_t emitted_sites_ = 0;
+    string file_path_;
+    chrono::steady_clock::time_point file_opened_at_;
+    atomic<size_t> bytes_in_file_{0};
+    mutex rings_mutex_;
+    vector<shared_ptr<LogRing>> rings_;
+
+    mutex wake_mutex_;
+    condition_variable wake_cv_;
+    atomic<bool> wake_pending_{false};
+
+    mutex flush_mutex_;
+    condition_variable flushed_cv_;
+    atomic<uint64_t> flush_requested_{0};
+    atomic<uint64_t> flush_completed_{0};
+
+    mutex compress_mutex_;
+    condition_variable compress_cv_;
+    deque<string> compress_queue_;
+    bool compressor_stop_ = false;
+    thread compressor_thread_;
+
+    atomic<uint64_t> producer_stalls_{0};
+    atomic<uint64_t> bytes_written_{0};
+    atomic<uint64_t> rotations_{0};
+    atomic<uint64_t> last_rotation_us_{0};
+    atomic<uint64_t> compressed_files_{0};
+    atomic<uint64_t> compress_failures_{0};
+
     thread writer_thread_;
     atomic<bool> shutdown_requested_;
     atomic<bool> is_initialized_;
+    chrono::milliseconds flush_interval_;
+    size_t max_file_bytes_;
+    chrono::seconds rotate_interval_;
+    size_t keep_files_;
 };
 
-inline string formatLogMessage(const char *level, const string &information)
+void make_sure_log_file()
 {
-    using namespace chrono;
-    auto now = system_clock::now();
-    auto ms = duration_cast<microseconds>(now.time_since_epoch()) % 1000000;
-    time_t tt = system_clock::to_time_t(now);
-
-    struct tm prepared_time;
-    if (localtime_r(&tt, &prepared_time) == nullptr)
+    if (const char *name = getenv("SIMPLE_K_LOG_LEVEL"))
     {
-        ostringstream error_oss;
-        error_oss << "[TIME_ERR] " << level
-                  << information;
-        return error_oss.str();
+        if (optional<LogLevel> level = logging::parse_level(name))
+            logging::set_level(*level);
+        else
+            cerr << "Unknown SIMPLE_K_LOG_LEVEL '" << name << "', keeping the default level." << endl;
     }
 
-    ostringstream oss;
-    oss << put_time(&prepared_time, "%Y-%m-%d %H:%M:%S");
-    oss << '.' << setfill('0') << setw(6) << ms.count();
-    oss << ' ' << level;
-    oss << information;
-
-    return oss.str();
-}
-
-void make_sure_log_file()
-{
     try
     {
         Logger::getInstance();
@@ -238,116 +856,83 @@ void close_log_file()
     }
 }
 
-void log_write_error_information(const string &information)
+void logging::write(LogLevel level, string &&information)
 {
-    if (!information.empty())
+    if (information.empty())
+        return;
+    try
     {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("ERROR ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write ERROR log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write ERROR log." << endl;
-        }
+        Logger &logger = Logger::getInstance();
+        if (!logging::binary_mode())
+            logger.append(logging::level_prefix(level), information);
+        else
+            logging::write_binary(static_cast<uint32_t>(level), information);
     }
+    catch (const runtime_error &e)
+    {
+        cerr << "LOGGER NOT INITIALIZED: Failed to write " << logging::level_prefix(level) << "log: " << e.what() << endl;
+    }
+    catch (...)
+    {
+        cerr << "LOGGER UNKNOWN ERROR: Failed to write " << logging::level_prefix(level) << "log." << endl;
+    }
+}
+
+void log_write_error_information(const string &information)
+{
+    SK_LOG_ERROR("{}", information);
 }
 
 void log_write_error_information(string &&information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("ERROR ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write ERROR log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write ERROR log." << endl;
-        }
-    }
+    SK_LOG_ERROR("{}", information);
 }
 
 void log_write_regular_information(const string &information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("INFO  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write INFO log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write INFO log." << endl;
-        }
-    }
+    SK_LOG_INFO("{}", information);
 }
 
 void log_write_regular_information(string &&information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("INFO  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write INFO log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write INFO log." << endl;
-        }
-    }
+    SK_LOG_INFO("{}", information);
 }
 
 void log_write_warning_information(const string &information)
 {
-    if (!information.empty())
+    SK_LOG_WARNING("{}", information);
+}
+
+void log_write_warning_information(string &&information)
+{
+    SK_LOG_WARNING("{}", information);
+}
+
+logging::Stats logging::stats()
+{
+    try
     {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("WARN  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write WARN log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write WARN log." << endl;
-        }
+        return Logger::getInstance().stats();
+    }
+    catch (...)
+    {
+        return {};
     }
 }
 
-void log_write_warning_information(string &&information)
+uint32_t logging::register_site(LogLevel level, const char *fmt, const char *file, int line)
 {
-    if (!information.empty())
+    return LogSiteTable::instance().add({level, fmt, file, line});
+}
+
+void logging::write_record(string_view record)
+{
+    try
     {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("WARN  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write WARN log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write WARN log." << endl;
-        }
+        Logger::getInstance().append_record(record);
+    }
+    catch (...)
+    {
+        cerr << "LOGGER NOT INITIALIZED: Failed to write binary log record." << endl;
     }
 }
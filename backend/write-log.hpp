@@ -0,0 +1,340 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _WRITE_LOG_HPP
+#define _WRITE_LOG_HPP
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+using namespace std;
+
+enum class LogLevel : int
+{
+    debug = 0,
+    info = 1,
+    warning = 2,
+    error = 3,
+    off = 4,
+};
+
+// Levels below SIMPLE_K_MIN_LOG_LEVEL are compiled out entirely. Above it, the runtime
+// level is checked before any argument of the log call is evaluated.
+#ifndef SIMPLE_K_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define SIMPLE_K_MIN_LOG_LEVEL 1
+#else
+#define SIMPLE_K_MIN_LOG_LEVEL 0
+#endif
+#endif
+
+// In binary mode each call site registers its format string once (fmt must be a string
+// literal) and the hot path only copies the site id, a timestamp and the raw arguments.
+#define SK_LOG(level, fmt, ...)                                                                             \
+    do                                                                                                      \
+    {                                                                                                       \
+        if constexpr (static_cast<int>(level) >= SIMPLE_K_MIN_LOG_LEVEL)                                    \
+            if (logging::enabled(level))                                                                    \
+            {                                                                                               \
+                if (logging::binary_mode())                                                                 \
+                {                                                                                           \
+                    static const uint32_t sk_log_site = logging::register_site(level, fmt, __FILE__, __LINE__); \
+                    logging::write_binary(sk_log_site __VA_OPT__(, ) __VA_ARGS__);                          \
+                }                                                                                           \
+                else                                                                                        \
+                    logging::write(level, logging::format(fmt __VA_OPT__(, ) __VA_ARGS__));                 \
+            }                                                                                               \
+    } while (0)
+
+#define SK_LOG_DEBUG(...) SK_LOG(LogLevel::debug, __VA_ARGS__)
+#define SK_LOG_INFO(...) SK_LOG(LogLevel::info, __VA_ARGS__)
+#define SK_LOG_WARNING(...) SK_LOG(LogLevel::warning, __VA_ARGS__)
+#define SK_LOG_ERROR(...) SK_LOG(LogLevel::error, __VA_ARGS__)
+
+namespace logging
+{
+    inline atomic<int> runtime_level{static_cast<int>(LogLevel::info)};
+
+    inline atomic<bool> binary_enabled{false};
+
+    inline bool enabled(LogLevel level) noexcept
+    {
+        return static_cast<int>(level) >= runtime_level.load(memory_order_relaxed);
+    }
+
+    inline bool binary_mode() noexcept { return binary_enabled.load(memory_order_relaxed); }
+
+    inline const char *level_prefix(LogLevel level) noexcept
+    {
+        switch (level)
+        {
+        case LogLevel::debug:
+            return "DEBUG ";
+        case LogLevel::info:
+            return "INFO  ";
+        case LogLevel::warning:
+            return "WARN  ";
+        default:
+            return "ERROR ";
+        }
+    }
+
+    inline void set_level(LogLevel level) noexcept { runtime_level.store(static_cast<int>(level), memory_order_relaxed); }
+    inline LogLevel level() noexcept { return static_cast<LogLevel>(runtime_level.load(memory_order_relaxed)); }
+
+    inline optional<LogLevel> parse_level(string_view name) noexcept
+    {
+        if (name == "debug")
+            return LogLevel::debug;
+        if (name == "info")
+            return LogLevel::info;
+        if (name == "warning")
+            return LogLevel::warning;
+        if (name == "error")
+            return LogLevel::error;
+        if (name == "off")
+            return LogLevel::off;
+        return nullopt;
+    }
+
+    void write(LogLevel level, string &&message);
+
+    struct Stats
+    {
+        size_t queued_bytes;
+        size_t max_ring_bytes;
+        size_t ring_capacity;
+        size_t pending_compressions;
+        uint64_t producer_stalls;
+        uint64_t bytes_written;
+        uint64_t rotations;
+        uint64_t last_rotation_us;
+        uint64_t compressed_files;
+        uint64_t compress_failures;
+    };
+
+    // Writer-side counters of the backend logger (ring fill, stalls, rotation).
+    Stats stats();
+
+    // Binary log layout (SIMPLE_K_LOG_FORMAT=binary), decoded offline by log-decode:
+    //   file   := magic[8] realtime_anchor_ns:i64 monotonic_anchor_ns:i64 record*
+    //   record := site:u32 payload_len:u32 monotonic_ns:u64 payload
+    // A record with site == kSiteRecord defines a site before its first use:
+    //   payload := id:u32 level:u8 line:u32 file_len:u16 file fmt_len:u32 fmt
+    // Otherwise the payload is the call's arguments, each a tag byte followed by
+    // 8 raw bytes, or by len:u32 and the bytes for strings.
+    namespace binary
+    {
+        constexpr char kMagic[8] = {'S', 'K', 'L', 'O', 'G', '\x01', '\0', '\0'};
+        constexpr uint32_t kSiteRecord = 0xFFFFFFFF;
+        constexpr size_t kRecordHeaderSize = 16;
+
+        enum ArgTag : char
+        {
+            kSigned = 'i',
+            kUnsigned = 'u',
+            kFloat = 'd',
+            kBool = 'b',
+            kChar = 'c',
+            kString = 's',
+            kPointer = 'p',
+        };
+
+        template <typename T>
+        void put(string &out, const T &value)
+        {
+            out.append(reinterpret_cast<const char *>(&value), sizeof value);
+        }
+
+        template <typename T>
+        void put_argument(string &out, const T &value)
+        {
+            using U = remove_cvref_t<T>;
+            if constexpr (is_same_v<U, bool>)
+            {
+                out.push_back(kBool);
+                put(out, uint64_t{value});
+            }
+            else if constexpr (is_same_v<U, char>)
+            {
+                out.push_back(kChar);
+                put(out, static_cast<uint64_t>(static_cast<unsigned char>(value)));
+            }
+            else if constexpr (is_convertible_v<const U &, string_view>)
+            {
+                string_view text(value);
+                out.push_back(kString);
+                put(out, static_cast<uint32_t>(text.size()));
+                out.append(text);
+            }
+            else if constexpr (is_enum_v<U>)
+                put_argument(out, static_cast<underlying_type_t<U>>(value));
+            else if constexpr (is_floating_point_v<U>)
+            {
+                out.push_back(kFloat);
+                put(out, static_cast<double>(value));
+            }
+            else if constexpr (is_integral_v<U> and is_signed_v<U>)
+            {
+                out.push_back(kSigned);
+                put(out, static_cast<int64_t>(value));
+            }
+            else if constexpr (is_integral_v<U>)
+            {
+                out.push_back(kUnsigned);
+                put(out, static_cast<uint64_t>(value));
+            }
+            else if constexpr (is_pointer_v<U>)
+            {
+                out.push_back(kPointer);
+                put(out, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+            }
+            else
+                static_assert(is_void_v<U>, "logging::write_binary: unsupported argument type");
+        }
+    }
+
+    uint32_t register_site(LogLevel level, const char *fmt, const char *file, int line);
+    void write_record(string_view record);
+
+    inline thread_local bool binary_record_buffer_destroyed = false;
+
+    // Null once the calling thread's thread_locals are destroyed: for the main thread that
+    // happens in exit() before the static destructors that still log.
+    inline string *binary_record_buffer()
+    {
+        struct Holder
+        {
+            string record;
+            ~Holder() { binary_record_buffer_destroyed = true; }
+        };
+
+        if (binary_record_buffer_destroyed)
+            return nullptr;
+        thread_local Holder holder;
+        return &holder.record;
+    }
+
+    template <typename... Args>
+    void write_binary(uint32_t site, const Args &...args)
+    {
+        string fallback;
+        string *buffer = binary_record_buffer();
+        string &record = buffer != nullptr ? *buffer : fallback;
+        record.clear();
+        binary::put(record, site);
+        binary::put(record, uint32_t{0});
+        binary::put(record, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count()));
+        (binary::put_argument(record, args), ...);
+        uint32_t payload_len = static_cast<uint32_t>(record.size() - binary::kRecordHeaderSize);
+        memcpy(record.data() + sizeof site, &payload_len, sizeof payload_len);
+        write_record(record);
+    }
+
+    // Copies fmt[pos..] up to the next "{}" into out, unescaping "{{" and "}}".
+    // Returns the position just past the placeholder, or npos if there is none.
+    // Placeholders left over once the arguments run out are copied verbatim.
+    inline size_t append_literal(string &out, string_view fmt, size_t pos, bool stop_at_placeholder = true)
+    {
+        while (pos < fmt.size())
+        {
+            size_t brace = fmt.find_first_of("{}", pos);
+            if (brace == string_view::npos)
+                break;
+            out.append(fmt.data() + pos, brace - pos);
+            if (brace + 1 < fmt.size() and fmt[brace + 1] == fmt[brace])
+            {
+                out.push_back(fmt[brace]);
+                pos = brace + 2;
+            }
+            else if (stop_at_placeholder and fmt[brace] == '{' and brace + 1 < fmt.size() and fmt[brace + 1] == '}')
+                return brace + 2;
+            else
+            {
+                out.push_back(fmt[brace]);
+                pos = brace + 1;
+            }
+        }
+        if (pos < fmt.size())
+            out.append(fmt.data() + pos, fmt.size() - pos);
+        return string_view::npos;
+    }
+
+    template <typename T>
+    void append_argument(string &out, const T &value)
+    {
+        using U = remove_cvref_t<T>;
+        if constexpr (is_same_v<U, bool>)
+            out.append(value ? "true" : "false");
+        else if constexpr (is_same_v<U, char>)
+            out.push_back(value);
+        else if constexpr (is_convertible_v<const U &, string_view>)
+            out.append(string_view(value));
+        else if constexpr (is_enum_v<U>)
+            append_argument(out, static_cast<underlying_type_t<U>>(value));
+        else if constexpr (is_arithmetic_v<U>)
+        {
+            char digits[64];
+            auto [end, ec] = to_chars(digits, digits + sizeof digits, value);
+            out.append(digits, ec == errc() ? end : digits);
+        }
+        else if constexpr (is_pointer_v<U>)
+        {
+            char digits[2 + 2 * sizeof(uintptr_t)] = {'0', 'x'};
+            auto [end, ec] = to_chars(digits + 2, digits + sizeof digits, reinterpret_cast<uintptr_t>(value), 16);
+            out.append(digits, end);
+        }
+        else
+            static_assert(is_void_v<U>, "logging::format: unsupported argument type");
+    }
+
+    template <typename... Args>
+    string format(string_view fmt, const Args &...args)
+    {
+        string out;
+        out.reserve(fmt.size() + 16 * sizeof...(Args));
+        size_t pos = 0;
+        (
+            [&]
+            {
+                if (pos == string_view::npos)
+                    return;
+                pos = append_literal(out, fmt, pos);
+                if (pos != string_view::npos)
+                    append_argument(out, args);
+            }(),
+            ...);
+        if (pos != string_view::npos)
+            append_literal(out, fmt, pos, false);
+        return out;
+    }
+}
+
+void log_write_error_information(const string &err);
+void log_write_error_information(string &&err);
+void log_write_regular_information(const string &info);
+void log_write_regular_information(string &&info);
+void log_write_warning_information(const string &info);
+void log_write_warning_information(string &&info);
+
+#endif
@@ -241,34 +241,11 @@ void MainWindow::connectSignalsAndSlots()
     connect(taskListWidget_, &QListWidget::itemDoubleClicked, this, &MainWindow::onTaskListItemDoubleClicked);
 
     connect(&taskManager_, &TaskManager::sendFileInitiationCompleted, this, &MainWindow::onSendFileInitiationCompleted);
+    connect(&taskManager_, &TaskManager::serverResponseReceived, this, &MainWindow::onServerResponseReceived);
     connect(&taskManager_, &TaskManager::receivedFileSaveCompleted, this, &MainWindow::onReceivedFileSaveCompleted);
 
     connect(&navigationWatcher_, &QFutureWatcherBase::finished, this, &MainWindow::handleNavigationFinished);
     connect(&openFileWatcher_, &QFutureWatcherBase::finished, this, &MainWindow::handleOpenFileFinished);
-
-    clientSocketInstance_.register_handler(
-        "compile-execute",
-        [this](const std::string &payload_str)
-        {
-            log_write_regular_information("Socket Handler: Received 'compile-execute' message. Raw Length: " + std::to_string(payload_str.length()));
-            ParsedPayload parsedResponse = parseEchoPayload(payload_str);
-            if (parsedResponse.successfullyParsed)
-            {
-                log_write_regular_information(QString("Socket Handler: Payload parsed successfully. FileName: '%1', DataSize: %2")
-                                                  .arg(parsedResponse.originalFileName)
-                                                  .arg(parsedResponse.fileData.size())
-                                                  .toStdString());
-            }
-            else
-            {
-                log_write_error_information(QString("Socket Handler: Failed to parse payload. Error: '%1'")
-                                                .arg(parsedResponse.message)
-                                                .toStdString());
-            }
-            QMetaObject::invokeMethod(this, [this, fileName = parsedResponse.originalFileName, data = parsedResponse.fileData, isParsedSuccessfully = parsedResponse.successfullyParsed, messageFromServer = parsedResponse.message]()
-                                      { handleServerFileResponse(fileName.toStdString(), data, isParsedSuccessfully, messageFromServer.toStdString()); }, Qt::QueuedConnection);
-        });
-    log_write_regular_information("Registered 'compile-execute' handler with ClientSocket.");
 }
 
 void MainWindow::onTreeViewClicked(const QModelIndex &index)
@@ -442,14 +419,14 @@ void MainWindow::onClearTasksButtonClicked()
     log_write_regular_information("Finished clearing completed/error tasks.");
 }
 
-void MainWindow::onSendFileInitiationCompleted(QString filePath, bool success, QString errorReason)
+void MainWindow::onSendFileInitiationCompleted(quint64 taskId, QString filePath, bool success, QString errorReason)
 {
     QString fileName = QFileInfo(filePath).fileName();
     log_write_regular_information(QString("Received sendFileInitiationCompleted for %1. Success: %2. Reason: %3").arg(fileName).arg(success).arg(errorReason).toStdString());
     QListWidgetItem *taskItem = nullptr;
     {
         QMutexLocker locker(&activeSendTasksMutex_);
-        auto it = activeSendTaskItems_.find(fileName);
+        auto it = activeSendTaskItems_.find(taskId);
         if (it != activeSendTaskItems_.end())
             taskItem = it->second;
     }
@@ -466,8 +443,34 @@ void MainWindow::onSendFileInitiationCompleted(QString filePath, bool success, Q
     {
         updateUITaskItem(taskItem, UITaskStatus::Error, QString("发送失败: %1").arg(fileName), QString("Failed to send file '%1'. Reason: %2").arg(filePath, errorReason), errorReason);
         QMutexLocker locker(&activeSendTasksMutex_);
-        activeSendTaskItems_.erase(fileName);
+        activeSendTaskItems_.erase(taskId);
+    }
+}
+
+void MainWindow::onServerResponseReceived(quint64 taskId, bool success, QByteArray payload, QString errorReason)
+{
+    log_write_regular_information(QString("Received server response for task %1. Success: %2. Raw Length: %3").arg(taskId).arg(success).arg(payload.size()).toStdString());
+    if (!success)
+    {
+        handleServerFileResponse(taskId, std::string(), std::vector<char>(), false, errorReason.toStdString());
+        return;
     }
+    ParsedPayload parsedResponse = parseEchoPayload(payload.toStdString());
+    if (parsedResponse.successfullyParsed)
+    {
+        log_write_regular_information(QString("Server response parsed successfully. FileName: '%1', DataSize: %2")
+                                          .arg(parsedResponse.originalFileName)
+                                          .arg(parsedResponse.fileData.size())
+                                          .toStdString());
+    }
+    else
+    {
+        log_write_error_information(QString("Failed to parse server response. Error: '%1'")
+                                        .arg(parsedResponse.message)
+                                        .toStdString());
+    }
+    handleServerFileResponse(taskId, parsedResponse.originalFileName.toStdString(), parsedResponse.fileData,
+                             parsedResponse.successfullyParsed, parsedResponse.message.toStdString());
 }
 
 void MainWindow::onReceivedFileSaveCompleted(QString originalFileName, QString savedFilePath, bool success, QString errorReason)
@@ -551,12 +554,13 @@ void MainWindow::handleOpenFileFinished()
     }
 }
 
-void MainWindow::handleServerFileResponse(const std::string &originalFileNameFromServer_std, const std::vector<char> &fileData, bool serverProcessingSuccess, const std::string &serverMessage_std)
+void MainWindow::handleServerFileResponse(quint64 taskId, const std::string &originalFileNameFromServer_std, const std::vector<char> &fileData, bool serverProcessingSuccess, const std::string &serverMessage_std)
 {
     QString originalFileNameFromServer = QString::fromStdString(originalFileNameFromServer_std);
     QString serverMessage = QString::fromStdString(serverMessage_std);
 
-    log_write_regular_information(QString("MainWindow::handleServerFileResponse (from socket) for '%1', payload parsed successfully: %2")
+    log_write_regular_information(QString("MainWindow::handleServerFileResponse for task %1 ('%2'), payload parsed successfully: %3")
+                                      .arg(taskId)
                                       .arg(originalFileNameFromServer)
                                       .arg(serverProcessingSuccess)
                                       .toStdString());
@@ -564,12 +568,12 @@ void MainWindow::handleServerFileResponse(const std::string &originalFileNameFro
     QListWidgetItem *sendingItemRawPtr = nullptr;
     {
         QMutexLocker locker(&activeSendTasksMutex_);
-        auto it = activeSendTaskItems_.find(originalFileNameFromServer);
+        auto it = activeSendTaskItems_.find(taskId);
         if (it != activeSendTaskItems_.end())
         {
             sendingItemRawPtr = it->second;
             activeSendTaskItems_.erase(it);
-            log_write_regular_information("Removed " + originalFileNameFromServer.toStdString() + " from activeSendTaskItems_ after server response.");
+            log_write_regular_information("Removed task " + std::to_string(taskId) + " from activeSendTaskItems_ after server response.");
         }
     }
 
@@ -777,10 +781,3 @@ void MainWindow::updateUITaskItem(QListWidgetItem *item, UITaskStatus status, co
                                       .arg(displayText)
                                       .toStdString());
 }
-
-QListWidgetItem *MainWindow::findActiveSendingTaskByOriginalName(const QString &originalFileName)
-{
-    QMutexLocker locker(&activeSendTasksMutex_);
-    auto it = activeSendTaskItems_.find(originalFileName);
-    return (it != activeSendTaskItems_.end()) ? it->second : nullptr;
-}
@@ -82,17 +82,6 @@ void SendFileTask::execute(MainWindow *mainWindowContext)
     QString fileName = fileInfo.fileName();
     log_write_regular_information("[SendFileTask] Initiating send for: " + filePath.toStdString());
 
-    {
-        QMutexLocker locker(&mainWindowContext->getActiveSendTaskItemsMutex());
-        if (mainWindowContext->getActiveSendTaskItems().count(fileName))
-        {
-            QMessageBox::warning(mainWindowContext, "任务已存在",
-                                 QString("文件 '%1' 的发送任务已经在进行中或等待服务器响应。").arg(fileName));
-            log_write_warning_information("[SendFileTask] Send request for " + fileName.toStdString() + " aborted, task already exists.");
-            return;
-        }
-    }
-
     QListWidgetItem *newItem = new QListWidgetItem();
     newItem->setData(OriginalFileNameRole, fileName);
     newItem->setData(FilePathRole, filePath);
@@ -111,11 +100,12 @@ void SendFileTask::execute(MainWindow *mainWindowContext)
 
     mainWindowContext->updateMainWindowUITaskItem(newItem, UITaskStatus::Preparing, QString("准备发送 (Preparing to send): %1").arg(fileName));
 
+    quint64 taskId = mainWindowContext->allocateSendTaskId();
     {
         QMutexLocker locker(&mainWindowContext->getActiveSendTaskItemsMutex());
-        mainWindowContext->getActiveSendTaskItems()[fileName] = newItem;
+        mainWindowContext->getActiveSendTaskItems()[taskId] = newItem;
     }
 
-    mainWindowContext->getTaskManager().initiateSendFile(filePath);
+    mainWindowContext->getTaskManager().initiateSendFile(taskId, filePath);
     log_write_regular_information("[SendFileTask] File send initiated for: " + fileName.toStdString());
 }
@@ -35,21 +35,54 @@ TaskManager::TaskManager(ClientSocket &sock, const QString &outDir, QObject *par
     log_write_regular_information("TaskManager initialized with output directory: " + outputDir_.toStdString());
 }
 
-void TaskManager::initiateSendFile(const QString &absoluteFilePath)
+void TaskManager::initiateSendFile(quint64 taskId, const QString &absoluteFilePath)
 {
     log_write_regular_information("TaskManager: Queuing send initiation for: " + absoluteFilePath.toStdString());
+    initiatingTasks_.insert(taskId);
     auto *watcher = new QFutureWatcher<tuple<QString, bool, QString>>(this);
     connect(watcher,
             &QFutureWatcherBase::finished,
             this,
-            [this, watcher]()
+            [this, watcher, taskId]()
             {
                 auto result = watcher->result();
-                emit sendFileInitiationCompleted(get<0>(result), get<1>(result), get<2>(result));
+                initiatingTasks_.erase(taskId);
+                emit sendFileInitiationCompleted(taskId, get<0>(result), get<1>(result), get<2>(result));
+                auto early = earlyResponses_.find(taskId);
+                if (early != earlyResponses_.end())
+                {
+                    auto response = move(early->second);
+                    earlyResponses_.erase(early);
+                    emit serverResponseReceived(taskId, get<0>(response), get<1>(response), get<2>(response));
+                }
                 watcher->deleteLater(); 
             });
+
+    // Runs on the socket's receive thread; the reply is handed to the GUI thread without
+    // holding any thread while the server works.
+    QPointer<TaskManager> self(this);
+    ClientSocket::ResponseCallback onResponse = [self, taskId](future<ClientSocket::Response> response)
+    {
+        auto result = unpackServerResponse(move(response));
+        if (self)
+            QMetaObject::invokeMethod(
+                self.data(), [self, taskId, result]()
+                { self->deliverServerResponse(taskId, result); },
+                Qt::QueuedConnection);
+    };
     watcher->setFuture(QtConcurrent::run(
-        &TaskManager::workerSendFileInitiation, &socket_, absoluteFilePath));
+        &TaskManager::workerSendFileInitiation, &socket_, absoluteFilePath, move(onResponse)));
+}
+
+void TaskManager::deliverServerResponse(quint64 taskId, tuple<bool, QByteArray, QString> response)
+{
+    // A fast reply can overtake the initiation result; hold it back so the task item sees them in order.
+    if (initiatingTasks_.count(taskId))
+    {
+        earlyResponses_[taskId] = move(response);
+        return;
+    }
+    emit serverResponseReceived(taskId, get<0>(response), get<1>(response), get<2>(response));
 }
 
 void TaskManager::saveReceivedFile(const QString &originalFileName, const vector<char> &fileData)
@@ -69,7 +102,7 @@ void TaskManager::saveReceivedFile(const QString &originalFileName, const vector
         &TaskManager::workerSaveReceivedFile, originalFileName, fileData, outputDir_));
 }
 
-tuple<QString, bool, QString> TaskManager::workerSendFileInitiation(ClientSocket *socket, QString filePath)
+tuple<QString, bool, QString> TaskManager::workerSendFileInitiation(ClientSocket *socket, QString filePath, ClientSocket::ResponseCallback onResponse)
 {
     log_write_regular_information("[Worker] TaskManager: Initiating send for: " + filePath.toStdString());
     QString errorMsg;
@@ -107,25 +140,25 @@ tuple<QString, bool, QString> TaskManager::workerSendFileInitiation(ClientSocket
     {
         try
         {
-            if (socket->send_file("compile-execute", filePath.toStdString()))
+            if (socket->send_file_request("compile-execute", filePath.toStdString(), move(onResponse)))
             {
                 success = true;
-                log_write_regular_information("[Worker] TaskManager: send_file call successful for " + filePath.toStdString() + ". Awaiting server processing.");
+                log_write_regular_information("[Worker] TaskManager: send_file_request call successful for " + filePath.toStdString() + ". Awaiting server processing.");
             }
             else
             {
-                errorMsg = "ClientSocket::send_file returned false.";
+                errorMsg = "ClientSocket::send_file_request returned false.";
                 log_write_error_information("[Worker] TaskManager: " + errorMsg.toStdString() + " for " + filePath.toStdString());
             }
         }
         catch (const exception &e)
         {
-            errorMsg = QString("Exception during send_file: %1").arg(e.what());
+            errorMsg = QString("Exception during send_file_request: %1").arg(e.what());
             log_write_error_information("[Worker] TaskManager: " + errorMsg.toStdString() + " for " + filePath.toStdString());
         }
         catch (...)
         {
-            errorMsg = "Unknown exception during send_file.";
+            errorMsg = "Unknown exception during send_file_request.";
             log_write_error_information("[Worker] TaskManager: " + errorMsg.toStdString() + " for " + filePath.toStdString());
         }
     }
@@ -138,6 +171,20 @@ tuple<QString, bool, QString> TaskManager::workerSendFileInitiation(ClientSocket
     return {filePath, success, errorMsg};
 }
 
+tuple<bool, QByteArray, QString> TaskManager::unpackServerResponse(future<ClientSocket::Response> response)
+{
+    try
+    {
+        ClientSocket::Response reply = response.get();
+        return {true, QByteArray(reply.payload.data(), static_cast<qsizetype>(reply.payload.size())), QString()};
+    }
+    catch (const exception &e)
+    {
+        log_write_error_information(string("TaskManager: Request failed: ") + e.what());
+        return {false, QByteArray(), QString::fromStdString(e.what())};
+    }
+}
+
 tuple<QString, QString, bool, QString> TaskManager::workerSaveReceivedFile(
     QString originalFileName, const vector<char> &fileDataVec, QString outputDir)
 {
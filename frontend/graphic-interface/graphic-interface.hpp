@@ -66,7 +66,9 @@
 #include <QPointer>
 
 #include <map>
+#include <set>
 #include <tuple>
+#include <future>
 
 enum class UITaskStatus : quint8
 {
@@ -89,24 +91,31 @@ class TaskManager : public QObject
 public:
     explicit TaskManager(ClientSocket &sock, const QString &outDir, QObject *parent = nullptr);
 
-    void initiateSendFile(const QString &absoluteFilePath);
+    void initiateSendFile(quint64 taskId, const QString &absoluteFilePath);
     void saveReceivedFile(const QString &originalFileName, const std::vector<char> &fileData);
 
     QString getOutputDirectory() const { return outputDir_; }
 
 signals:
-    void sendFileInitiationCompleted(QString filePath, bool success, QString errorReason);
+    void sendFileInitiationCompleted(quint64 taskId, QString filePath, bool success, QString errorReason);
+    void serverResponseReceived(quint64 taskId, bool success, QByteArray payload, QString errorReason);
     void receivedFileSaveCompleted(QString originalFileName, QString savedFilePath, bool success, QString errorReason);
 
 private:
     friend class MainWindow;
 
-    static std::tuple<QString, bool, QString> workerSendFileInitiation(ClientSocket *socket, QString filePath);
+    void deliverServerResponse(quint64 taskId, std::tuple<bool, QByteArray, QString> response);
+
+    static std::tuple<QString, bool, QString> workerSendFileInitiation(ClientSocket *socket, QString filePath, ClientSocket::ResponseCallback onResponse);
+    static std::tuple<bool, QByteArray, QString> unpackServerResponse(std::future<ClientSocket::Response> response);
     static std::tuple<QString, QString, bool, QString> workerSaveReceivedFile(
         QString originalFileName, const std::vector<char> &fileDataVec, QString outputDir);
 
     ClientSocket &socket_;
     QString outputDir_;
+    // Touched only on the GUI thread.
+    std::set<quint64> initiatingTasks_;
+    std::map<quint64, std::tuple<bool, QByteArray, QString>> earlyResponses_;
 };
 
 class MainWindow : public QMainWindow
@@ -120,8 +129,9 @@ public:
     QString getSelectedFilePath() const;
     TaskManager &getTaskManager() { return taskManager_; }
     QListWidget *getTaskListWidget() { return taskListWidget_; }
-    map<QString, QListWidgetItem *> &getActiveSendTaskItems() { return activeSendTaskItems_; }
+    map<quint64, QListWidgetItem *> &getActiveSendTaskItems() { return activeSendTaskItems_; }
     QMutex &getActiveSendTaskItemsMutex() { return activeSendTasksMutex_; }
+    quint64 allocateSendTaskId() { return nextSendTaskId_++; }
 
     void updateMainWindowUITaskItem(QListWidgetItem *item, UITaskStatus status, const QString &displayText, const QString &toolTipText = QString(), const QString &errorMsgForRole = QString());
 
@@ -135,7 +145,8 @@ private slots:
     void onTaskListItemDoubleClicked(QListWidgetItem *item);
     void onClearTasksButtonClicked();
 
-    void onSendFileInitiationCompleted(QString filePath, bool success, QString errorReason);
+    void onSendFileInitiationCompleted(quint64 taskId, QString filePath, bool success, QString errorReason);
+    void onServerResponseReceived(quint64 taskId, bool success, QByteArray payload, QString errorReason);
     void onReceivedFileSaveCompleted(QString originalFileName, QString savedFilePath, bool success, QString errorReason);
 
     void handleNavigationFinished();
@@ -148,13 +159,12 @@ private:
     void connectSignalsAndSlots();
     void createToolbarActions();
 
-    void handleServerFileResponse(const string &originalFileNameFromServer_std, const vector<char> &fileData, bool serverProcessingSuccess, const string &serverMessage_std);
+    void handleServerFileResponse(quint64 taskId, const string &originalFileNameFromServer_std, const vector<char> &fileData, bool serverProcessingSuccess, const string &serverMessage_std);
 
     void startNavigateToPath(const QString &path);
     void startOpenFile(const QString &filePath);
 
     void updateUITaskItem(QListWidgetItem *item, UITaskStatus status, const QString &displayText, const QString &toolTipText = QString(), const QString &errorMsgForRole = QString());
-    QListWidgetItem *findActiveSendingTaskByOriginalName(const QString &originalFileName);
 
     static pair<bool, QString> performNavigationTask(QString path);
 
@@ -173,8 +183,9 @@ private:
     QString outputDirectory_;
     TaskManager taskManager_;
 
-    map<QString, QListWidgetItem *> activeSendTaskItems_;
+    map<quint64, QListWidgetItem *> activeSendTaskItems_;
     QMutex activeSendTasksMutex_;
+    quint64 nextSendTaskId_ = 1;
 
     QFutureWatcher<pair<bool, QString>> navigationWatcher_;
     QFutureWatcher<bool> openFileWatcher_;
@@ -31,9 +31,6 @@ int main(int argc, char *argv[])
         [](const string &payload)
         { log_write_error_information("Client received error-information from server: " + payload); });
 
-
-    client.send_message("Hello", "Hello from client!");
-    
     vector<string> args;
     return runMainWindow(client, args);
 }
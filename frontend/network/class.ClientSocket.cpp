@@ -27,16 +27,18 @@ ClientSocket::ClientSocket(string server_ip, uint16_t server_port)
       connection_manager_(make_unique<ConnectionManager>(*this)),
       sender_(make_unique<Sender>(*this)),
       receiver_(make_unique<Receiver>(*this)),
-      message_handler_(make_unique<MessageHandler>(*this))
+      message_handler_(make_unique<MessageHandler>(*this)),
+      peer_protocol_(0),
+      next_request_id_(1)
 {
-    log_write_regular_information("ClientSocket components initialized for " + server_ip_ + ":" + to_string(server_port_));
+    SK_LOG_INFO("ClientSocket components initialized for {}:{}", server_ip_, server_port_);
     if (!connect())
-        log_write_warning_information("Initial connection attempt failed during construction.");
+        SK_LOG_WARNING("Initial connection attempt failed during construction.");
 }
 
 ClientSocket::~ClientSocket()
 {
-    log_write_regular_information("ClientSocket destructor called.");
+    SK_LOG_INFO("ClientSocket destructor called.");
     disconnect();
 }
 
@@ -58,25 +60,25 @@ bool ClientSocket::connect_internal()
         return true;
     disconnect_internal();
 
-    log_write_regular_information("Attempting internal connection...");
+    SK_LOG_INFO("Attempting internal connection...");
     int new_sockfd = connection_manager_->try_connect();
     if (new_sockfd == -1)
     {
-        log_write_error_information("Internal connection attempt failed.");
+        SK_LOG_ERROR("Internal connection attempt failed.");
         sockfd_.store(-1, memory_order_relaxed);
         is_connected_.store(false, memory_order_relaxed);
         stop_requested_.store(true, memory_order_relaxed);
         return false;
     }
 
-    log_write_regular_information("Socket connected successfully (fd=" + to_string(new_sockfd) + ").");
+    SK_LOG_INFO("Socket connected successfully (fd={}).", new_sockfd);
     sockfd_.store(new_sockfd, memory_order_release);
     stop_requested_.store(false, memory_order_release);
     is_connected_.store(true, memory_order_release);
 
     if (!start_io_threads())
     {
-        log_write_error_information("Failed to start IO threads after connection.");
+        SK_LOG_ERROR("Failed to start IO threads after connection.");
 
         is_connected_.store(false, memory_order_relaxed);
         stop_requested_.store(true, memory_order_relaxed);
@@ -86,7 +88,8 @@ bool ClientSocket::connect_internal()
         return false;
     }
 
-    log_write_regular_information("IO threads started.");
+    SK_LOG_INFO("IO threads started.");
+    send_message(kHelloTag, "Hello from client!\nprotocol=" + to_string(kProtocolVersion));
     trigger_connection_callback_internal(true);
     return true;
 }
@@ -115,6 +118,9 @@ void ClientSocket::disconnect_internal()
         sender_->clear_queue();
     if (receiver_)
         receiver_->clear_buffer();
+    if (message_handler_)
+        message_handler_->reset();
+    fail_pending_requests_internal("Connection closed.");
 
     bool was_connected = is_connected_.exchange(false);
     if (was_connected)
@@ -125,22 +131,22 @@ bool ClientSocket::send_message(const string &tag, string_view payload)
 {
     if (!is_connected_.load(memory_order_relaxed))
     {
-        log_write_warning_information("Cannot send message: Not connected.");
+        SK_LOG_WARNING("Cannot send message: Not connected.");
         return false;
     }
     if (!sender_)
     {
-        log_write_error_information("Cannot send message: Sender component is not initialized.");
+        SK_LOG_ERROR("Cannot send message: Sender component is not initialized.");
         return false;
     }
     if (tag.length() > numeric_limits<uint8_t>::max())
     {
-        log_write_warning_information("Tag too long");
+        SK_LOG_WARNING("Tag too long");
         return false;
     }
     if (payload.length() > numeric_limits<uint32_t>::max())
     {
-        log_write_warning_information("Payload too long");
+        SK_LOG_WARNING("Payload too long");
         return false;
     }
     uint8_t tag_len = static_cast<uint8_t>(tag.length());
@@ -161,22 +167,22 @@ bool ClientSocket::send_message(const string &tag, unique_ptr<char[]> buffer, si
 {
     if (!is_connected_.load(memory_order_relaxed))
     {
-        log_write_warning_information("Cannot send message: Not connected.");
+        SK_LOG_WARNING("Cannot send message: Not connected.");
         return false;
     }
     if (!sender_)
     {
-        log_write_error_information("Cannot send message: Sender component is not initialized.");
+        SK_LOG_ERROR("Cannot send message: Sender component is not initialized.");
         return false;
     }
     if (tag.length() > numeric_limits<uint8_t>::max())
     {
-        log_write_warning_information("Tag too long");
+        SK_LOG_WARNING("Tag too long");
         return false;
     }
     if (buflen > numeric_limits<uint32_t>::max())
     {
-        log_write_warning_information("Payload too long");
+        SK_LOG_WARNING("Payload too long");
         return false;
     }
 
@@ -196,6 +202,116 @@ bool ClientSocket::send_message(const string &tag, unique_ptr<char[]> buffer, si
     return true;
 }
 
+future<ClientSocket::Response> ClientSocket::send_request(const string &tag, string_view payload)
+{
+    PendingRequest request;
+    future<Response> result = request.waiter.get_future();
+    string error;
+    if (!start_request(tag, payload, request, error))
+        request.waiter.set_exception(make_exception_ptr(runtime_error(error)));
+    return result;
+}
+
+bool ClientSocket::send_request(const string &tag, string_view payload, ResponseCallback on_response)
+{
+    PendingRequest request{promise<Response>(), move(on_response)};
+    string error;
+    return start_request(tag, payload, request, error);
+}
+
+future<ClientSocket::Response> ClientSocket::send_file_request(const string &tag, const string &file_path)
+{
+    string payload;
+    if (!read_request_file(file_path, payload))
+    {
+        promise<Response> failed;
+        failed.set_exception(make_exception_ptr(runtime_error("Failed to read file: " + file_path)));
+        return failed.get_future();
+    }
+    return send_request(tag, payload);
+}
+
+bool ClientSocket::send_file_request(const string &tag, const string &file_path, ResponseCallback on_response)
+{
+    string payload;
+    return read_request_file(file_path, payload) and send_request(tag, payload, move(on_response));
+}
+
+bool ClientSocket::start_request(const string &tag, string_view payload, PendingRequest &request, string &error)
+{
+    if (!is_connected_.load(memory_order_relaxed))
+        error = "Not connected.";
+    else if (!sender_)
+        error = "Sender component is not initialized.";
+    else if (tag.length() > numeric_limits<uint8_t>::max())
+        error = "Tag too long.";
+    else if (payload.length() > numeric_limits<uint32_t>::max())
+        error = "Payload too long.";
+
+    uint64_t request_id = 0;
+    if (error.empty())
+    {
+        unique_lock lock(requests_mutex_);
+        if (!handshake_cv_.wait_for(lock, kHandshakeTimeout, [this]
+                                    { return peer_protocol_ != 0 or stop_requested_.load(memory_order_relaxed); }))
+            error = "Timed out waiting for the server's Hello.";
+        else if (stop_requested_.load(memory_order_relaxed))
+            error = "Not connected.";
+        else if (peer_protocol_ < kProtocolVersion)
+        {
+            // Sent under the lock so that legacy_requests_ stays in wire order.
+            legacy_requests_.emplace_back(tag, move(request));
+            if (send_message(tag, payload))
+                return true;
+            request = move(legacy_requests_.back().second);
+            legacy_requests_.pop_back();
+            error = "Failed to send request.";
+        }
+        else
+        {
+            request_id = next_request_id_++;
+            pending_requests_.emplace(request_id, move(request));
+        }
+    }
+    if (!error.empty())
+    {
+        SK_LOG_WARNING("Cannot send request '{}': {}", tag, error);
+        return false;
+    }
+
+    uint8_t tag_len = static_cast<uint8_t>(tag.length());
+    uint64_t request_id_net = htobe64(request_id);
+    uint32_t payload_len_net = htonl(static_cast<uint32_t>(payload.length()));
+    size_t msglen = 4 + tag_len + sizeof(request_id_net) + sizeof(payload_len_net) + payload.length();
+    unique_ptr<char[]> message = make_unique<char[]>(msglen);
+    char *writer = message.get();
+
+    *writer = static_cast<char>(kFrameV2Marker), writer++;
+    *writer = static_cast<char>(kProtocolVersion), writer++;
+    *writer = 0, writer++;
+    *writer = static_cast<char>(tag_len), writer++;
+    memcpy(writer, tag.data(), tag_len), writer += tag_len;
+    memcpy(writer, &request_id_net, sizeof(request_id_net)), writer += sizeof(request_id_net);
+    memcpy(writer, &payload_len_net, sizeof(payload_len_net)), writer += sizeof(payload_len_net);
+    memcpy(writer, payload.data(), payload.length());
+    sender_->enqueue_message(move(message), msglen);
+    return true;
+}
+
+/* static */ bool ClientSocket::read_request_file(const string &file_path, string &payload)
+{
+    ifstream ifs(file_path, ios::binary);
+    payload = filesystem::path(file_path).filename().string() + '\0';
+    if (ifs)
+        payload.append(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+    if (!ifs.is_open() or ifs.bad())
+    {
+        SK_LOG_ERROR("Failed to read file for request: {}", file_path);
+        return false;
+    }
+    return true;
+}
+
 bool ClientSocket::send_text(const string &tag, const string &text_payload) { return send_message(tag, text_payload); }
 bool ClientSocket::send_binary(const string &tag, const vector<char> &binary_payload) { return send_message(tag, string_view(binary_payload.data(), binary_payload.size())); }
 
@@ -204,7 +320,7 @@ bool ClientSocket::send_file(const string &tag, const string &file_path, size_t
     ifstream ifs(file_path, ios::binary | ios::ate);
     if (!ifs)
     {
-        log_write_error_information("Failed to open file for sending: " + file_path);
+        SK_LOG_ERROR("Failed to open file for sending: {}", file_path);
         return false;
     }
     streamsize file_size = ifs.tellg();
@@ -213,7 +329,7 @@ bool ClientSocket::send_file(const string &tag, const string &file_path, size_t
         return send_message(tag, "");
     if (file_size < 0)
     {
-        log_write_error_information("Failed to get file size or file not seekable: " + file_path);
+        SK_LOG_ERROR("Failed to get file size or file not seekable: {}", file_path);
         return false;
     }
 
@@ -239,7 +355,7 @@ bool ClientSocket::send_file(const string &tag, const string &file_path, size_t
     }
     if (ifs.bad())
     {
-        log_write_error_information("Error reading file: " + file_path);
+        SK_LOG_ERROR("Error reading file: {}", file_path);
         return false;
     }
 
@@ -252,7 +368,7 @@ bool ClientSocket::send_file(const string &tag, const string &file_path, size_t
     {
         if (!send_message(tag, move(msg), total))
         {
-            log_write_error_information("Failed to send file chunk for: " + file_path);
+            SK_LOG_ERROR("Failed to send file chunk for: {}", file_path);
             return false;
         }
     }
@@ -280,7 +396,7 @@ void ClientSocket::trigger_error_callback_internal(const string &error_msg)
     {
         auto cb = error_cb_;
         thread_pool_.enqueue(0, [cb, msg = error_msg]()
-                             { try { cb(msg); } catch (...) { log_write_error_information("Exception caught in error callback."); } });
+                             { try { cb(msg); } catch (...) { SK_LOG_ERROR("Exception caught in error callback."); } });
     }
 }
 
@@ -290,7 +406,7 @@ void ClientSocket::trigger_connection_callback_internal(bool connected)
     {
         auto cb = connection_cb_;
         thread_pool_.enqueue(0, [cb, conn = connected]()
-                             { try { cb(conn); } catch (...) { log_write_error_information("Exception caught in connection callback."); } });
+                             { try { cb(conn); } catch (...) { SK_LOG_ERROR("Exception caught in connection callback."); } });
     }
 }
 
@@ -298,17 +414,123 @@ void ClientSocket::request_disconnect_async_internal(const string &reason)
 {
     if (!stop_requested_.exchange(true))
     {
-        log_write_regular_information("Async disconnect requested due to: " + reason);
+        SK_LOG_INFO("Async disconnect requested due to: {}", reason);
         if (sender_)
             sender_->notify_sender();
     }
 }
 
+void ClientSocket::set_peer_protocol_internal(int version)
+{
+    {
+        lock_guard lock(requests_mutex_);
+        peer_protocol_ = version;
+    }
+    handshake_cv_.notify_all();
+    SK_LOG_INFO("Server negotiated protocol v{}.", version);
+}
+
+void ClientSocket::PendingRequest::set_value(Response response)
+{
+    waiter.set_value(move(response));
+    if (on_response)
+        try { on_response(waiter.get_future()); } catch (...) { SK_LOG_ERROR("Exception caught in response callback."); }
+}
+
+void ClientSocket::PendingRequest::set_exception(exception_ptr error)
+{
+    waiter.set_exception(move(error));
+    if (on_response)
+        try { on_response(waiter.get_future()); } catch (...) { SK_LOG_ERROR("Exception caught in response callback."); }
+}
+
+void ClientSocket::complete_request_internal(uint64_t request_id, Response response, bool failed)
+{
+    PendingRequest waiter;
+    {
+        lock_guard lock(requests_mutex_);
+        auto it = pending_requests_.find(request_id);
+        if (it == pending_requests_.end())
+        {
+            SK_LOG_WARNING("Discarding response '{}' for unknown request {}.", response.tag, request_id);
+            return;
+        }
+        waiter = move(it->second);
+        pending_requests_.erase(it);
+    }
+    if (failed and response.tag == kBusyTag)
+        waiter.set_exception(make_exception_ptr(parse_busy_payload(response.payload)));
+    else if (failed)
+        waiter.set_exception(make_exception_ptr(runtime_error(response.payload)));
+    else
+        waiter.set_value(move(response));
+}
+
+bool ClientSocket::complete_legacy_request_internal(string_view tag, string &payload)
+{
+    PendingRequest waiter;
+    {
+        lock_guard lock(requests_mutex_);
+        // A handler may answer without a reply of its own tag, so busy fails the oldest request
+        // and any other reply completes the oldest request with the same tag.
+        auto it = tag == kBusyTag ? legacy_requests_.begin()
+                                  : find_if(legacy_requests_.begin(), legacy_requests_.end(), [tag](const auto &request)
+                                            { return request.first == tag; });
+        if (it == legacy_requests_.end())
+            return false;
+        waiter = move(it->second);
+        legacy_requests_.erase(it);
+    }
+    if (tag == kBusyTag)
+        waiter.set_exception(make_exception_ptr(parse_busy_payload(payload)));
+    else
+        waiter.set_value(Response{string(tag), move(payload)});
+    return true;
+}
+
+void ClientSocket::fail_pending_requests_internal(const string &reason)
+{
+    unordered_map<uint64_t, PendingRequest> orphaned;
+    deque<pair<string, PendingRequest>> orphaned_legacy;
+    {
+        lock_guard lock(requests_mutex_);
+        orphaned.swap(pending_requests_);
+        orphaned_legacy.swap(legacy_requests_);
+        peer_protocol_ = 0;
+    }
+    handshake_cv_.notify_all();
+    for (auto &[request_id, waiter] : orphaned)
+        waiter.set_exception(make_exception_ptr(runtime_error(reason)));
+    for (auto &[tag, waiter] : orphaned_legacy)
+        waiter.set_exception(make_exception_ptr(runtime_error(reason)));
+}
+
+/* static */ int ClientSocket::parse_protocol_offer(string_view hello_payload)
+{
+    constexpr string_view key = "\nprotocol=";
+    size_t pos = hello_payload.find(key);
+    if (pos == string_view::npos)
+        return 1;
+    return max(1, atoi(string(hello_payload.substr(pos + key.size(), 3)).c_str()));
+}
+
+/* static */ ClientSocket::ServerBusy ClientSocket::parse_busy_payload(const string &payload)
+{
+    constexpr string_view key = "retry_after_ms=";
+    long long retry_after_ms = 1000;
+    if (size_t pos = payload.find(key); pos != string::npos)
+        retry_after_ms = max(0LL, atoll(payload.c_str() + pos + key.size()));
+    size_t last_line = payload.rfind('\n');
+    string message = last_line == string::npos ? payload : payload.substr(last_line + 1);
+    message += " Retry after " + to_string((retry_after_ms + 999) / 1000) + " s.";
+    return ServerBusy(message, chrono::milliseconds{retry_after_ms});
+}
+
 bool ClientSocket::start_io_threads()
 {
     if (!sender_ or !receiver_)
     {
-        log_write_error_information("Cannot start IO threads: Sender or Receiver component is null.");
+        SK_LOG_ERROR("Cannot start IO threads: Sender or Receiver component is null.");
         return false;
     }
     try
@@ -319,7 +541,7 @@ bool ClientSocket::start_io_threads()
     }
     catch (const system_error &e)
     {
-        log_write_error_information("Failed to start IO threads: " + string(e.what()));
+        SK_LOG_ERROR("Failed to start IO threads: {}", e.what());
         stop_requested_ = true;
         return false;
     }
@@ -334,7 +556,7 @@ void ClientSocket::stop_and_join_io_threads()
         }
         catch (const system_error &e)
         {
-            log_write_error_information("Exception caught joining send thread: " + string(e.what()));
+            SK_LOG_ERROR("Exception caught joining send thread: {}", e.what());
         }
     }
     if (recv_thread_.joinable())
@@ -345,7 +567,7 @@ void ClientSocket::stop_and_join_io_threads()
         }
         catch (const system_error &e)
         {
-            log_write_error_information("Exception caught joining receive thread: " + string(e.what()));
+            SK_LOG_ERROR("Exception caught joining receive thread: {}", e.what());
         }
     }
 }
\ No newline at end of file
@@ -19,51 +19,127 @@
 
 void ClientSocket::MessageHandler::process_received_data(Buffer &recv_buffer)
 {
+    shared_ptr<const Routes> routes = routes_.load();
     while (true)
     {
         if (recv_buffer.readable_bytes() < 1)
             break;
-        const uint8_t tag_len = static_cast<uint8_t>(*recv_buffer.peek());
+        if (static_cast<uint8_t>(recv_buffer.peek_byte(0)) == kFrameV2Marker)
+        {
+            if (!process_response_frame(recv_buffer))
+                break;
+            continue;
+        }
+        const uint8_t tag_len = static_cast<uint8_t>(recv_buffer.peek_byte(0));
         const size_t header_len = 1 + tag_len + sizeof(uint32_t);
         if (recv_buffer.readable_bytes() < header_len)
             break;
         uint32_t payload_len_net;
-        std::memcpy(&payload_len_net, recv_buffer.peek() + 1 + tag_len, sizeof(payload_len_net));
+        recv_buffer.copy_out(1 + tag_len, &payload_len_net, sizeof(payload_len_net));
         uint32_t payload_len = ntohl(payload_len_net);
         if (payload_len > Buffer::kMaxFrameSize)
         {
-            log_write_error_information("Received frame payload length (" + std::to_string(payload_len) + ") exceeds limit (" + std::to_string(Buffer::kMaxFrameSize) + ").");
-            owner_.trigger_error_callback_internal("Received frame too large.");
-            owner_.request_disconnect_async_internal("Protocol error: frame too large");
-            recv_buffer.retrieve_all();
+            SK_LOG_ERROR("Received frame payload length ({}) exceeds limit ({}).", payload_len, Buffer::kMaxFrameSize);
+            abort_on_protocol_error(recv_buffer, "Received frame too large.");
             return;
         }
         const size_t total_message_len = header_len + payload_len;
         if (recv_buffer.readable_bytes() < total_message_len)
+        {
+            recv_buffer.reserve(total_message_len - recv_buffer.readable_bytes());
             break;
-        std::string tag(recv_buffer.peek() + 1, tag_len);
+        }
+        char tag_bytes[kMaxTagLength];
+        recv_buffer.copy_out(1, tag_bytes, tag_len);
+        string_view tag(tag_bytes, tag_len);
+        TagTable::TagId tag_id = routes->tags.find(tag);
         recv_buffer.retrieve(header_len);
         std::string payload = recv_buffer.retrieve_as_string(payload_len);
-        Handler handler_to_call;
-        bool found_handler = false;
+        if (tag == kHelloTag)
+            owner_.set_peer_protocol_internal(parse_protocol_offer(payload));
+        else if (owner_.complete_legacy_request_internal(tag, payload))
+            continue;
+
+        if (tag_id != TagTable::kUnknownTag)
+            owner_.thread_pool_.enqueue(0, [routes, tag_id, p = std::move(payload)]() mutable
+                                        { try { routes->handlers[tag_id](p); } catch (const std::exception& e) { SK_LOG_ERROR("Handler for tag '{}' threw an exception: {}", routes->tags.name(tag_id), e.what()); } catch (...) { SK_LOG_ERROR("Handler for tag '{}' threw an unknown exception.", routes->tags.name(tag_id)); } });
+        else if (routes->default_handler)
+            owner_.thread_pool_.enqueue(0, [routes, p = std::move(payload), tag_copy = string(tag)]() mutable
+                                        { try { routes->default_handler(p); } catch (const std::exception& e) { SK_LOG_ERROR("Handler for tag '{}' threw an exception: {}", tag_copy, e.what()); } catch (...) { SK_LOG_ERROR("Handler for tag '{}' threw an unknown exception.", tag_copy); } });
+        else
+            SK_LOG_WARNING("No handler found for tag '{}' and no default handler set. Discarding message payload (size {}).", tag, payload.length());
+    }
+}
+
+bool ClientSocket::MessageHandler::process_response_frame(Buffer &recv_buffer)
+{
+    const size_t prefix_len = 4 * sizeof(uint8_t);
+    if (recv_buffer.readable_bytes() < prefix_len)
+        return false;
+    const uint8_t version = static_cast<uint8_t>(recv_buffer.peek_byte(1));
+    const uint8_t flags = static_cast<uint8_t>(recv_buffer.peek_byte(2));
+    const uint8_t tag_len = static_cast<uint8_t>(recv_buffer.peek_byte(3));
+    if (version != kProtocolVersion)
+    {
+        SK_LOG_ERROR("Received frame with unsupported protocol version {}.", version);
+        abort_on_protocol_error(recv_buffer, "Received frame with unsupported protocol version.");
+        return false;
+    }
+
+    const size_t header_len = prefix_len + tag_len + sizeof(uint64_t) + sizeof(uint32_t);
+    if (recv_buffer.readable_bytes() < header_len)
+        return false;
+    uint64_t request_id_net;
+    recv_buffer.copy_out(prefix_len + tag_len, &request_id_net, sizeof(request_id_net));
+    const uint64_t request_id = be64toh(request_id_net);
+    uint32_t payload_len_net;
+    recv_buffer.copy_out(prefix_len + tag_len + sizeof(request_id_net), &payload_len_net, sizeof(payload_len_net));
+    const uint32_t payload_len = ntohl(payload_len_net);
+    if (payload_len > Buffer::kMaxFrameSize)
+    {
+        SK_LOG_ERROR("Received frame payload length ({}) exceeds limit ({}).", payload_len, Buffer::kMaxFrameSize);
+        abort_on_protocol_error(recv_buffer, "Received frame too large.");
+        return false;
+    }
+    const size_t total_message_len = header_len + payload_len;
+    if (recv_buffer.readable_bytes() < total_message_len)
+    {
+        recv_buffer.reserve(total_message_len - recv_buffer.readable_bytes());
+        return false;
+    }
+
+    string tag(tag_len, '\0');
+    recv_buffer.copy_out(prefix_len, tag.data(), tag_len);
+    recv_buffer.retrieve(header_len);
+    string payload = recv_buffer.retrieve_as_string(payload_len);
+
+    auto partial = partial_responses_.find(request_id);
+    if (flags & kFlagMoreFragments)
+    {
+        string &assembled = partial == partial_responses_.end() ? partial_responses_[request_id] : partial->second;
+        if (assembled.size() + payload.size() > kMaxResponseSize)
         {
-            std::shared_lock lock(handler_rw_mutex_);
-            auto it = handlers_.find(tag);
-            if (it != handlers_.end())
-            {
-                handler_to_call = it->second;
-                found_handler = true;
-            }
-            else if (default_handler_)
-            {
-                handler_to_call = default_handler_;
-                found_handler = true;
-            }
+            SK_LOG_ERROR("Response to request {} exceeds limit ({} bytes), dropping it.", request_id, kMaxResponseSize);
+            partial_responses_.erase(request_id);
+            owner_.complete_request_internal(request_id, Response{move(tag), "Response too large."}, true);
+            return true;
         }
-        if (found_handler && handler_to_call)
-            owner_.thread_pool_.enqueue(0, [h = std::move(handler_to_call), p = std::move(payload), tag_copy = tag]() mutable
-                                        { try { h(p); } catch (const std::exception& e) { log_write_error_information("Handler for tag '" + tag_copy + "' threw an exception: " + std::string(e.what())); } catch (...) { log_write_error_information("Handler for tag '" + tag_copy + "' threw an unknown exception."); } });
-        else
-            log_write_warning_information("No handler found for tag '" + tag + "' and no default handler set. Discarding message payload (size " + std::to_string(payload.length()) + ").");
+        assembled.append(payload);
+        return true;
+    }
+    if (partial != partial_responses_.end())
+    {
+        partial->second.append(payload);
+        payload = move(partial->second);
+        partial_responses_.erase(partial);
     }
-}
\ No newline at end of file
+    owner_.complete_request_internal(request_id, Response{move(tag), move(payload)}, flags & kFlagError);
+    return true;
+}
+
+void ClientSocket::MessageHandler::abort_on_protocol_error(Buffer &recv_buffer, const string &error_msg)
+{
+    owner_.trigger_error_callback_internal(error_msg);
+    owner_.request_disconnect_async_internal("Protocol error: " + error_msg);
+    recv_buffer.retrieve_all();
+}
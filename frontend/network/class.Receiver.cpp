@@ -19,11 +19,11 @@
 
 void ClientSocket::Receiver::recv_loop()
 {
-    log_write_regular_information("Receive thread started.");
+    SK_LOG_INFO("Receive thread started.");
     int current_sockfd = owner_.sockfd_.load(std::memory_order_relaxed);
     if (current_sockfd == -1)
     {
-        log_write_error_information("Receive loop cannot start: Socket is not valid (-1).");
+        SK_LOG_ERROR("Receive loop cannot start: Socket is not valid (-1).");
         return;
     }
     struct pollfd pfd{current_sockfd, POLLIN | POLLPRI, 0};
@@ -33,7 +33,7 @@ void ClientSocket::Receiver::recv_loop()
         current_sockfd = owner_.sockfd_.load(std::memory_order_relaxed);
         if (current_sockfd == -1)
         {
-            log_write_warning_information("Receive loop stopping: Socket became invalid (-1).");
+            SK_LOG_WARNING("Receive loop stopping: Socket became invalid (-1).");
             break;
         }
         pfd.fd = current_sockfd;
@@ -45,7 +45,7 @@ void ClientSocket::Receiver::recv_loop()
         {
             if (errno == EINTR)
                 continue;
-            log_write_error_information("Poll failed: " + errno_to_string(errno));
+            SK_LOG_ERROR("Poll failed: {}", errno_to_string(errno));
             owner_.trigger_error_callback_internal("Poll operation failed: " + errno_to_string(errno));
             owner_.request_disconnect_async_internal("Poll failure");
             break;
@@ -63,7 +63,7 @@ void ClientSocket::Receiver::recv_loop()
                 err_msg = "Socket error: " + errno_to_string(socket_error);
             else if (pfd.revents & POLLNVAL)
                 err_msg = "Socket invalid (POLLNVAL)";
-            log_write_error_information(err_msg);
+            SK_LOG_ERROR("{}", err_msg);
             owner_.trigger_error_callback_internal(err_msg);
             owner_.request_disconnect_async_internal("Socket error event");
             break;
@@ -77,11 +77,11 @@ void ClientSocket::Receiver::recv_loop()
                 if (owner_.message_handler_)
                     owner_.message_handler_->process_received_data(recv_buffer_);
                 else      
-                    log_write_error_information("MessageHandler is null, cannot process received data."); /* 可能需要断开? */
+                    SK_LOG_ERROR("MessageHandler is null, cannot process received data."); /* 可能需要断开? */
             }
             else if (n == 0)
             {
-                log_write_regular_information("Connection closed by peer (EOF).");
+                SK_LOG_INFO("Connection closed by peer (EOF).");
                 owner_.request_disconnect_async_internal("Peer closed connection");
                 break;
             }
@@ -89,12 +89,13 @@ void ClientSocket::Receiver::recv_loop()
             {
                 if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK || saved_errno == EINTR)
                     continue;
-                log_write_error_information("Recv failed: " + errno_to_string(saved_errno));
+                SK_LOG_ERROR("Recv failed: {}", errno_to_string(saved_errno));
                 owner_.trigger_error_callback_internal("Receive operation failed: " + errno_to_string(saved_errno));
                 owner_.request_disconnect_async_internal("Receive failure");
                 break;
             }
         }
     }
-    log_write_regular_information("Receive thread finished.");
+    owner_.fail_pending_requests_internal("Connection closed.");
+    SK_LOG_INFO("Receive thread finished.");
 }
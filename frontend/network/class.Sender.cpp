@@ -19,7 +19,7 @@
 
 void ClientSocket::Sender::send_loop()
 {
-    log_write_regular_information("Send thread started.");
+    SK_LOG_INFO("Send thread started.");
     while (!owner_.stop_requested_.load(memory_order_relaxed))
     {
         tuple<unique_ptr<char[]>, size_t> message_to_send;
@@ -37,13 +37,13 @@ void ClientSocket::Sender::send_loop()
 
         if (auto &[msg, len] = message_to_send; !send_all_internal(msg.get(), len))
         {
-            log_write_error_information("Send failed, likely disconnected. Stopping send loop.");
+            SK_LOG_ERROR("Send failed, likely disconnected. Stopping send loop.");
             owner_.trigger_error_callback_internal("Send operation failed.");
             owner_.request_disconnect_async_internal("Send failure");
             break;
         }
     }
-    log_write_regular_information("Send thread finished.");
+    SK_LOG_INFO("Send thread finished.");
 }
 
 bool ClientSocket::Sender::send_all_internal(const char *data, size_t len)
@@ -55,7 +55,7 @@ bool ClientSocket::Sender::send_all_internal(const char *data, size_t len)
     {
         if (current_sockfd == -1)
         {
-            log_write_error_information("Send failed: Socket is not valid (-1).");
+            SK_LOG_ERROR("Send failed: Socket is not valid (-1).");
             return false;
         }
 
@@ -68,7 +68,7 @@ bool ClientSocket::Sender::send_all_internal(const char *data, size_t len)
         }
         if (sent == 0)
         {
-            log_write_warning_information("Send returned 0 unexpectedly.");
+            SK_LOG_WARNING("Send returned 0 unexpectedly.");
             return false;
         }
 
@@ -89,7 +89,7 @@ bool ClientSocket::Sender::send_all_internal(const char *data, size_t len)
             {
                 if (errno == EINTR and !owner_.stop_requested_.load(memory_order_relaxed))
                     continue;
-                log_write_error_information("Poll failed while waiting to send or socket error: " + errno_to_string(errno));
+                SK_LOG_ERROR("Poll failed while waiting to send or socket error: {}", errno_to_string(errno));
                 return false;
             }
         }
@@ -97,7 +97,7 @@ bool ClientSocket::Sender::send_all_internal(const char *data, size_t len)
             continue;
         else
         {
-            log_write_error_information("Send failed: " + errno_to_string(current_errno));
+            SK_LOG_ERROR("Send failed: {}", errno_to_string(current_errno));
             return false;
         }
     }
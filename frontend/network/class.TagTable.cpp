@@ -0,0 +1,89 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _CLASS_TAGTABLE_CPP
+#include "network.hpp"
+
+#include <bit>
+
+ClientSocket::TagTable::TagId ClientSocket::TagTable::intern(string_view tag)
+{
+    if (TagId id = find(tag); id != kUnknownTag)
+        return id;
+    if (names_.size() >= kUnknownTag)
+    {
+        SK_LOG_ERROR("TagTable::intern - too many tags, cannot intern {}", tag);
+        return kUnknownTag;
+    }
+    names_.emplace_back(tag);
+    rebuild();
+    return static_cast<TagId>(names_.size() - 1);
+}
+
+ClientSocket::TagTable::TagId ClientSocket::TagTable::find(string_view tag) const noexcept
+{
+    if (slots_.empty())
+        return kUnknownTag;
+    TagId id = slots_[hash(tag, seed_) & mask_];
+    if (id != kUnknownTag and names_[id] == tag)
+        return id;
+    return kUnknownTag;
+}
+
+// FNV-1a over the tag bytes, seeded and finished with a 64-bit mixer so the low bits used
+// for the slot index depend on every byte.
+/* static */ uint64_t ClientSocket::TagTable::hash(string_view tag, uint64_t seed) noexcept
+{
+    uint64_t h = 0xcbf29ce484222325ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    for (char c : tag)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 29;
+    return h;
+}
+
+void ClientSocket::TagTable::rebuild()
+{
+    size_t slot_count = bit_ceil(max(kMinSlots, names_.size() * 2));
+    vector<TagId> slots;
+    while (true)
+    {
+        for (uint64_t seed = 1; seed <= kSeedAttempts; ++seed)
+        {
+            slots.assign(slot_count, kUnknownTag);
+            bool collision = false;
+            for (size_t id = 0; id < names_.size() and !collision; ++id)
+            {
+                TagId &slot = slots[hash(names_[id], seed) & (slot_count - 1)];
+                collision = slot != kUnknownTag;
+                slot = static_cast<TagId>(id);
+            }
+            if (!collision)
+            {
+                slots_ = move(slots);
+                seed_ = seed;
+                mask_ = slot_count - 1;
+                return;
+            }
+        }
+        slot_count *= 2;
+    }
+}
@@ -27,6 +27,7 @@
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <chrono>
 #include <unordered_map>
 #include <memory>
 #include <system_error>
@@ -40,6 +41,9 @@
 #include <filesystem>
 #include <future>
 #include <list>
+#include <deque>
+#include <string_view>
+#include <iterator>
 
 #include <unistd.h>
 #include <sys/socket.h>
@@ -48,16 +52,13 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/uio.h>
+#include <endian.h>
 #include <cerrno>
 
+#include "../write-log.hpp"
+
 using namespace std;
 
-void log_write_error_information(const string &err);
-void log_write_error_information(string &&err);
-void log_write_regular_information(const string &info);
-void log_write_regular_information(string &&info);
-void log_write_warning_information(const string &info);
-void log_write_warning_information(string &&info);
 
 class ThreadPool
 {
@@ -85,7 +86,7 @@ public:
         for (thread &w : workers_)
             if (w.joinable())
                 w.join();
-        log_write_regular_information("thread pool closed");
+        SK_LOG_INFO("thread pool closed");
     }
 
     template <typename F, typename... Args>
@@ -109,7 +110,7 @@ public:
           idle_threads_{0}
     {
 
-        log_write_regular_information("thread pool initialzed with maximum set:" + to_string(max_threads_));
+        SK_LOG_INFO("thread pool initialzed with maximum set:{}", max_threads_);
         workers_.reserve(max_threads_);
     }
 
@@ -149,13 +150,13 @@ private:
 
             if (stop_)
             {
-                log_write_error_information("task pushed to stopped thread pool");
+                SK_LOG_ERROR("task pushed to stopped thread pool");
                 return std::future<R>();
             }
 
             tasks_.emplace(TaskWrapper{priority, seq_++, [taskPtr]()
                                        { (*taskPtr)(); }});
-            log_write_regular_information("task pushed, priority:" + to_string(priority) + ", sequence code:" + to_string(seq_.load() - 1));
+            SK_LOG_DEBUG("task pushed, priority:{}, sequence code:{}", priority, seq_.load() - 1);
 
             if (idle_threads_ == 0 and workers_.size() < max_threads_)
                 workers_.emplace_back([this]
@@ -168,7 +169,7 @@ private:
 
     void worker_thread(void)
     {
-        log_write_regular_information("thread pool: worker start");
+        SK_LOG_INFO("thread pool: worker start");
         while (true)
         {
             TaskWrapper task_to_run;
@@ -183,7 +184,7 @@ private:
 
                 if (stop_ and tasks_.empty())
                 {
-                    log_write_regular_information("thread pool: worker exited");
+                    SK_LOG_INFO("thread pool: worker exited");
                     return;
                 }
 
@@ -196,15 +197,15 @@ private:
                 if (task_to_run.func)
                     task_to_run.func();
                 else
-                    log_write_error_information("thread pool: worker: ignored empty task");
+                    SK_LOG_ERROR("thread pool: worker: ignored empty task");
             }
             catch (const exception &e)
             {
-                log_write_error_information("thread pool: worker: error occurred:" + string(e.what()));
+                SK_LOG_ERROR("thread pool: worker: error occurred:{}", e.what());
             }
             catch (...)
             {
-                log_write_error_information("thread pool: worker: unkown exception occurred");
+                SK_LOG_ERROR("thread pool: worker: unkown exception occurred");
             }
         }
     }
@@ -229,71 +230,169 @@ class ClientSocket
     class Buffer
     {
     public:
-        static constexpr size_t kInitialSize = 4096;
-        static constexpr size_t kPrependSize = 8;
+        static constexpr size_t kBlockSize = 16 * 1024;
+        static constexpr size_t kMaxCachedBlocks = 64;
+        static constexpr size_t kMinReadAhead = 4 * kBlockSize;
+        static constexpr size_t kMaxReadAhead = 1024 * 1024;
         static constexpr size_t kMaxFrameSize = 64 * 1024 * 1024; // 64 MiB
 
-        explicit Buffer(size_t initial_size = kInitialSize)
-            : buffer_(kPrependSize + initial_size),
-              read_index_(kPrependSize),
-              write_index_(kPrependSize) {}
+        Buffer() = default;
+        ~Buffer() { retrieve_all(); }
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
 
         void swap(Buffer &rhs) noexcept
         {
-            buffer_.swap(rhs.buffer_);
-            std::swap(read_index_, rhs.read_index_);
-            std::swap(write_index_, rhs.write_index_);
+            blocks_.swap(rhs.blocks_);
+            std::swap(write_block_, rhs.write_block_);
+            std::swap(readable_, rhs.readable_);
+            std::swap(reserve_hint_, rhs.reserve_hint_);
         }
 
-        size_t readable_bytes() const noexcept { return write_index_ - read_index_; }
-        size_t writable_bytes() const noexcept { return buffer_.size() - write_index_; }
-        size_t prependable_bytes() const noexcept { return read_index_; }
+        size_t readable_bytes() const noexcept { return readable_; }
+        size_t writable_bytes() const noexcept
+        {
+            size_t writable = 0;
+            for (size_t i = write_block_; i < blocks_.size(); ++i)
+                writable += kBlockSize - blocks_[i].write;
+            return writable;
+        }
 
-        const char *peek() const noexcept { return begin() + read_index_; }
-        char *begin_write() noexcept { return begin() + write_index_; }
-        const char *begin_write() const noexcept { return begin() + write_index_; }
+        const char *peek() const noexcept { return readable_ == 0 ? nullptr : blocks_.front().data + blocks_.front().read; }
+        size_t contiguous_bytes() const noexcept { return readable_ == 0 ? 0 : blocks_.front().write - blocks_.front().read; }
+
+        char peek_byte(size_t offset) const noexcept
+        {
+            char byte = 0;
+            copy_out(offset, &byte, 1);
+            return byte;
+        }
 
-        void has_written(size_t len) noexcept { write_index_ += len; }
+        void copy_out(size_t offset, void *dst, size_t len) const noexcept
+        {
+            char *out = static_cast<char *>(dst);
+            for (const Block &block : blocks_)
+            {
+                if (len == 0)
+                    break;
+                size_t available = block.write - block.read;
+                if (offset >= available)
+                {
+                    offset -= available;
+                    continue;
+                }
+                size_t n = min(len, available - offset);
+                memcpy(out, block.data + block.read + offset, n);
+                out += n;
+                len -= n;
+                offset = 0;
+            }
+        }
+
+        vector<string_view> views(size_t len) const
+        {
+            vector<string_view> result;
+            for (const Block &block : blocks_)
+            {
+                if (len == 0)
+                    break;
+                size_t n = min(len, block.write - block.read);
+                result.emplace_back(block.data + block.read, n);
+                len -= n;
+            }
+            return result;
+        }
 
         void ensure_writable_bytes(size_t len)
         {
-            if (writable_bytes() < len)
-                make_space(len);
+            for (size_t writable = writable_bytes(); writable < len; writable += kBlockSize)
+                blocks_.push_back(Block{acquire_block(), 0, 0});
         }
 
+        void reserve(size_t len) noexcept { reserve_hint_ = len; }
+
         void append(const void *data, size_t len)
         {
-            ensure_writable_bytes(len);
-            memcpy(begin_write(), data, len);
-            has_written(len);
+            const char *d = static_cast<const char *>(data);
+            while (len > 0)
+            {
+                if (blocks_.empty())
+                    blocks_.push_back(Block{acquire_block(), 0, 0});
+                Block &block = blocks_[write_block_];
+                size_t space = kBlockSize - block.write;
+                if (space == 0)
+                {
+                    if (write_block_ + 1 == blocks_.size())
+                        blocks_.push_back(Block{acquire_block(), 0, 0});
+                    ++write_block_;
+                    continue;
+                }
+                size_t n = min(space, len);
+                memcpy(block.data + block.write, d, n);
+                block.write += n;
+                readable_ += n;
+                d += n;
+                len -= n;
+            }
         }
         void append(const string &str) { append(str.data(), str.length()); }
 
         void prepend(const void *data, size_t len)
         {
-            if (len > prependable_bytes())
+            if (len > kBlockSize)
             {
-                log_write_error_information("Prepend length exceeds prependable space");
+                SK_LOG_ERROR("Prepend length exceeds prependable space");
                 return;
             }
-            read_index_ -= len;
-            const char *d = static_cast<const char *>(data);
-            memcpy(begin() + read_index_, d, len);
+            if (blocks_.empty() or blocks_.front().read < len)
+            {
+                blocks_.push_front(Block{acquire_block(), kBlockSize, kBlockSize});
+                if (blocks_.size() > 1)
+                    ++write_block_;
+            }
+            Block &front = blocks_.front();
+            front.read -= len;
+            memcpy(front.data + front.read, data, len);
+            readable_ += len;
         }
 
         void retrieve(size_t len) noexcept
         {
-            if (len < readable_bytes())
-                read_index_ += len;
-            else
+            if (len >= readable_)
+            {
                 retrieve_all();
+                return;
+            }
+            readable_ -= len;
+            while (len > 0)
+            {
+                Block &block = blocks_.front();
+                size_t n = min(len, block.write - block.read);
+                block.read += n;
+                len -= n;
+                if (block.read == block.write and write_block_ > 0)
+                {
+                    release_block(block.data);
+                    blocks_.pop_front();
+                    --write_block_;
+                }
+            }
+        }
+        void retrieve_all() noexcept
+        {
+            for (Block &block : blocks_)
+                release_block(block.data);
+            blocks_.clear();
+            write_block_ = 0;
+            readable_ = 0;
         }
-        void retrieve_all() noexcept { read_index_ = write_index_ = kPrependSize; }
 
         string retrieve_as_string(size_t len)
         {
             len = min(len, readable_bytes());
-            string result(peek(), len);
+            string result(len, '\0');
+            copy_out(0, result.data(), len);
             retrieve(len);
             return result;
         }
@@ -302,26 +401,111 @@ class ClientSocket
         ssize_t read_fd(int fd, int *saved_errno);
 
     private:
-        char *begin() noexcept { return buffer_.data(); }
-        const char *begin() const noexcept { return buffer_.data(); }
+        struct Block
+        {
+            char *data;
+            size_t read;
+            size_t write;
+        };
 
-        void make_space(size_t len)
+        struct BlockCache
         {
-            if (prependable_bytes() + writable_bytes() < len + kPrependSize)
-                buffer_.resize(write_index_ + len);
-            else
+            vector<char *> blocks;
+            ~BlockCache()
             {
-                size_t readable = readable_bytes();
-                memmove(begin() + kPrependSize, peek(), readable);
-                read_index_ = kPrependSize;
-                write_index_ = read_index_ + readable;
+                cache_destroyed_ = true;
+                for (char *block : blocks)
+                    delete[] block;
             }
+        };
+
+        static inline thread_local bool cache_destroyed_ = false;
+
+        static BlockCache *block_cache() noexcept
+        {
+            if (cache_destroyed_)
+                return nullptr;
+            thread_local BlockCache cache;
+            return &cache;
+        }
+
+        static char *acquire_block()
+        {
+            BlockCache *cache = block_cache();
+            if (cache != nullptr and !cache->blocks.empty())
+            {
+                char *block = cache->blocks.back();
+                cache->blocks.pop_back();
+                return block;
+            }
+            return new char[kBlockSize];
         }
 
+        static void release_block(char *block) noexcept
+        {
+            BlockCache *cache = block_cache();
+            if (cache != nullptr and cache->blocks.size() < kMaxCachedBlocks)
+            {
+                try
+                {
+                    cache->blocks.push_back(block);
+                    return;
+                }
+                catch (...)
+                {
+                }
+            }
+            delete[] block;
+        }
+
+        void trim_spare_blocks() noexcept
+        {
+            if (readable_ == 0 and reserve_hint_ == 0)
+            {
+                retrieve_all();
+                return;
+            }
+            size_t keep = min(reserve_hint_, kMaxReadAhead);
+            size_t spare = blocks_.size() > write_block_ + 1 ? (blocks_.size() - write_block_ - 1) * kBlockSize : 0;
+            while (blocks_.size() > write_block_ + 1 and spare - kBlockSize >= keep)
+            {
+                spare -= kBlockSize;
+                release_block(blocks_.back().data);
+                blocks_.pop_back();
+            }
+        }
+
+    private:
+        deque<Block> blocks_;
+        size_t write_block_{0};
+        size_t readable_{0};
+        size_t reserve_hint_{0};
+    };
+
+    // Interns frame tags into dense ids; the seed is chosen at registration time so that
+    // every registered tag hashes to its own slot and lookups never allocate.
+    class TagTable
+    {
+    public:
+        using TagId = uint16_t;
+
+        static constexpr TagId kUnknownTag = numeric_limits<TagId>::max();
+        static constexpr size_t kMinSlots = 8;
+        static constexpr int kSeedAttempts = 64;
+
+        TagId intern(string_view tag);
+        TagId find(string_view tag) const noexcept;
+        const string &name(TagId id) const noexcept { return names_[id]; }
+        size_t size() const noexcept { return names_.size(); }
+
     private:
-        vector<char> buffer_;
-        size_t read_index_;
-        size_t write_index_;
+        static uint64_t hash(string_view tag, uint64_t seed) noexcept;
+        void rebuild();
+
+        vector<string> names_;
+        vector<TagId> slots_;
+        uint64_t seed_ = 0;
+        uint64_t mask_ = 0;
     };
 
     class ConnectionManager;
@@ -334,6 +518,37 @@ public:
     using ConnectionCallback = function<void(bool connected)>;
     using ErrorCallback = function<void(const string &error_msg)>;
 
+    struct Response
+    {
+        string tag;
+        string payload;
+    };
+    // Called once with a ready future, on whichever thread completes the request (usually the
+    // receive thread), so it must not block.
+    using ResponseCallback = function<void(future<Response> response)>;
+
+    // Raised through a request future when the server turned the request away under load.
+    class ServerBusy : public runtime_error
+    {
+    public:
+        ServerBusy(const string &message, chrono::milliseconds retry_after) : runtime_error(message), retry_after_{retry_after} {}
+        chrono::milliseconds retry_after() const noexcept { return retry_after_; }
+
+    private:
+        chrono::milliseconds retry_after_;
+    };
+
+    // Protocol v2 frames start with a zero byte where v1 has its tag length:
+    // [0][version][flags][tag_len][tag][u64 request_id][u32 payload_len][payload]
+    static constexpr uint8_t kFrameV2Marker = 0;
+    static constexpr uint8_t kProtocolVersion = 2;
+    static constexpr uint8_t kFlagMoreFragments = 0x01;
+    static constexpr uint8_t kFlagError = 0x02;
+    static constexpr size_t kMaxResponseSize = 256 * 1024 * 1024; // 256 MiB
+    static constexpr chrono::seconds kHandshakeTimeout{5};
+    static inline const string kHelloTag = "Hello";
+    static inline const string kBusyTag = "busy";
+
 private:
     string server_ip_;
     uint16_t server_port_;
@@ -356,6 +571,24 @@ private:
 
     mutex connection_mutex_;
 
+    mutex requests_mutex_;
+    condition_variable handshake_cv_;
+    int peer_protocol_;
+    uint64_t next_request_id_;
+    // Completes the future handed out by send_request(), or on_response when one was given.
+    struct PendingRequest
+    {
+        promise<Response> waiter;
+        ResponseCallback on_response;
+
+        void set_value(Response response);
+        void set_exception(exception_ptr error);
+    };
+    unordered_map<uint64_t, PendingRequest> pending_requests_;
+    // Requests sent as v1 frames to a server without protocol v2, oldest first. v1 replies carry
+    // no request id; the server answers a connection's requests in order.
+    deque<pair<string, PendingRequest>> legacy_requests_;
+
 public:
     ClientSocket(string server_ip, uint16_t server_port);
     ~ClientSocket();
@@ -374,6 +607,11 @@ public:
     bool send_text(const string &tag, const string &text_payload);
     bool send_binary(const string &tag, const vector<char> &binary_payload);
     bool send_file(const string &tag, const string &file_path, size_t chunk_size = 64 * 1024);
+    future<Response> send_request(const string &tag, string_view payload);
+    future<Response> send_file_request(const string &tag, const string &file_path);
+    // Return false, without calling on_response, when the request could not be sent.
+    bool send_request(const string &tag, string_view payload, ResponseCallback on_response);
+    bool send_file_request(const string &tag, const string &file_path, ResponseCallback on_response);
 
     void register_handler(const string &tag, Handler handler);
     void register_default_handler(Handler handler);
@@ -389,6 +627,14 @@ private:
     void trigger_error_callback_internal(const string &error_msg);
     void trigger_connection_callback_internal(bool connected);
     void request_disconnect_async_internal(const string &reason);
+    void set_peer_protocol_internal(int version);
+    void complete_request_internal(uint64_t request_id, Response response, bool failed);
+    bool complete_legacy_request_internal(string_view tag, string &payload);
+    void fail_pending_requests_internal(const string &reason);
+    bool start_request(const string &tag, string_view payload, PendingRequest &request, string &error);
+    static bool read_request_file(const string &file_path, string &payload);
+    static int parse_protocol_offer(string_view hello_payload);
+    static ServerBusy parse_busy_payload(const string &payload);
     bool start_io_threads();
     void stop_and_join_io_threads();
     bool connect_internal();
@@ -408,7 +654,7 @@ private:
         {
             if (sockfd_ref != -1)
             {
-                log_write_regular_information("socket closed.");
+                SK_LOG_INFO("socket closed.");
                 shutdown(sockfd_ref, SHUT_RDWR);
                 close(sockfd_ref);
                 sockfd_ref = -1;
@@ -478,10 +724,24 @@ private:
     class MessageHandler
     {
     private:
+        static constexpr size_t kMaxTagLength = numeric_limits<uint8_t>::max();
+
+        // Immutable once published; registration copies, modifies and republishes it, so the
+        // receive thread only pays one atomic load per batch of frames.
+        struct Routes
+        {
+            TagTable tags;
+            vector<Handler> handlers;
+            Handler default_handler;
+        };
+
         ClientSocket &owner_;
-        shared_mutex handler_rw_mutex_;
-        unordered_map<string, Handler> handlers_;
-        Handler default_handler_;
+        mutex registration_mutex_;
+        atomic<shared_ptr<const Routes>> routes_{make_shared<const Routes>()};
+        unordered_map<uint64_t, string> partial_responses_;
+
+        bool process_response_frame(Buffer &recv_buffer);
+        void abort_on_protocol_error(Buffer &recv_buffer, const string &error_msg);
 
     public:
         explicit MessageHandler(ClientSocket &owner) : owner_(owner) {}
@@ -489,49 +749,71 @@ private:
         {
             if (!handler)
             {
-                log_write_warning_information("Attempted to register a null handler for tag: " + tag);
+                SK_LOG_WARNING("Attempted to register a null handler for tag: {}", tag);
                 return;
             }
-            unique_lock lock(handler_rw_mutex_);
-            handlers_.insert_or_assign(tag, handler);
-            log_write_regular_information("Registered handler for tag: " + tag);
+            lock_guard lock(registration_mutex_);
+            auto routes = make_shared<Routes>(*routes_.load());
+            TagTable::TagId id = routes->tags.intern(tag);
+            if (id == TagTable::kUnknownTag)
+                return;
+            if (id == routes->handlers.size())
+                routes->handlers.emplace_back();
+            routes->handlers[id] = move(handler);
+            routes_.store(move(routes));
+            SK_LOG_INFO("Registered handler for tag: {}", tag);
         }
         void register_default_handler(Handler handler)
         {
             if (!handler)
             {
-                log_write_warning_information("Attempted to register a null default handler.");
+                SK_LOG_WARNING("Attempted to register a null default handler.");
                 return;
             }
-            unique_lock lock(handler_rw_mutex_);
-            default_handler_ = move(handler);
-            log_write_regular_information("Registered default handler.");
+            lock_guard lock(registration_mutex_);
+            auto routes = make_shared<Routes>(*routes_.load());
+            routes->default_handler = move(handler);
+            routes_.store(move(routes));
+            SK_LOG_INFO("Registered default handler.");
         }
 
         void process_received_data(Buffer &recv_buffer);
+        void reset() { partial_responses_.clear(); }
     };
 };
 
 inline ssize_t ClientSocket::Buffer::read_fd(int fd, int *saved_errno)
 {
-    char extrabuf[65536];
-    struct iovec vec[2];
-    const size_t writable = writable_bytes();
-    vec[0].iov_base = begin_write();
-    vec[0].iov_len = writable;
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof(extrabuf);
-    const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
-    const ssize_t n = ::readv(fd, vec, iovcnt);
+    ensure_writable_bytes(clamp(reserve_hint_, kMinReadAhead, kMaxReadAhead));
+
+    struct iovec vec[kMaxReadAhead / kBlockSize + 2];
+    size_t count = 0;
+    for (size_t i = write_block_; i < blocks_.size() and count < std::size(vec); ++i)
+    {
+        vec[count].iov_base = blocks_[i].data + blocks_[i].write;
+        vec[count].iov_len = kBlockSize - blocks_[i].write;
+        ++count;
+    }
+
+    const ssize_t n = ::readv(fd, vec, static_cast<int>(count));
     if (n < 0)
         *saved_errno = errno;
-    else if (static_cast<size_t>(n) <= writable)
-        has_written(n);
     else
     {
-        write_index_ = buffer_.size();
-        append(extrabuf, static_cast<size_t>(n) - writable);
+        size_t left = static_cast<size_t>(n);
+        readable_ += left;
+        reserve_hint_ = reserve_hint_ > left ? reserve_hint_ - left : 0;
+        while (left > 0)
+        {
+            Block &block = blocks_[write_block_];
+            size_t m = min(left, kBlockSize - block.write);
+            block.write += m;
+            left -= m;
+            if (block.write == kBlockSize and write_block_ + 1 < blocks_.size())
+                ++write_block_;
+        }
     }
+    trim_spare_blocks();
     return n;
 }
 
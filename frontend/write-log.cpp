@@ -200,6 +200,14 @@ inline string formatLogMessage(const char *level, const string &information)
 
 void make_sure_log_file()
 {
+    if (const char *name = getenv("SIMPLE_K_LOG_LEVEL"))
+    {
+        if (optional<LogLevel> level = logging::parse_level(name))
+            logging::set_level(*level);
+        else
+            cerr << "Unknown SIMPLE_K_LOG_LEVEL '" << name << "', keeping the default level." << endl;
+    }
+
     try
     {
         Logger::getInstance();
@@ -238,116 +246,68 @@ void close_log_file()
     }
 }
 
-void log_write_error_information(const string &information)
+namespace
 {
-    if (!information.empty())
+    const char *level_prefix(LogLevel level) noexcept
     {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("ERROR ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write ERROR log: " << e.what() << endl;
-        }
-        catch (...)
+        switch (level)
         {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write ERROR log." << endl;
+        case LogLevel::debug:
+            return "DEBUG ";
+        case LogLevel::info:
+            return "INFO  ";
+        case LogLevel::warning:
+            return "WARN  ";
+        default:
+            return "ERROR ";
         }
     }
 }
 
-void log_write_error_information(string &&information)
+void logging::write(LogLevel level, string &&information)
 {
-    if (!information.empty())
+    if (information.empty())
+        return;
+    try
     {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("ERROR ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write ERROR log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write ERROR log." << endl;
-        }
+        Logger::getInstance().enqueueLog(formatLogMessage(level_prefix(level), information));
     }
+    catch (const runtime_error &e)
+    {
+        cerr << "LOGGER NOT INITIALIZED: Failed to write " << level_prefix(level) << "log: " << e.what() << endl;
+    }
+    catch (...)
+    {
+        cerr << "LOGGER UNKNOWN ERROR: Failed to write " << level_prefix(level) << "log." << endl;
+    }
+}
+
+void log_write_error_information(const string &information)
+{
+    SK_LOG_ERROR("{}", information);
+}
+
+void log_write_error_information(string &&information)
+{
+    SK_LOG_ERROR("{}", information);
 }
 
 void log_write_regular_information(const string &information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("INFO  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write INFO log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write INFO log." << endl;
-        }
-    }
+    SK_LOG_INFO("{}", information);
 }
 
 void log_write_regular_information(string &&information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("INFO  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write INFO log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write INFO log." << endl;
-        }
-    }
+    SK_LOG_INFO("{}", information);
 }
 
 void log_write_warning_information(const string &information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("WARN  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write WARN log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write WARN log." << endl;
-        }
-    }
+    SK_LOG_WARNING("{}", information);
 }
 
 void log_write_warning_information(string &&information)
 {
-    if (!information.empty())
-    {
-        try
-        {
-            Logger::getInstance().enqueueLog(formatLogMessage("WARN  ", information));
-        }
-        catch (const runtime_error &e)
-        {
-            cerr << "LOGGER NOT INITIALIZED: Failed to write WARN log: " << e.what() << endl;
-        }
-        catch (...)
-        {
-            cerr << "LOGGER UNKNOWN ERROR: Failed to write WARN log." << endl;
-        }
-    }
+    SK_LOG_WARNING("{}", information);
 }
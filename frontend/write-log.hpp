@@ -0,0 +1,177 @@
+// Copyright (C) [2025] [@kleedaisuki] <kleedaisuki@outlook.com>
+// This file is part of Simple-K Cloud Executor.
+//
+// Simple-K Cloud Executor is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Simple-K Cloud Executor is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Simple-K Cloud Executor.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _WRITE_LOG_HPP
+#define _WRITE_LOG_HPP
+
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+using namespace std;
+
+enum class LogLevel : int
+{
+    debug = 0,
+    info = 1,
+    warning = 2,
+    error = 3,
+    off = 4,
+};
+
+// Levels below SIMPLE_K_MIN_LOG_LEVEL are compiled out entirely. Above it, the runtime
+// level is checked before any argument of the log call is evaluated.
+#ifndef SIMPLE_K_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define SIMPLE_K_MIN_LOG_LEVEL 1
+#else
+#define SIMPLE_K_MIN_LOG_LEVEL 0
+#endif
+#endif
+
+#define SK_LOG(level, ...)                                                  \
+    do                                                                      \
+    {                                                                       \
+        if constexpr (static_cast<int>(level) >= SIMPLE_K_MIN_LOG_LEVEL)    \
+            if (logging::enabled(level))                                    \
+                logging::write(level, logging::format(__VA_ARGS__));        \
+    } while (0)
+
+#define SK_LOG_DEBUG(...) SK_LOG(LogLevel::debug, __VA_ARGS__)
+#define SK_LOG_INFO(...) SK_LOG(LogLevel::info, __VA_ARGS__)
+#define SK_LOG_WARNING(...) SK_LOG(LogLevel::warning, __VA_ARGS__)
+#define SK_LOG_ERROR(...) SK_LOG(LogLevel::error, __VA_ARGS__)
+
+namespace logging
+{
+    inline atomic<int> runtime_level{static_cast<int>(LogLevel::info)};
+
+    inline bool enabled(LogLevel level) noexcept
+    {
+        return static_cast<int>(level) >= runtime_level.load(memory_order_relaxed);
+    }
+
+    inline void set_level(LogLevel level) noexcept { runtime_level.store(static_cast<int>(level), memory_order_relaxed); }
+    inline LogLevel level() noexcept { return static_cast<LogLevel>(runtime_level.load(memory_order_relaxed)); }
+
+    inline optional<LogLevel> parse_level(string_view name) noexcept
+    {
+        if (name == "debug")
+            return LogLevel::debug;
+        if (name == "info")
+            return LogLevel::info;
+        if (name == "warning")
+            return LogLevel::warning;
+        if (name == "error")
+            return LogLevel::error;
+        if (name == "off")
+            return LogLevel::off;
+        return nullopt;
+    }
+
+    void write(LogLevel level, string &&message);
+
+    // Copies fmt[pos..] up to the next "{}" into out, unescaping "{{" and "}}".
+    // Returns the position just past the placeholder, or npos if there is none.
+    // Placeholders left over once the arguments run out are copied verbatim.
+    inline size_t append_literal(string &out, string_view fmt, size_t pos, bool stop_at_placeholder = true)
+    {
+        while (pos < fmt.size())
+        {
+            size_t brace = fmt.find_first_of("{}", pos);
+            if (brace == string_view::npos)
+                break;
+            out.append(fmt.data() + pos, brace - pos);
+            if (brace + 1 < fmt.size() and fmt[brace + 1] == fmt[brace])
+            {
+                out.push_back(fmt[brace]);
+                pos = brace + 2;
+            }
+            else if (stop_at_placeholder and fmt[brace] == '{' and brace + 1 < fmt.size() and fmt[brace + 1] == '}')
+                return brace + 2;
+            else
+            {
+                out.push_back(fmt[brace]);
+                pos = brace + 1;
+            }
+        }
+        if (pos < fmt.size())
+            out.append(fmt.data() + pos, fmt.size() - pos);
+        return string_view::npos;
+    }
+
+    template <typename T>
+    void append_argument(string &out, const T &value)
+    {
+        using U = remove_cvref_t<T>;
+        if constexpr (is_same_v<U, bool>)
+            out.append(value ? "true" : "false");
+        else if constexpr (is_same_v<U, char>)
+            out.push_back(value);
+        else if constexpr (is_convertible_v<const U &, string_view>)
+            out.append(string_view(value));
+        else if constexpr (is_enum_v<U>)
+            append_argument(out, static_cast<underlying_type_t<U>>(value));
+        else if constexpr (is_arithmetic_v<U>)
+        {
+            char digits[64];
+            auto [end, ec] = to_chars(digits, digits + sizeof digits, value);
+            out.append(digits, ec == errc() ? end : digits);
+        }
+        else if constexpr (is_pointer_v<U>)
+        {
+            char digits[2 + 2 * sizeof(uintptr_t)] = {'0', 'x'};
+            auto [end, ec] = to_chars(digits + 2, digits + sizeof digits, reinterpret_cast<uintptr_t>(value), 16);
+            out.append(digits, end);
+        }
+        else
+            static_assert(is_void_v<U>, "logging::format: unsupported argument type");
+    }
+
+    template <typename... Args>
+    string format(string_view fmt, const Args &...args)
+    {
+        string out;
+        out.reserve(fmt.size() + 16 * sizeof...(Args));
+        size_t pos = 0;
+        (
+            [&]
+            {
+                if (pos == string_view::npos)
+                    return;
+                pos = append_literal(out, fmt, pos);
+                if (pos != string_view::npos)
+                    append_argument(out, args);
+            }(),
+            ...);
+        if (pos != string_view::npos)
+            append_literal(out, fmt, pos, false);
+        return out;
+    }
+}
+
+void log_write_error_information(const string &err);
+void log_write_error_information(string &&err);
+void log_write_regular_information(const string &info);
+void log_write_regular_information(string &&info);
+void log_write_warning_information(const string &info);
+void log_write_warning_information(string &&info);
+
+#endif